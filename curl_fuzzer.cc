@@ -37,6 +37,8 @@ extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
   int tlv_rc;
   FUZZ_DATA fuzz;
   TLV tlv;
+  FUZZ_INPUT input;
+  int probing = fuzz_complexity_probing();
 
   /* Ignore SIGPIPE errors. We'll handle the errors ourselves. */
   signal(SIGPIPE, SIG_IGN);
@@ -44,34 +46,61 @@ extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
   /* Have to set all fields to zero before getting to the terminate function */
   memset(&fuzz, 0, sizeof(FUZZ_DATA));
 
+  /* A complexity probe is not an input of its own, so only the complexity
+     oracle sees it. */
+  if(!probing) {
+    fuzz_alloc_begin_input();
+    fuzz_stats_begin_input();
+    fuzz_timing_begin_input();
+    fuzz_spin_begin_input();
+    fuzz_digest_begin_input();
+  }
+  fuzz_complexity_begin_input();
+
   if(size < sizeof(TLV_RAW)) {
     /* Not enough data for a single TLV - don't continue */
+    fuzz_stats_reject(FUZZ_STATS_REJECT_TOO_SHORT, FUZZ_STATS_KEY_NONE, 0);
     goto EXIT_LABEL;
   }
 
   /* Try to initialize the fuzz data */
-  FTRY(fuzz_initialize_fuzz_data(&fuzz, data, size));
+  rc = fuzz_initialize_fuzz_data(&fuzz, data, size);
+  if(rc != 0) {
+    fuzz_stats_reject(FUZZ_STATS_REJECT_SETUP, FUZZ_STATS_KEY_NONE, 0);
+    goto EXIT_LABEL;
+  }
 
   for(tlv_rc = fuzz_get_first_tlv(&fuzz, &tlv);
       tlv_rc == 0;
       tlv_rc = fuzz_get_next_tlv(&fuzz, &tlv)) {
 
     /* Have the TLV in hand. Parse the TLV. */
+    fuzz_stats_note_key(FUZZ_STATS_KEY_TLV, tlv.type);
     rc = fuzz_parse_tlv(&fuzz, &tlv);
 
     if(rc != 0) {
       /* Failed to parse the TLV. Can't continue. */
+      fuzz_stats_reject(rc == 127 ? FUZZ_STATS_REJECT_UNKNOWN_TLV :
+                                    FUZZ_STATS_REJECT_INVALID_TLV,
+                        FUZZ_STATS_KEY_TLV,
+                        tlv.type);
       goto EXIT_LABEL;
     }
   }
 
   if(tlv_rc != TLV_RC_NO_MORE_TLVS) {
     /* A TLV call failed. Can't continue. */
+    fuzz_stats_reject(FUZZ_STATS_REJECT_TLV_LENGTH, FUZZ_STATS_KEY_NONE, 0);
     goto EXIT_LABEL;
   }
 
   /* Set up the standard easy options. */
-  FTRY(fuzz_set_easy_options(&fuzz));
+  fuzz_timing_switch(FUZZ_TIMING_SETOPT);
+  rc = fuzz_set_easy_options(&fuzz);
+  if(rc != 0) {
+    fuzz_stats_reject(FUZZ_STATS_REJECT_SETUP, FUZZ_STATS_KEY_NONE, 0);
+    goto EXIT_LABEL;
+  }
 
   /**
    * Add in more curl options that have been accumulated over possibly
@@ -98,8 +127,31 @@ extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
 
 EXIT_LABEL:
 
+  fuzz_timing_switch(FUZZ_TIMING_TEARDOWN);
   fuzz_terminate_fuzz_data(&fuzz);
 
+  /* Write out any packets captured for this input, and account for it.
+     A probe's grown copy is not an input of its own, so its packets are
+     dropped. */
+  if(probing) {
+    fuzz_pcap_discard_input();
+  }
+  else {
+    fuzz_pcap_end_input();
+    fuzz_stats_end_input();
+    fuzz_timing_end_input();
+    fuzz_spin_end_input();
+    fuzz_alloc_end_input(size);
+    fuzz_drift_end_input(data, size);
+  }
+
+  /* Probe expensive inputs for superlinear cost. This re-enters this
+     function with grown copies of the input, which skip the telemetry
+     above. */
+  input.data = data;
+  input.size = size;
+  fuzz_complexity_end_input(size, fuzz_complexity_run_tlv, &input);
+
   /* This function must always return 0. Non-zero codes are reserved. */
   return 0;
 }
@@ -150,6 +202,7 @@ int fuzz_initialize_fuzz_data(FUZZ_DATA *fuzz,
   for(ii = 0; ii < FUZZ_NUM_CONNECTIONS; ii++) {
     fuzz->sockman[ii].index = ii;
     fuzz->sockman[ii].fd_state = FUZZ_SOCK_CLOSED;
+    fuzz->sockman[ii].pcap_stream = FUZZ_PCAP_NO_STREAM;
   }
 
   /* Check for verbose mode. */
@@ -194,6 +247,14 @@ int fuzz_set_easy_options(FUZZ_DATA *fuzz)
                         fuzz_write_callback));
   FTRY(curl_easy_setopt(fuzz->easy, CURLOPT_WRITEDATA, fuzz));
 
+  /* The determinism and fragmentation checks compare headers as well as the
+     body, so have them delivered too. */
+  if(fuzz_digest_enabled()) {
+    FTRY(curl_easy_setopt(fuzz->easy,
+                          CURLOPT_HEADERFUNCTION,
+                          fuzz_header_callback));
+  }
+
   /* Set the writable cookie jar path so cookies are tested. */
   FTRY(curl_easy_setopt(fuzz->easy, CURLOPT_COOKIEJAR, FUZZ_COOKIE_JAR_PATH));
 
@@ -244,9 +305,12 @@ void fuzz_terminate_fuzz_data(FUZZ_DATA *fuzz)
 
   for(ii = 0; ii < FUZZ_NUM_CONNECTIONS; ii++) {
     if(fuzz->sockman[ii].fd_state != FUZZ_SOCK_CLOSED) {
+      /* Capture whatever the client sent that nobody read. */
+      fuzz_pcap_drain(&fuzz->sockman[ii]);
       close(fuzz->sockman[ii].fd);
       fuzz->sockman[ii].fd_state = FUZZ_SOCK_CLOSED;
     }
+    fuzz_frag_free(&fuzz->sockman[ii].frag);
   }
 
   if(fuzz->connect_to_list != NULL) {
@@ -330,6 +394,9 @@ int fuzz_handle_transfer(FUZZ_DATA *fuzz)
     sman[ii]->response_index = 1;
   }
 
+  /* Everything from here on is curl's time unless switched out below. */
+  fuzz_timing_switch(FUZZ_TIMING_PERFORM_CURL);
+
   /* init a multi stack */
   multi_handle = curl_multi_init();
 
@@ -338,6 +405,8 @@ int fuzz_handle_transfer(FUZZ_DATA *fuzz)
 
   /* Do an initial process. This might end the transfer immediately. */
   curl_multi_perform(multi_handle, &still_running);
+  fuzz_spin_note_perform(multi_handle, still_running);
+  fuzz_digest_iteration();
   FV_PRINTF(fuzz,
             "FUZZ: Initial perform; still running? %d \n",
             still_running);
@@ -373,8 +442,22 @@ int fuzz_handle_transfer(FUZZ_DATA *fuzz)
       }
     }
 
+    /* Under FUZZ_FRAGMENT, hand curl the next piece of any queued response
+       once it has read the last. */
+    int server_data_sent = 0;
+    for(ii = 0; ii < FUZZ_NUM_CONNECTIONS; ii++) {
+      if(sman[ii]->fd_state != FUZZ_SOCK_CLOSED &&
+         fuzz_frag_flush(&sman[ii]->frag, sman[ii]->fd)) {
+        server_data_sent = 1;
+      }
+    }
+
     /* Work out what file descriptors need work. */
+    fuzz_waits_begin(multi_handle, fuzz->easy, timeout.tv_usec / 1000);
+    fuzz_timing_switch(FUZZ_TIMING_PERFORM_WAIT);
     rc = fuzz_select(maxfd + 1, &fdread, &fdwrite, &fdexcep, &timeout);
+    fuzz_timing_switch(FUZZ_TIMING_PERFORM_CURL);
+    fuzz_waits_end(rc);
 
     if(rc == -1) {
       /* Had an issue while selecting a file descriptor. Let's just exit. */
@@ -384,11 +467,12 @@ int fuzz_handle_transfer(FUZZ_DATA *fuzz)
 
     /* Check to see if a server file descriptor is readable. If it is,
        then send the next response from the fuzzing data. */
-    int server_data_sent = 0;
     for(ii = 0; ii < FUZZ_NUM_CONNECTIONS; ii++) {
       if(sman[ii]->fd_state == FUZZ_SOCK_OPEN &&
          FD_ISSET(sman[ii]->fd, &fdread)) {
+        fuzz_timing_switch(FUZZ_TIMING_MOCK_IO);
         rc = fuzz_send_next_response(fuzz, sman[ii]);
+        fuzz_timing_switch(FUZZ_TIMING_PERFORM_CURL);
         if(rc != 0) {
           /* Failed to send a response. Break out here. */
           break;
@@ -413,6 +497,17 @@ int fuzz_handle_transfer(FUZZ_DATA *fuzz)
     }
 
     curl_multi_perform(multi_handle, &still_running);
+    fuzz_spin_note_perform(multi_handle, still_running);
+    fuzz_digest_iteration();
+  }
+
+  /* Record how the transfer ended, if it did, for the determinism check
+     and the wait report. */
+  while((msg = curl_multi_info_read(multi_handle, &msgs_left)) != NULL) {
+    if(msg->msg == CURLMSG_DONE) {
+      fuzz_digest_result(msg->data.result);
+      fuzz_waits_result(msg->data.result);
+    }
   }
 
   /* Remove the easy handle from the multi stack. */
@@ -442,6 +537,15 @@ int fuzz_send_next_response(FUZZ_DATA *fuzz, FUZZ_SOCKET_MANAGER *sman)
      hang here. */
   do {
     ret_in = read(sman->fd, buffer, sizeof(buffer));
+    if(ret_in > 0) {
+      fuzz_pcap_record(sman->pcap_stream,
+                       FUZZ_PCAP_TO_SERVER,
+                       buffer,
+                       (size_t)ret_in);
+      fuzz_spin_note_bytes((size_t)ret_in);
+      fuzz_digest_bytes(FUZZ_DIGEST_SENT, buffer, (size_t)ret_in);
+      fuzz_digest_event(FUZZ_DIGEST_SEND);
+    }
     if(fuzz->verbose && ret_in > 0) {
       printf("FUZZ[%d]: Received %zu bytes \n==>\n", sman->index, ret_in);
       fwrite(buffer, ret_in, 1, stdout);
@@ -458,11 +562,19 @@ int fuzz_send_next_response(FUZZ_DATA *fuzz, FUZZ_SOCKET_MANAGER *sman)
   data_len = sman->responses[sman->response_index].data_len;
 
   if(data != NULL) {
-    if(write(sman->fd, data, data_len) != (ssize_t)data_len) {
+    if(fuzz_frag_write(&sman->frag, sman->fd, data, data_len) != 0) {
       /* Failed to write the data back to the client. Prevent any further
          testing. */
       rc = -1;
     }
+    else {
+      fuzz_pcap_record(sman->pcap_stream,
+                       FUZZ_PCAP_TO_CLIENT,
+                       data,
+                       data_len);
+      fuzz_spin_note_bytes(data_len);
+      fuzz_digest_event(FUZZ_DIGEST_RESPOND);
+    }
   }
 
   /* Work out if there are any more responses. If not, then shut down the
@@ -475,13 +587,38 @@ int fuzz_send_next_response(FUZZ_DATA *fuzz, FUZZ_SOCKET_MANAGER *sman)
               "FUZZ[%d]: Shutting down server socket: %d \n",
               sman->index,
               sman->fd);
-    shutdown(sman->fd, SHUT_WR);
+    fuzz_frag_shutdown(&sman->frag, sman->fd);
     sman->fd_state = FUZZ_SOCK_SHUTDOWN;
+    fuzz_pcap_close_stream(sman->pcap_stream, FUZZ_PCAP_TO_CLIENT);
   }
 
   return rc;
 }
 
+/**
+ * Reads any client data still queued on a server socket into the packet
+ * capture. Only does any work when capture is enabled.
+ */
+void fuzz_pcap_drain(FUZZ_SOCKET_MANAGER *sman)
+{
+  ssize_t ret_in;
+  char buffer[8192];
+
+  if(sman->pcap_stream == FUZZ_PCAP_NO_STREAM) {
+    return;
+  }
+
+  do {
+    ret_in = read(sman->fd, buffer, sizeof(buffer));
+    if(ret_in > 0) {
+      fuzz_pcap_record(sman->pcap_stream,
+                       FUZZ_PCAP_TO_SERVER,
+                       buffer,
+                       (size_t)ret_in);
+    }
+  } while(ret_in > 0);
+}
+
 /**
  * Wrapper for select() so profiling can track it.
  */
@@ -578,3 +715,79 @@ EXIT_LABEL:
 
   return rc;
 }
+
+/**
+ * Complexity oracle callback. Re-runs the input with the value of its
+ * largest top-level TLV repeated factor times, and returns the size of the
+ * grown input, or 0 if there's nothing to grow.
+ */
+size_t fuzz_complexity_run_tlv(const void *ctx, unsigned int factor)
+{
+  const FUZZ_INPUT *input = (const FUZZ_INPUT *)ctx;
+  const TLV_RAW *raw;
+  size_t pos = 0;
+  size_t largest_pos = 0;
+  uint32_t largest_len = 0;
+  uint32_t length;
+  uint32_t grown_len;
+  size_t grown_size;
+  uint8_t *grown;
+  uint8_t *cursor;
+  unsigned int ii;
+
+  /* Find the largest well-formed TLV. */
+  while(pos + sizeof(TLV_RAW) <= input->size) {
+    raw = (const TLV_RAW *)&input->data[pos];
+    length = to_u32(raw->raw_length);
+    if(length > input->size - pos - sizeof(TLV_RAW)) {
+      break;
+    }
+    if(length > largest_len) {
+      largest_pos = pos;
+      largest_len = length;
+    }
+    pos += sizeof(TLV_RAW) + length;
+  }
+
+  if(largest_len == 0 ||
+     (uint64_t)largest_len * factor > FUZZ_COMPLEXITY_MAX_GROWN) {
+    return 0;
+  }
+
+  grown_len = largest_len * factor;
+  grown_size = input->size - largest_len + grown_len;
+  grown = (uint8_t *)malloc(grown_size);
+  if(grown == NULL) {
+    return 0;
+  }
+
+  /* Everything up to and including the TLV header, with the new length. */
+  cursor = grown;
+  memcpy(cursor, input->data, largest_pos + sizeof(TLV_RAW));
+  raw = (const TLV_RAW *)&input->data[largest_pos];
+  cursor += largest_pos + sizeof(raw->raw_type);
+  cursor[0] = (uint8_t)(grown_len >> 24);
+  cursor[1] = (uint8_t)(grown_len >> 16);
+  cursor[2] = (uint8_t)(grown_len >> 8);
+  cursor[3] = (uint8_t)grown_len;
+  cursor += sizeof(raw->raw_length);
+
+  /* The value, repeated. */
+  for(ii = 0; ii < factor; ii++) {
+    memcpy(cursor, &input->data[largest_pos + sizeof(TLV_RAW)], largest_len);
+    cursor += largest_len;
+  }
+
+  /* Everything after it. */
+  pos = largest_pos + sizeof(TLV_RAW) + largest_len;
+  memcpy(cursor, &input->data[pos], input->size - pos);
+
+  /* Keep the grown run out of the input's behaviour digest, which the
+     runner compares once this input returns. */
+  fuzz_digest_pause(1);
+  LLVMFuzzerTestOneInput(grown, grown_size);
+  fuzz_digest_pause(0);
+  free(grown);
+
+  return grown_size;
+}
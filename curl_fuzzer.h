@@ -22,6 +22,16 @@
 #include <inttypes.h>
 #include <curl/curl.h>
 #include "testinput.h"
+#include "curl_fuzzer_alloc.h"
+#include "curl_fuzzer_complexity.h"
+#include "curl_fuzzer_digest.h"
+#include "curl_fuzzer_drift.h"
+#include "curl_fuzzer_frag.h"
+#include "curl_fuzzer_pcap.h"
+#include "curl_fuzzer_spin.h"
+#include "curl_fuzzer_stats.h"
+#include "curl_fuzzer_timing.h"
+#include "curl_fuzzer_waits.h"
 
 /**
  * TLV types.
@@ -339,6 +349,16 @@ typedef struct tlv
 
 } TLV;
 
+/**
+ * A whole input, as handed to the complexity oracle for re-running.
+ */
+typedef struct fuzz_input
+{
+  const uint8_t *data;
+  size_t size;
+
+} FUZZ_INPUT;
+
 /**
  * Internal state when parsing a TLV data stream.
  */
@@ -377,6 +397,12 @@ typedef struct fuzz_socket_manager
   FUZZ_SOCK_STATE fd_state;
   curl_socket_t fd;
 
+  /* Packet capture stream ID, or FUZZ_PCAP_NO_STREAM. */
+  int pcap_stream;
+
+  /* Response bytes not yet handed to curl under FUZZ_FRAGMENT. */
+  FUZZ_FRAG_QUEUE frag;
+
 } FUZZ_SOCKET_MANAGER;
 
 /**
@@ -447,6 +473,9 @@ void fuzz_free(void **ptr);
 curl_socket_t fuzz_open_socket(void *ptr,
                                curlsocktype purpose,
                                struct curl_sockaddr *address);
+curl_socket_t fuzz_open_socket_comn(void *ptr,
+                                    curlsocktype purpose,
+                                    struct curl_sockaddr *address);
 int fuzz_sockopt_callback(void *ptr,
                           curl_socket_t curlfd,
                           curlsocktype purpose);
@@ -458,6 +487,10 @@ size_t fuzz_write_callback(void *contents,
                            size_t size,
                            size_t nmemb,
                            void *ptr);
+size_t fuzz_header_callback(char *buffer,
+                            size_t size,
+                            size_t nitems,
+                            void *userdata);
 int fuzz_get_first_tlv(FUZZ_DATA *fuzz, TLV *tlv);
 int fuzz_get_next_tlv(FUZZ_DATA *fuzz, TLV *tlv);
 int fuzz_get_tlv_comn(FUZZ_DATA *fuzz, TLV *tlv);
@@ -468,6 +501,8 @@ int fuzz_add_mime_part(TLV *src_tlv, curl_mimepart *part);
 int fuzz_parse_mime_tlv(curl_mimepart *part, TLV *tlv);
 int fuzz_handle_transfer(FUZZ_DATA *fuzz);
 int fuzz_send_next_response(FUZZ_DATA *fuzz, FUZZ_SOCKET_MANAGER *sockman);
+void fuzz_pcap_drain(FUZZ_SOCKET_MANAGER *sockman);
+size_t fuzz_complexity_run_tlv(const void *ctx, unsigned int factor);
 int fuzz_select(int nfds,
                 fd_set *readfds,
                 fd_set *writefds,
@@ -500,7 +535,16 @@ int fuzz_set_allowed_protocols(FUZZ_DATA *fuzz);
         (FUZZP)->options[OPTNAME % 1000] = 1
 
 #define FCHECK_OPTION_UNSET(FUZZP, OPTNAME)                                   \
-        FCHECK((FUZZP)->options[OPTNAME % 1000] == 0)
+        {                                                                     \
+          if ((FUZZP)->options[OPTNAME % 1000] != 0)                          \
+          {                                                                   \
+            fuzz_stats_reject(FUZZ_STATS_REJECT_DUPLICATE_OPTION,             \
+                              FUZZ_STATS_KEY_NONE,                            \
+                              0);                                             \
+            rc = 255;                                                         \
+            goto EXIT_LABEL;                                                  \
+          }                                                                   \
+        }
 
 #define FSINGLETONTLV(FUZZP, TLVNAME, OPTNAME)                                \
         case TLVNAME:                                                         \
@@ -0,0 +1,362 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curl/curl.h>
+#include "curl_fuzzer_alloc.h"
+
+/* Every block handed to curl is prefixed with its size. 16 bytes keeps the
+   returned pointer as aligned as malloc's. */
+#define FUZZ_ALLOC_HEADER               16
+
+typedef struct fuzz_alloc_state
+{
+  /* Whether the environment has been checked, and what it said. */
+  int checked;
+  int enabled;
+
+  /* Whether curl's global init has been done through this module. */
+  int global_init_done;
+
+  /* Report path and amplification threshold (0 = off). */
+  const char *path;
+  double amplification;
+
+  /* Live bytes and blocks across the whole process. Updated from any thread
+     curl allocates on (e.g. the threaded resolver). */
+  uint64_t live;
+  uint64_t live_blocks;
+
+  /* Current input. */
+  uint64_t base_live;
+  uint64_t count;
+  uint64_t bytes;
+  uint64_t peak;
+  uint64_t largest;
+
+  /* Totals across inputs. */
+  uint64_t inputs;
+  uint64_t total_count;
+  uint64_t total_bytes;
+  uint64_t max_peak;
+  uint64_t max_largest;
+  uint64_t findings;
+  double worst_ratio;
+  size_t worst_input_size;
+
+} FUZZ_ALLOC_STATE;
+
+static FUZZ_ALLOC_STATE g_alloc;
+
+/**
+ * Account for a new block and return the pointer curl sees.
+ */
+static void *fuzz_alloc_account(void *raw, size_t size)
+{
+  uint64_t live;
+  uint64_t peak;
+  uint64_t largest;
+
+  if(raw == NULL) {
+    return NULL;
+  }
+
+  memcpy(raw, &size, sizeof(size));
+
+  __atomic_add_fetch(&g_alloc.count, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&g_alloc.bytes, size, __ATOMIC_RELAXED);
+  live = __atomic_add_fetch(&g_alloc.live, size, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&g_alloc.live_blocks, 1, __ATOMIC_RELAXED);
+
+  peak = __atomic_load_n(&g_alloc.peak, __ATOMIC_RELAXED);
+  while(live > peak &&
+        !__atomic_compare_exchange_n(&g_alloc.peak, &peak, live, 1,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+
+  largest = __atomic_load_n(&g_alloc.largest, __ATOMIC_RELAXED);
+  while(size > largest &&
+        !__atomic_compare_exchange_n(&g_alloc.largest, &largest, size, 1,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+
+  return (char *)raw + FUZZ_ALLOC_HEADER;
+}
+
+/**
+ * Return the raw block behind a pointer curl holds, and forget its size.
+ */
+static void *fuzz_alloc_release(void *ptr)
+{
+  void *raw = (char *)ptr - FUZZ_ALLOC_HEADER;
+  size_t size;
+
+  memcpy(&size, raw, sizeof(size));
+  __atomic_sub_fetch(&g_alloc.live, size, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&g_alloc.live_blocks, 1, __ATOMIC_RELAXED);
+
+  return raw;
+}
+
+static void *fuzz_alloc_malloc(size_t size)
+{
+  return fuzz_alloc_account(malloc(size + FUZZ_ALLOC_HEADER), size);
+}
+
+static void fuzz_alloc_free(void *ptr)
+{
+  if(ptr != NULL) {
+    free(fuzz_alloc_release(ptr));
+  }
+}
+
+static void *fuzz_alloc_realloc(void *ptr, size_t size)
+{
+  void *raw;
+  void *new_raw;
+  size_t old_size;
+
+  if(ptr == NULL) {
+    return fuzz_alloc_malloc(size);
+  }
+
+  raw = (char *)ptr - FUZZ_ALLOC_HEADER;
+  memcpy(&old_size, raw, sizeof(old_size));
+
+  new_raw = realloc(raw, size + FUZZ_ALLOC_HEADER);
+  if(new_raw == NULL) {
+    /* The old block is untouched and still accounted for. */
+    return NULL;
+  }
+
+  __atomic_sub_fetch(&g_alloc.live, old_size, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&g_alloc.live_blocks, 1, __ATOMIC_RELAXED);
+  return fuzz_alloc_account(new_raw, size);
+}
+
+static char *fuzz_alloc_strdup(const char *str)
+{
+  size_t len = strlen(str) + 1;
+  char *copy = (char *)fuzz_alloc_malloc(len);
+
+  if(copy != NULL) {
+    memcpy(copy, str, len);
+  }
+  return copy;
+}
+
+static void *fuzz_alloc_calloc(size_t nmemb, size_t size)
+{
+  if(size != 0 && nmemb > (SIZE_MAX - FUZZ_ALLOC_HEADER) / size) {
+    return NULL;
+  }
+  return fuzz_alloc_account(calloc(1, nmemb * size + FUZZ_ALLOC_HEADER),
+                            nmemb * size);
+}
+
+/**
+ * Check FUZZ_ALLOC_STATS and FUZZ_ALLOC_AMPLIFICATION. The drift monitor
+ * (FUZZ_DRIFT) also needs the allocators installed, to sample curl's live
+ * allocation count, but doesn't want the report.
+ */
+int fuzz_alloc_enabled(void)
+{
+  const char *threshold;
+  const char *drift;
+
+  if(g_alloc.checked) {
+    return g_alloc.enabled;
+  }
+
+  g_alloc.checked = 1;
+  g_alloc.path = getenv("FUZZ_ALLOC_STATS");
+  if(g_alloc.path != NULL && *g_alloc.path == '\0') {
+    g_alloc.path = NULL;
+  }
+
+  drift = getenv("FUZZ_DRIFT");
+  if(g_alloc.path == NULL && (drift == NULL || *drift == '\0')) {
+    return 0;
+  }
+
+  threshold = getenv("FUZZ_ALLOC_AMPLIFICATION");
+  if(threshold != NULL && g_alloc.path != NULL) {
+    g_alloc.amplification = atof(threshold);
+  }
+
+  if(g_alloc.path != NULL) {
+    atexit(fuzz_alloc_dump);
+  }
+
+  g_alloc.enabled = 1;
+  return 1;
+}
+
+/**
+ * Initialise libcurl, installing the counting allocators if accounting is
+ * enabled. Only the first call does anything. This must run before any
+ * other libcurl call, or curl will already be using the default allocators.
+ */
+int fuzz_alloc_global_init(long flags)
+{
+  if(g_alloc.global_init_done) {
+    return CURLE_OK;
+  }
+  g_alloc.global_init_done = 1;
+
+  if(!fuzz_alloc_enabled()) {
+    return curl_global_init(flags);
+  }
+
+  return curl_global_init_mem(flags,
+                              fuzz_alloc_malloc,
+                              fuzz_alloc_free,
+                              fuzz_alloc_realloc,
+                              fuzz_alloc_strdup,
+                              fuzz_alloc_calloc);
+}
+
+/**
+ * Reset the per-input counters. Peak live bytes are measured relative to
+ * what curl already held when the input started.
+ */
+void fuzz_alloc_begin_input(void)
+{
+  if(!fuzz_alloc_enabled()) {
+    return;
+  }
+
+  fuzz_alloc_global_init(CURL_GLOBAL_DEFAULT);
+
+  g_alloc.base_live = __atomic_load_n(&g_alloc.live, __ATOMIC_RELAXED);
+  g_alloc.peak = g_alloc.base_live;
+  g_alloc.count = 0;
+  g_alloc.bytes = 0;
+  g_alloc.largest = 0;
+}
+
+/**
+ * Fold the input's counters into the totals and check for amplification.
+ */
+void fuzz_alloc_end_input(size_t input_size)
+{
+  uint64_t peak;
+  double ratio;
+
+  if(g_alloc.enabled != 1) {
+    return;
+  }
+
+  peak = g_alloc.peak - g_alloc.base_live;
+  ratio = (double)peak / (input_size ? input_size : 1);
+
+  g_alloc.inputs++;
+  g_alloc.total_count += g_alloc.count;
+  g_alloc.total_bytes += g_alloc.bytes;
+  if(peak > g_alloc.max_peak) {
+    g_alloc.max_peak = peak;
+  }
+  if(g_alloc.largest > g_alloc.max_largest) {
+    g_alloc.max_largest = g_alloc.largest;
+  }
+  if(ratio > g_alloc.worst_ratio) {
+    g_alloc.worst_ratio = ratio;
+    g_alloc.worst_input_size = input_size;
+  }
+
+  if(g_alloc.amplification > 0 &&
+     peak >= FUZZ_ALLOC_MIN_FINDING &&
+     ratio > g_alloc.amplification) {
+    g_alloc.findings++;
+    fprintf(stderr,
+            "FUZZ: memory amplification: %zu byte input peaked at %" PRIu64
+            " live bytes (%.1fx, limit %.1fx); %" PRIu64 " allocations, %"
+            PRIu64 " bytes total, largest %" PRIu64 "\n",
+            input_size,
+            peak,
+            ratio,
+            g_alloc.amplification,
+            g_alloc.count,
+            g_alloc.bytes,
+            g_alloc.largest);
+    fuzz_alloc_dump();
+    abort();
+  }
+}
+
+/**
+ * Number of blocks libcurl currently holds, or -1 if the counting allocators
+ * aren't installed.
+ */
+long fuzz_alloc_live_blocks(void)
+{
+  if(g_alloc.enabled != 1) {
+    return -1;
+  }
+  return (long)__atomic_load_n(&g_alloc.live_blocks, __ATOMIC_RELAXED);
+}
+
+/**
+ * Write the summary report.
+ */
+void fuzz_alloc_dump(void)
+{
+  FILE *fp;
+
+  if(g_alloc.enabled != 1 || g_alloc.path == NULL) {
+    return;
+  }
+
+  if(strcmp(g_alloc.path, "-") == 0) {
+    fp = stderr;
+  }
+  else {
+    fp = fopen(g_alloc.path, "w");
+    if(fp == NULL) {
+      fprintf(stderr, "FUZZ: cannot open FUZZ_ALLOC_STATS file %s\n",
+              g_alloc.path);
+      return;
+    }
+  }
+
+  fprintf(fp, "# curl-fuzzer allocation stats\n");
+  fprintf(fp, "inputs                 %" PRIu64 "\n", g_alloc.inputs);
+  fprintf(fp, "avg_allocs_per_input   %.1f\n",
+          g_alloc.inputs ? (double)g_alloc.total_count / g_alloc.inputs : 0);
+  fprintf(fp, "avg_bytes_per_input    %.1f\n",
+          g_alloc.inputs ? (double)g_alloc.total_bytes / g_alloc.inputs : 0);
+  fprintf(fp, "max_peak_live_bytes    %" PRIu64 "\n", g_alloc.max_peak);
+  fprintf(fp, "max_single_alloc       %" PRIu64 "\n", g_alloc.max_largest);
+  fprintf(fp, "worst_amplification    %.1fx (%zu byte input)\n",
+          g_alloc.worst_ratio, g_alloc.worst_input_size);
+  fprintf(fp, "amplification_findings %" PRIu64 "\n", g_alloc.findings);
+
+  if(fp == stderr) {
+    fflush(fp);
+  }
+  else {
+    fclose(fp);
+  }
+}
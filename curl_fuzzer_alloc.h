@@ -0,0 +1,54 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#ifndef CURL_FUZZER_ALLOC_H
+#define CURL_FUZZER_ALLOC_H
+
+#include <stddef.h>
+
+/**
+ * Opt-in accounting of libcurl's heap usage per input. Shared by the TLV
+ * fuzzers and curl_fuzzer_proto.
+ *
+ * Setting FUZZ_ALLOC_STATS=<path> (or "-" for stderr) makes
+ * fuzz_alloc_global_init() install counting allocators with
+ * curl_global_init_mem(). For every input the harness then records the
+ * number of allocations, total bytes allocated, peak live bytes and the
+ * largest single allocation, and writes a summary at exit.
+ *
+ * Setting FUZZ_ALLOC_AMPLIFICATION=<multiple> as well turns inputs whose
+ * peak live bytes exceed <multiple> times their own size (and
+ * FUZZ_ALLOC_MIN_FINDING) into findings: the numbers are printed and the
+ * harness aborts so the fuzzer keeps the input.
+ */
+
+/* Peaks below this many bytes are never reported as amplification. */
+#define FUZZ_ALLOC_MIN_FINDING          (1024 * 1024)
+
+/* Function prototypes */
+int fuzz_alloc_global_init(long flags);
+int fuzz_alloc_enabled(void);
+void fuzz_alloc_begin_input(void);
+void fuzz_alloc_end_input(size_t input_size);
+long fuzz_alloc_live_blocks(void);
+void fuzz_alloc_dump(void);
+
+#endif /* CURL_FUZZER_ALLOC_H */
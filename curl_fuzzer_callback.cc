@@ -33,12 +33,64 @@
  */
 #define FUZZ_VALID_SOCK(s) (((s) >= 0) && ((s) < FD_SETSIZE))
 
+/**
+ * Give the server end of a datagram socket pair a name and point curl's
+ * address at it. curl's TFTP code binds its own socket in the address's
+ * family and sends every packet with sendto() to that address, neither of
+ * which works with the AF_INET address curl resolved.
+ */
+static int fuzz_name_dgram_server(int fd, struct curl_sockaddr *address)
+{
+  struct sockaddr_un server_addr;
+  socklen_t len;
+
+  /* Binding with just the family autobinds to a unique abstract name. */
+  memset(&server_addr, 0, sizeof(server_addr));
+  server_addr.sun_family = AF_UNIX;
+  if(bind(fd, (struct sockaddr *)&server_addr, sizeof(sa_family_t)) != 0) {
+    return -1;
+  }
+
+  len = sizeof(server_addr);
+  if(getsockname(fd, (struct sockaddr *)&server_addr, &len) != 0) {
+    return -1;
+  }
+
+  /* curl's address storage is large enough for any sockaddr. */
+  address->family = AF_UNIX;
+  address->protocol = 0;
+  address->addrlen = (unsigned int)len;
+  memcpy(&address->addr, &server_addr, len);
+
+  return 0;
+}
+
 /**
  * Function for providing a socket to CURL already primed with data.
  */
 curl_socket_t fuzz_open_socket(void *ptr,
                                curlsocktype purpose,
                                struct curl_sockaddr *address)
+{
+  FUZZ_TIMING_PHASE prev_phase;
+  curl_socket_t sock;
+
+  /* Time spent setting up the mock socket is the harness's, not curl's. */
+  prev_phase = fuzz_timing_switch(FUZZ_TIMING_SOCKET_OPEN);
+  fuzz_digest_event(FUZZ_DIGEST_SOCKET_OPEN);
+  sock = fuzz_open_socket_comn(ptr, purpose, address);
+  fuzz_timing_switch(prev_phase);
+
+  return sock;
+}
+
+/**
+ * Creates the socket pair for fuzz_open_socket and sends the initial
+ * response.
+ */
+curl_socket_t fuzz_open_socket_comn(void *ptr,
+                                    curlsocktype purpose,
+                                    struct curl_sockaddr *address)
 {
   FUZZ_DATA *fuzz = (FUZZ_DATA *)ptr;
   int fds[2];
@@ -46,12 +98,11 @@ curl_socket_t fuzz_open_socket(void *ptr,
   int status;
   const uint8_t *data;
   size_t data_len;
-  struct sockaddr_un client_addr;
+  int socktype;
   FUZZ_SOCKET_MANAGER *sman;
 
   /* Handle unused parameters */
   (void)purpose;
-  (void)address;
 
   if(fuzz->sockman[0].fd_state != FUZZ_SOCK_CLOSED &&
      fuzz->sockman[1].fd_state != FUZZ_SOCK_CLOSED) {
@@ -69,7 +120,11 @@ curl_socket_t fuzz_open_socket(void *ptr,
             sman->index,
             sman->index);
 
-  if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+  /* Hand back the kind of socket curl asked for. TFTP wants datagrams, so
+     that each response is delivered as exactly one packet. */
+  socktype = (address->socktype == SOCK_DGRAM) ? SOCK_DGRAM : SOCK_STREAM;
+
+  if(socketpair(AF_UNIX, socktype, 0, fds)) {
     /* Failed to create a pair of sockets. */
     return CURL_SOCKET_BAD;
   }
@@ -112,10 +167,18 @@ curl_socket_t fuzz_open_socket(void *ptr,
     return CURL_SOCKET_BAD;
   }
 
+  if(socktype == SOCK_DGRAM && fuzz_name_dgram_server(fds[0], address)) {
+    close(fds[0]);
+    close(fds[1]);
+    return CURL_SOCKET_BAD;
+  }
+
   /* At this point, the file descriptors in hand should be good enough to
      work with. */
   sman->fd = fds[0];
   sman->fd_state = FUZZ_SOCK_OPEN;
+  sman->frag.datagram = (socktype == SOCK_DGRAM);
+  sman->pcap_stream = fuzz_pcap_open_stream();
 
   /* If the server should be sending data immediately, send it here. */
   data = sman->responses[0].data;
@@ -124,7 +187,7 @@ curl_socket_t fuzz_open_socket(void *ptr,
   if(data != NULL) {
     FV_PRINTF(fuzz, "FUZZ[%d]: Sending initial response \n", sman->index);
 
-    if(write(sman->fd, data, data_len) != (ssize_t)data_len) {
+    if(fuzz_frag_write(&sman->frag, sman->fd, data, data_len) != 0) {
       /* Close the file descriptors so they don't leak. */
       close(sman->fd);
       sman->fd = -1;
@@ -134,6 +197,9 @@ curl_socket_t fuzz_open_socket(void *ptr,
       /* Failed to write all of the response data. */
       return CURL_SOCKET_BAD;
     }
+
+    fuzz_pcap_record(sman->pcap_stream, FUZZ_PCAP_TO_CLIENT, data, data_len);
+    fuzz_digest_event(FUZZ_DIGEST_RESPOND);
   }
 
   /* Check to see if the socket should be shut down immediately. */
@@ -142,8 +208,9 @@ curl_socket_t fuzz_open_socket(void *ptr,
               "FUZZ[%d]: Shutting down server socket: %d \n",
               sman->index,
               sman->fd);
-    shutdown(sman->fd, SHUT_WR);
+    fuzz_frag_shutdown(&sman->frag, sman->fd);
     sman->fd_state = FUZZ_SOCK_SHUTDOWN;
+    fuzz_pcap_close_stream(sman->pcap_stream, FUZZ_PCAP_TO_CLIENT);
   }
 
   /* Return the other half of the socket pair. */
@@ -177,6 +244,8 @@ size_t fuzz_read_callback(char *buffer,
   size_t remaining_data;
   size_t buffer_size = size * nitems;
 
+  fuzz_digest_event(FUZZ_DIGEST_READ_CB);
+
   /* If no upload data has been specified, then return an error code. */
   if(fuzz->upload1_data_len == 0) {
     /* No data to upload */
@@ -221,6 +290,9 @@ size_t fuzz_write_callback(void *contents,
   FUZZ_DATA *fuzz = (FUZZ_DATA *)ptr;
   size_t copy_len = total;
 
+  fuzz_digest_event(FUZZ_DIGEST_WRITE_CB);
+  fuzz_digest_bytes(FUZZ_DIGEST_DELIVERED, contents, total);
+
   /* Restrict copy_len to at most TEMP_WRITE_ARRAY_SIZE. */
   if(copy_len > TEMP_WRITE_ARRAY_SIZE) {
     copy_len = TEMP_WRITE_ARRAY_SIZE;
@@ -243,3 +315,22 @@ size_t fuzz_write_callback(void *contents,
 
   return total;
 }
+
+/**
+ * Callback function for headers, installed only while the behaviour digest
+ * is on so they can be compared along with the body.
+ */
+size_t fuzz_header_callback(char *buffer,
+                            size_t size,
+                            size_t nitems,
+                            void *userdata)
+{
+  size_t total = size * nitems;
+
+  (void)userdata;
+
+  fuzz_digest_event(FUZZ_DIGEST_WRITE_CB);
+  fuzz_digest_bytes(FUZZ_DIGEST_DELIVERED, buffer, total);
+
+  return total;
+}
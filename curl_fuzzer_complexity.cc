@@ -0,0 +1,230 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "curl_fuzzer_complexity.h"
+
+#define FUZZ_COMPLEXITY_NUM_POINTS      (FUZZ_COMPLEXITY_GROWTH_STEPS + 1)
+
+typedef struct fuzz_complexity_state
+{
+  /* Whether the environment has been checked, and what it said. */
+  int checked;
+  int enabled;
+
+  /* Exponent above which an input is reported, and the probing floor. */
+  double exponent;
+  uint64_t min_ns;
+
+  /* CPU time when the current input started. */
+  uint64_t start_ns;
+
+  /* Set while grown inputs are running, so they aren't probed in turn. */
+  int probing;
+
+  /* Totals across inputs. */
+  uint64_t inputs;
+  uint64_t probed;
+  double worst_exponent;
+
+} FUZZ_COMPLEXITY_STATE;
+
+static FUZZ_COMPLEXITY_STATE g_complexity;
+
+static uint64_t fuzz_complexity_cpu_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void fuzz_complexity_dump(void)
+{
+  fprintf(stderr,
+          "FUZZ: complexity: %" PRIu64 " inputs, %" PRIu64
+          " probed, worst exponent %.2f\n",
+          g_complexity.inputs,
+          g_complexity.probed,
+          g_complexity.worst_exponent);
+}
+
+/**
+ * Check FUZZ_COMPLEXITY and FUZZ_COMPLEXITY_MIN_US.
+ */
+int fuzz_complexity_enabled(void)
+{
+  const char *exponent;
+  const char *min_us;
+
+  if(g_complexity.checked) {
+    return g_complexity.enabled;
+  }
+
+  g_complexity.checked = 1;
+  exponent = getenv("FUZZ_COMPLEXITY");
+  if(exponent == NULL || atof(exponent) <= 0) {
+    return 0;
+  }
+
+  g_complexity.exponent = atof(exponent);
+  min_us = getenv("FUZZ_COMPLEXITY_MIN_US");
+  g_complexity.min_ns = 1000ULL * (min_us != NULL ?
+                                   strtoull(min_us, NULL, 10) :
+                                   FUZZ_COMPLEXITY_DEFAULT_MIN_US);
+  atexit(fuzz_complexity_dump);
+
+  g_complexity.enabled = 1;
+  return 1;
+}
+
+/**
+ * Whether the oracle is re-running a grown copy of an input. Harnesses keep
+ * their other per-input telemetry out of those runs.
+ */
+int fuzz_complexity_probing(void)
+{
+  return g_complexity.probing;
+}
+
+void fuzz_complexity_begin_input(void)
+{
+  if(!fuzz_complexity_enabled() || g_complexity.probing) {
+    return;
+  }
+  g_complexity.start_ns = fuzz_complexity_cpu_ns();
+}
+
+/**
+ * Least squares slope of log(cost) against log(size).
+ */
+static double fuzz_complexity_fit(const size_t *sizes,
+                                  const uint64_t *costs,
+                                  int num_points)
+{
+  double sum_x = 0;
+  double sum_y = 0;
+  double sum_xx = 0;
+  double sum_xy = 0;
+  double x;
+  double y;
+  double denom;
+  int ii;
+
+  for(ii = 0; ii < num_points; ii++) {
+    x = log((double)sizes[ii]);
+    y = log((double)(costs[ii] ? costs[ii] : 1));
+    sum_x += x;
+    sum_y += y;
+    sum_xx += x * x;
+    sum_xy += x * y;
+  }
+
+  denom = num_points * sum_xx - sum_x * sum_x;
+  if(denom <= 0) {
+    return 0;
+  }
+  return (num_points * sum_xy - sum_x * sum_y) / denom;
+}
+
+/**
+ * Run the input at each growth factor and fit the cost curve.
+ */
+static void fuzz_complexity_probe(FUZZ_COMPLEXITY_RUN run,
+                                  const void *ctx)
+{
+  size_t sizes[FUZZ_COMPLEXITY_NUM_POINTS];
+  uint64_t costs[FUZZ_COMPLEXITY_NUM_POINTS];
+  int num_points = 0;
+  uint64_t start;
+  size_t size;
+  double exponent;
+  int ii;
+
+  g_complexity.probing = 1;
+  g_complexity.probed++;
+
+  /* Re-run the original too, so every point is measured the same way
+     (warm caches, no first-time setup). */
+  for(ii = 0; ii < FUZZ_COMPLEXITY_NUM_POINTS; ii++) {
+    start = fuzz_complexity_cpu_ns();
+    size = run(ctx, 1U << ii);
+    if(size == 0) {
+      break;
+    }
+    sizes[num_points] = size;
+    costs[num_points] = fuzz_complexity_cpu_ns() - start;
+    num_points++;
+  }
+
+  g_complexity.probing = 0;
+
+  if(num_points < 2) {
+    return;
+  }
+
+  exponent = fuzz_complexity_fit(sizes, costs, num_points);
+  if(exponent > g_complexity.worst_exponent) {
+    g_complexity.worst_exponent = exponent;
+  }
+
+  if(exponent <= g_complexity.exponent) {
+    return;
+  }
+
+  fprintf(stderr,
+          "FUZZ: complexity: cost grows as size^%.2f (limit %.2f)\n",
+          exponent,
+          g_complexity.exponent);
+  for(ii = 0; ii < num_points; ii++) {
+    fprintf(stderr,
+            "FUZZ: complexity:   %10zu bytes %12" PRIu64 " us\n",
+            sizes[ii],
+            costs[ii] / 1000);
+  }
+  abort();
+}
+
+/**
+ * Charge the input's CPU time and, if it was expensive enough, probe it.
+ */
+void fuzz_complexity_end_input(size_t size,
+                               FUZZ_COMPLEXITY_RUN run,
+                               const void *ctx)
+{
+  uint64_t cost;
+
+  if(!fuzz_complexity_enabled() || g_complexity.probing) {
+    return;
+  }
+
+  cost = fuzz_complexity_cpu_ns() - g_complexity.start_ns;
+  g_complexity.inputs++;
+
+  if(cost >= g_complexity.min_ns && size > 0) {
+    fuzz_complexity_probe(run, ctx);
+  }
+}
@@ -0,0 +1,62 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#ifndef CURL_FUZZER_COMPLEXITY_H
+#define CURL_FUZZER_COMPLEXITY_H
+
+#include <stddef.h>
+
+/**
+ * Opt-in algorithmic complexity oracle. Shared by the TLV fuzzers and
+ * curl_fuzzer_proto.
+ *
+ * Setting FUZZ_COMPLEXITY=<exponent> measures the CPU time of every input.
+ * Inputs that cost at least FUZZ_COMPLEXITY_MIN_US microseconds (default
+ * FUZZ_COMPLEXITY_DEFAULT_MIN_US) are probed: the harness re-runs them with
+ * their largest field grown FUZZ_COMPLEXITY_GROWTH_STEPS times, doubling each
+ * time, and fits cost = k * size^e to the results. If e is above <exponent>
+ * the curve is printed and the harness aborts, so the fuzzer keeps the input.
+ *
+ * The harness supplies the growing: a FUZZ_COMPLEXITY_RUN callback builds the
+ * input with its largest field repeated <factor> times, runs it, and returns
+ * the size of what it ran (0 if it couldn't grow the input).
+ */
+
+/* Probing only starts above this many microseconds of CPU per input. */
+#define FUZZ_COMPLEXITY_DEFAULT_MIN_US  200
+
+/* Growth factors tried are 2, 4, ... 2^FUZZ_COMPLEXITY_GROWTH_STEPS. */
+#define FUZZ_COMPLEXITY_GROWTH_STEPS    3
+
+/* Grown inputs larger than this aren't run. */
+#define FUZZ_COMPLEXITY_MAX_GROWN       (16 * 1024 * 1024)
+
+typedef size_t (*FUZZ_COMPLEXITY_RUN)(const void *ctx, unsigned int factor);
+
+/* Function prototypes */
+int fuzz_complexity_enabled(void);
+int fuzz_complexity_probing(void);
+void fuzz_complexity_begin_input(void);
+void fuzz_complexity_end_input(size_t size,
+                               FUZZ_COMPLEXITY_RUN run,
+                               const void *ctx);
+
+#endif /* CURL_FUZZER_COMPLEXITY_H */
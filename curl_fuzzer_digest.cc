@@ -0,0 +1,374 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "curl_fuzzer_digest.h"
+
+#define FUZZ_DIGEST_FNV_OFFSET          0xcbf29ce484222325ULL
+#define FUZZ_DIGEST_FNV_PRIME           0x100000001b3ULL
+
+typedef struct fuzz_digest_stream_state
+{
+  uint64_t hash;
+  uint64_t len;
+
+  /* Whether the stream is left out of this run's digest. */
+  int ignored;
+
+  /* The first FUZZ_DIGEST_MAX_PREFIX bytes, to find where runs diverge. */
+  uint8_t prefix[FUZZ_DIGEST_MAX_PREFIX];
+
+} FUZZ_DIGEST_STREAM_STATE;
+
+/* Everything observed of one run of an input. */
+typedef struct fuzz_digest_run
+{
+  FUZZ_DIGEST_STREAM_STATE streams[FUZZ_DIGEST_NUM_STREAMS];
+
+  /* Collapsed event sequence. All events go into the hash; the first
+     FUZZ_DIGEST_MAX_EVENTS are also logged. */
+  uint8_t events[FUZZ_DIGEST_MAX_EVENTS];
+  uint64_t num_events;
+  uint64_t events_hash;
+  int last_event;
+
+  uint64_t iterations;
+  int result;
+
+} FUZZ_DIGEST_RUN;
+
+typedef struct fuzz_digest_state
+{
+  /* Whether the environment has been checked, and what it said. */
+  int checked;
+  int enabled;
+  int runs;
+
+  /* Set while the harness runs something that isn't the input itself. */
+  int paused;
+
+  FUZZ_DIGEST_RUN current;
+  FUZZ_DIGEST_RUN reference;
+
+} FUZZ_DIGEST_STATE;
+
+static FUZZ_DIGEST_STATE g_digest;
+
+static const char *fuzz_digest_stream_names[FUZZ_DIGEST_NUM_STREAMS] = {
+  "sent",
+  "delivered"
+};
+
+static const char *fuzz_digest_event_names[FUZZ_DIGEST_NUM_EVENTS] = {
+  "socket_open",
+  "send",
+  "respond",
+  "read_cb",
+  "write_cb",
+  "done"
+};
+
+static uint64_t fuzz_digest_fnv(uint64_t hash, const uint8_t *data, size_t len)
+{
+  size_t ii;
+
+  for(ii = 0; ii < len; ii++) {
+    hash ^= data[ii];
+    hash *= FUZZ_DIGEST_FNV_PRIME;
+  }
+  return hash;
+}
+
+/**
+ * Check FUZZ_DETERMINISM. The fragmentation oracle (FUZZ_FRAGMENT) also needs
+ * the digest, but doesn't re-run inputs for it.
+ */
+int fuzz_digest_enabled(void)
+{
+  const char *runs;
+  const char *fragment;
+
+  if(g_digest.checked) {
+    return g_digest.enabled;
+  }
+
+  g_digest.checked = 1;
+  runs = getenv("FUZZ_DETERMINISM");
+  if(runs != NULL && atoi(runs) >= 2) {
+    g_digest.runs = atoi(runs);
+  }
+
+  fragment = getenv("FUZZ_FRAGMENT");
+  if(g_digest.runs == 0 && (fragment == NULL || *fragment == '\0')) {
+    return 0;
+  }
+
+  g_digest.enabled = 1;
+  return 1;
+}
+
+/**
+ * Number of times FUZZ_DETERMINISM asks for each input to be run, or 0 if
+ * the determinism checker is off.
+ */
+int fuzz_digest_runs(void)
+{
+  fuzz_digest_enabled();
+  return g_digest.runs;
+}
+
+/**
+ * Start a fresh digest for the run that's starting.
+ */
+void fuzz_digest_begin_input(void)
+{
+  FUZZ_DIGEST_RUN *run = &g_digest.current;
+  int ii;
+
+  if(!fuzz_digest_enabled() || g_digest.paused) {
+    return;
+  }
+
+  for(ii = 0; ii < FUZZ_DIGEST_NUM_STREAMS; ii++) {
+    run->streams[ii].hash = FUZZ_DIGEST_FNV_OFFSET;
+    run->streams[ii].len = 0;
+    run->streams[ii].ignored = 0;
+  }
+  run->num_events = 0;
+  run->events_hash = FUZZ_DIGEST_FNV_OFFSET;
+  run->last_event = -1;
+  run->iterations = 0;
+  run->result = FUZZ_DIGEST_NO_RESULT;
+}
+
+void fuzz_digest_bytes(FUZZ_DIGEST_STREAM stream,
+                       const void *data,
+                       size_t len)
+{
+  FUZZ_DIGEST_STREAM_STATE *state;
+  size_t keep;
+
+  if(!g_digest.enabled || g_digest.paused) {
+    return;
+  }
+
+  state = &g_digest.current.streams[stream];
+  if(state->ignored) {
+    return;
+  }
+
+  state->hash = fuzz_digest_fnv(state->hash, (const uint8_t *)data, len);
+
+  if(state->len < FUZZ_DIGEST_MAX_PREFIX) {
+    keep = FUZZ_DIGEST_MAX_PREFIX - (size_t)state->len;
+    if(keep > len) {
+      keep = len;
+    }
+    memcpy(&state->prefix[state->len], data, keep);
+  }
+  state->len += len;
+}
+
+/**
+ * Leave a stream out of the current run's digest, for a mock whose peer
+ * randomises it (e.g. WebSocket frame masking).
+ */
+void fuzz_digest_ignore(FUZZ_DIGEST_STREAM stream)
+{
+  if(g_digest.enabled && !g_digest.paused) {
+    g_digest.current.streams[stream].ignored = 1;
+  }
+}
+
+void fuzz_digest_event(FUZZ_DIGEST_EVENT event)
+{
+  FUZZ_DIGEST_RUN *run = &g_digest.current;
+  uint8_t byte = (uint8_t)event;
+
+  if(!g_digest.enabled || g_digest.paused || run->last_event == (int)event) {
+    return;
+  }
+
+  if(run->num_events < FUZZ_DIGEST_MAX_EVENTS) {
+    run->events[run->num_events] = byte;
+  }
+  run->num_events++;
+  run->events_hash = fuzz_digest_fnv(run->events_hash, &byte, 1);
+  run->last_event = (int)event;
+}
+
+void fuzz_digest_iteration(void)
+{
+  if(g_digest.enabled && !g_digest.paused) {
+    g_digest.current.iterations++;
+  }
+}
+
+void fuzz_digest_result(int result)
+{
+  if(!g_digest.enabled || g_digest.paused) {
+    return;
+  }
+  g_digest.current.result = result;
+  fuzz_digest_event(FUZZ_DIGEST_DONE);
+}
+
+/**
+ * Stop (or resume) recording into the current run, so a run the harness makes
+ * of its own accord (e.g. a complexity probe) leaves the input's digest alone.
+ */
+void fuzz_digest_pause(int paused)
+{
+  g_digest.paused = paused;
+}
+
+/**
+ * Make the run that just finished the one later runs are compared with.
+ */
+void fuzz_digest_keep_reference(void)
+{
+  if(g_digest.enabled) {
+    memcpy(&g_digest.reference, &g_digest.current, sizeof(FUZZ_DIGEST_RUN));
+  }
+}
+
+static const char *fuzz_digest_event_name(const FUZZ_DIGEST_RUN *run,
+                                          uint64_t index)
+{
+  return index < run->num_events ?
+         fuzz_digest_event_names[run->events[index]] : "end";
+}
+
+/**
+ * Compare the run that just finished with the reference, either all of it or
+ * only the delivered bytes and result. Returns 1 and describes the first
+ * divergence of each kind in where if they differ.
+ */
+static int fuzz_digest_diff(char *where, size_t where_len, int output_only)
+{
+  const FUZZ_DIGEST_RUN *ref = &g_digest.reference;
+  const FUZZ_DIGEST_RUN *cur = &g_digest.current;
+  const FUZZ_DIGEST_STREAM_STATE *ref_stream;
+  const FUZZ_DIGEST_STREAM_STATE *cur_stream;
+  uint64_t logged;
+  uint64_t ii;
+  size_t used = 0;
+  int jj;
+
+  where[0] = '\0';
+
+#define FUZZ_DIGEST_APPEND(...)                                               \
+  do {                                                                        \
+    if(used < where_len) {                                                    \
+      used += snprintf(where + used, where_len - used, __VA_ARGS__);          \
+    }                                                                         \
+  } while(0)
+
+  if(!output_only &&
+     (ref->num_events != cur->num_events ||
+      ref->events_hash != cur->events_hash)) {
+    logged = ref->num_events < cur->num_events ?
+             ref->num_events : cur->num_events;
+    if(logged > FUZZ_DIGEST_MAX_EVENTS) {
+      logged = FUZZ_DIGEST_MAX_EVENTS;
+    }
+    for(ii = 0; ii < logged && ref->events[ii] == cur->events[ii]; ii++) {
+    }
+    if(ii < FUZZ_DIGEST_MAX_EVENTS) {
+      FUZZ_DIGEST_APPEND("event #%" PRIu64 " %s vs %s; ",
+                         ii,
+                         fuzz_digest_event_name(ref, ii),
+                         fuzz_digest_event_name(cur, ii));
+    }
+    else {
+      FUZZ_DIGEST_APPEND("events after #%d; ", FUZZ_DIGEST_MAX_EVENTS);
+    }
+  }
+
+  for(jj = 0; jj < FUZZ_DIGEST_NUM_STREAMS; jj++) {
+    ref_stream = &ref->streams[jj];
+    cur_stream = &cur->streams[jj];
+    if((output_only && jj != FUZZ_DIGEST_DELIVERED) ||
+       (ref_stream->len == cur_stream->len &&
+        ref_stream->hash == cur_stream->hash)) {
+      continue;
+    }
+
+    logged = ref_stream->len < cur_stream->len ?
+             ref_stream->len : cur_stream->len;
+    if(logged > FUZZ_DIGEST_MAX_PREFIX) {
+      logged = FUZZ_DIGEST_MAX_PREFIX;
+    }
+    for(ii = 0;
+        ii < logged && ref_stream->prefix[ii] == cur_stream->prefix[ii];
+        ii++) {
+    }
+    if(ii < FUZZ_DIGEST_MAX_PREFIX) {
+      FUZZ_DIGEST_APPEND("%s byte %" PRIu64 " (%" PRIu64 " vs %" PRIu64
+                         " bytes); ",
+                         fuzz_digest_stream_names[jj],
+                         ii,
+                         ref_stream->len,
+                         cur_stream->len);
+    }
+    else {
+      FUZZ_DIGEST_APPEND("%s after byte %d; ",
+                         fuzz_digest_stream_names[jj],
+                         FUZZ_DIGEST_MAX_PREFIX);
+    }
+  }
+
+  if(ref->result != cur->result) {
+    FUZZ_DIGEST_APPEND("result %d vs %d; ", ref->result, cur->result);
+  }
+
+  if(!output_only && ref->iterations != cur->iterations) {
+    FUZZ_DIGEST_APPEND("iterations %" PRIu64 " vs %" PRIu64 "; ",
+                       ref->iterations,
+                       cur->iterations);
+  }
+
+#undef FUZZ_DIGEST_APPEND
+
+  if(used == 0) {
+    return 0;
+  }
+
+  /* Drop the trailing separator. */
+  if(used >= 2 && used < where_len) {
+    where[used - 2] = '\0';
+  }
+  return 1;
+}
+
+int fuzz_digest_compare(char *where, size_t where_len)
+{
+  return fuzz_digest_diff(where, where_len, 0);
+}
+
+int fuzz_digest_compare_output(char *where, size_t where_len)
+{
+  return fuzz_digest_diff(where, where_len, 1);
+}
@@ -0,0 +1,89 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#ifndef CURL_FUZZER_DIGEST_H
+#define CURL_FUZZER_DIGEST_H
+
+#include <stddef.h>
+
+/**
+ * Behaviour digest for the determinism checker. Shared by the TLV fuzzers,
+ * curl_fuzzer_proto and the standalone runner.
+ *
+ * Setting FUZZ_DETERMINISM=<N> makes the standalone runner run every input
+ * N times. While an input runs, the harness feeds this module what can be
+ * observed of it: the bytes curl sends to the mock, the bytes curl hands to
+ * its write callbacks, the sequence of callbacks and socket events, the
+ * transfer's result and the number of perform loop iterations. The first
+ * run's digest becomes the reference and every later run is compared with
+ * it; the runner reports inputs that differ and where they first diverged.
+ *
+ * The fragmentation oracle (FUZZ_FRAGMENT, see curl_fuzzer_frag) uses the
+ * same digest but only compares what curl delivered and the results, since
+ * splitting a response legitimately changes the rest.
+ *
+ * Byte streams are compared as streams, so it doesn't matter how they were
+ * split into reads and writes. Repeated events are collapsed for the same
+ * reason.
+ */
+
+/* Byte streams that are hashed. */
+typedef enum fuzz_digest_stream {
+  FUZZ_DIGEST_SENT,                     /* curl to the mock server */
+  FUZZ_DIGEST_DELIVERED,                /* curl to its write callbacks */
+  FUZZ_DIGEST_NUM_STREAMS
+} FUZZ_DIGEST_STREAM;
+
+/* Events whose order is recorded. */
+typedef enum fuzz_digest_event {
+  FUZZ_DIGEST_SOCKET_OPEN,
+  FUZZ_DIGEST_SEND,
+  FUZZ_DIGEST_RESPOND,
+  FUZZ_DIGEST_READ_CB,
+  FUZZ_DIGEST_WRITE_CB,
+  FUZZ_DIGEST_DONE,
+  FUZZ_DIGEST_NUM_EVENTS
+} FUZZ_DIGEST_EVENT;
+
+/* Stream bytes kept per run to locate a divergence, and events logged. */
+#define FUZZ_DIGEST_MAX_PREFIX          (64 * 1024)
+#define FUZZ_DIGEST_MAX_EVENTS          1024
+
+/* Result recorded when the harness gave up before curl finished. */
+#define FUZZ_DIGEST_NO_RESULT           -1
+
+/* Function prototypes */
+int fuzz_digest_enabled(void);
+int fuzz_digest_runs(void);
+void fuzz_digest_begin_input(void);
+void fuzz_digest_bytes(FUZZ_DIGEST_STREAM stream,
+                       const void *data,
+                       size_t len);
+void fuzz_digest_ignore(FUZZ_DIGEST_STREAM stream);
+void fuzz_digest_event(FUZZ_DIGEST_EVENT event);
+void fuzz_digest_iteration(void);
+void fuzz_digest_result(int result);
+void fuzz_digest_pause(int paused);
+void fuzz_digest_keep_reference(void);
+int fuzz_digest_compare(char *where, size_t where_len);
+int fuzz_digest_compare_output(char *where, size_t where_len);
+
+#endif /* CURL_FUZZER_DIGEST_H */
@@ -0,0 +1,368 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#include <dirent.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "curl_fuzzer_alloc.h"
+#include "curl_fuzzer_drift.h"
+
+/* A run of consecutive inputs between two samples. Windows are shared by
+   reference between the current window and any metric whose growth began
+   in it. */
+typedef struct fuzz_drift_window
+{
+  int refs;
+
+  /* Index of the first input in the window, and how many it holds. */
+  uint64_t first_input;
+  uint64_t num_inputs;
+
+  /* Copies of the inputs, up to FUZZ_DRIFT_MAX_WINDOW_BYTES. */
+  uint8_t **data;
+  size_t *lens;
+  size_t num_saved;
+  size_t cap_saved;
+  size_t bytes;
+
+} FUZZ_DRIFT_WINDOW;
+
+typedef struct fuzz_drift_track
+{
+  /* Value at the start of the current run of non-decreasing samples, and
+     the input count when it was taken. */
+  int64_t low;
+  uint64_t low_input;
+
+  /* Most recent sample. */
+  int64_t last;
+
+  /* Window in which the metric first rose above low, or NULL. */
+  FUZZ_DRIFT_WINDOW *rise;
+
+  /* Whether this run has already been reported. */
+  int reported;
+
+} FUZZ_DRIFT_TRACK;
+
+typedef struct fuzz_drift_state
+{
+  /* Whether the environment has been checked, and what it said. */
+  int checked;
+  int enabled;
+
+  /* Sampling interval in inputs, and where to save windows (or NULL). */
+  uint64_t interval;
+  const char *abort_dir;
+
+  /* Inputs seen so far, and whether a first sample has been taken. */
+  uint64_t inputs;
+  int sampled;
+
+  FUZZ_DRIFT_WINDOW *window;
+  FUZZ_DRIFT_TRACK tracks[FUZZ_DRIFT_NUM_METRICS];
+
+} FUZZ_DRIFT_STATE;
+
+static FUZZ_DRIFT_STATE g_drift;
+
+static const char *fuzz_drift_metric_names[FUZZ_DRIFT_NUM_METRICS] = {
+  "open fds",
+  "rss bytes",
+  "curl live allocations"
+};
+
+static const int64_t fuzz_drift_limits[FUZZ_DRIFT_NUM_METRICS] = {
+  FUZZ_DRIFT_FD_LIMIT,
+  FUZZ_DRIFT_RSS_LIMIT,
+  FUZZ_DRIFT_ALLOC_LIMIT
+};
+
+static FUZZ_DRIFT_WINDOW *fuzz_drift_new_window(uint64_t first_input)
+{
+  FUZZ_DRIFT_WINDOW *window;
+
+  window = (FUZZ_DRIFT_WINDOW *)calloc(1, sizeof(FUZZ_DRIFT_WINDOW));
+  if(window != NULL) {
+    window->refs = 1;
+    window->first_input = first_input;
+  }
+  return window;
+}
+
+static void fuzz_drift_release_window(FUZZ_DRIFT_WINDOW *window)
+{
+  size_t ii;
+
+  if(window == NULL || --window->refs > 0) {
+    return;
+  }
+
+  for(ii = 0; ii < window->num_saved; ii++) {
+    free(window->data[ii]);
+  }
+  free(window->data);
+  free(window->lens);
+  free(window);
+}
+
+/**
+ * Keep a copy of an input in the current window, if there's room.
+ */
+static void fuzz_drift_save_input(FUZZ_DRIFT_WINDOW *window,
+                                  const uint8_t *data,
+                                  size_t size)
+{
+  uint8_t **new_data;
+  size_t *new_lens;
+  size_t new_cap;
+  uint8_t *copy;
+
+  window->num_inputs++;
+
+  if(window->bytes + size > FUZZ_DRIFT_MAX_WINDOW_BYTES) {
+    return;
+  }
+
+  if(window->num_saved == window->cap_saved) {
+    new_cap = window->cap_saved ? window->cap_saved * 2 : 64;
+    new_data = (uint8_t **)realloc(window->data, new_cap * sizeof(*new_data));
+    if(new_data == NULL) {
+      return;
+    }
+    window->data = new_data;
+    new_lens = (size_t *)realloc(window->lens, new_cap * sizeof(*new_lens));
+    if(new_lens == NULL) {
+      return;
+    }
+    window->lens = new_lens;
+    window->cap_saved = new_cap;
+  }
+
+  copy = (uint8_t *)malloc(size ? size : 1);
+  if(copy == NULL) {
+    return;
+  }
+  if(size > 0) {
+    memcpy(copy, data, size);
+  }
+
+  window->data[window->num_saved] = copy;
+  window->lens[window->num_saved] = size;
+  window->num_saved++;
+  window->bytes += size;
+}
+
+/**
+ * Count this process's open file descriptors, or -1 if /proc isn't there.
+ */
+static int64_t fuzz_drift_sample_fds(void)
+{
+  DIR *dir;
+  struct dirent *entry;
+  int64_t count = 0;
+
+  dir = opendir("/proc/self/fd");
+  if(dir == NULL) {
+    return -1;
+  }
+
+  while((entry = readdir(dir)) != NULL) {
+    if(entry->d_name[0] != '.') {
+      count++;
+    }
+  }
+  closedir(dir);
+
+  /* Don't count the descriptor opendir() used. */
+  return count - 1;
+}
+
+/**
+ * Resident set size in bytes, or -1 if /proc isn't there.
+ */
+static int64_t fuzz_drift_sample_rss(void)
+{
+  FILE *fp;
+  long pages = -1;
+
+  fp = fopen("/proc/self/statm", "r");
+  if(fp == NULL) {
+    return -1;
+  }
+  if(fscanf(fp, "%*s %ld", &pages) != 1) {
+    pages = -1;
+  }
+  fclose(fp);
+
+  return pages < 0 ? -1 : (int64_t)pages * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * Check FUZZ_DRIFT and FUZZ_DRIFT_ABORT.
+ */
+int fuzz_drift_enabled(void)
+{
+  const char *interval;
+
+  if(g_drift.checked) {
+    return g_drift.enabled;
+  }
+
+  g_drift.checked = 1;
+  interval = getenv("FUZZ_DRIFT");
+  if(interval == NULL || atoi(interval) <= 0) {
+    return 0;
+  }
+
+  g_drift.interval = (uint64_t)atoi(interval);
+  g_drift.abort_dir = getenv("FUZZ_DRIFT_ABORT");
+  g_drift.window = fuzz_drift_new_window(0);
+  if(g_drift.window == NULL) {
+    return 0;
+  }
+
+  g_drift.enabled = 1;
+  return 1;
+}
+
+/**
+ * Write the inputs of a window into FUZZ_DRIFT_ABORT.
+ */
+static void fuzz_drift_save_window(FUZZ_DRIFT_WINDOW *window)
+{
+  char path[4096];
+  FILE *fp;
+  size_t ii;
+
+  for(ii = 0; ii < window->num_saved; ii++) {
+    snprintf(path, sizeof(path), "%s/drift-input-%" PRIu64,
+             g_drift.abort_dir, window->first_input + ii);
+    fp = fopen(path, "wb");
+    if(fp == NULL) {
+      fprintf(stderr, "FUZZ: drift: cannot write %s\n", path);
+      continue;
+    }
+    fwrite(window->data[ii], 1, window->lens[ii], fp);
+    fclose(fp);
+  }
+
+  fprintf(stderr,
+          "FUZZ: drift: saved %zu of %" PRIu64 " inputs to %s\n",
+          window->num_saved,
+          window->num_inputs,
+          g_drift.abort_dir);
+}
+
+/**
+ * Report a metric whose growth has passed its limit.
+ */
+static void fuzz_drift_report(FUZZ_DRIFT_METRIC metric,
+                              FUZZ_DRIFT_TRACK *track,
+                              int64_t value)
+{
+  FUZZ_DRIFT_WINDOW *rise = track->rise;
+
+  fprintf(stderr,
+          "FUZZ: drift: %s grew from %" PRId64 " to %" PRId64
+          " between inputs %" PRIu64 " and %" PRIu64,
+          fuzz_drift_metric_names[metric],
+          track->low,
+          value,
+          track->low_input,
+          g_drift.inputs);
+  if(rise != NULL) {
+    fprintf(stderr,
+            "; growth began in inputs %" PRIu64 "-%" PRIu64,
+            rise->first_input,
+            rise->first_input + rise->num_inputs - 1);
+  }
+  fprintf(stderr, "\n");
+
+  if(g_drift.abort_dir != NULL) {
+    if(rise != NULL) {
+      fuzz_drift_save_window(rise);
+    }
+    abort();
+  }
+}
+
+/**
+ * Record an input and, every FUZZ_DRIFT inputs, sample the metrics.
+ */
+void fuzz_drift_end_input(const uint8_t *data, size_t size)
+{
+  int64_t values[FUZZ_DRIFT_NUM_METRICS];
+  FUZZ_DRIFT_TRACK *track;
+  int ii;
+
+  if(!fuzz_drift_enabled()) {
+    return;
+  }
+
+  fuzz_drift_save_input(g_drift.window, data, size);
+  g_drift.inputs++;
+
+  if(g_drift.inputs % g_drift.interval != 0) {
+    return;
+  }
+
+  values[FUZZ_DRIFT_FDS] = fuzz_drift_sample_fds();
+  values[FUZZ_DRIFT_RSS] = fuzz_drift_sample_rss();
+  values[FUZZ_DRIFT_ALLOCS] = fuzz_alloc_live_blocks();
+
+  for(ii = 0; ii < FUZZ_DRIFT_NUM_METRICS; ii++) {
+    track = &g_drift.tracks[ii];
+    if(values[ii] < 0) {
+      continue;
+    }
+
+    if(!g_drift.sampled || values[ii] < track->last) {
+      /* First sample, or the metric dropped: start a new run. */
+      track->low = values[ii];
+      track->low_input = g_drift.inputs;
+      fuzz_drift_release_window(track->rise);
+      track->rise = NULL;
+      track->reported = 0;
+    }
+    else if(values[ii] > track->low && track->rise == NULL) {
+      track->rise = g_drift.window;
+      track->rise->refs++;
+    }
+    track->last = values[ii];
+
+    if(!track->reported &&
+       values[ii] - track->low >= fuzz_drift_limits[ii]) {
+      track->reported = 1;
+      fuzz_drift_report((FUZZ_DRIFT_METRIC)ii, track, values[ii]);
+    }
+  }
+  g_drift.sampled = 1;
+
+  fuzz_drift_release_window(g_drift.window);
+  g_drift.window = fuzz_drift_new_window(g_drift.inputs);
+  if(g_drift.window == NULL) {
+    g_drift.enabled = 0;
+  }
+}
@@ -0,0 +1,64 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#ifndef CURL_FUZZER_DRIFT_H
+#define CURL_FUZZER_DRIFT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Opt-in cross-input resource drift monitor. Shared by the TLV fuzzers and
+ * curl_fuzzer_proto.
+ *
+ * Setting FUZZ_DRIFT=<N> samples the process's open fd count, RSS and
+ * libcurl's live allocation count (via the counting allocators in
+ * curl_fuzzer_alloc) after every N inputs. A metric that keeps growing
+ * without ever dropping back is reported once its growth passes the
+ * metric's limit, naming the window of N inputs in which the growth began.
+ *
+ * The inputs of that window are kept in memory. Setting FUZZ_DRIFT_ABORT to
+ * a directory writes them there as individual files when drift is reported
+ * and then aborts, so the window can be replayed to find the leak.
+ */
+
+/* Sampled metrics. */
+typedef enum fuzz_drift_metric {
+  FUZZ_DRIFT_FDS,                       /* open file descriptors */
+  FUZZ_DRIFT_RSS,                       /* resident set size in bytes */
+  FUZZ_DRIFT_ALLOCS,                    /* blocks libcurl holds */
+  FUZZ_DRIFT_NUM_METRICS
+} FUZZ_DRIFT_METRIC;
+
+/* Growth that counts as drift, per metric. */
+#define FUZZ_DRIFT_FD_LIMIT             16
+#define FUZZ_DRIFT_RSS_LIMIT            (256 * 1024 * 1024)
+#define FUZZ_DRIFT_ALLOC_LIMIT          100000
+
+/* Maximum bytes of input kept per window. Inputs past this are dropped from
+   the saved window (but still counted). */
+#define FUZZ_DRIFT_MAX_WINDOW_BYTES     (16 * 1024 * 1024)
+
+/* Function prototypes */
+int fuzz_drift_enabled(void);
+void fuzz_drift_end_input(const uint8_t *data, size_t size);
+
+#endif /* CURL_FUZZER_DRIFT_H */
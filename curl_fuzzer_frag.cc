@@ -0,0 +1,250 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include "curl_fuzzer_frag.h"
+
+typedef struct fuzz_frag_state
+{
+  /* Whether the environment has been checked, and what it said. */
+  int checked;
+  int enabled;
+  double slowdown_limit;
+
+  /* Plan the mock servers are currently following. */
+  FUZZ_FRAG_PLAN plan;
+
+} FUZZ_FRAG_STATE;
+
+static FUZZ_FRAG_STATE g_frag;
+
+static const char *fuzz_frag_plan_names[FUZZ_FRAG_NUM_PLANS] = {
+  "whole",
+  "bytes",
+  "prime",
+  "lines"
+};
+
+/**
+ * Check FUZZ_FRAGMENT.
+ */
+int fuzz_frag_enabled(void)
+{
+  const char *limit;
+
+  if(g_frag.checked) {
+    return g_frag.enabled;
+  }
+
+  g_frag.checked = 1;
+  limit = getenv("FUZZ_FRAGMENT");
+  if(limit == NULL || *limit == '\0') {
+    return 0;
+  }
+
+  g_frag.slowdown_limit = atof(limit);
+  if(g_frag.slowdown_limit <= 1.0) {
+    g_frag.slowdown_limit = FUZZ_FRAG_DEFAULT_SLOWDOWN;
+  }
+
+  g_frag.enabled = 1;
+  return 1;
+}
+
+double fuzz_frag_slowdown_limit(void)
+{
+  return fuzz_frag_enabled() ? g_frag.slowdown_limit : 0;
+}
+
+/**
+ * Choose how the mock servers split what they write from now on. The
+ * standalone runner sets this between inputs.
+ */
+void fuzz_frag_set_plan(FUZZ_FRAG_PLAN plan)
+{
+  g_frag.plan = plan;
+}
+
+FUZZ_FRAG_PLAN fuzz_frag_plan(void)
+{
+  return g_frag.plan;
+}
+
+const char *fuzz_frag_plan_name(FUZZ_FRAG_PLAN plan)
+{
+  return fuzz_frag_plan_names[plan];
+}
+
+/**
+ * Length of the next fragment of the queue under the current plan.
+ */
+static size_t fuzz_frag_next_len(const FUZZ_FRAG_QUEUE *queue)
+{
+  const uint8_t *next = queue->data + queue->sent;
+  size_t left = queue->len - queue->sent;
+  size_t ii;
+
+  /* Stop at the end of the write this fragment starts in. */
+  if(queue->next_end < queue->num_ends) {
+    left = queue->ends[queue->next_end] - queue->sent;
+  }
+
+  switch(g_frag.plan) {
+  case FUZZ_FRAG_BYTES:
+    return 1;
+
+  case FUZZ_FRAG_PRIME:
+    return left < FUZZ_FRAG_PRIME_SIZE ? left : FUZZ_FRAG_PRIME_SIZE;
+
+  case FUZZ_FRAG_LINES:
+    for(ii = 0; ii < left; ii++) {
+      if(next[ii] == '\r' || next[ii] == '\n') {
+        return ii + 1;
+      }
+    }
+    return left;
+
+  default:
+    return left;
+  }
+}
+
+/**
+ * Write data to a mock server socket. On a datagram socket, or under
+ * FUZZ_FRAG_WHOLE with nothing queued, this is a plain write; otherwise the
+ * data is queued behind anything already there and fuzz_frag_flush() hands
+ * it over. Returns 0 on success and -1 if the data couldn't be written (or
+ * queued).
+ */
+int fuzz_frag_write(FUZZ_FRAG_QUEUE *queue,
+                    int fd,
+                    const uint8_t *data,
+                    size_t len)
+{
+  uint8_t *new_data;
+  size_t *new_ends;
+  size_t new_cap;
+
+  if(queue->datagram ||
+     (g_frag.plan == FUZZ_FRAG_WHOLE && queue->sent == queue->len)) {
+    return write(fd, data, len) == (ssize_t)len ? 0 : -1;
+  }
+
+  if(queue->num_ends == queue->ends_cap) {
+    new_cap = queue->ends_cap ? queue->ends_cap * 2 : 16;
+    new_ends = (size_t *)realloc(queue->ends, new_cap * sizeof(size_t));
+    if(new_ends == NULL) {
+      return -1;
+    }
+    queue->ends = new_ends;
+    queue->ends_cap = new_cap;
+  }
+
+  if(queue->len + len > queue->cap) {
+    new_cap = queue->cap ? queue->cap : 4096;
+    while(new_cap < queue->len + len) {
+      new_cap *= 2;
+    }
+    new_data = (uint8_t *)realloc(queue->data, new_cap);
+    if(new_data == NULL) {
+      return -1;
+    }
+    queue->data = new_data;
+    queue->cap = new_cap;
+  }
+
+  memcpy(queue->data + queue->len, data, len);
+  queue->len += len;
+  queue->ends[queue->num_ends++] = queue->len;
+
+  fuzz_frag_flush(queue, fd);
+  return 0;
+}
+
+/**
+ * Shut down the write side of a mock server socket, once everything queued
+ * on it has been written.
+ */
+void fuzz_frag_shutdown(FUZZ_FRAG_QUEUE *queue, int fd)
+{
+  if(queue->sent == queue->len) {
+    shutdown(fd, SHUT_WR);
+  }
+  else {
+    queue->shutdown = 1;
+  }
+}
+
+/**
+ * Write the next fragment of the queue if curl has read everything written
+ * before it. Returns 1 if a fragment was written.
+ */
+int fuzz_frag_flush(FUZZ_FRAG_QUEUE *queue, int fd)
+{
+  ssize_t written;
+  int unread;
+
+  if(queue->sent == queue->len) {
+    return 0;
+  }
+
+  /* TIOCOUTQ counts what the peer hasn't read yet. Where it isn't supported
+     a fragment is written every time. */
+  if(ioctl(fd, TIOCOUTQ, &unread) == 0 && unread > 0) {
+    return 0;
+  }
+
+  written = write(fd, queue->data + queue->sent, fuzz_frag_next_len(queue));
+  if(written <= 0) {
+    return 0;
+  }
+  queue->sent += (size_t)written;
+  while(queue->next_end < queue->num_ends &&
+        queue->ends[queue->next_end] <= queue->sent) {
+    queue->next_end++;
+  }
+
+  if(queue->sent == queue->len) {
+    queue->sent = 0;
+    queue->len = 0;
+    queue->num_ends = 0;
+    queue->next_end = 0;
+    if(queue->shutdown) {
+      queue->shutdown = 0;
+      shutdown(fd, SHUT_WR);
+    }
+  }
+  return 1;
+}
+
+/**
+ * Drop anything left in the queue when its socket closes.
+ */
+void fuzz_frag_free(FUZZ_FRAG_QUEUE *queue)
+{
+  free(queue->data);
+  free(queue->ends);
+  memset(queue, 0, sizeof(*queue));
+}
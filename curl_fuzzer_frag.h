@@ -0,0 +1,102 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#ifndef CURL_FUZZER_FRAG_H
+#define CURL_FUZZER_FRAG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Fragmentation oracle. Shared by the TLV fuzzers, curl_fuzzer_proto and the
+ * standalone runner.
+ *
+ * The mock servers normally hand curl each response in a single write.
+ * Setting FUZZ_FRAGMENT makes the standalone runner replay every input once
+ * per fragmentation plan below. Under a plan other than FUZZ_FRAG_WHOLE the
+ * mock servers queue what they write and feed it to curl one fragment at a
+ * time, only writing the next fragment once curl has read the last.
+ *
+ * The bytes and headers curl delivers and each transfer's result must be the
+ * same however the response was split; the runner compares them with the
+ * unsplit run using the behaviour digest (curl_fuzzer_digest) and reports
+ * any difference. It also reports plans that make an input more than
+ * FUZZ_FRAGMENT=<factor> times slower than the unsplit run, or
+ * FUZZ_FRAG_DEFAULT_SLOWDOWN times if the value isn't a number above 1.
+ */
+
+/* Ways of splitting what the mock servers write. */
+typedef enum fuzz_frag_plan {
+  FUZZ_FRAG_WHOLE,                      /* each write in one piece */
+  FUZZ_FRAG_BYTES,                      /* one byte at a time */
+  FUZZ_FRAG_PRIME,                      /* FUZZ_FRAG_PRIME_SIZE at a time */
+  FUZZ_FRAG_LINES,                      /* split after every CR and LF */
+  FUZZ_FRAG_NUM_PLANS
+} FUZZ_FRAG_PLAN;
+
+/* Fragment size for FUZZ_FRAG_PRIME. Prime so that fragments don't line up
+   with any power-of-two buffer or field size. */
+#define FUZZ_FRAG_PRIME_SIZE            7
+
+/* Slowdown against the unsplit run that is reported if FUZZ_FRAGMENT
+   doesn't give a usable one. */
+#define FUZZ_FRAG_DEFAULT_SLOWDOWN      50.0
+
+/* Bytes a mock server has written that curl hasn't been handed yet. */
+typedef struct fuzz_frag_queue
+{
+  uint8_t *data;
+  size_t len;
+  size_t cap;
+
+  /* Bytes of data already written to the socket. */
+  size_t sent;
+
+  /* Where each queued write ends in data. A fragment never runs past the
+     next one, so separate writes (e.g. two responses) are never joined. */
+  size_t *ends;
+  size_t num_ends;
+  size_t ends_cap;
+  size_t next_end;
+
+  /* Whether to shut down the write side once everything has been sent. */
+  int shutdown;
+
+  /* Datagram sockets keep each write as one packet and are never split. */
+  int datagram;
+
+} FUZZ_FRAG_QUEUE;
+
+/* Function prototypes */
+int fuzz_frag_enabled(void);
+double fuzz_frag_slowdown_limit(void);
+void fuzz_frag_set_plan(FUZZ_FRAG_PLAN plan);
+FUZZ_FRAG_PLAN fuzz_frag_plan(void);
+const char *fuzz_frag_plan_name(FUZZ_FRAG_PLAN plan);
+int fuzz_frag_write(FUZZ_FRAG_QUEUE *queue,
+                    int fd,
+                    const uint8_t *data,
+                    size_t len);
+void fuzz_frag_shutdown(FUZZ_FRAG_QUEUE *queue, int fd);
+int fuzz_frag_flush(FUZZ_FRAG_QUEUE *queue, int fd);
+void fuzz_frag_free(FUZZ_FRAG_QUEUE *queue);
+
+#endif /* CURL_FUZZER_FRAG_H */
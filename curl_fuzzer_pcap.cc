@@ -0,0 +1,585 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "curl_fuzzer_pcap.h"
+
+/* pcapng block types and constants. */
+#define PCAPNG_BT_SHB                   0x0A0D0D0A
+#define PCAPNG_BT_IDB                   0x00000001
+#define PCAPNG_BT_EPB                   0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC         0x1A2B3C4D
+#define PCAPNG_OPT_ENDOFOPT             0
+#define PCAPNG_OPT_COMMENT              1
+#define PCAPNG_LINKTYPE_RAW             101
+
+/* Synthetic addresses. The server side matches the CURLOPT_CONNECT_TO
+   override both harnesses install. */
+#define FUZZ_PCAP_CLIENT_ADDR           0x7F000001      /* 127.0.0.1 */
+#define FUZZ_PCAP_SERVER_ADDR           0x7F01017F      /* 127.0.1.127 */
+#define FUZZ_PCAP_FIRST_CLIENT_PORT     32768
+#define FUZZ_PCAP_NUM_CLIENT_PORTS      28000
+
+/* IPv4 + TCP header bytes, and the largest payload a single IPv4 packet can
+   carry with them. */
+#define FUZZ_PCAP_HDR_LEN               40
+#define FUZZ_PCAP_MAX_SEGMENT           (65535 - FUZZ_PCAP_HDR_LEN)
+
+/* TCP flags. */
+#define FUZZ_TCP_FIN                    0x01
+#define FUZZ_TCP_SYN                    0x02
+#define FUZZ_TCP_PSH                    0x08
+#define FUZZ_TCP_ACK                    0x10
+
+/* Initial sequence numbers, indexed by FUZZ_PCAP_DIR. */
+#define FUZZ_PCAP_ISN_SERVER            0x50000000
+#define FUZZ_PCAP_ISN_CLIENT            0x10000000
+
+/* Default server port, picked so that Wireshark's port-based heuristics
+   dissect the stream without a "Decode As". The proto fuzzer covers every
+   scheme in one binary and sets the port per input with
+   fuzz_pcap_set_port() instead. */
+#if defined(FUZZ_PROTOCOLS_DICT)
+#define FUZZ_PCAP_DEFAULT_PORT          2628
+#elif defined(FUZZ_PROTOCOLS_FTP)
+#define FUZZ_PCAP_DEFAULT_PORT          21
+#elif defined(FUZZ_PROTOCOLS_GOPHER)
+#define FUZZ_PCAP_DEFAULT_PORT          70
+#elif defined(FUZZ_PROTOCOLS_HTTPS)
+#define FUZZ_PCAP_DEFAULT_PORT          443
+#elif defined(FUZZ_PROTOCOLS_IMAP)
+#define FUZZ_PCAP_DEFAULT_PORT          143
+#elif defined(FUZZ_PROTOCOLS_LDAP)
+#define FUZZ_PCAP_DEFAULT_PORT          389
+#elif defined(FUZZ_PROTOCOLS_MQTT)
+#define FUZZ_PCAP_DEFAULT_PORT          1883
+#elif defined(FUZZ_PROTOCOLS_POP3)
+#define FUZZ_PCAP_DEFAULT_PORT          110
+#elif defined(FUZZ_PROTOCOLS_RTSP)
+#define FUZZ_PCAP_DEFAULT_PORT          554
+#elif defined(FUZZ_PROTOCOLS_SMB)
+#define FUZZ_PCAP_DEFAULT_PORT          445
+#elif defined(FUZZ_PROTOCOLS_SMTP)
+#define FUZZ_PCAP_DEFAULT_PORT          25
+#elif defined(FUZZ_PROTOCOLS_TFTP)
+#define FUZZ_PCAP_DEFAULT_PORT          69
+#else
+#define FUZZ_PCAP_DEFAULT_PORT          80
+#endif
+
+typedef struct fuzz_pcap_stream
+{
+  /* Whether this slot is in use for the current input. */
+  int in_use;
+
+  /* Synthetic client port identifying the stream. */
+  uint16_t client_port;
+
+  /* Server port, fixed when the stream is opened. */
+  uint16_t server_port;
+
+  /* Next sequence number and FIN state, indexed by FUZZ_PCAP_DIR. */
+  uint32_t seq[2];
+  int fin_sent[2];
+
+} FUZZ_PCAP_STREAM;
+
+typedef struct fuzz_pcap_state
+{
+  /* -1 until the environment has been checked, then 0 (off) or 1 (on). */
+  int enabled;
+
+  /* Output file descriptor. Written with write(2) so the fatal-signal
+     handler can flush safely. */
+  int fd;
+
+  /* Per-input packet buffer. */
+  unsigned char *buf;
+  size_t buf_len;
+  size_t buf_cap;
+  int truncated;
+
+  /* Monotonic input counter and client port allocator. */
+  unsigned long input_index;
+  unsigned int next_port;
+
+  /* Server port given to new streams, and whether FUZZ_PCAP_PORT set it
+     (in which case fuzz_pcap_set_port() leaves it alone). */
+  uint16_t server_port;
+  int port_from_env;
+
+  /* Streams opened during the current input. */
+  FUZZ_PCAP_STREAM streams[FUZZ_PCAP_MAX_STREAMS];
+  int num_streams;
+
+} FUZZ_PCAP_STATE;
+
+static FUZZ_PCAP_STATE g_pcap = { -1, -1, NULL, 0, 0, 0, 0, 0, 0, 0, {}, 0 };
+
+/**
+ * Write the whole of a buffer to the capture file, retrying on short writes.
+ * Only uses async-signal-safe calls.
+ */
+static void fuzz_pcap_write_fd(const unsigned char *data, size_t len)
+{
+  while(len > 0) {
+    ssize_t n = write(g_pcap.fd, data, len);
+    if(n <= 0) {
+      return;
+    }
+    data += n;
+    len -= (size_t)n;
+  }
+}
+
+/**
+ * Push the buffered packets for the current input to disk.
+ */
+static void fuzz_pcap_flush(void)
+{
+  if(g_pcap.fd >= 0 && g_pcap.buf_len > 0) {
+    fuzz_pcap_write_fd(g_pcap.buf, g_pcap.buf_len);
+  }
+  g_pcap.buf_len = 0;
+}
+
+/**
+ * Fatal signal handler: flush the in-flight input so a crashing exchange
+ * still lands in the capture, then re-raise with the default disposition.
+ */
+static void fuzz_pcap_fatal_handler(int sig)
+{
+  fuzz_pcap_flush();
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+/**
+ * Install the fatal signal handler, but never on top of a handler someone
+ * else (a sanitizer runtime, libFuzzer) already owns.
+ */
+static void fuzz_pcap_install_signal(int sig)
+{
+  struct sigaction old_sa;
+  struct sigaction sa;
+
+  if(sigaction(sig, NULL, &old_sa) != 0 || old_sa.sa_handler != SIG_DFL) {
+    return;
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = fuzz_pcap_fatal_handler;
+  sigemptyset(&sa.sa_mask);
+  sigaction(sig, &sa, NULL);
+}
+
+/**
+ * Make sure there's room for another len bytes in the packet buffer.
+ * Returns 0 on success; once the per-input cap is hit further packets for
+ * the input are dropped.
+ */
+static int fuzz_pcap_reserve(size_t len)
+{
+  size_t new_cap;
+  unsigned char *new_buf;
+
+  if(g_pcap.buf_len + len > FUZZ_PCAP_MAX_BUFFER) {
+    g_pcap.truncated = 1;
+    return -1;
+  }
+
+  if(g_pcap.buf_len + len <= g_pcap.buf_cap) {
+    return 0;
+  }
+
+  new_cap = g_pcap.buf_cap ? g_pcap.buf_cap : 65536;
+  while(new_cap < g_pcap.buf_len + len) {
+    new_cap *= 2;
+  }
+
+  new_buf = (unsigned char *)realloc(g_pcap.buf, new_cap);
+  if(new_buf == NULL) {
+    g_pcap.truncated = 1;
+    return -1;
+  }
+
+  g_pcap.buf = new_buf;
+  g_pcap.buf_cap = new_cap;
+  return 0;
+}
+
+static void fuzz_pcap_put_u16(uint16_t v)
+{
+  memcpy(&g_pcap.buf[g_pcap.buf_len], &v, sizeof(v));
+  g_pcap.buf_len += sizeof(v);
+}
+
+static void fuzz_pcap_put_u32(uint32_t v)
+{
+  memcpy(&g_pcap.buf[g_pcap.buf_len], &v, sizeof(v));
+  g_pcap.buf_len += sizeof(v);
+}
+
+static void fuzz_pcap_put_bytes(const void *data, size_t len)
+{
+  memcpy(&g_pcap.buf[g_pcap.buf_len], data, len);
+  g_pcap.buf_len += len;
+}
+
+static void fuzz_pcap_put_pad(size_t len)
+{
+  while(len % 4) {
+    g_pcap.buf[g_pcap.buf_len++] = 0;
+    len++;
+  }
+}
+
+/**
+ * Store a 16 or 32 bit value in network byte order.
+ */
+static void fuzz_pcap_be16(uint8_t *p, uint16_t v)
+{
+  p[0] = (uint8_t)(v >> 8);
+  p[1] = (uint8_t)v;
+}
+
+static void fuzz_pcap_be32(uint8_t *p, uint32_t v)
+{
+  p[0] = (uint8_t)(v >> 24);
+  p[1] = (uint8_t)(v >> 16);
+  p[2] = (uint8_t)(v >> 8);
+  p[3] = (uint8_t)v;
+}
+
+/**
+ * Write the section header and interface description blocks. Done once
+ * when the capture file is created.
+ */
+static void fuzz_pcap_write_file_header(void)
+{
+  uint32_t shb[7];
+  uint32_t idb[5];
+  uint64_t section_len = UINT64_MAX;
+
+  shb[0] = PCAPNG_BT_SHB;
+  shb[1] = sizeof(shb);
+  shb[2] = PCAPNG_BYTE_ORDER_MAGIC;
+  shb[3] = 1;                           /* major 1, minor 0 */
+  memcpy(&shb[4], &section_len, sizeof(section_len));
+  shb[6] = sizeof(shb);
+
+  idb[0] = PCAPNG_BT_IDB;
+  idb[1] = sizeof(idb);
+  idb[2] = PCAPNG_LINKTYPE_RAW;         /* linktype, reserved = 0 */
+  idb[3] = 0;                           /* no snaplen limit */
+  idb[4] = sizeof(idb);
+
+  fuzz_pcap_write_fd((const unsigned char *)shb, sizeof(shb));
+  fuzz_pcap_write_fd((const unsigned char *)idb, sizeof(idb));
+}
+
+/**
+ * Check FUZZ_PCAP and, the first time through, open the capture file.
+ */
+int fuzz_pcap_enabled(void)
+{
+  const char *path;
+  const char *port;
+
+  if(g_pcap.enabled >= 0) {
+    return g_pcap.enabled;
+  }
+
+  g_pcap.enabled = 0;
+  path = getenv("FUZZ_PCAP");
+  if(path == NULL || *path == '\0') {
+    return 0;
+  }
+
+  g_pcap.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(g_pcap.fd < 0) {
+    fprintf(stderr, "FUZZ: cannot open FUZZ_PCAP file %s\n", path);
+    return 0;
+  }
+
+  g_pcap.server_port = FUZZ_PCAP_DEFAULT_PORT;
+  port = getenv("FUZZ_PCAP_PORT");
+  if(port != NULL && atoi(port) > 0 && atoi(port) <= 65535) {
+    g_pcap.server_port = (uint16_t)atoi(port);
+    g_pcap.port_from_env = 1;
+  }
+
+  fuzz_pcap_write_file_header();
+
+  atexit(fuzz_pcap_flush);
+  fuzz_pcap_install_signal(SIGABRT);
+  fuzz_pcap_install_signal(SIGSEGV);
+  fuzz_pcap_install_signal(SIGBUS);
+
+  g_pcap.enabled = 1;
+  return 1;
+}
+
+/**
+ * Append one enhanced packet block carrying a synthetic IPv4/TCP segment.
+ */
+static void fuzz_pcap_emit(FUZZ_PCAP_STREAM *s,
+                           FUZZ_PCAP_DIR dir,
+                           uint8_t flags,
+                           const unsigned char *data,
+                           size_t len,
+                           const char *comment)
+{
+  uint8_t hdr[FUZZ_PCAP_HDR_LEN];
+  size_t pkt_len = FUZZ_PCAP_HDR_LEN + len;
+  size_t pkt_padded = (pkt_len + 3) & ~(size_t)3;
+  size_t comment_len = comment ? strlen(comment) : 0;
+  size_t comment_padded = (comment_len + 3) & ~(size_t)3;
+  size_t opts_len = comment ? 4 + comment_padded + 4 : 0;
+  size_t block_len = 28 + pkt_padded + opts_len + 4;
+  int to_client = (dir == FUZZ_PCAP_TO_CLIENT);
+  uint32_t src = to_client ? FUZZ_PCAP_SERVER_ADDR : FUZZ_PCAP_CLIENT_ADDR;
+  uint32_t dst = to_client ? FUZZ_PCAP_CLIENT_ADDR : FUZZ_PCAP_SERVER_ADDR;
+  uint16_t sport = to_client ? s->server_port : s->client_port;
+  uint16_t dport = to_client ? s->client_port : s->server_port;
+  uint32_t ack = (flags & FUZZ_TCP_ACK) ? s->seq[!dir] : 0;
+  uint32_t csum = 0;
+  struct timeval tv;
+  uint64_t ts;
+  int ii;
+
+  if(fuzz_pcap_reserve(block_len) != 0) {
+    return;
+  }
+
+  /* IPv4 header. */
+  memset(hdr, 0, sizeof(hdr));
+  hdr[0] = 0x45;
+  fuzz_pcap_be16(&hdr[2], (uint16_t)pkt_len);
+  fuzz_pcap_be16(&hdr[6], 0x4000);      /* don't fragment */
+  hdr[8] = 64;
+  hdr[9] = 6;                           /* TCP */
+  fuzz_pcap_be32(&hdr[12], src);
+  fuzz_pcap_be32(&hdr[16], dst);
+  for(ii = 0; ii < 20; ii += 2) {
+    csum += (uint32_t)((hdr[ii] << 8) | hdr[ii + 1]);
+  }
+  while(csum >> 16) {
+    csum = (csum & 0xFFFF) + (csum >> 16);
+  }
+  fuzz_pcap_be16(&hdr[10], (uint16_t)~csum);
+
+  /* TCP header. The checksum is left at zero; Wireshark doesn't validate it
+     by default. */
+  fuzz_pcap_be16(&hdr[20], sport);
+  fuzz_pcap_be16(&hdr[22], dport);
+  fuzz_pcap_be32(&hdr[24], s->seq[dir]);
+  fuzz_pcap_be32(&hdr[28], ack);
+  hdr[32] = 5 << 4;
+  hdr[33] = flags;
+  fuzz_pcap_be16(&hdr[34], 65535);
+
+  gettimeofday(&tv, NULL);
+  ts = (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_usec;
+
+  fuzz_pcap_put_u32(PCAPNG_BT_EPB);
+  fuzz_pcap_put_u32((uint32_t)block_len);
+  fuzz_pcap_put_u32(0);                 /* interface ID */
+  fuzz_pcap_put_u32((uint32_t)(ts >> 32));
+  fuzz_pcap_put_u32((uint32_t)ts);
+  fuzz_pcap_put_u32((uint32_t)pkt_len);
+  fuzz_pcap_put_u32((uint32_t)pkt_len);
+  fuzz_pcap_put_bytes(hdr, sizeof(hdr));
+  if(len > 0) {
+    fuzz_pcap_put_bytes(data, len);
+  }
+  fuzz_pcap_put_pad(pkt_len);
+  if(comment) {
+    fuzz_pcap_put_u16(PCAPNG_OPT_COMMENT);
+    fuzz_pcap_put_u16((uint16_t)comment_len);
+    fuzz_pcap_put_bytes(comment, comment_len);
+    fuzz_pcap_put_pad(comment_len);
+    fuzz_pcap_put_u16(PCAPNG_OPT_ENDOFOPT);
+    fuzz_pcap_put_u16(0);
+  }
+  fuzz_pcap_put_u32((uint32_t)block_len);
+
+  s->seq[dir] += (uint32_t)len;
+  if(flags & (FUZZ_TCP_SYN | FUZZ_TCP_FIN)) {
+    s->seq[dir]++;
+  }
+}
+
+/**
+ * Set the server port of streams opened from now on, so a fuzzer that isn't
+ * built for one protocol can still label each input's traffic with the
+ * port Wireshark expects. FUZZ_PCAP_PORT, when set, takes precedence.
+ */
+void fuzz_pcap_set_port(uint16_t port)
+{
+  if(!fuzz_pcap_enabled() || g_pcap.port_from_env || port == 0) {
+    return;
+  }
+  g_pcap.server_port = port;
+}
+
+/**
+ * Start recording a new mock connection. Emits a three-way handshake so
+ * Wireshark's stream tracking works. Returns the stream ID to pass to the
+ * other functions, or FUZZ_PCAP_NO_STREAM.
+ */
+int fuzz_pcap_open_stream(void)
+{
+  FUZZ_PCAP_STREAM *s;
+  char comment[64];
+  int stream;
+
+  if(!fuzz_pcap_enabled() || g_pcap.num_streams >= FUZZ_PCAP_MAX_STREAMS) {
+    return FUZZ_PCAP_NO_STREAM;
+  }
+
+  stream = g_pcap.num_streams++;
+  s = &g_pcap.streams[stream];
+  memset(s, 0, sizeof(*s));
+  s->in_use = 1;
+  s->client_port = (uint16_t)(FUZZ_PCAP_FIRST_CLIENT_PORT +
+                              g_pcap.next_port++ % FUZZ_PCAP_NUM_CLIENT_PORTS);
+  s->server_port = g_pcap.server_port;
+  s->seq[FUZZ_PCAP_TO_CLIENT] = FUZZ_PCAP_ISN_SERVER;
+  s->seq[FUZZ_PCAP_TO_SERVER] = FUZZ_PCAP_ISN_CLIENT;
+
+  snprintf(comment, sizeof(comment), "input %lu stream %d",
+           g_pcap.input_index, stream);
+  fuzz_pcap_emit(s, FUZZ_PCAP_TO_SERVER, FUZZ_TCP_SYN, NULL, 0, comment);
+  fuzz_pcap_emit(s, FUZZ_PCAP_TO_CLIENT, FUZZ_TCP_SYN | FUZZ_TCP_ACK,
+                 NULL, 0, NULL);
+  fuzz_pcap_emit(s, FUZZ_PCAP_TO_SERVER, FUZZ_TCP_ACK, NULL, 0, NULL);
+
+  return stream;
+}
+
+/**
+ * Record bytes moving across a mock connection.
+ */
+void fuzz_pcap_record(int stream,
+                      FUZZ_PCAP_DIR dir,
+                      const void *data,
+                      size_t len)
+{
+  const unsigned char *p = (const unsigned char *)data;
+  FUZZ_PCAP_STREAM *s;
+  size_t seg;
+
+  if(stream < 0 || stream >= g_pcap.num_streams || len == 0) {
+    return;
+  }
+
+  s = &g_pcap.streams[stream];
+  if(!s->in_use || s->fin_sent[dir]) {
+    return;
+  }
+
+  while(len > 0) {
+    seg = len > FUZZ_PCAP_MAX_SEGMENT ? FUZZ_PCAP_MAX_SEGMENT : len;
+    fuzz_pcap_emit(s, dir, FUZZ_TCP_PSH | FUZZ_TCP_ACK, p, seg, NULL);
+    p += seg;
+    len -= seg;
+  }
+}
+
+/**
+ * Record a half-close in the given direction.
+ */
+void fuzz_pcap_close_stream(int stream, FUZZ_PCAP_DIR dir)
+{
+  FUZZ_PCAP_STREAM *s;
+
+  if(stream < 0 || stream >= g_pcap.num_streams) {
+    return;
+  }
+
+  s = &g_pcap.streams[stream];
+  if(!s->in_use || s->fin_sent[dir]) {
+    return;
+  }
+
+  fuzz_pcap_emit(s, dir, FUZZ_TCP_FIN | FUZZ_TCP_ACK, NULL, 0, NULL);
+  s->fin_sent[dir] = 1;
+}
+
+/**
+ * Close any streams still open, flush the input's packets to disk and
+ * reset per-input state. Call once at the end of every input.
+ */
+void fuzz_pcap_end_input(void)
+{
+  int ii;
+
+  if(g_pcap.enabled != 1) {
+    return;
+  }
+
+  for(ii = 0; ii < g_pcap.num_streams; ii++) {
+    fuzz_pcap_close_stream(ii, FUZZ_PCAP_TO_CLIENT);
+    fuzz_pcap_close_stream(ii, FUZZ_PCAP_TO_SERVER);
+    g_pcap.streams[ii].in_use = 0;
+  }
+
+  if(g_pcap.truncated) {
+    fprintf(stderr,
+            "FUZZ: pcap for input %lu truncated at %d bytes\n",
+            g_pcap.input_index,
+            FUZZ_PCAP_MAX_BUFFER);
+  }
+
+  fuzz_pcap_flush();
+  g_pcap.num_streams = 0;
+  g_pcap.truncated = 0;
+  g_pcap.input_index++;
+}
+
+/**
+ * Drop the input's packets without writing them or counting the input.
+ * For runs that are not inputs of their own, such as complexity probes.
+ */
+void fuzz_pcap_discard_input(void)
+{
+  int ii;
+
+  if(g_pcap.enabled != 1) {
+    return;
+  }
+
+  for(ii = 0; ii < g_pcap.num_streams; ii++) {
+    g_pcap.streams[ii].in_use = 0;
+  }
+
+  g_pcap.buf_len = 0;
+  g_pcap.num_streams = 0;
+  g_pcap.truncated = 0;
+}
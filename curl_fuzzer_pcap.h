@@ -0,0 +1,69 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#ifndef CURL_FUZZER_PCAP_H
+#define CURL_FUZZER_PCAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Opt-in pcapng capture of the bytes exchanged between curl and the mock
+ * servers. Shared by the TLV fuzzers and curl_fuzzer_proto.
+ *
+ * Setting FUZZ_PCAP=<path> enables capture. Every mock connection becomes
+ * a synthetic TCP stream (client 127.0.0.1:<ephemeral> to server
+ * 127.0.1.127:<protocol port>) with a SYN handshake, one segment per read or
+ * write and a FIN when the mock half-closes. Packets are buffered in memory
+ * and appended to the file once per input, so whole-corpus replays end up
+ * in a single capture with one set of streams per input.
+ *
+ * When capture is disabled every entry point is a single branch.
+ */
+
+/* Direction of a captured segment. */
+typedef enum fuzz_pcap_dir {
+  FUZZ_PCAP_TO_CLIENT,            /* mock server -> curl */
+  FUZZ_PCAP_TO_SERVER             /* curl -> mock server */
+} FUZZ_PCAP_DIR;
+
+/* Stream ID returned when capture is off or the stream table is full. */
+#define FUZZ_PCAP_NO_STREAM             -1
+
+/* Maximum number of connections recorded per input. */
+#define FUZZ_PCAP_MAX_STREAMS           16
+
+/* Maximum number of capture bytes buffered per input (64MB). */
+#define FUZZ_PCAP_MAX_BUFFER            (64 * 1024 * 1024)
+
+/* Function prototypes */
+int fuzz_pcap_enabled(void);
+void fuzz_pcap_set_port(uint16_t port);
+int fuzz_pcap_open_stream(void);
+void fuzz_pcap_record(int stream,
+                      FUZZ_PCAP_DIR dir,
+                      const void *data,
+                      size_t len);
+void fuzz_pcap_close_stream(int stream, FUZZ_PCAP_DIR dir);
+void fuzz_pcap_end_input(void);
+void fuzz_pcap_discard_input(void);
+
+#endif /* CURL_FUZZER_PCAP_H */
@@ -0,0 +1,172 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "curl_fuzzer_perf.h"
+
+/* Layout of a read() from the group leader with PERF_FORMAT_GROUP. */
+typedef struct fuzz_perf_group_read
+{
+  uint64_t nr;
+  uint64_t values[2];
+
+} FUZZ_PERF_GROUP_READ;
+
+typedef struct fuzz_perf_state
+{
+  /* Whether the environment has been checked, and what it said. */
+  int checked;
+  FUZZ_PERF_SOURCE source;
+
+  /* Instruction counter (group leader) and cycle counter. */
+  int instructions_fd;
+  int cycles_fd;
+
+} FUZZ_PERF_STATE;
+
+static FUZZ_PERF_STATE g_perf;
+
+static int fuzz_perf_open(uint64_t config, int group_fd)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.read_format = PERF_FORMAT_GROUP;
+  attr.disabled = (group_fd == -1);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+/**
+ * Open the counters as a group, so both are scheduled onto the PMU together.
+ * Returns 0 on success.
+ */
+static int fuzz_perf_open_counters(void)
+{
+  g_perf.instructions_fd = fuzz_perf_open(PERF_COUNT_HW_INSTRUCTIONS, -1);
+  if(g_perf.instructions_fd == -1) {
+    return -1;
+  }
+
+  g_perf.cycles_fd = fuzz_perf_open(PERF_COUNT_HW_CPU_CYCLES,
+                                    g_perf.instructions_fd);
+  if(g_perf.cycles_fd == -1) {
+    close(g_perf.instructions_fd);
+    return -1;
+  }
+
+  ioctl(g_perf.instructions_fd, PERF_EVENT_IOC_ENABLE,
+        PERF_IOC_FLAG_GROUP);
+  return 0;
+}
+
+/**
+ * Check FUZZ_PERF and open the counters the first time through.
+ */
+FUZZ_PERF_SOURCE fuzz_perf_source(void)
+{
+  const char *mode;
+
+  if(g_perf.checked) {
+    return g_perf.source;
+  }
+
+  g_perf.checked = 1;
+  g_perf.instructions_fd = -1;
+  g_perf.cycles_fd = -1;
+
+  mode = getenv("FUZZ_PERF");
+  if(mode == NULL || *mode == '\0') {
+    g_perf.source = FUZZ_PERF_NONE;
+  }
+  else if(strcmp(mode, "rusage") != 0 && fuzz_perf_open_counters() == 0) {
+    g_perf.source = FUZZ_PERF_COUNTERS;
+  }
+  else {
+    if(strcmp(mode, "rusage") != 0) {
+      fprintf(stderr,
+              "FUZZ: perf: hardware counters unavailable, using "
+              "getrusage() CPU time\n");
+    }
+    g_perf.source = FUZZ_PERF_RUSAGE;
+  }
+
+  return g_perf.source;
+}
+
+/**
+ * Take a reading. Leaves the sample zeroed if FUZZ_PERF is unset.
+ */
+void fuzz_perf_read(FUZZ_PERF_SAMPLE *sample)
+{
+  FUZZ_PERF_GROUP_READ group;
+  struct rusage usage;
+
+  memset(sample, 0, sizeof(*sample));
+
+  if(fuzz_perf_source() == FUZZ_PERF_NONE) {
+    return;
+  }
+
+  if(g_perf.source == FUZZ_PERF_COUNTERS &&
+     read(g_perf.instructions_fd, &group, sizeof(group)) ==
+       (ssize_t)sizeof(group)) {
+    sample->instructions = group.values[0];
+    sample->cycles = group.values[1];
+  }
+
+  if(getrusage(RUSAGE_SELF, &usage) == 0) {
+    sample->cpu_ns =
+      ((uint64_t)usage.ru_utime.tv_sec + (uint64_t)usage.ru_stime.tv_sec) *
+        1000000000ULL +
+      ((uint64_t)usage.ru_utime.tv_usec + (uint64_t)usage.ru_stime.tv_usec) *
+        1000ULL;
+  }
+}
+
+/**
+ * Cost between two samples, in fuzz_perf_cost_unit() units.
+ */
+uint64_t fuzz_perf_cost(const FUZZ_PERF_SAMPLE *start,
+                        const FUZZ_PERF_SAMPLE *end)
+{
+  if(g_perf.source == FUZZ_PERF_COUNTERS) {
+    return end->instructions - start->instructions;
+  }
+  return end->cpu_ns - start->cpu_ns;
+}
+
+const char *fuzz_perf_cost_unit(void)
+{
+  return g_perf.source == FUZZ_PERF_COUNTERS ? "insns" : "cpu_ns";
+}
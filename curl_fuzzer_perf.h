@@ -0,0 +1,66 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#ifndef CURL_FUZZER_PERF_H
+#define CURL_FUZZER_PERF_H
+
+#include <stdint.h>
+
+/**
+ * Opt-in per-input cost counters that are stable across machines. Shared by
+ * the TLV fuzzers, curl_fuzzer_proto and the standalone runner.
+ *
+ * Setting FUZZ_PERF (to anything) opens user-space retired-instruction and
+ * cycle counters for the fuzzing thread with perf_event_open(). Where that
+ * isn't allowed (most containers, perf_event_paranoid > 2) it falls back to
+ * CPU time from getrusage(); FUZZ_PERF=rusage forces the fallback.
+ *
+ * Consumers take a sample before and after an input and ask for the cost
+ * between them: retired instructions when the counters are available, CPU
+ * nanoseconds otherwise. FUZZ_STATS ranks TLV types and options by it, and
+ * the standalone runner lists the most expensive inputs it replayed.
+ */
+
+/* Where the numbers come from. */
+typedef enum fuzz_perf_source {
+  FUZZ_PERF_NONE,                       /* FUZZ_PERF unset */
+  FUZZ_PERF_COUNTERS,                   /* perf_event_open() */
+  FUZZ_PERF_RUSAGE                      /* getrusage() CPU time only */
+} FUZZ_PERF_SOURCE;
+
+/* A reading of the counters. instructions and cycles stay 0 without
+   FUZZ_PERF_COUNTERS. */
+typedef struct fuzz_perf_sample
+{
+  uint64_t instructions;
+  uint64_t cycles;
+  uint64_t cpu_ns;
+
+} FUZZ_PERF_SAMPLE;
+
+/* Function prototypes */
+FUZZ_PERF_SOURCE fuzz_perf_source(void);
+void fuzz_perf_read(FUZZ_PERF_SAMPLE *sample);
+uint64_t fuzz_perf_cost(const FUZZ_PERF_SAMPLE *start,
+                        const FUZZ_PERF_SAMPLE *end);
+const char *fuzz_perf_cost_unit(void);
+
+#endif /* CURL_FUZZER_PERF_H */
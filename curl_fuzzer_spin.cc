@@ -0,0 +1,204 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "curl_fuzzer_spin.h"
+
+/* One wakeup, as recorded for the trace. */
+typedef struct fuzz_spin_wakeup
+{
+  uint64_t index;
+  long timeout_ms;
+  int still_running;
+  uint64_t bytes;
+
+} FUZZ_SPIN_WAKEUP;
+
+typedef struct fuzz_spin_state
+{
+  /* Whether the environment has been checked, and what it said. */
+  int checked;
+  int enabled;
+
+  /* Busy wakeups per KiB moved above which an input is reported. */
+  double ratio;
+
+  /* Current input. */
+  uint64_t wakeups;
+  uint64_t zero_timeouts;
+  uint64_t bytes;
+  FUZZ_SPIN_WAKEUP trace[FUZZ_SPIN_TRACE_LEN];
+
+  /* Totals across inputs. */
+  uint64_t inputs;
+  double worst_ratio;
+  uint64_t worst_zero_timeouts;
+
+} FUZZ_SPIN_STATE;
+
+static FUZZ_SPIN_STATE g_spin;
+
+static void fuzz_spin_dump(void)
+{
+  fprintf(stderr,
+          "FUZZ: spin: %" PRIu64 " inputs, worst %.1f busy wakeups/KiB (%"
+          PRIu64 " busy wakeups)\n",
+          g_spin.inputs,
+          g_spin.worst_ratio,
+          g_spin.worst_zero_timeouts);
+}
+
+/**
+ * Check FUZZ_SPIN.
+ */
+int fuzz_spin_enabled(void)
+{
+  const char *ratio;
+
+  if(g_spin.checked) {
+    return g_spin.enabled;
+  }
+
+  g_spin.checked = 1;
+  ratio = getenv("FUZZ_SPIN");
+  if(ratio == NULL || atof(ratio) <= 0) {
+    return 0;
+  }
+
+  g_spin.ratio = atof(ratio);
+  atexit(fuzz_spin_dump);
+
+  g_spin.enabled = 1;
+  return 1;
+}
+
+void fuzz_spin_begin_input(void)
+{
+  if(!fuzz_spin_enabled()) {
+    return;
+  }
+
+  g_spin.wakeups = 0;
+  g_spin.zero_timeouts = 0;
+  g_spin.bytes = 0;
+}
+
+/**
+ * Record a curl_multi_perform() call, and whether curl wants to be called
+ * again straight away.
+ */
+void fuzz_spin_note_perform(CURLM *multi, int still_running)
+{
+  FUZZ_SPIN_WAKEUP *wakeup;
+  long timeout_ms = -1;
+
+  if(!g_spin.enabled) {
+    return;
+  }
+
+  if(still_running) {
+    curl_multi_timeout(multi, &timeout_ms);
+    if(timeout_ms == 0) {
+      g_spin.zero_timeouts++;
+    }
+  }
+
+  wakeup = &g_spin.trace[g_spin.wakeups % FUZZ_SPIN_TRACE_LEN];
+  wakeup->index = g_spin.wakeups;
+  wakeup->timeout_ms = timeout_ms;
+  wakeup->still_running = still_running;
+  wakeup->bytes = g_spin.bytes;
+
+  g_spin.wakeups++;
+}
+
+/**
+ * Record bytes moved between curl and the mock server.
+ */
+void fuzz_spin_note_bytes(size_t len)
+{
+  if(!g_spin.enabled) {
+    return;
+  }
+  g_spin.bytes += len;
+}
+
+static void fuzz_spin_report(double ratio)
+{
+  FUZZ_SPIN_WAKEUP *wakeup;
+  uint64_t first;
+  uint64_t ii;
+
+  fprintf(stderr,
+          "FUZZ: spin: %" PRIu64 " wakeups (%" PRIu64 " with zero timeout)"
+          " moved %" PRIu64 " bytes: %.1f busy wakeups/KiB (limit %.1f)\n",
+          g_spin.wakeups,
+          g_spin.zero_timeouts,
+          g_spin.bytes,
+          ratio,
+          g_spin.ratio);
+
+  first = g_spin.wakeups > FUZZ_SPIN_TRACE_LEN ?
+          g_spin.wakeups - FUZZ_SPIN_TRACE_LEN : 0;
+  for(ii = first; ii < g_spin.wakeups; ii++) {
+    wakeup = &g_spin.trace[ii % FUZZ_SPIN_TRACE_LEN];
+    fprintf(stderr,
+            "FUZZ: spin:   wakeup %6" PRIu64 " timeout %5ld ms running %d"
+            " bytes %" PRIu64 "\n",
+            wakeup->index,
+            wakeup->timeout_ms,
+            wakeup->still_running,
+            wakeup->bytes);
+  }
+}
+
+/**
+ * Check the input's busy wakeups against the bytes it moved. Wakeups where
+ * curl had a timer of its own pending are the harness polling an idle
+ * transfer, not curl spinning, so they don't count.
+ */
+void fuzz_spin_end_input(void)
+{
+  double ratio;
+
+  if(!g_spin.enabled) {
+    return;
+  }
+
+  /* An input that moved nothing counts as having moved one byte. */
+  ratio = (double)g_spin.zero_timeouts * 1024 /
+          (g_spin.bytes ? g_spin.bytes : 1);
+
+  g_spin.inputs++;
+  if(g_spin.zero_timeouts >= FUZZ_SPIN_MIN_WAKEUPS &&
+     ratio > g_spin.worst_ratio) {
+    g_spin.worst_ratio = ratio;
+    g_spin.worst_zero_timeouts = g_spin.zero_timeouts;
+  }
+
+  if(g_spin.zero_timeouts >= FUZZ_SPIN_MIN_WAKEUPS && ratio > g_spin.ratio) {
+    fuzz_spin_report(ratio);
+    abort();
+  }
+}
@@ -0,0 +1,57 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#ifndef CURL_FUZZER_SPIN_H
+#define CURL_FUZZER_SPIN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <curl/curl.h>
+
+/**
+ * Opt-in busy-loop detector for the perform loops. Shared by the TLV fuzzers
+ * and curl_fuzzer_proto.
+ *
+ * Setting FUZZ_SPIN=<ratio> counts, per input, the curl_multi_perform()
+ * calls the harness makes (wakeups), how many of them left
+ * curl_multi_timeout() at 0 (busy wakeups, where curl wants to be called
+ * straight back), and the bytes the mock server moved in either direction.
+ * Wakeups on the harness's poll interval, with curl waiting on a timer of
+ * its own, are idle rather than busy. An input with at least
+ * FUZZ_SPIN_MIN_WAKEUPS busy wakeups and more than <ratio> of them per KiB
+ * moved is reported with a trace of its last wakeups, and the harness
+ * aborts so the fuzzer keeps it.
+ */
+
+/* Inputs with fewer busy wakeups than this are never reported. */
+#define FUZZ_SPIN_MIN_WAKEUPS           100
+
+/* Number of wakeups kept for the trace. */
+#define FUZZ_SPIN_TRACE_LEN             32
+
+/* Function prototypes */
+int fuzz_spin_enabled(void);
+void fuzz_spin_begin_input(void);
+void fuzz_spin_note_perform(CURLM *multi, int still_running);
+void fuzz_spin_note_bytes(size_t len);
+void fuzz_spin_end_input(void);
+
+#endif /* CURL_FUZZER_SPIN_H */
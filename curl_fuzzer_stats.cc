@@ -0,0 +1,461 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <curl/curl.h>
+#include "curl_fuzzer_perf.h"
+#include "curl_fuzzer_stats.h"
+
+/* Marker for an empty key table slot. */
+#define FUZZ_STATS_EMPTY_KEY            0xFFFFFFFFu
+
+typedef struct fuzz_stats_key
+{
+  /* Key value, or FUZZ_STATS_EMPTY_KEY. */
+  unsigned int key;
+
+  /* Inputs that used this key, and how many of them were rejected. */
+  uint64_t inputs;
+  uint64_t rejected;
+
+  /* Inputs rejected with this key as the culprit, per reason. */
+  uint64_t culprit[FUZZ_STATS_NUM_REASONS];
+
+  /* Ignored curl_easy_setopt failures. */
+  uint64_t setopt_failed;
+
+  /* Total wall time and FUZZ_PERF cost of the inputs that used this key. */
+  uint64_t total_ns;
+  uint64_t total_cost;
+
+} FUZZ_STATS_KEY;
+
+typedef struct fuzz_stats_state
+{
+  /* Whether the environment has been checked, and what it said. */
+  int checked;
+  int enabled;
+
+  /* Output path; "-" means stderr. */
+  const char *path;
+
+  /* Totals. */
+  uint64_t inputs;
+  uint64_t reasons[FUZZ_STATS_NUM_REASONS];
+  uint64_t reason_ns[FUZZ_STATS_NUM_REASONS];
+  uint64_t reason_cost[FUZZ_STATS_NUM_REASONS];
+  uint64_t setopt_failed;
+
+  /* Per-key tables, open addressed, indexed by FUZZ_STATS_DOMAIN. */
+  FUZZ_STATS_KEY keys[FUZZ_STATS_NUM_DOMAINS][FUZZ_STATS_MAX_KEYS];
+
+  /* Current input. */
+  struct timespec start;
+  FUZZ_PERF_SAMPLE perf_start;
+  FUZZ_STATS_REASON reason;
+  FUZZ_STATS_KEY *culprit;
+  FUZZ_STATS_KEY *input_keys[FUZZ_STATS_MAX_INPUT_KEYS];
+  int num_input_keys;
+
+} FUZZ_STATS_STATE;
+
+static FUZZ_STATS_STATE g_stats;
+static volatile sig_atomic_t g_stats_dump_requested;
+
+static const char *fuzz_stats_reason_names[FUZZ_STATS_NUM_REASONS] = {
+  "accepted",
+  "too_short",
+  "tlv_length",
+  "unknown_tlv",
+  "duplicate_option",
+  "tlv_limit",
+  "invalid_tlv",
+  "no_scheme",
+  "no_host_path",
+  "setup"
+};
+
+/**
+ * SIGUSR1 handler: ask for a report at the end of the current input.
+ */
+static void fuzz_stats_usr1_handler(int sig)
+{
+  (void)sig;
+  g_stats_dump_requested = 1;
+}
+
+/**
+ * Check FUZZ_STATS and, the first time through, set up the dump hooks.
+ */
+int fuzz_stats_enabled(void)
+{
+  struct sigaction old_sa;
+  struct sigaction sa;
+  int ii;
+  int jj;
+
+  if(g_stats.checked) {
+    return g_stats.enabled;
+  }
+
+  g_stats.checked = 1;
+  g_stats.path = getenv("FUZZ_STATS");
+  if(g_stats.path == NULL || *g_stats.path == '\0') {
+    return 0;
+  }
+
+  for(ii = 0; ii < FUZZ_STATS_NUM_DOMAINS; ii++) {
+    for(jj = 0; jj < FUZZ_STATS_MAX_KEYS; jj++) {
+      g_stats.keys[ii][jj].key = FUZZ_STATS_EMPTY_KEY;
+    }
+  }
+
+  atexit(fuzz_stats_dump);
+
+  /* Don't take SIGUSR1 from anyone who already handles it. */
+  if(sigaction(SIGUSR1, NULL, &old_sa) == 0 &&
+     old_sa.sa_handler == SIG_DFL) {
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = fuzz_stats_usr1_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+  }
+
+  g_stats.enabled = 1;
+  return 1;
+}
+
+/**
+ * Find (or claim) the table entry for a key. Returns NULL if the table is
+ * full or the domain isn't keyed.
+ */
+static FUZZ_STATS_KEY *fuzz_stats_lookup(FUZZ_STATS_DOMAIN domain,
+                                         unsigned int key)
+{
+  FUZZ_STATS_KEY *table;
+  unsigned int slot;
+  int ii;
+
+  if(domain == FUZZ_STATS_KEY_NONE || domain >= FUZZ_STATS_NUM_DOMAINS ||
+     key == FUZZ_STATS_EMPTY_KEY) {
+    return NULL;
+  }
+
+  table = g_stats.keys[domain];
+  slot = (key * 2654435761u) % FUZZ_STATS_MAX_KEYS;
+
+  for(ii = 0; ii < FUZZ_STATS_MAX_KEYS; ii++) {
+    if(table[slot].key == key) {
+      return &table[slot];
+    }
+    if(table[slot].key == FUZZ_STATS_EMPTY_KEY) {
+      table[slot].key = key;
+      return &table[slot];
+    }
+    slot = (slot + 1) % FUZZ_STATS_MAX_KEYS;
+  }
+
+  return NULL;
+}
+
+/**
+ * Start timing an input.
+ */
+void fuzz_stats_begin_input(void)
+{
+  if(!fuzz_stats_enabled()) {
+    return;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &g_stats.start);
+  fuzz_perf_read(&g_stats.perf_start);
+  g_stats.reason = FUZZ_STATS_ACCEPTED;
+  g_stats.culprit = NULL;
+  g_stats.num_input_keys = 0;
+}
+
+/**
+ * Record that the current input uses a key, so the input's cost and fate are
+ * charged to it. Repeated keys within one input are only counted once.
+ */
+void fuzz_stats_note_key(FUZZ_STATS_DOMAIN domain, unsigned int key)
+{
+  FUZZ_STATS_KEY *entry;
+  int ii;
+
+  if(g_stats.enabled != 1) {
+    return;
+  }
+
+  entry = fuzz_stats_lookup(domain, key);
+  if(entry == NULL) {
+    return;
+  }
+
+  for(ii = 0; ii < g_stats.num_input_keys; ii++) {
+    if(g_stats.input_keys[ii] == entry) {
+      return;
+    }
+  }
+
+  if(g_stats.num_input_keys < FUZZ_STATS_MAX_INPUT_KEYS) {
+    g_stats.input_keys[g_stats.num_input_keys++] = entry;
+  }
+}
+
+/**
+ * Record why the current input was thrown away. The first call for an input
+ * decides the reason; the first key supplied is blamed for it.
+ */
+void fuzz_stats_reject(FUZZ_STATS_REASON reason,
+                       FUZZ_STATS_DOMAIN domain,
+                       unsigned int key)
+{
+  FUZZ_STATS_KEY *entry;
+
+  if(g_stats.enabled != 1) {
+    return;
+  }
+
+  if(g_stats.reason == FUZZ_STATS_ACCEPTED) {
+    g_stats.reason = reason;
+  }
+
+  if(g_stats.culprit == NULL) {
+    entry = fuzz_stats_lookup(domain, key);
+    if(entry != NULL) {
+      g_stats.culprit = entry;
+      entry->culprit[g_stats.reason]++;
+      fuzz_stats_note_key(domain, key);
+    }
+  }
+}
+
+/**
+ * Record a curl_easy_setopt failure that the harness ignored.
+ */
+void fuzz_stats_setopt_failed(FUZZ_STATS_DOMAIN domain, unsigned int key)
+{
+  FUZZ_STATS_KEY *entry;
+
+  if(g_stats.enabled != 1) {
+    return;
+  }
+
+  g_stats.setopt_failed++;
+  entry = fuzz_stats_lookup(domain, key);
+  if(entry != NULL) {
+    entry->setopt_failed++;
+  }
+}
+
+/**
+ * Charge the current input's cost and fate to the totals and to every key it
+ * used. Writes a report if one was asked for with SIGUSR1.
+ */
+void fuzz_stats_end_input(void)
+{
+  struct timespec now;
+  FUZZ_PERF_SAMPLE perf_end;
+  uint64_t elapsed;
+  uint64_t cost;
+  int ii;
+
+  if(g_stats.enabled != 1) {
+    return;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  elapsed = (uint64_t)(now.tv_sec - g_stats.start.tv_sec) * 1000000000 +
+            (uint64_t)now.tv_nsec - (uint64_t)g_stats.start.tv_nsec;
+  fuzz_perf_read(&perf_end);
+  cost = fuzz_perf_cost(&g_stats.perf_start, &perf_end);
+
+  g_stats.inputs++;
+  g_stats.reasons[g_stats.reason]++;
+  g_stats.reason_ns[g_stats.reason] += elapsed;
+  g_stats.reason_cost[g_stats.reason] += cost;
+
+  for(ii = 0; ii < g_stats.num_input_keys; ii++) {
+    g_stats.input_keys[ii]->inputs++;
+    g_stats.input_keys[ii]->total_ns += elapsed;
+    g_stats.input_keys[ii]->total_cost += cost;
+    if(g_stats.reason != FUZZ_STATS_ACCEPTED) {
+      g_stats.input_keys[ii]->rejected++;
+    }
+  }
+  g_stats.num_input_keys = 0;
+
+  if(g_stats_dump_requested) {
+    g_stats_dump_requested = 0;
+    fuzz_stats_dump();
+  }
+}
+
+/**
+ * qsort comparator: most expensive keys first, by FUZZ_PERF cost if that's
+ * being measured and by total time otherwise.
+ */
+static int fuzz_stats_cmp_cost(const void *a, const void *b)
+{
+  const FUZZ_STATS_KEY *ka = *(const FUZZ_STATS_KEY *const *)a;
+  const FUZZ_STATS_KEY *kb = *(const FUZZ_STATS_KEY *const *)b;
+
+  if(fuzz_perf_source() != FUZZ_PERF_NONE &&
+     ka->total_cost != kb->total_cost) {
+    return ka->total_cost < kb->total_cost ? 1 : -1;
+  }
+  if(ka->total_ns != kb->total_ns) {
+    return ka->total_ns < kb->total_ns ? 1 : -1;
+  }
+  return ka->key < kb->key ? -1 : (ka->key > kb->key);
+}
+
+/**
+ * Print one per-key table.
+ */
+static void fuzz_stats_dump_domain(FILE *fp, FUZZ_STATS_DOMAIN domain)
+{
+  FUZZ_STATS_KEY *sorted[FUZZ_STATS_MAX_KEYS];
+  const struct curl_easyoption *opt;
+  FUZZ_STATS_KEY *entry;
+  char name[64];
+  int count = 0;
+  int ii;
+  int jj;
+
+  for(ii = 0; ii < FUZZ_STATS_MAX_KEYS; ii++) {
+    entry = &g_stats.keys[domain][ii];
+    if(entry->key != FUZZ_STATS_EMPTY_KEY &&
+       (entry->inputs > 0 || entry->setopt_failed > 0)) {
+      sorted[count++] = entry;
+    }
+  }
+  qsort(sorted, count, sizeof(sorted[0]), fuzz_stats_cmp_cost);
+
+  fprintf(fp, "\n# %-30s %10s %10s %10s %10s",
+          domain == FUZZ_STATS_KEY_TLV ? "tlv_type" : "curlopt",
+          "inputs", "rejected", "avg_us", "setopt_err");
+  if(fuzz_perf_source() != FUZZ_PERF_NONE) {
+    snprintf(name, sizeof(name), "avg_%s", fuzz_perf_cost_unit());
+    fprintf(fp, " %14s", name);
+  }
+  fprintf(fp, "  culprit\n");
+
+  for(ii = 0; ii < count; ii++) {
+    entry = sorted[ii];
+
+    if(domain == FUZZ_STATS_KEY_CURLOPT &&
+       (opt = curl_easy_option_by_id((CURLoption)entry->key)) != NULL) {
+      snprintf(name, sizeof(name), "CURLOPT_%s", opt->name);
+    }
+    else {
+      snprintf(name, sizeof(name), "%u", entry->key);
+    }
+
+    fprintf(fp, "%-32s %10" PRIu64 " %10" PRIu64 " %10.1f %10" PRIu64 " ",
+            name,
+            entry->inputs,
+            entry->rejected,
+            entry->inputs ? (double)entry->total_ns / entry->inputs / 1000 : 0,
+            entry->setopt_failed);
+    if(fuzz_perf_source() != FUZZ_PERF_NONE) {
+      fprintf(fp, " %14.0f",
+              entry->inputs ? (double)entry->total_cost / entry->inputs : 0);
+    }
+
+    for(jj = 1; jj < FUZZ_STATS_NUM_REASONS; jj++) {
+      if(entry->culprit[jj] > 0) {
+        fprintf(fp, " %s=%" PRIu64, fuzz_stats_reason_names[jj],
+                entry->culprit[jj]);
+      }
+    }
+    fprintf(fp, "\n");
+  }
+}
+
+/**
+ * Write the report. Overwrites the previous report at the same path.
+ */
+void fuzz_stats_dump(void)
+{
+  FILE *fp;
+  char name[32];
+  int ii;
+
+  if(g_stats.enabled != 1) {
+    return;
+  }
+
+  if(strcmp(g_stats.path, "-") == 0) {
+    fp = stderr;
+  }
+  else {
+    fp = fopen(g_stats.path, "w");
+    if(fp == NULL) {
+      fprintf(stderr, "FUZZ: cannot open FUZZ_STATS file %s\n", g_stats.path);
+      return;
+    }
+  }
+
+  fprintf(fp, "# curl-fuzzer exec stats\n");
+  fprintf(fp, "# %-30s %10s %10s %10s", "outcome", "inputs", "percent",
+          "avg_us");
+  if(fuzz_perf_source() != FUZZ_PERF_NONE) {
+    snprintf(name, sizeof(name), "avg_%s", fuzz_perf_cost_unit());
+    fprintf(fp, " %14s", name);
+  }
+  fprintf(fp, "\n");
+  fprintf(fp, "%-32s %10" PRIu64 "\n", "total", g_stats.inputs);
+
+  for(ii = 0; ii < FUZZ_STATS_NUM_REASONS; ii++) {
+    fprintf(fp, "%-32s %10" PRIu64 " %9.2f%% %10.1f",
+            fuzz_stats_reason_names[ii],
+            g_stats.reasons[ii],
+            g_stats.inputs ?
+              100.0 * g_stats.reasons[ii] / g_stats.inputs : 0,
+            g_stats.reasons[ii] ?
+              (double)g_stats.reason_ns[ii] / g_stats.reasons[ii] / 1000 : 0);
+    if(fuzz_perf_source() != FUZZ_PERF_NONE) {
+      fprintf(fp, " %14.0f",
+              g_stats.reasons[ii] ?
+                (double)g_stats.reason_cost[ii] / g_stats.reasons[ii] : 0);
+    }
+    fprintf(fp, "\n");
+  }
+  fprintf(fp, "%-32s %10" PRIu64 "\n", "setopt_failed", g_stats.setopt_failed);
+
+  fuzz_stats_dump_domain(fp, FUZZ_STATS_KEY_TLV);
+  fuzz_stats_dump_domain(fp, FUZZ_STATS_KEY_CURLOPT);
+
+  if(fp == stderr) {
+    fflush(fp);
+  }
+  else {
+    fclose(fp);
+  }
+}
@@ -0,0 +1,79 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#ifndef CURL_FUZZER_STATS_H
+#define CURL_FUZZER_STATS_H
+
+/**
+ * Opt-in exec-efficiency telemetry. Shared by the TLV fuzzers and
+ * curl_fuzzer_proto.
+ *
+ * Setting FUZZ_STATS=<path> (or "-" for stderr) counts why inputs are thrown
+ * away before they reach a transfer, and how much wall time each input
+ * costs. Counts and average cost are also broken down per TLV type and per
+ * CurlOptionId, so options that waste mutation effort stand out. The report
+ * is written at exit and whenever the process receives SIGUSR1.
+ *
+ * When telemetry is disabled every entry point is a single branch.
+ */
+
+/* Why an input was thrown away. Only the first reason recorded for an input
+   counts. */
+typedef enum fuzz_stats_reason {
+  FUZZ_STATS_ACCEPTED,                  /* input reached the transfer */
+  FUZZ_STATS_REJECT_TOO_SHORT,          /* smaller than one TLV header */
+  FUZZ_STATS_REJECT_TLV_LENGTH,         /* TLV length runs past the input */
+  FUZZ_STATS_REJECT_UNKNOWN_TLV,        /* fuzz_parse_tlv returned 127 */
+  FUZZ_STATS_REJECT_DUPLICATE_OPTION,   /* FCHECK_OPTION_UNSET tripped */
+  FUZZ_STATS_REJECT_TLV_LIMIT,          /* too many headers / recipients */
+  FUZZ_STATS_REJECT_INVALID_TLV,        /* any other fuzz_parse_tlv error */
+  FUZZ_STATS_REJECT_NO_SCHEME,          /* proto: SCHEME_UNSPECIFIED */
+  FUZZ_STATS_REJECT_NO_HOST_PATH,       /* proto: empty host_path */
+  FUZZ_STATS_REJECT_SETUP,              /* harness setup failed */
+  FUZZ_STATS_NUM_REASONS
+} FUZZ_STATS_REASON;
+
+/* Which per-key table a key belongs to. */
+typedef enum fuzz_stats_domain {
+  FUZZ_STATS_KEY_NONE,
+  FUZZ_STATS_KEY_TLV,                   /* TLV type */
+  FUZZ_STATS_KEY_CURLOPT,               /* CurlOptionId (== CURLoption) */
+  FUZZ_STATS_NUM_DOMAINS
+} FUZZ_STATS_DOMAIN;
+
+/* Number of distinct keys tracked per domain. */
+#define FUZZ_STATS_MAX_KEYS             512
+
+/* Number of distinct keys a single input can charge its cost to. */
+#define FUZZ_STATS_MAX_INPUT_KEYS       64
+
+/* Function prototypes */
+int fuzz_stats_enabled(void);
+void fuzz_stats_begin_input(void);
+void fuzz_stats_note_key(FUZZ_STATS_DOMAIN domain, unsigned int key);
+void fuzz_stats_reject(FUZZ_STATS_REASON reason,
+                       FUZZ_STATS_DOMAIN domain,
+                       unsigned int key);
+void fuzz_stats_setopt_failed(FUZZ_STATS_DOMAIN domain, unsigned int key);
+void fuzz_stats_end_input(void);
+void fuzz_stats_dump(void);
+
+#endif /* CURL_FUZZER_STATS_H */
@@ -0,0 +1,285 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "curl_fuzzer_timing.h"
+
+typedef struct fuzz_timing_state
+{
+  /* Whether the environment has been checked, and what it said. */
+  int checked;
+  int enabled;
+
+  /* Histograms; either mapped from the stats file or the fallback below. */
+  FUZZ_TIMING_FILE *file;
+  FUZZ_TIMING_FILE local;
+
+  /* Current input. */
+  FUZZ_TIMING_PHASE phase;
+  uint64_t input_start_ns;
+  uint64_t phase_start_ns;
+  uint64_t phase_ns[FUZZ_TIMING_NUM_PHASES];
+
+} FUZZ_TIMING_STATE;
+
+static FUZZ_TIMING_STATE g_timing;
+
+static const char *fuzz_timing_phase_names[FUZZ_TIMING_NUM_PHASES] = {
+  "parse",
+  "setopt",
+  "socket_open",
+  "perform_curl",
+  "perform_wait",
+  "mock_io",
+  "teardown",
+  "total"
+};
+
+static uint64_t fuzz_timing_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Map the stats file named by FUZZ_TIMING. Returns NULL if it can't be
+ * created, in which case the in-memory copy is used instead.
+ */
+static FUZZ_TIMING_FILE *fuzz_timing_map_file(const char *path)
+{
+  void *mem;
+  int fd;
+
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0) {
+    fprintf(stderr, "FUZZ: cannot open FUZZ_TIMING file %s\n", path);
+    return NULL;
+  }
+
+  if(ftruncate(fd, sizeof(FUZZ_TIMING_FILE)) != 0) {
+    close(fd);
+    return NULL;
+  }
+
+  mem = mmap(NULL, sizeof(FUZZ_TIMING_FILE), PROT_READ | PROT_WRITE,
+             MAP_SHARED, fd, 0);
+  close(fd);
+
+  return mem == MAP_FAILED ? NULL : (FUZZ_TIMING_FILE *)mem;
+}
+
+/**
+ * Check FUZZ_TIMING and, the first time through, set up the histograms.
+ */
+int fuzz_timing_enabled(void)
+{
+  const char *path;
+  FUZZ_TIMING_FILE *file = NULL;
+  int ii;
+
+  if(g_timing.checked) {
+    return g_timing.enabled;
+  }
+
+  g_timing.checked = 1;
+  path = getenv("FUZZ_TIMING");
+  if(path == NULL || *path == '\0') {
+    return 0;
+  }
+
+  if(strcmp(path, "-") != 0) {
+    file = fuzz_timing_map_file(path);
+  }
+  if(file == NULL) {
+    file = &g_timing.local;
+  }
+
+  /* Fill in the header last so a reader never sees a valid magic in front
+     of half-initialised data. */
+  file->version = FUZZ_TIMING_VERSION;
+  file->num_phases = FUZZ_TIMING_NUM_PHASES;
+  file->num_buckets = FUZZ_TIMING_NUM_BUCKETS;
+  file->pid = (uint32_t)getpid();
+  for(ii = 0; ii < FUZZ_TIMING_NUM_PHASES; ii++) {
+    strncpy(file->phases[ii].name,
+            fuzz_timing_phase_names[ii],
+            FUZZ_TIMING_NAME_LEN - 1);
+  }
+  __atomic_store_n(&file->magic, FUZZ_TIMING_MAGIC, __ATOMIC_RELEASE);
+
+  g_timing.file = file;
+  atexit(fuzz_timing_print);
+
+  g_timing.enabled = 1;
+  return 1;
+}
+
+/**
+ * Start timing an input. The parse phase is active until the first switch.
+ */
+void fuzz_timing_begin_input(void)
+{
+  if(!fuzz_timing_enabled()) {
+    return;
+  }
+
+  memset(g_timing.phase_ns, 0, sizeof(g_timing.phase_ns));
+  g_timing.phase = FUZZ_TIMING_PARSE;
+  g_timing.input_start_ns = fuzz_timing_now_ns();
+  g_timing.phase_start_ns = g_timing.input_start_ns;
+}
+
+/**
+ * Charge the time since the last switch to the active phase and make 'phase'
+ * active. Returns the phase that was active, so callbacks can restore it.
+ */
+FUZZ_TIMING_PHASE fuzz_timing_switch(FUZZ_TIMING_PHASE phase)
+{
+  FUZZ_TIMING_PHASE prev;
+  uint64_t now;
+
+  if(g_timing.enabled != 1) {
+    return phase;
+  }
+
+  now = fuzz_timing_now_ns();
+  prev = g_timing.phase;
+  g_timing.phase_ns[prev] += now - g_timing.phase_start_ns;
+  g_timing.phase_start_ns = now;
+  g_timing.phase = phase;
+
+  return prev;
+}
+
+/**
+ * Add one sample to a histogram.
+ */
+static void fuzz_timing_add_sample(FUZZ_TIMING_HIST *hist, uint64_t ns)
+{
+  int bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+
+  if(bucket >= FUZZ_TIMING_NUM_BUCKETS) {
+    bucket = FUZZ_TIMING_NUM_BUCKETS - 1;
+  }
+
+  hist->count++;
+  hist->total_ns += ns;
+  if(ns > hist->max_ns) {
+    hist->max_ns = ns;
+  }
+  hist->buckets[bucket]++;
+}
+
+/**
+ * Close the active phase and fold the input's per-phase totals into the
+ * histograms. Phases the input never entered aren't sampled.
+ */
+void fuzz_timing_end_input(void)
+{
+  FUZZ_TIMING_FILE *file = g_timing.file;
+  int ii;
+
+  if(g_timing.enabled != 1) {
+    return;
+  }
+
+  fuzz_timing_switch(FUZZ_TIMING_PARSE);
+  g_timing.phase_ns[FUZZ_TIMING_TOTAL] =
+    g_timing.phase_start_ns - g_timing.input_start_ns;
+
+  __atomic_add_fetch(&file->seq, 1, __ATOMIC_RELEASE);
+  for(ii = 0; ii < FUZZ_TIMING_NUM_PHASES; ii++) {
+    if(g_timing.phase_ns[ii] > 0 || ii == FUZZ_TIMING_TOTAL) {
+      fuzz_timing_add_sample(&file->phases[ii], g_timing.phase_ns[ii]);
+    }
+  }
+  file->inputs++;
+  __atomic_add_fetch(&file->seq, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Format a duration with a sensible unit.
+ */
+static void fuzz_timing_format_ns(char *buf, size_t len, uint64_t ns)
+{
+  if(ns < 1000) {
+    snprintf(buf, len, "%" PRIu64 "ns", ns);
+  }
+  else if(ns < 1000000) {
+    snprintf(buf, len, "%" PRIu64 "us", ns / 1000);
+  }
+  else if(ns < 1000000000) {
+    snprintf(buf, len, "%" PRIu64 "ms", ns / 1000000);
+  }
+  else {
+    snprintf(buf, len, "%" PRIu64 "s", ns / 1000000000);
+  }
+}
+
+/**
+ * Print the histograms to stderr. Each non-empty bucket is shown as
+ * ">=lower_bound:count".
+ */
+void fuzz_timing_print(void)
+{
+  FUZZ_TIMING_FILE *file = g_timing.file;
+  FUZZ_TIMING_HIST *hist;
+  char bound[16];
+  int ii;
+  int jj;
+
+  if(g_timing.enabled != 1) {
+    return;
+  }
+
+  fprintf(stderr, "# curl-fuzzer phase timing, %" PRIu64 " inputs\n",
+          file->inputs);
+  fprintf(stderr, "# %-14s %10s %10s %10s  histogram\n",
+          "phase", "count", "avg_us", "max_us");
+
+  for(ii = 0; ii < FUZZ_TIMING_NUM_PHASES; ii++) {
+    hist = &file->phases[ii];
+    fprintf(stderr, "%-16s %10" PRIu64 " %10.1f %10.1f ",
+            hist->name,
+            hist->count,
+            hist->count ? (double)hist->total_ns / hist->count / 1000 : 0,
+            (double)hist->max_ns / 1000);
+
+    for(jj = 0; jj < FUZZ_TIMING_NUM_BUCKETS; jj++) {
+      if(hist->buckets[jj] == 0) {
+        continue;
+      }
+      fuzz_timing_format_ns(bound, sizeof(bound),
+                            jj ? (uint64_t)1 << (jj - 1) : 0);
+      fprintf(stderr, " >=%s:%" PRIu64, bound, hist->buckets[jj]);
+    }
+    fprintf(stderr, "\n");
+  }
+}
@@ -0,0 +1,94 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#ifndef CURL_FUZZER_TIMING_H
+#define CURL_FUZZER_TIMING_H
+
+#include <stdint.h>
+
+/**
+ * Opt-in per-phase timing. Shared by the TLV fuzzers and curl_fuzzer_proto.
+ *
+ * Setting FUZZ_TIMING=<path> splits every input's wall time into phases and
+ * adds each phase's per-input total to a log2 histogram. The histograms live
+ * in <path>, a FUZZ_TIMING_FILE mapped MAP_SHARED, so they can be read while
+ * the fuzzer is running (see read_timing_stats). FUZZ_TIMING=- keeps them in
+ * memory only. Either way they are printed to stderr at exit.
+ *
+ * Exactly one phase is active at a time; fuzz_timing_switch() charges the
+ * time since the last switch to the outgoing phase.
+ */
+
+/* Phases an input's time is split into. */
+typedef enum fuzz_timing_phase {
+  FUZZ_TIMING_PARSE,                    /* TLV / scenario decoding */
+  FUZZ_TIMING_SETOPT,                   /* configuring the easy handle */
+  FUZZ_TIMING_SOCKET_OPEN,              /* inside the open socket callback */
+  FUZZ_TIMING_PERFORM_CURL,             /* inside curl_multi_* calls */
+  FUZZ_TIMING_PERFORM_WAIT,             /* blocked in select() */
+  FUZZ_TIMING_MOCK_IO,                  /* mock server reads and writes */
+  FUZZ_TIMING_TEARDOWN,                 /* freeing handles and sockets */
+  FUZZ_TIMING_TOTAL,                    /* the whole input */
+  FUZZ_TIMING_NUM_PHASES
+} FUZZ_TIMING_PHASE;
+
+/* Layout of the stats file. Keep in sync with read_timing_stats.py. */
+#define FUZZ_TIMING_MAGIC               0x474E494D49544643ULL /* CFTIMING */
+#define FUZZ_TIMING_VERSION             1
+#define FUZZ_TIMING_NUM_BUCKETS         48
+#define FUZZ_TIMING_NAME_LEN            16
+
+/* Histogram for one phase. Bucket 0 counts zero-length samples; bucket i
+   counts samples in [2^(i-1), 2^i) nanoseconds, with the last bucket
+   catching everything larger. */
+typedef struct fuzz_timing_hist
+{
+  char name[FUZZ_TIMING_NAME_LEN];
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t buckets[FUZZ_TIMING_NUM_BUCKETS];
+
+} FUZZ_TIMING_HIST;
+
+/* The stats file. seq is odd while an update is in progress, so readers
+   retry until they see the same even value either side of their copy. */
+typedef struct fuzz_timing_file
+{
+  uint64_t magic;
+  uint32_t version;
+  uint32_t num_phases;
+  uint32_t num_buckets;
+  uint32_t pid;
+  uint64_t seq;
+  uint64_t inputs;
+  FUZZ_TIMING_HIST phases[FUZZ_TIMING_NUM_PHASES];
+
+} FUZZ_TIMING_FILE;
+
+/* Function prototypes */
+int fuzz_timing_enabled(void);
+void fuzz_timing_begin_input(void);
+FUZZ_TIMING_PHASE fuzz_timing_switch(FUZZ_TIMING_PHASE phase);
+void fuzz_timing_end_input(void);
+void fuzz_timing_print(void);
+
+#endif /* CURL_FUZZER_TIMING_H */
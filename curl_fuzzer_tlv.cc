@@ -139,6 +139,7 @@ int fuzz_parse_tlv(FUZZ_DATA *fuzz, TLV *tlv)
       /* Limit the number of headers that can be added to a message to prevent
          timeouts. */
       if(fuzz->header_list_count >= TLV_MAX_NUM_CURLOPT_HEADER) {
+        fuzz_stats_reject(FUZZ_STATS_REJECT_TLV_LIMIT, FUZZ_STATS_KEY_NONE, 0);
         rc = 255;
         goto EXIT_LABEL;
       }
@@ -160,6 +161,7 @@ int fuzz_parse_tlv(FUZZ_DATA *fuzz, TLV *tlv)
       /* Limit the number of headers that can be added to a message to prevent
          timeouts. */
       if(fuzz->header_list_count >= TLV_MAX_NUM_CURLOPT_HEADER) {
+        fuzz_stats_reject(FUZZ_STATS_REJECT_TLV_LIMIT, FUZZ_STATS_KEY_NONE, 0);
         rc = 255;
         goto EXIT_LABEL;
       }
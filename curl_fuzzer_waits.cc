@@ -0,0 +1,303 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "curl_fuzzer_waits.h"
+
+/* Totals for one phase and end reason. */
+typedef struct fuzz_waits_bucket
+{
+  uint64_t count;
+  uint64_t wall_ns;
+
+} FUZZ_WAITS_BUCKET;
+
+typedef struct fuzz_waits_state
+{
+  /* Whether the environment has been checked, and what it said. */
+  int checked;
+  int enabled;
+
+  /* Output path; "-" means stderr. */
+  const char *path;
+
+  /* The wait in progress. */
+  int waiting;
+  FUZZ_WAITS_PHASE phase;
+  long curl_timeout_ms;
+  long poll_ms;
+  uint64_t start_ns;
+
+  /* Phase of the last wait of the current transfer, if it had one. */
+  int have_last;
+  FUZZ_WAITS_PHASE last_phase;
+
+  /* Totals. */
+  FUZZ_WAITS_BUCKET buckets[FUZZ_WAITS_NUM_PHASES][FUZZ_WAITS_NUM_ENDS];
+  uint64_t curl_timeout_ms_total[FUZZ_WAITS_NUM_PHASES];
+  long curl_timeout_ms_max[FUZZ_WAITS_NUM_PHASES];
+  uint64_t no_curl_timer[FUZZ_WAITS_NUM_PHASES];
+  uint64_t timed_out[FUZZ_WAITS_NUM_PHASES];
+
+} FUZZ_WAITS_STATE;
+
+static FUZZ_WAITS_STATE g_waits;
+
+static const char *fuzz_waits_phase_names[FUZZ_WAITS_NUM_PHASES] = {
+  "resolve",
+  "connect",
+  "request",
+  "expect",
+  "upload",
+  "response",
+  "body"
+};
+
+static const char *fuzz_waits_end_names[FUZZ_WAITS_NUM_ENDS] = {
+  "ready",
+  "curl_timer",
+  "poll"
+};
+
+static uint64_t fuzz_waits_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * Check FUZZ_WAITS.
+ */
+int fuzz_waits_enabled(void)
+{
+  if(g_waits.checked) {
+    return g_waits.enabled;
+  }
+
+  g_waits.checked = 1;
+  g_waits.path = getenv("FUZZ_WAITS");
+  if(g_waits.path == NULL || *g_waits.path == '\0') {
+    return 0;
+  }
+
+  atexit(fuzz_waits_dump);
+
+  g_waits.enabled = 1;
+  return 1;
+}
+
+/**
+ * Work out which phase a transfer is in from the timestamps curl has
+ * filled in so far. A timestamp is 0 until its phase completes. Once the
+ * request is on its way, an upload of known size that hasn't started is
+ * curl holding the body back, typically for a 100-continue; one that has
+ * started but not finished is still being sent.
+ */
+static FUZZ_WAITS_PHASE fuzz_waits_phase(CURL *easy)
+{
+  curl_off_t namelookup = 0;
+  curl_off_t connect = 0;
+  curl_off_t pretransfer = 0;
+  curl_off_t starttransfer = 0;
+  curl_off_t upload_len = -1;
+  curl_off_t uploaded = 0;
+
+  curl_easy_getinfo(easy, CURLINFO_NAMELOOKUP_TIME_T, &namelookup);
+  curl_easy_getinfo(easy, CURLINFO_CONNECT_TIME_T, &connect);
+  curl_easy_getinfo(easy, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+  curl_easy_getinfo(easy, CURLINFO_STARTTRANSFER_TIME_T, &starttransfer);
+
+  if(starttransfer > 0) {
+    return FUZZ_WAITS_BODY;
+  }
+  if(pretransfer > 0) {
+    curl_easy_getinfo(easy, CURLINFO_CONTENT_LENGTH_UPLOAD_T, &upload_len);
+    curl_easy_getinfo(easy, CURLINFO_SIZE_UPLOAD_T, &uploaded);
+    if(upload_len > 0 && uploaded == 0) {
+      return FUZZ_WAITS_EXPECT;
+    }
+    if(upload_len > 0 && uploaded < upload_len) {
+      return FUZZ_WAITS_UPLOAD;
+    }
+    return FUZZ_WAITS_RESPONSE;
+  }
+  if(connect > 0) {
+    return FUZZ_WAITS_REQUEST;
+  }
+  if(namelookup > 0) {
+    return FUZZ_WAITS_CONNECT;
+  }
+  return FUZZ_WAITS_RESOLVE;
+}
+
+/**
+ * Called just before the harness waits for up to poll_ms on curl's sockets.
+ */
+void fuzz_waits_begin(CURLM *multi, CURL *easy, long poll_ms)
+{
+  if(!fuzz_waits_enabled()) {
+    return;
+  }
+
+  g_waits.curl_timeout_ms = -1;
+  curl_multi_timeout(multi, &g_waits.curl_timeout_ms);
+  g_waits.phase = fuzz_waits_phase(easy);
+  g_waits.poll_ms = poll_ms;
+  g_waits.waiting = 1;
+  g_waits.start_ns = fuzz_waits_now_ns();
+}
+
+/**
+ * Called when the wait returns, with the number of ready descriptors.
+ */
+void fuzz_waits_end(int ready)
+{
+  FUZZ_WAITS_BUCKET *bucket;
+  FUZZ_WAITS_END end;
+  FUZZ_WAITS_PHASE phase = g_waits.phase;
+
+  if(!g_waits.waiting) {
+    return;
+  }
+  g_waits.waiting = 0;
+  g_waits.have_last = 1;
+  g_waits.last_phase = phase;
+
+  if(ready > 0) {
+    end = FUZZ_WAITS_READY;
+  }
+  else if(g_waits.curl_timeout_ms >= 0 &&
+          g_waits.curl_timeout_ms <= g_waits.poll_ms) {
+    end = FUZZ_WAITS_CURL_TIMER;
+  }
+  else {
+    end = FUZZ_WAITS_POLL;
+  }
+
+  bucket = &g_waits.buckets[phase][end];
+  bucket->count++;
+  bucket->wall_ns += fuzz_waits_now_ns() - g_waits.start_ns;
+
+  if(g_waits.curl_timeout_ms < 0) {
+    g_waits.no_curl_timer[phase]++;
+  }
+  else {
+    g_waits.curl_timeout_ms_total[phase] += g_waits.curl_timeout_ms;
+    if(g_waits.curl_timeout_ms > g_waits.curl_timeout_ms_max[phase]) {
+      g_waits.curl_timeout_ms_max[phase] = g_waits.curl_timeout_ms;
+    }
+  }
+}
+
+/**
+ * Called with the result of each finished transfer. A timeout is charged to
+ * the phase of the transfer's last wait.
+ */
+void fuzz_waits_result(CURLcode result)
+{
+  if(!g_waits.have_last) {
+    return;
+  }
+  g_waits.have_last = 0;
+
+  if(result == CURLE_OPERATION_TIMEDOUT) {
+    g_waits.timed_out[g_waits.last_phase]++;
+  }
+}
+
+/**
+ * Write the report.
+ */
+void fuzz_waits_dump(void)
+{
+  FUZZ_WAITS_BUCKET *bucket;
+  FILE *fp;
+  uint64_t waits;
+  uint64_t timed;
+  int ii;
+  int jj;
+
+  if(!g_waits.enabled) {
+    return;
+  }
+
+  if(strcmp(g_waits.path, "-") == 0) {
+    fp = stderr;
+  }
+  else {
+    fp = fopen(g_waits.path, "w");
+    if(fp == NULL) {
+      fprintf(stderr, "FUZZ: cannot open FUZZ_WAITS file %s\n",
+              g_waits.path);
+      return;
+    }
+  }
+
+  fprintf(fp, "# curl-fuzzer wait attribution\n");
+  fprintf(fp, "# %-10s %-12s %10s %12s\n", "phase", "ended_by", "waits",
+          "wall_ms");
+  for(ii = 0; ii < FUZZ_WAITS_NUM_PHASES; ii++) {
+    for(jj = 0; jj < FUZZ_WAITS_NUM_ENDS; jj++) {
+      bucket = &g_waits.buckets[ii][jj];
+      if(bucket->count == 0) {
+        continue;
+      }
+      fprintf(fp, "  %-10s %-12s %10" PRIu64 " %12.1f\n",
+              fuzz_waits_phase_names[ii],
+              fuzz_waits_end_names[jj],
+              bucket->count,
+              (double)bucket->wall_ns / 1e6);
+    }
+  }
+
+  fprintf(fp, "# %-10s %10s %16s %16s %10s\n", "phase", "no_timer",
+          "avg_curl_timeout", "max_curl_timeout", "timed_out");
+  for(ii = 0; ii < FUZZ_WAITS_NUM_PHASES; ii++) {
+    waits = 0;
+    for(jj = 0; jj < FUZZ_WAITS_NUM_ENDS; jj++) {
+      waits += g_waits.buckets[ii][jj].count;
+    }
+    if(waits == 0) {
+      continue;
+    }
+    timed = waits - g_waits.no_curl_timer[ii];
+    fprintf(fp, "  %-10s %10" PRIu64 " %16.1f %16ld %10" PRIu64 "\n",
+            fuzz_waits_phase_names[ii],
+            g_waits.no_curl_timer[ii],
+            timed ? (double)g_waits.curl_timeout_ms_total[ii] / timed : 0,
+            g_waits.curl_timeout_ms_max[ii],
+            g_waits.timed_out[ii]);
+  }
+
+  if(fp == stderr) {
+    fflush(fp);
+  }
+  else {
+    fclose(fp);
+  }
+}
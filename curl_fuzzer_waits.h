@@ -0,0 +1,69 @@
+/***************************************************************************
+ *                                  _   _ ____  _
+ *  Project                     ___| | | |  _ \| |
+ *                             / __| | | | |_) | |
+ *                            | (__| |_| |  _ <| |___
+ *                             \___|\___/|_| \_\_____|
+ *
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution. The terms
+ * are also available at https://curl.se/docs/copyright.html.
+ *
+ * You may opt to use, copy, modify, merge, publish, distribute and/or sell
+ * copies of the Software, and permit persons to whom the Software is
+ * furnished to do so, under the terms of the COPYING file.
+ *
+ * This software is distributed on an "AS IS" basis, WITHOUT WARRANTY OF ANY
+ * KIND, either express or implied.
+ *
+ ***************************************************************************/
+#ifndef CURL_FUZZER_WAITS_H
+#define CURL_FUZZER_WAITS_H
+
+#include <curl/curl.h>
+
+/**
+ * Opt-in attribution of the harness's select() waits to curl's transfer
+ * phases. Shared by the TLV fuzzers and curl_fuzzer_proto.
+ *
+ * Setting FUZZ_WAITS=<path> (or "-" for stderr) records, for every wait, the
+ * value curl_multi_timeout() asked for and the phase the transfer was in,
+ * read from the CURLINFO_*_TIME_T timestamps. Each wait is also classified
+ * by what ended it: socket activity, curl's own timer running out, or the
+ * harness's poll interval, and transfers that fail with
+ * CURLE_OPERATION_TIMEDOUT are charged to the phase of their last wait. A
+ * table of wall time per phase and reason is written at exit, so a corpus
+ * replay shows which of curl's timers (DNS, connect, 100-continue,
+ * server-response, body stalls) the time goes on.
+ */
+
+/* Transfer phase a wait happened in. */
+typedef enum fuzz_waits_phase {
+  FUZZ_WAITS_RESOLVE,                   /* before name resolution finished */
+  FUZZ_WAITS_CONNECT,                   /* resolving done, not connected */
+  FUZZ_WAITS_REQUEST,                   /* connected, request not yet sent */
+  FUZZ_WAITS_EXPECT,                    /* request sent, body held back */
+  FUZZ_WAITS_UPLOAD,                    /* request body partly sent */
+  FUZZ_WAITS_RESPONSE,                  /* request sent, no response yet */
+  FUZZ_WAITS_BODY,                      /* response started */
+  FUZZ_WAITS_NUM_PHASES
+} FUZZ_WAITS_PHASE;
+
+/* What ended a wait. */
+typedef enum fuzz_waits_end {
+  FUZZ_WAITS_READY,                     /* a socket became ready */
+  FUZZ_WAITS_CURL_TIMER,                /* curl's timeout ran out first */
+  FUZZ_WAITS_POLL,                      /* the harness's poll interval */
+  FUZZ_WAITS_NUM_ENDS
+} FUZZ_WAITS_END;
+
+/* Function prototypes */
+int fuzz_waits_enabled(void);
+void fuzz_waits_begin(CURLM *multi, CURL *easy, long poll_ms);
+void fuzz_waits_end(int ready);
+void fuzz_waits_result(CURLcode result);
+void fuzz_waits_dump(void);
+
+#endif /* CURL_FUZZER_WAITS_H */
@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief Implementation of EncodeBody, BodyEncodingToken and CorruptBody.
+
+#include "proto_fuzzer/body_encoding.h"
+
+#include <zlib.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace proto_fuzzer {
+
+namespace {
+
+// Caps so one input can't make compression dominate runtime.
+constexpr int kMaxEncodings = 8;
+constexpr std::size_t kMaxPlaintextBytes = 1024 * 1024;
+
+// Bounds on the cache. Past either, it is emptied and starts again: the
+// bodies worth keeping are the ones the mutator is currently working on,
+// and they come straight back.
+constexpr std::size_t kMaxCacheBytes = 64 * 1024 * 1024;
+constexpr std::size_t kMaxCacheEntries = 4096;
+
+// zlib windowBits selecting the gzip wrapper, the zlib wrapper and none.
+constexpr int kGzipWindowBits = 15 + 16;
+constexpr int kZlibWindowBits = 15;
+constexpr int kRawWindowBits = -15;
+
+constexpr int kZstdLevel = 3;
+
+// FNV-1a, as the digest uses.
+constexpr std::uint64_t kFnvOffset = 0xcbf29ce484222325ULL;
+constexpr std::uint64_t kFnvPrime = 0x100000001b3ULL;
+
+/// One memoised result. The key material is kept so a hash collision is
+/// a miss rather than the wrong body.
+struct CacheEntry {
+  std::string chain;
+  std::string plaintext;
+  std::string encoded;
+};
+
+/// Results of earlier iterations, by hash of chain and plaintext.
+struct BodyCache {
+  std::unordered_map<std::uint64_t, CacheEntry> entries;
+  std::size_t bytes = 0;
+};
+
+BodyCache& Cache() {
+  static BodyCache cache;
+  return cache;
+}
+
+std::uint64_t Fnv1a(std::uint64_t hash, const std::string& data) {
+  for (unsigned char c : data) {
+    hash ^= c;
+    hash *= kFnvPrime;
+  }
+  return hash;
+}
+
+/// Compress 'in' with zlib's deflate in the wrapper 'window_bits' selects.
+/// @return false if zlib failed, leaving 'out' unspecified.
+bool Deflate(const std::string& in, int window_bits, std::string* out) {
+  z_stream stream{};
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+  out->resize(deflateBound(&stream, static_cast<uLong>(in.size())));
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+  stream.avail_in = static_cast<uInt>(in.size());
+  stream.next_out = reinterpret_cast<Bytef*>(&(*out)[0]);
+  stream.avail_out = static_cast<uInt>(out->size());
+  const int rc = deflate(&stream, Z_FINISH);
+  out->resize(stream.total_out);
+  deflateEnd(&stream);
+  return rc == Z_STREAM_END;
+}
+
+/// Compress 'in' into a single zstd frame.
+/// @return false if zstd failed, leaving 'out' unspecified.
+bool ZstdCompress(const std::string& in, std::string* out) {
+  out->resize(ZSTD_compressBound(in.size()));
+  const std::size_t size = ZSTD_compress(&(*out)[0], out->size(), in.data(), in.size(), kZstdLevel);
+  if (ZSTD_isError(size)) {
+    return false;
+  }
+  out->resize(size);
+  return true;
+}
+
+/// Apply one coding to 'body'. A coding that fails leaves the body as it
+/// was, so the label then lies, which is a case worth reaching too.
+void ApplyEncoding(int encoding, std::string* body) {
+  std::string out;
+  bool ok = false;
+  switch (encoding) {
+    case curl::fuzzer::proto::ENCODING_GZIP:
+      ok = Deflate(*body, kGzipWindowBits, &out);
+      break;
+    case curl::fuzzer::proto::ENCODING_DEFLATE:
+      ok = Deflate(*body, kZlibWindowBits, &out);
+      break;
+    case curl::fuzzer::proto::ENCODING_RAW_DEFLATE:
+      ok = Deflate(*body, kRawWindowBits, &out);
+      break;
+    case curl::fuzzer::proto::ENCODING_ZSTD:
+      ok = ZstdCompress(*body, &out);
+      break;
+    default:
+      break;
+  }
+  if (ok) {
+    body->swap(out);
+  }
+}
+
+}  // namespace
+
+/// Encode a body through a chain of codings, from the cache when the same
+/// chain has been applied to the same plaintext before.
+/// @param plaintext The body before any coding; only its first 1 MiB is
+///                  used.
+/// @param encodings BodyEncoding values, first applied first. Only the
+///                  first 8 are applied, and values outside the enum are
+///                  skipped.
+/// @return the encoded body.
+std::string EncodeBody(const std::string& plaintext, const google::protobuf::RepeatedField<int>& encodings) {
+  const int count = std::min(kMaxEncodings, encodings.size());
+  std::string chain;
+  for (int i = 0; i < count; ++i) {
+    // Values the enum doesn't name are identity, as BodyEncodingToken
+    // labels them.
+    const int encoding = encodings.Get(i);
+    if (encoding > curl::fuzzer::proto::ENCODING_IDENTITY && encoding <= curl::fuzzer::proto::ENCODING_ZSTD) {
+      chain.push_back(static_cast<char>(encoding));
+    }
+  }
+  std::string body = plaintext.substr(0, kMaxPlaintextBytes);
+  if (chain.empty()) {
+    return body;
+  }
+
+  // The chain's length goes in first so its bytes can't run into the
+  // plaintext's.
+  const std::uint64_t key = Fnv1a(Fnv1a(kFnvOffset, std::string(1, static_cast<char>(chain.size())) + chain), body);
+  BodyCache& cache = Cache();
+  auto it = cache.entries.find(key);
+  if (it != cache.entries.end() && it->second.chain == chain && it->second.plaintext == body) {
+    return it->second.encoded;
+  }
+
+  CacheEntry entry;
+  entry.chain = chain;
+  entry.plaintext = body;
+  for (char encoding : chain) {
+    ApplyEncoding(static_cast<unsigned char>(encoding), &body);
+  }
+  entry.encoded = body;
+
+  const std::size_t size = entry.plaintext.size() + entry.encoded.size();
+  if (it != cache.entries.end()) {
+    cache.bytes -= it->second.plaintext.size() + it->second.encoded.size();
+    cache.entries.erase(it);
+  }
+  if (cache.bytes + size > kMaxCacheBytes || cache.entries.size() >= kMaxCacheEntries) {
+    cache.entries.clear();
+    cache.bytes = 0;
+  }
+  if (size <= kMaxCacheBytes) {
+    cache.bytes += size;
+    cache.entries.emplace(key, std::move(entry));
+  }
+  return body;
+}
+
+/// Name a coding the way a Content-Encoding header does. Unknown values are
+/// treated as identity, as EncodeBody does.
+/// @param encoding A BodyEncoding value.
+/// @return the header token.
+const char* BodyEncodingToken(int encoding) {
+  switch (encoding) {
+    case curl::fuzzer::proto::ENCODING_GZIP:
+      return "gzip";
+    case curl::fuzzer::proto::ENCODING_DEFLATE:
+    case curl::fuzzer::proto::ENCODING_RAW_DEFLATE:
+      return "deflate";
+    case curl::fuzzer::proto::ENCODING_ZSTD:
+      return "zstd";
+    default:
+      return "identity";
+  }
+}
+
+/// Flip bits in, or truncate, an encoded body. Applied after the cache, so
+/// corrupted variants of one body share its entry.
+/// @param corruption Where and how to damage the body.
+/// @param body       The encoded body; left alone if empty.
+void CorruptBody(const curl::fuzzer::proto::BodyCorruption& corruption, std::string* body) {
+  if (body->empty()) {
+    return;
+  }
+  const std::size_t offset = corruption.offset() % body->size();
+  if (corruption.truncate()) {
+    body->resize(offset);
+    return;
+  }
+  const std::uint32_t mask = corruption.xor_mask() & 0xFF;
+  (*body)[offset] = static_cast<char>((*body)[offset] ^ (mask != 0 ? mask : 0xFF));
+}
+
+}  // namespace proto_fuzzer
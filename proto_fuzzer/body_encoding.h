@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief Compress response bodies through a chain of HTTP content codings,
+///        memoising the results across fuzz iterations.
+
+#ifndef PROTO_FUZZER_BODY_ENCODING_H_
+#define PROTO_FUZZER_BODY_ENCODING_H_
+
+#include <string>
+
+#include "curl_fuzzer.pb.h"
+
+namespace proto_fuzzer {
+
+// Encode 'plaintext' through 'encodings' (BodyEncoding values), first to
+// last. Compressing costs far more than the rest of an iteration, and the
+// mutator mostly leaves a body alone while it varies other fields, so
+// results are cached process-wide keyed by a hash of the chain and the
+// plaintext.
+std::string EncodeBody(const std::string& plaintext, const google::protobuf::RepeatedField<int>& encodings);
+
+// @return the Content-Encoding token for 'encoding'.
+const char* BodyEncodingToken(int encoding);
+
+// Apply 'corruption' to an encoded body in place.
+void CorruptBody(const curl::fuzzer::proto::BodyCorruption& corruption, std::string* body);
+
+}  // namespace proto_fuzzer
+
+#endif  // PROTO_FUZZER_BODY_ENCODING_H_
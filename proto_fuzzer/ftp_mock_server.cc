@@ -0,0 +1,580 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief Implementation of FtpMockServer.
+
+#include "proto_fuzzer/ftp_mock_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+
+#include "curl_fuzzer_digest.h"
+#include "curl_fuzzer_spin.h"
+
+namespace proto_fuzzer {
+
+namespace {
+
+// Cap on scripted replies considered, so a mutator that piles up entries
+// can't make every command a long scan.
+constexpr std::size_t kMaxScriptedReplies = 64;
+
+// Longest command line the mock buffers before treating it as complete.
+constexpr std::size_t kMaxCommandLine = 4096;
+
+// Bytes of a listing or file body written to the data connection per loop
+// iteration, so large transfers stream rather than filling the socket.
+constexpr std::size_t kDataChunkBytes = 4096;
+
+constexpr char kDefaultGreeting[] = "220 curl-fuzzer FTP mock ready\r\n";
+constexpr char kDefaultTransferDone[] = "226 Transfer complete\r\n";
+// The address in a PASV reply and the port in an EPSV reply are never used:
+// every socket curl opens lands on the mock whatever it asked for.
+constexpr char kPasvReply[] = "227 Entering Passive Mode (127,0,0,1,39,16)\r\n";
+constexpr char kEpsvReply[] = "229 Entering Extended Passive Mode (|||10000|)\r\n";
+constexpr char kPortReply[] = "200 PORT command successful\r\n";
+constexpr char kBadPortReply[] = "501 Illegal PORT command\r\n";
+constexpr char kOpeningData[] = "150 Opening data connection\r\n";
+constexpr char kNoDataConnection[] = "425 Can't open data connection\r\n";
+constexpr char kQuitReply[] = "221 Goodbye\r\n";
+constexpr char kTransferAborted[] = "426 Connection closed; transfer aborted\r\n";
+constexpr char kNotImplemented[] = "502 Command not implemented\r\n";
+
+/// A fixed reply for a command that needs no state.
+struct DefaultReply {
+  /// Upper-case command verb.
+  const char* verb;
+  /// Complete reply, CRLF included.
+  const char* reply;
+};
+
+constexpr DefaultReply kDefaultReplies[] = {
+    {"USER", "331 Password required\r\n"},
+    {"PASS", "230 Logged in\r\n"},
+    {"ACCT", "230 Account accepted\r\n"},
+    {"PWD", "257 \"/\" is the current directory\r\n"},
+    {"CWD", "250 Directory changed\r\n"},
+    {"CDUP", "250 Directory changed\r\n"},
+    {"MKD", "257 \"/new\" created\r\n"},
+    {"RMD", "250 Directory removed\r\n"},
+    {"DELE", "250 File deleted\r\n"},
+    {"RNFR", "350 Ready for destination name\r\n"},
+    {"RNTO", "250 File renamed\r\n"},
+    {"TYPE", "200 Type set\r\n"},
+    {"MODE", "200 Mode set\r\n"},
+    {"STRU", "200 Structure set\r\n"},
+    {"SYST", "215 UNIX Type: L8\r\n"},
+    {"FEAT", "211-Features:\r\n EPRT\r\n EPSV\r\n MDTM\r\n REST STREAM\r\n SIZE\r\n211 End\r\n"},
+    {"OPTS", "200 OK\r\n"},
+    {"MDTM", "213 20240101000000\r\n"},
+    {"NOOP", "200 OK\r\n"},
+    {"PRET", "200 OK\r\n"},
+    {"SITE", "200 OK\r\n"},
+    {"PBSZ", "200 OK\r\n"},
+    {"PROT", "200 OK\r\n"},
+};
+
+/// @return true if 'verb' opens the data channel for a transfer.
+bool IsTransferCommand(const std::string& verb) {
+  return verb == "RETR" || verb == "LIST" || verb == "NLST" || verb == "MLSD" || verb == "STOR" || verb == "APPE" ||
+         verb == "STOU";
+}
+
+/// @return true if 'verb' sends data to the server rather than fetching it.
+bool IsUploadCommand(const std::string& verb) { return verb == "STOR" || verb == "APPE" || verb == "STOU"; }
+
+/// @return the first digit of a reply, which is all FTP clients act on.
+char ReplyClass(const std::string& reply) { return reply.empty() ? '\0' : reply[0]; }
+
+/// @return true for an address the mock is willing to connect back to.
+bool IsLoopback(const struct sockaddr_storage& addr) {
+  if (addr.ss_family == AF_INET) {
+    const auto* sin = reinterpret_cast<const struct sockaddr_in*>(&addr);
+    return (ntohl(sin->sin_addr.s_addr) >> 24) == 127;
+  }
+  if (addr.ss_family == AF_INET6) {
+    const auto* sin6 = reinterpret_cast<const struct sockaddr_in6*>(&addr);
+    return IN6_IS_ADDR_LOOPBACK(&sin6->sin6_addr);
+  }
+  return false;
+}
+
+/// Parse a PORT argument, "h1,h2,h3,h4,p1,p2".
+/// @param argument The text after the verb.
+/// @param addr     Receives the IPv4 address and port.
+/// @param len      Receives the size of the address.
+/// @return true if 'argument' named a loopback address and non-zero port.
+bool ParsePortArgument(const std::string& argument, struct sockaddr_storage* addr, socklen_t* len) {
+  unsigned int fields[6];
+  char tail = '\0';
+  if (sscanf(argument.c_str(), "%u,%u,%u,%u,%u,%u%c", &fields[0], &fields[1], &fields[2], &fields[3], &fields[4],
+             &fields[5], &tail) != 6) {
+    return false;
+  }
+  for (unsigned int field : fields) {
+    if (field > 255) {
+      return false;
+    }
+  }
+  auto* sin = reinterpret_cast<struct sockaddr_in*>(addr);
+  memset(addr, 0, sizeof(*addr));
+  sin->sin_family = AF_INET;
+  sin->sin_addr.s_addr = htonl((fields[0] << 24) | (fields[1] << 16) | (fields[2] << 8) | fields[3]);
+  sin->sin_port = htons(static_cast<uint16_t>((fields[4] << 8) | fields[5]));
+  *len = sizeof(*sin);
+  return sin->sin_port != 0 && IsLoopback(*addr);
+}
+
+/// Parse an EPRT argument, "|1|127.0.0.1|port|" or "|2|::1|port|". Any
+/// printable delimiter may stand in for '|' (RFC 2428).
+/// @param argument The text after the verb.
+/// @param addr     Receives the IPv4 or IPv6 address and port.
+/// @param len      Receives the size of the address.
+/// @return true if 'argument' named a loopback address and valid port.
+bool ParseEprtArgument(const std::string& argument, struct sockaddr_storage* addr, socklen_t* len) {
+  if (argument.size() < 2) {
+    return false;
+  }
+  const char delim = argument[0];
+  std::string fields[3];
+  std::size_t pos = 1;
+  for (std::string& field : fields) {
+    const std::size_t end = argument.find(delim, pos);
+    if (end == std::string::npos) {
+      return false;
+    }
+    field = argument.substr(pos, end - pos);
+    pos = end + 1;
+  }
+  char* port_end = nullptr;
+  const unsigned long port = strtoul(fields[2].c_str(), &port_end, 10);
+  if (fields[2].empty() || *port_end != '\0' || port == 0 || port > 65535) {
+    return false;
+  }
+
+  memset(addr, 0, sizeof(*addr));
+  if (fields[0] == "1") {
+    auto* sin = reinterpret_cast<struct sockaddr_in*>(addr);
+    if (inet_pton(AF_INET, fields[1].c_str(), &sin->sin_addr) != 1) {
+      return false;
+    }
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(static_cast<uint16_t>(port));
+    *len = sizeof(*sin);
+  } else if (fields[0] == "2") {
+    auto* sin6 = reinterpret_cast<struct sockaddr_in6*>(addr);
+    if (inet_pton(AF_INET6, fields[1].c_str(), &sin6->sin6_addr) != 1) {
+      return false;
+    }
+    sin6->sin6_family = AF_INET6;
+    sin6->sin6_port = htons(static_cast<uint16_t>(port));
+    *len = sizeof(*sin6);
+  } else {
+    return false;
+  }
+  return IsLoopback(*addr);
+}
+
+}  // namespace
+
+/// Construct an idle FtpMockServer. RunLoop() seeds it from the scenario
+/// before curl opens the control connection.
+FtpMockServer::FtpMockServer()
+    : script_(nullptr),
+      passive_pending_(false),
+      active_pending_(false),
+      active_addr_(),
+      active_addr_len_(0),
+      data_state_(DataState::kIdle),
+      payload_(nullptr),
+      payload_offset_(0),
+      restart_offset_(0),
+      quit_seen_(false) {}
+
+/// Default destructor; the control and data MockConnections close their
+/// sockets.
+FtpMockServer::~FtpMockServer() = default;
+
+/// Use 'script' for the rest of the scenario and mark every scripted reply
+/// unused.
+/// @param script The scenario's FtpScript; must outlive the run.
+void FtpMockServer::SetScript(const curl::fuzzer::proto::FtpScript& script) {
+  script_ = &script;
+  reply_used_.assign(std::min<std::size_t>(kMaxScriptedReplies, script.replies_size()), false);
+}
+
+/// Called by the OPENSOCKETFUNCTION trampoline in the base class. The first
+/// socket is the control connection and gets the greeting; after a positive
+/// PASV/EPSV the next one is the passive data connection. Anything else is
+/// the socket curl wants to listen on for an active-mode data connection,
+/// which has to be a real socket of the family curl asked for so that curl
+/// can bind it.
+/// @param address The address curl wants the socket for.
+/// @return the fd to hand to libcurl, or CURL_SOCKET_BAD on failure.
+curl_socket_t FtpMockServer::HandleOpenSocket(const struct curl_sockaddr* address) {
+  if (!connection_) {
+    connection_ = std::make_unique<MockConnection>();
+    if (!connection_->ok()) {
+      connection_.reset();
+      return CURL_SOCKET_BAD;
+    }
+    ApplyPendingBackpressure();
+    const std::string& greeting = script_ != nullptr ? script_->greeting() : std::string();
+    SendReply(greeting.empty() ? std::string(kDefaultGreeting) : greeting);
+    return connection_->take_client_fd();
+  }
+
+  if (passive_pending_ && !data_) {
+    data_ = std::make_unique<MockConnection>();
+    if (!data_->ok()) {
+      data_.reset();
+      return CURL_SOCKET_BAD;
+    }
+    return data_->take_client_fd();
+  }
+
+  if (address == nullptr || (address->family != AF_INET && address->family != AF_INET6)) {
+    return CURL_SOCKET_BAD;
+  }
+  // curl listens on an ephemeral port, so the PORT/EPRT it is about to send
+  // differs between runs.
+  fuzz_digest_ignore(FUZZ_DIGEST_SENT);
+  const int fd = ::socket(address->family, address->socktype, address->protocol);
+  if (fd < 0) {
+    return CURL_SOCKET_BAD;
+  }
+  if (fd >= FD_SETSIZE) {
+    close(fd);
+    return CURL_SOCKET_BAD;
+  }
+  return static_cast<curl_socket_t>(fd);
+}
+
+/// Take the next unused scripted reply for 'verb', if there is one.
+/// @param verb  Upper-case command verb.
+/// @param reply Receives the reply.
+/// @return true if a scripted reply was found.
+bool FtpMockServer::TakeScriptedReply(const std::string& verb, std::string* reply) {
+  for (std::size_t i = 0; i < reply_used_.size(); ++i) {
+    if (reply_used_[i]) {
+      continue;
+    }
+    const auto& entry = script_->replies(static_cast<int>(i));
+    const std::string& candidate = entry.verb();
+    if (candidate.size() != verb.size() ||
+        !std::equal(candidate.begin(), candidate.end(), verb.begin(), [](char a, char b) {
+          return std::toupper(static_cast<unsigned char>(a)) == static_cast<unsigned char>(b);
+        })) {
+      continue;
+    }
+    reply_used_[i] = true;
+    *reply = entry.reply();
+    return true;
+  }
+  return false;
+}
+
+/// Write a reply on the control connection.
+/// @param reply   Complete reply, CRLF included.
+/// @param unsplit true for replies curl reads in a blocking call, which
+///                FUZZ_FRAGMENT must not split.
+void FtpMockServer::SendReply(const std::string& reply, bool unsplit) {
+  if (!connection_ || reply.empty()) {
+    return;
+  }
+  const auto* data = reinterpret_cast<const unsigned char*>(reply.data());
+  if (unsplit) {
+    connection_->WriteUnsplit(data, reply.size());
+  } else {
+    connection_->WriteAll(data, reply.size());
+  }
+}
+
+/// Send the scripted transfer-complete reply, or 226. curl reads it in a
+/// blocking call once the data connection is done, so it goes out unsplit.
+void FtpMockServer::SendTransferDone() {
+  const std::string& done = script_->transfer_done();
+  SendReply(done.empty() ? std::string(kDefaultTransferDone) : done, true);
+}
+
+/// Answer the QUIT curl sends when the connection is torn down, ahead of
+/// time. curl waits for the reply inside curl_multi_cleanup, after the drive
+/// loop has stopped servicing the control connection.
+void FtpMockServer::PreAnswerQuit() {
+  if (!connection_ || quit_seen_) {
+    return;
+  }
+  std::string scripted;
+  SendReply(TakeScriptedReply("QUIT", &scripted) ? scripted : std::string(kQuitReply), true);
+}
+
+/// Connect to the address curl sent in PORT/EPRT and adopt the socket as the
+/// data connection. curl's listen socket already has the connection queued
+/// by the time connect() returns, so curl can accept it whenever it gets to.
+/// @return true if the data connection is open.
+bool FtpMockServer::ConnectActiveData() {
+  const int fd = ::socket(active_addr_.ss_family, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return false;
+  }
+  if (::connect(fd, reinterpret_cast<const struct sockaddr*>(&active_addr_), active_addr_len_) != 0) {
+    close(fd);
+    return false;
+  }
+  data_ = std::make_unique<MockConnection>(fd);
+  if (!data_->ok()) {
+    data_.reset();
+    return false;
+  }
+  return true;
+}
+
+/// Answer a transfer command. Needs a data connection armed by the last
+/// PASV/EPSV or PORT/EPRT; the preliminary reply (scripted, or 150) decides
+/// whether the transfer actually starts.
+/// @param verb     Upper-case transfer verb.
+/// @param scripted Scripted reply for the command, or nullptr.
+void FtpMockServer::StartTransfer(const std::string& verb, const std::string* scripted) {
+  bool connected = false;
+  if (passive_pending_) {
+    connected = data_ != nullptr;
+  } else if (active_pending_) {
+    connected = ConnectActiveData();
+  }
+  passive_pending_ = false;
+  active_pending_ = false;
+
+  if (!connected) {
+    data_.reset();
+    SendReply(scripted != nullptr ? *scripted : std::string(kNoDataConnection));
+    return;
+  }
+
+  // An upload's 226 follows right behind, so the preliminary reply goes out
+  // unsplit too rather than holding it back in the fragment queue.
+  const std::string reply = scripted != nullptr ? *scripted : std::string(kOpeningData);
+  SendReply(reply, IsUploadCommand(verb));
+  if (ReplyClass(reply) != '1') {
+    data_.reset();
+    return;
+  }
+
+  if (IsUploadCommand(verb)) {
+    // curl waits for the transfer-complete reply inside the perform call that
+    // closes the data connection, so the mock can't wait to see the close
+    // before replying. Queue it now; curl only reads it once it's done.
+    data_state_ = DataState::kReceiving;
+    SendTransferDone();
+  } else {
+    payload_ = verb == "RETR" ? &script_->file_body() : &script_->listing();
+    payload_offset_ = verb == "RETR" ? std::min(restart_offset_, payload_->size()) : 0;
+    data_state_ = DataState::kSending;
+  }
+  restart_offset_ = 0;
+}
+
+/// Reply to one command line. Scripted replies win; the built-in defaults
+/// keep curl's state machine moving when the script has nothing to say.
+/// @param verb     Upper-case command verb.
+/// @param argument Everything after the verb and its separating space.
+void FtpMockServer::HandleCommand(const std::string& verb, const std::string& argument) {
+  std::string scripted;
+  const bool have_scripted = TakeScriptedReply(verb, &scripted);
+
+  if (verb == "PASV" || verb == "EPSV") {
+    const std::string reply = have_scripted ? scripted : std::string(verb == "PASV" ? kPasvReply : kEpsvReply);
+    data_.reset();
+    passive_pending_ = ReplyClass(reply) == '2';
+    active_pending_ = false;
+    SendReply(reply);
+    return;
+  }
+
+  if (verb == "PORT" || verb == "EPRT") {
+    const bool parsed = verb == "PORT" ? ParsePortArgument(argument, &active_addr_, &active_addr_len_)
+                                       : ParseEprtArgument(argument, &active_addr_, &active_addr_len_);
+    const std::string reply = have_scripted ? scripted : std::string(parsed ? kPortReply : kBadPortReply);
+    data_.reset();
+    passive_pending_ = false;
+    active_pending_ = parsed && ReplyClass(reply) == '2';
+    SendReply(reply);
+    return;
+  }
+
+  if (IsTransferCommand(verb)) {
+    StartTransfer(verb, have_scripted ? &scripted : nullptr);
+    return;
+  }
+
+  if (verb == "REST") {
+    restart_offset_ = static_cast<std::size_t>(strtoull(argument.c_str(), nullptr, 10));
+    SendReply(have_scripted ? scripted : "350 Restarting at " + std::to_string(restart_offset_) + "\r\n");
+    return;
+  }
+
+  if (have_scripted) {
+    SendReply(scripted);
+  } else if (verb == "SIZE") {
+    SendReply("213 " + std::to_string(script_->file_body().size()) + "\r\n");
+  } else if (verb == "QUIT") {
+    SendReply(kQuitReply);
+  } else {
+    const DefaultReply* found = nullptr;
+    for (const DefaultReply& entry : kDefaultReplies) {
+      if (verb == entry.verb) {
+        found = &entry;
+        break;
+      }
+    }
+    SendReply(found != nullptr ? found->reply : kNotImplemented);
+  }
+
+  if (verb == "QUIT" && connection_) {
+    quit_seen_ = true;
+    connection_->ShutdownWrite();
+  }
+}
+
+/// Read what curl has sent on the control connection and answer every
+/// complete command line in it.
+/// @return true if at least one command was handled.
+bool FtpMockServer::ServiceControl() {
+  if (!connection_) {
+    return false;
+  }
+  connection_->ReadAvailable(&command_buffer_);
+
+  bool handled = false;
+  while (!command_buffer_.empty()) {
+    std::size_t end = command_buffer_.find('\n');
+    if (end == std::string::npos) {
+      if (command_buffer_.size() < kMaxCommandLine) {
+        break;
+      }
+      end = command_buffer_.size() - 1;
+    }
+    std::string line = command_buffer_.substr(0, end);
+    command_buffer_.erase(0, end + 1);
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+
+    const std::size_t space = line.find(' ');
+    std::string verb = line.substr(0, space);
+    std::transform(verb.begin(), verb.end(), verb.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+    const std::string argument = space == std::string::npos ? std::string() : line.substr(space + 1);
+    HandleCommand(verb, argument);
+    handled = true;
+  }
+  return handled;
+}
+
+/// Move the current transfer along: write the next chunk of a listing or file
+/// body, or drain an upload. A finished download closes the data connection
+/// and sends the transfer-complete reply.
+/// @return true if anything moved.
+bool FtpMockServer::ServiceData() {
+  if (!data_ || data_state_ == DataState::kIdle) {
+    return false;
+  }
+
+  if (data_state_ == DataState::kReceiving) {
+    data_->DrainIncoming();
+    if (!data_->peer_closed()) {
+      return false;
+    }
+    data_state_ = DataState::kIdle;
+    return true;
+  }
+
+  // Hold the transfer back until curl has the whole preliminary reply, so
+  // the 226 at the end isn't queued behind it: curl reads that one in a
+  // blocking call.
+  if (connection_ && connection_->fragments_pending()) {
+    return false;
+  }
+  if (payload_offset_ < payload_->size()) {
+    const std::size_t n = std::min(kDataChunkBytes, payload_->size() - payload_offset_);
+    if (!data_->WriteAll(reinterpret_cast<const unsigned char*>(payload_->data()) + payload_offset_, n)) {
+      data_state_ = DataState::kIdle;
+      data_.reset();
+      SendReply(kTransferAborted);
+      return true;
+    }
+    payload_offset_ += n;
+    if (payload_offset_ < payload_->size()) {
+      return true;
+    }
+  }
+
+  // Under FUZZ_FRAGMENT the shutdown waits for the queue to drain, so the
+  // data connection stays open until the next transfer replaces it.
+  data_->ShutdownWrite();
+  data_state_ = DataState::kIdle;
+  SendTransferDone();
+  return true;
+}
+
+/// Seed the mock from the scenario, then drive the perform loop until curl is
+/// done or the idle-iteration cap is hit. Each iteration answers whatever
+/// commands curl has sent and moves the current transfer along.
+/// @param multi    caller-owned multi; 'easy' is already added.
+/// @param easy     the curl easy handle attached to this mock.
+/// @param scenario source of the FtpScript.
+void FtpMockServer::RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Scenario& scenario) {
+  SetScript(scenario.connection().ftp());
+
+  int still_running = 1;
+  int idle_iterations = 0;
+  CURLMcode rc = CURLM_OK;
+
+  while (still_running && idle_iterations < kMaxIdleIterations) {
+    rc = curl_multi_perform(multi, &still_running);
+    fuzz_spin_note_perform(multi, still_running);
+    fuzz_digest_iteration();
+    if (rc != CURLM_OK) {
+      break;
+    }
+    if (!still_running) {
+      break;
+    }
+    bool flushed = connection_ && connection_->FlushFragment();
+    flushed = (data_ && data_->FlushFragment()) || flushed;
+    if (flushed) {
+      idle_iterations = 0;
+    }
+
+    int ready = WaitOnMultiFdset(multi, easy, &rc);
+    if (rc != CURLM_OK) {
+      break;
+    }
+
+    bool progressed = ServiceControl();
+    progressed = ServiceData() || progressed;
+    if (progressed) {
+      idle_iterations = 0;
+    } else if (ready == 0) {
+      ++idle_iterations;
+    } else {
+      idle_iterations = 0;
+    }
+  }
+  PreAnswerQuit();
+}
+
+}  // namespace proto_fuzzer
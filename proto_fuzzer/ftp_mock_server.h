@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief FtpMockServer — an in-process FTP server that answers curl's
+///        control-channel commands from an FtpScript and carries listings and
+///        file bodies over separate passive or active data connections.
+
+#ifndef PROTO_FUZZER_FTP_MOCK_SERVER_H_
+#define PROTO_FUZZER_FTP_MOCK_SERVER_H_
+
+#include <curl/curl.h>
+#include <sys/socket.h>
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "curl_fuzzer.pb.h"
+#include "proto_fuzzer/mock_server.h"
+#include "proto_fuzzer/mock_server_base.h"
+
+namespace proto_fuzzer {
+
+/// @class proto_fuzzer::FtpMockServer
+/// @brief In-process FTP peer. The first socket curl opens is the control
+///        connection; the mock greets it, then reads one command line at a
+///        time and replies from the scenario's FtpScript or a built-in
+///        default. After a positive PASV/EPSV reply the next socket curl opens
+///        becomes the passive data connection. Any other socket curl opens is
+///        the one it listens on for active mode: the mock hands out a real
+///        socket for curl to bind, and connects to the address curl sends in
+///        PORT/EPRT when a transfer starts. Transfers stream in bounded chunks
+///        from the drive loop, and end with a close of the data connection
+///        and a 226 on the control connection.
+class FtpMockServer : public MockServerBase {
+ public:
+  FtpMockServer();
+  ~FtpMockServer() override;
+
+  void SetScript(const curl::fuzzer::proto::FtpScript& script);
+
+ protected:
+  curl_socket_t HandleOpenSocket(const struct curl_sockaddr* address) override;
+  void RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Scenario& scenario) override;
+
+ private:
+  /// What the data connection is being used for.
+  enum class DataState {
+    kIdle,       ///< No transfer in progress.
+    kSending,    ///< Streaming a listing or file body to curl.
+    kReceiving,  ///< Draining an upload until curl closes the connection.
+  };
+
+  bool ServiceControl();
+  bool ServiceData();
+  void HandleCommand(const std::string& verb, const std::string& argument);
+  bool TakeScriptedReply(const std::string& verb, std::string* reply);
+  void SendReply(const std::string& reply, bool unsplit = false);
+  void SendTransferDone();
+  void PreAnswerQuit();
+  void StartTransfer(const std::string& verb, const std::string* scripted);
+  bool ConnectActiveData();
+
+  /// The scenario's script; owned by the Scenario, which outlives the run.
+  const curl::fuzzer::proto::FtpScript* script_;
+  /// Which scripted replies have been used, parallel to script_->replies().
+  std::vector<bool> reply_used_;
+  /// Bytes read from the control connection that don't yet form a line.
+  std::string command_buffer_;
+
+  /// The data connection, passive or active, if one is open.
+  std::unique_ptr<MockConnection> data_;
+  /// Set by a positive PASV/EPSV reply: the next socket curl opens is data.
+  bool passive_pending_;
+  /// Set by a positive PORT/EPRT reply: connect to active_addr_ on transfer.
+  bool active_pending_;
+  /// Address curl listens on for active mode, parsed from PORT/EPRT.
+  struct sockaddr_storage active_addr_;
+  socklen_t active_addr_len_;
+
+  DataState data_state_;
+  /// Listing or file body being sent, and how much of it has been.
+  const std::string* payload_;
+  std::size_t payload_offset_;
+  /// Offset from the last REST, applied to the next RETR.
+  std::size_t restart_offset_;
+  /// Set once curl's QUIT has been answered.
+  bool quit_seen_;
+};
+
+}  // namespace proto_fuzzer
+
+#endif  // PROTO_FUZZER_FTP_MOCK_SERVER_H_
@@ -9,20 +9,106 @@
 ///        Wires DEFINE_BINARY_PROTO_FUZZER to ScenarioRunner::Run.
 
 #include <curl/curl.h>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
 #include <libprotobuf-mutator/src/libfuzzer/libfuzzer_macro.h>
 
+#include <csignal>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "curl_fuzzer.pb.h"
+#include "curl_fuzzer_alloc.h"
+#include "curl_fuzzer_complexity.h"
+#include "curl_fuzzer_digest.h"
 #include "proto_fuzzer/scenario_runner.h"
 
 namespace {
 
 // Wire curl_global_init once so repeated fuzz iterations don't pay for it on every call. libFuzzer reuses the process;
-// static ctors run once.
+// static ctors run once. Goes through fuzz_alloc_global_init so FUZZ_ALLOC_STATS can install its counting allocators
+// before curl allocates anything. SIGPIPE is ignored as in the TLV fuzzer: the reactive mocks can answer a command
+// after curl has closed the socket, which must be a failed write rather than a crash.
 struct CurlGlobalBootstrap {
-  CurlGlobalBootstrap() { curl_global_init(CURL_GLOBAL_ALL); }
+  CurlGlobalBootstrap() {
+    signal(SIGPIPE, SIG_IGN);
+    fuzz_alloc_global_init(CURL_GLOBAL_ALL);
+  }
 };
 const CurlGlobalBootstrap kGlobalBootstrap;
 
+/// @brief The largest string or bytes field found in a message tree.
+struct LargestField {
+  google::protobuf::Message* message = nullptr;
+  const google::protobuf::FieldDescriptor* field = nullptr;
+  int index = -1;  // -1 for singular fields.
+  std::size_t size = 0;
+};
+
+/// @brief Walk every set field of a message, recording the largest string or bytes value in @p largest.
+/// @param message Message to search; nested messages are searched too.
+/// @param largest Updated in place when a larger value is found.
+void FindLargestField(google::protobuf::Message* message, LargestField* largest) {
+  const google::protobuf::Reflection* reflection = message->GetReflection();
+  std::vector<const google::protobuf::FieldDescriptor*> fields;
+  reflection->ListFields(*message, &fields);
+
+  for (const google::protobuf::FieldDescriptor* field : fields) {
+    const int count = field->is_repeated() ? reflection->FieldSize(*message, field) : 1;
+    for (int i = 0; i < count; ++i) {
+      const int index = field->is_repeated() ? i : -1;
+      if (field->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
+        FindLargestField(index < 0 ? reflection->MutableMessage(message, field)
+                                   : reflection->MutableRepeatedMessage(message, field, index),
+                         largest);
+      } else if (field->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_STRING) {
+        const std::size_t size = index < 0 ? reflection->GetString(*message, field).size()
+                                           : reflection->GetRepeatedString(*message, field, index).size();
+        if (size > largest->size) {
+          *largest = LargestField{message, field, index, size};
+        }
+      }
+    }
+  }
+}
+
+/// @brief Complexity oracle callback: runs a copy of the scenario with its largest string or bytes field repeated
+///        @p factor times.
+/// @param ctx The original Scenario.
+/// @param factor How many copies of the field's value to use.
+/// @return Serialised size of the grown scenario, or 0 if there was nothing to grow.
+std::size_t RunGrownScenario(const void* ctx, unsigned int factor) {
+  curl::fuzzer::proto::Scenario grown(*static_cast<const curl::fuzzer::proto::Scenario*>(ctx));
+  LargestField largest;
+  FindLargestField(&grown, &largest);
+  if (largest.field == nullptr || largest.size * factor > FUZZ_COMPLEXITY_MAX_GROWN) {
+    return 0;
+  }
+
+  const google::protobuf::Reflection* reflection = largest.message->GetReflection();
+  const std::string value = largest.index < 0
+                                ? reflection->GetString(*largest.message, largest.field)
+                                : reflection->GetRepeatedString(*largest.message, largest.field, largest.index);
+  std::string repeated;
+  repeated.reserve(value.size() * factor);
+  for (unsigned int i = 0; i < factor; ++i) {
+    repeated += value;
+  }
+  if (largest.index < 0) {
+    reflection->SetString(largest.message, largest.field, std::move(repeated));
+  } else {
+    reflection->SetRepeatedString(largest.message, largest.field, largest.index, std::move(repeated));
+  }
+
+  // Keep the grown run out of the scenario's behaviour digest.
+  fuzz_digest_pause(1);
+  proto_fuzzer::ScenarioRunner().Run(grown);
+  fuzz_digest_pause(0);
+  return grown.ByteSizeLong();
+}
+
 }  // namespace
 
 /// @brief libFuzzer entry point. libFuzzer will call this function with a valid Scenario protobuf message on each
@@ -30,5 +116,9 @@ const CurlGlobalBootstrap kGlobalBootstrap;
 /// scenario execution will be reported by libFuzzer as fuzzing bugs.
 /// @param scenario The Scenario describing the curl operations to perform.
 DEFINE_BINARY_PROTO_FUZZER(const curl::fuzzer::proto::Scenario& scenario) {
+  fuzz_complexity_begin_input();
   proto_fuzzer::ScenarioRunner().Run(scenario);
+  if (fuzz_complexity_enabled()) {
+    fuzz_complexity_end_input(scenario.ByteSizeLong(), RunGrownScenario, &scenario);
+  }
 }
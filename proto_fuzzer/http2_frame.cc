@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief Implementation of SerializeHttp2Frame and EncodeHpackBlock.
+
+#include "proto_fuzzer/http2_frame.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace proto_fuzzer {
+
+namespace {
+
+// RFC 7541 §6 representation patterns and the prefix width of the integer
+// that follows each.
+constexpr std::uint8_t kIndexedPattern = 0x80;
+constexpr int kIndexedPrefix = 7;
+constexpr std::uint8_t kLiteralIndexedPattern = 0x40;
+constexpr int kLiteralIndexedPrefix = 6;
+constexpr std::uint8_t kLiteralPattern = 0x00;
+constexpr std::uint8_t kLiteralNeverIndexedPattern = 0x10;
+constexpr int kLiteralPrefix = 4;
+constexpr std::uint8_t kTableSizePattern = 0x20;
+constexpr int kTableSizePrefix = 5;
+constexpr int kStringPrefix = 7;
+
+/// Append 'value' as an HPACK integer (RFC 7541 §5.1) with an N-bit prefix,
+/// the bits above the prefix taken from 'pattern'.
+void AppendHpackInteger(std::string* out, std::uint8_t pattern, int prefix_bits, std::uint64_t value) {
+  const std::uint64_t max_prefix = (1u << prefix_bits) - 1;
+  if (value < max_prefix) {
+    out->push_back(static_cast<char>(pattern | value));
+    return;
+  }
+  out->push_back(static_cast<char>(pattern | max_prefix));
+  value -= max_prefix;
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+/// Append 'value' as an HPACK string literal (§5.2), Huffman bit clear.
+void AppendHpackString(std::string* out, const std::string& value) {
+  AppendHpackInteger(out, 0x00, kStringPrefix, value.size());
+  out->append(value);
+}
+
+/// Append a literal field (§6.2) whose name is table entry 'field.index()',
+/// or the literal 'field.name()' when the index is 0.
+void AppendHpackLiteral(std::string* out, std::uint8_t pattern, int prefix_bits,
+                        const curl::fuzzer::proto::HpackField& field) {
+  AppendHpackInteger(out, pattern, prefix_bits, field.index());
+  if (field.index() == 0) {
+    AppendHpackString(out, field.name());
+  }
+  AppendHpackString(out, field.value());
+}
+
+}  // namespace
+
+/// Append a frame header: 24-bit length, type, flags and the 31-bit stream
+/// identifier with its reserved bit clear.
+/// @param out       Destination buffer.
+/// @param length    Payload length to declare.
+/// @param type      Frame type.
+/// @param flags     Frame flags.
+/// @param stream_id Stream the frame belongs to.
+void AppendHttp2FrameHeader(std::string* out, std::uint32_t length, std::uint8_t type, std::uint8_t flags,
+                            std::uint32_t stream_id) {
+  out->push_back(static_cast<char>((length >> 16) & 0xFF));
+  out->push_back(static_cast<char>((length >> 8) & 0xFF));
+  out->push_back(static_cast<char>(length & 0xFF));
+  out->push_back(static_cast<char>(type));
+  out->push_back(static_cast<char>(flags));
+  out->push_back(static_cast<char>((stream_id >> 24) & 0x7F));
+  out->push_back(static_cast<char>((stream_id >> 16) & 0xFF));
+  out->push_back(static_cast<char>((stream_id >> 8) & 0xFF));
+  out->push_back(static_cast<char>(stream_id & 0xFF));
+}
+
+/// Encode a header block. Each field is written in the representation it
+/// names, so indexes past the end of curl's tables and size updates past
+/// its limit reach the decoder.
+/// @param fields The fields, in order.
+/// @return the header block bytes.
+std::string EncodeHpackBlock(const google::protobuf::RepeatedPtrField<curl::fuzzer::proto::HpackField>& fields) {
+  std::string block;
+  for (const auto& field : fields) {
+    switch (field.representation()) {
+      case curl::fuzzer::proto::HpackField::LITERAL_INDEXED:
+        AppendHpackLiteral(&block, kLiteralIndexedPattern, kLiteralIndexedPrefix, field);
+        break;
+      case curl::fuzzer::proto::HpackField::LITERAL_NEVER_INDEXED:
+        AppendHpackLiteral(&block, kLiteralNeverIndexedPattern, kLiteralPrefix, field);
+        break;
+      case curl::fuzzer::proto::HpackField::INDEXED:
+        AppendHpackInteger(&block, kIndexedPattern, kIndexedPrefix, field.index());
+        break;
+      case curl::fuzzer::proto::HpackField::TABLE_SIZE_UPDATE:
+        AppendHpackInteger(&block, kTableSizePattern, kTableSizePrefix, field.index());
+        break;
+      case curl::fuzzer::proto::HpackField::LITERAL:
+      default:
+        AppendHpackLiteral(&block, kLiteralPattern, kLiteralPrefix, field);
+        break;
+    }
+  }
+  return block;
+}
+
+/// Serialise a proto Http2Frame into wire bytes: the frame header, then the
+/// payload with any header block appended.
+/// @param frame     The Http2Frame proto message to render.
+/// @param stream_id Stream identifier to write, masked to 31 bits.
+/// @return The serialised byte string, ready to push onto the mock socket.
+std::string SerializeHttp2Frame(const curl::fuzzer::proto::Http2Frame& frame, std::uint32_t stream_id) {
+  std::string payload = frame.payload();
+  if (!frame.headers().empty()) {
+    payload += EncodeHpackBlock(frame.headers());
+  }
+  const std::uint32_t length = frame.length() != 0 ? frame.length() : static_cast<std::uint32_t>(payload.size());
+
+  std::string out;
+  out.reserve(9 + payload.size());
+  AppendHttp2FrameHeader(&out, length, static_cast<std::uint8_t>(frame.type() & 0xFF),
+                         static_cast<std::uint8_t>(frame.flags() & 0xFF), stream_id);
+  if (frame.reserved_bit()) {
+    out[5] = static_cast<char>(out[5] | 0x80);
+  }
+  out.append(payload);
+  return out;
+}
+
+}  // namespace proto_fuzzer
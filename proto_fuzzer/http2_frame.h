@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief Serialize proto Http2Frame messages into RFC 9113 wire bytes, with
+///        header blocks HPACK-encoded per RFC 7541.
+
+#ifndef PROTO_FUZZER_HTTP2_FRAME_H_
+#define PROTO_FUZZER_HTTP2_FRAME_H_
+
+#include <cstdint>
+#include <string>
+
+#include "curl_fuzzer.pb.h"
+
+namespace proto_fuzzer {
+
+// Append a 9-byte frame header to 'out'. 'length' is masked to 24 bits and
+// 'stream_id' to 31.
+void AppendHttp2FrameHeader(std::string* out, std::uint32_t length, std::uint8_t type, std::uint8_t flags,
+                            std::uint32_t stream_id);
+
+// Encode 'fields' as an HPACK header block, without Huffman coding.
+std::string EncodeHpackBlock(const google::protobuf::RepeatedPtrField<curl::fuzzer::proto::HpackField>& fields);
+
+// Render 'frame' into raw wire bytes on stream 'stream_id', which the caller
+// picks from the frame's own stream_id or the stream it is answering. No
+// validation: reserved bits, unknown types and lengths that disagree with
+// the payload round-trip into the byte stream unchanged so the decoder sees
+// them.
+std::string SerializeHttp2Frame(const curl::fuzzer::proto::Http2Frame& frame, std::uint32_t stream_id);
+
+}  // namespace proto_fuzzer
+
+#endif  // PROTO_FUZZER_HTTP2_FRAME_H_
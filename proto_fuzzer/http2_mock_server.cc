@@ -0,0 +1,485 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief Implementation of Http2MockServer.
+
+#include "proto_fuzzer/http2_mock_server.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "curl_fuzzer_digest.h"
+#include "curl_fuzzer_spin.h"
+#include "proto_fuzzer/http2_frame.h"
+#include "proto_fuzzer/mock_server.h"
+
+namespace proto_fuzzer {
+
+namespace {
+
+// Caps so a mutator that piles up entries can't dominate runtime.
+constexpr std::size_t kMaxScriptedResponses = 64;
+constexpr std::size_t kMaxScriptedFrames = 64;
+constexpr std::size_t kMaxSettings = 64;
+constexpr std::size_t kMaxStreams = 256;
+constexpr std::uint64_t kMaxBodyBytes = 1024 * 1024;
+
+// Generated DATA bytes written per drive-loop iteration. Well inside a
+// socketpair's buffer, so a burst is never cut short by a full socket.
+constexpr std::size_t kStreamBurstBytes = 16 * 1024;
+
+// Largest frame from curl the mock buffers. curl's frames are bounded by the
+// mock's SETTINGS_MAX_FRAME_SIZE; anything beyond this means the stream is
+// out of step.
+constexpr std::uint32_t kMaxClientFrame = 1024 * 1024;
+
+// RFC 9113 §3.4 client connection preface.
+constexpr char kClientPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+constexpr std::size_t kClientPrefaceSize = sizeof(kClientPreface) - 1;
+
+constexpr std::size_t kFrameHeaderSize = 9;
+
+// RFC 9113 §6 frame types and flags.
+constexpr std::uint8_t kTypeData = 0;
+constexpr std::uint8_t kTypeHeaders = 1;
+constexpr std::uint8_t kTypeRstStream = 3;
+constexpr std::uint8_t kTypeSettings = 4;
+constexpr std::uint8_t kTypePing = 6;
+constexpr std::uint8_t kTypeGoaway = 7;
+constexpr std::uint8_t kTypeWindowUpdate = 8;
+constexpr std::uint8_t kTypeContinuation = 9;
+constexpr std::uint8_t kFlagAck = 0x1;
+constexpr std::uint8_t kFlagEndStream = 0x1;
+constexpr std::uint8_t kFlagEndHeaders = 0x4;
+
+// RFC 9113 §6.5.2 settings the mock tracks, and their defaults and limits.
+constexpr std::uint32_t kSettingsInitialWindowSize = 4;
+constexpr std::uint32_t kSettingsMaxFrameSize = 5;
+constexpr std::int64_t kDefaultWindow = 65535;
+constexpr std::int64_t kMaxWindow = 0x7FFFFFFF;
+constexpr std::uint32_t kDefaultMaxFrameSize = 16384;
+constexpr std::uint32_t kMaxFrameSizeLimit = 0xFFFFFF;
+
+// RFC 9113 §7 error codes.
+constexpr std::uint32_t kNoError = 0;
+constexpr std::uint32_t kProtocolError = 1;
+constexpr std::uint32_t kFrameSizeError = 6;
+
+// HPACK static table entry 8 (RFC 7541 Appendix A), ":status: 200".
+constexpr char kStatus200Block[] = "\x88";
+
+/// Append 'value' as a big-endian 32-bit integer to 'out'.
+void AppendUint32(std::string* out, std::uint32_t value) {
+  out->push_back(static_cast<char>((value >> 24) & 0xFF));
+  out->push_back(static_cast<char>((value >> 16) & 0xFF));
+  out->push_back(static_cast<char>((value >> 8) & 0xFF));
+  out->push_back(static_cast<char>(value & 0xFF));
+}
+
+/// @return the big-endian integer of 'width' bytes at 'offset' in 'data'.
+std::uint32_t ReadBigEndian(const std::string& data, std::size_t offset, std::size_t width) {
+  std::uint32_t value = 0;
+  for (std::size_t i = 0; i < width; ++i) {
+    value = (value << 8) | static_cast<unsigned char>(data[offset + i]);
+  }
+  return value;
+}
+
+}  // namespace
+
+/// Construct an idle Http2MockServer. RunLoop() seeds it from the scenario
+/// before curl opens the connection.
+Http2MockServer::Http2MockServer()
+    : script_(nullptr),
+      preface_seen_(false),
+      closed_(false),
+      last_stream_id_(0),
+      responses_sent_(0),
+      body_budget_used_(0),
+      connection_window_(kDefaultWindow),
+      initial_window_(kDefaultWindow),
+      max_frame_size_(kDefaultMaxFrameSize) {}
+
+/// Default destructor; the MockConnection closes its socket.
+Http2MockServer::~Http2MockServer() = default;
+
+void Http2MockServer::Install(CURL* easy) {
+  MockServerBase::Install(easy);
+  curl_easy_setopt(easy, CURLOPT_HTTP_VERSION, static_cast<long>(CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE));
+}
+
+/// Use 'script' for the rest of the scenario.
+/// @param script The scenario's Http2Script; must outlive the run.
+void Http2MockServer::SetScript(const curl::fuzzer::proto::Http2Script& script) { script_ = &script; }
+
+/// Called by the OPENSOCKETFUNCTION trampoline in the base class. HTTP/2
+/// uses a single connection, and the server preface may go out before the
+/// client's.
+curl_socket_t Http2MockServer::HandleOpenSocket(const struct curl_sockaddr* /*address*/) {
+  if (connection_) {
+    return CURL_SOCKET_BAD;
+  }
+  connection_ = std::make_unique<MockConnection>();
+  if (!connection_->ok()) {
+    connection_.reset();
+    return CURL_SOCKET_BAD;
+  }
+  ApplyPendingBackpressure();
+
+  std::string settings;
+  const std::size_t count = std::min<std::size_t>(kMaxSettings, script_->settings_size());
+  for (std::size_t i = 0; i < count; ++i) {
+    const auto& setting = script_->settings(static_cast<int>(i));
+    settings.push_back(static_cast<char>((setting.id() >> 8) & 0xFF));
+    settings.push_back(static_cast<char>(setting.id() & 0xFF));
+    AppendUint32(&settings, setting.value());
+  }
+  SendFrame(kTypeSettings, 0, 0, settings);
+  const std::size_t frames = std::min<std::size_t>(kMaxScriptedFrames, script_->preface_frames_size());
+  for (std::size_t i = 0; i < frames; ++i) {
+    const auto& frame = script_->preface_frames(static_cast<int>(i));
+    SendBytes(SerializeHttp2Frame(frame, frame.stream_id()));
+  }
+  return connection_->take_client_fd();
+}
+
+/// Write already-serialised frame bytes to curl.
+/// @param bytes One or more whole frames.
+void Http2MockServer::SendBytes(const std::string& bytes) {
+  if (connection_ && !closed_ && !bytes.empty()) {
+    connection_->WriteAll(reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size());
+  }
+}
+
+/// Write one frame the mock builds itself.
+void Http2MockServer::SendFrame(std::uint8_t type, std::uint8_t flags, std::uint32_t stream_id,
+                                const std::string& payload) {
+  std::string frame;
+  frame.reserve(kFrameHeaderSize + payload.size());
+  AppendHttp2FrameHeader(&frame, static_cast<std::uint32_t>(payload.size()), type, flags, stream_id);
+  frame.append(payload);
+  SendBytes(frame);
+}
+
+/// Send GOAWAY with 'error_code', stop streaming and half-close the
+/// connection.
+/// @param error_code RFC 9113 §7 error code for the GOAWAY.
+void Http2MockServer::Close(std::uint32_t error_code) {
+  if (connection_ && !closed_) {
+    std::string payload;
+    AppendUint32(&payload, last_stream_id_);
+    AppendUint32(&payload, error_code);
+    SendFrame(kTypeGoaway, 0, 0, payload);
+    closed_ = true;
+    sending_.clear();
+    connection_->ShutdownWrite();
+  }
+}
+
+/// Apply the settings in a SETTINGS frame from curl that change what the
+/// mock may send: the initial stream window, which moves every open
+/// stream's window by the difference (RFC 9113 §6.9.2), and the largest
+/// frame payload.
+/// @param payload The frame payload, six bytes per setting.
+void Http2MockServer::HandleSettings(const std::string& payload) {
+  for (std::size_t offset = 0; offset + 6 <= payload.size(); offset += 6) {
+    const std::uint32_t id = ReadBigEndian(payload, offset, 2);
+    const std::uint32_t value = ReadBigEndian(payload, offset + 2, 4);
+    if (id == kSettingsInitialWindowSize && value <= kMaxWindow) {
+      const std::int64_t delta = static_cast<std::int64_t>(value) - initial_window_;
+      for (auto& entry : streams_) {
+        entry.second.send_window += delta;
+      }
+      initial_window_ = value;
+    } else if (id == kSettingsMaxFrameSize) {
+      max_frame_size_ = std::min(std::max(value, kDefaultMaxFrameSize), kMaxFrameSizeLimit);
+    }
+  }
+}
+
+/// Answer a stream once curl has sent its whole request: the scenario's next
+/// Http2Response, or a bare 200. A generated body is queued for StreamBurst.
+/// @param stream_id The stream to consider.
+void Http2MockServer::MaybeAnswer(std::uint32_t stream_id) {
+  auto it = streams_.find(stream_id);
+  if (it == streams_.end()) {
+    return;
+  }
+  Stream& stream = it->second;
+  if (stream.answered || stream.reset || !stream.headers_done || !stream.end_stream) {
+    return;
+  }
+  stream.answered = true;
+
+  const curl::fuzzer::proto::Http2Response* response = nullptr;
+  if (responses_sent_ < std::min<std::size_t>(kMaxScriptedResponses, script_->responses_size())) {
+    response = &script_->responses(static_cast<int>(responses_sent_));
+  }
+  ++responses_sent_;
+
+  std::uint64_t body_size = 0;
+  if (response != nullptr) {
+    body_size = std::min<std::uint64_t>(response->body_size(), kMaxBodyBytes - body_budget_used_);
+  }
+
+  if (response != nullptr && response->frames_size() > 0) {
+    const std::size_t count = std::min<std::size_t>(kMaxScriptedFrames, response->frames_size());
+    for (std::size_t i = 0; i < count; ++i) {
+      const auto& frame = response->frames(static_cast<int>(i));
+      const std::uint32_t target = frame.fixed_stream_id() ? frame.stream_id() : stream_id;
+      const std::string bytes = SerializeHttp2Frame(frame, target);
+      if ((frame.type() & 0xFF) == kTypeData) {
+        // Scripted DATA ignores the windows but still uses them up.
+        const auto size = static_cast<std::int64_t>(bytes.size() - kFrameHeaderSize);
+        connection_window_ -= size;
+        auto target_it = streams_.find(target & 0x7FFFFFFF);
+        if (target_it != streams_.end()) {
+          target_it->second.send_window -= size;
+        }
+      }
+      SendBytes(bytes);
+    }
+  } else {
+    SendFrame(kTypeHeaders, body_size == 0 ? kFlagEndHeaders | kFlagEndStream : kFlagEndHeaders, stream_id,
+              std::string(kStatus200Block, sizeof(kStatus200Block) - 1));
+  }
+
+  if (body_size > 0) {
+    body_budget_used_ += body_size;
+    stream.body_remaining = body_size;
+    stream.data_frame_size = std::min(response->data_frame_size(), kMaxFrameSizeLimit);
+    sending_.push_back(stream_id);
+  }
+}
+
+/// Answer one frame from curl.
+/// @param type      Frame type.
+/// @param flags     Frame flags.
+/// @param stream_id Stream identifier, reserved bit cleared.
+/// @param payload   Frame payload.
+void Http2MockServer::HandleFrame(std::uint8_t type, std::uint8_t flags, std::uint32_t stream_id,
+                                  const std::string& payload) {
+  auto it = streams_.find(stream_id);
+  switch (type) {
+    case kTypeHeaders:
+      if (stream_id == 0) {
+        break;
+      }
+      if (it == streams_.end()) {
+        if (streams_.size() >= kMaxStreams) {
+          break;
+        }
+        it = streams_.emplace(stream_id, Stream()).first;
+        it->second.send_window = initial_window_;
+        last_stream_id_ = std::max(last_stream_id_, stream_id);
+      }
+      it->second.headers_done = (flags & kFlagEndHeaders) != 0;
+      it->second.end_stream = it->second.end_stream || (flags & kFlagEndStream) != 0;
+      MaybeAnswer(stream_id);
+      break;
+    case kTypeContinuation:
+      if (it != streams_.end() && (flags & kFlagEndHeaders) != 0) {
+        it->second.headers_done = true;
+        MaybeAnswer(stream_id);
+      }
+      break;
+    case kTypeData:
+      if (!payload.empty() && !script_->withhold_window_updates()) {
+        // Hand the window straight back, padding included (RFC 9113 §6.9.1).
+        std::string increment;
+        AppendUint32(&increment, static_cast<std::uint32_t>(payload.size()));
+        SendFrame(kTypeWindowUpdate, 0, 0, increment);
+        if ((flags & kFlagEndStream) == 0 && it != streams_.end() && !it->second.reset) {
+          SendFrame(kTypeWindowUpdate, 0, stream_id, increment);
+        }
+      }
+      if (it != streams_.end() && (flags & kFlagEndStream) != 0) {
+        it->second.end_stream = true;
+        MaybeAnswer(stream_id);
+      }
+      break;
+    case kTypeRstStream:
+      if (it != streams_.end()) {
+        it->second.reset = true;
+      }
+      break;
+    case kTypeSettings:
+      if ((flags & kFlagAck) == 0) {
+        HandleSettings(payload);
+        if (!script_->withhold_settings_ack()) {
+          SendFrame(kTypeSettings, kFlagAck, 0, std::string());
+        }
+      }
+      break;
+    case kTypePing:
+      if ((flags & kFlagAck) == 0) {
+        SendFrame(kTypePing, kFlagAck, 0, payload);
+      }
+      break;
+    case kTypeGoaway:
+      Close(kNoError);
+      break;
+    case kTypeWindowUpdate:
+      if (payload.size() >= 4) {
+        const std::int64_t increment = ReadBigEndian(payload, 0, 4) & 0x7FFFFFFF;
+        if (stream_id == 0) {
+          connection_window_ += increment;
+        } else if (it != streams_.end()) {
+          it->second.send_window += increment;
+        }
+      }
+      break;
+    default:
+      // PRIORITY, PUSH_PROMISE (curl never sends one) and extension types
+      // need no answer.
+      break;
+  }
+}
+
+/// Check curl's client preface, then split what it sends into frames and
+/// answer each whole one.
+/// @return true if anything was read.
+bool Http2MockServer::ServiceInput() {
+  if (!connection_) {
+    return false;
+  }
+  const std::size_t before = input_.size();
+  connection_->ReadAvailable(&input_);
+  const bool read = input_.size() != before;
+  if (closed_) {
+    input_.clear();
+    return read;
+  }
+
+  if (!preface_seen_) {
+    const std::size_t size = std::min(input_.size(), kClientPrefaceSize);
+    if (input_.compare(0, size, kClientPreface, size) != 0) {
+      // Not HTTP/2 (a scenario that turned prior knowledge off, say).
+      input_.clear();
+      Close(kProtocolError);
+      return read;
+    }
+    if (size < kClientPrefaceSize) {
+      return read;
+    }
+    input_.erase(0, kClientPrefaceSize);
+    preface_seen_ = true;
+  }
+
+  while (!closed_ && input_.size() >= kFrameHeaderSize) {
+    const std::uint32_t length = ReadBigEndian(input_, 0, 3);
+    if (length > kMaxClientFrame) {
+      input_.clear();
+      Close(kFrameSizeError);
+      break;
+    }
+    if (input_.size() < kFrameHeaderSize + length) {
+      break;
+    }
+    const auto type = static_cast<std::uint8_t>(input_[3]);
+    const auto flags = static_cast<std::uint8_t>(input_[4]);
+    const std::uint32_t stream_id = ReadBigEndian(input_, 5, 4) & 0x7FFFFFFF;
+    const std::string payload = input_.substr(kFrameHeaderSize, length);
+    input_.erase(0, kFrameHeaderSize + length);
+    HandleFrame(type, flags, stream_id, payload);
+  }
+  return read;
+}
+
+/// Send the next burst of generated DATA, taking streams in the order they
+/// were answered and never exceeding the connection's or a stream's window.
+/// A stream whose window is spent waits for curl's WINDOW_UPDATE while the
+/// others carry on.
+/// @return true if any DATA was sent.
+bool Http2MockServer::StreamBurst() {
+  if (!connection_ || closed_) {
+    return false;
+  }
+  std::string burst;
+  for (auto it = sending_.begin(); it != sending_.end() && burst.size() < kStreamBurstBytes;) {
+    Stream& stream = streams_[*it];
+    if (stream.reset || stream.body_remaining == 0) {
+      it = sending_.erase(it);
+      continue;
+    }
+    const std::uint32_t frame_size = stream.data_frame_size != 0 ? stream.data_frame_size : max_frame_size_;
+    const std::int64_t window = std::min(connection_window_, stream.send_window);
+    if (window <= 0) {
+      if (connection_window_ <= 0) {
+        break;
+      }
+      ++it;
+      continue;
+    }
+    const auto size = static_cast<std::size_t>(
+        std::min<std::uint64_t>({static_cast<std::uint64_t>(window), frame_size, stream.body_remaining,
+                                 kStreamBurstBytes - burst.size()}));
+    stream.body_remaining -= size;
+    stream.send_window -= static_cast<std::int64_t>(size);
+    connection_window_ -= static_cast<std::int64_t>(size);
+    const bool last = stream.body_remaining == 0;
+    AppendHttp2FrameHeader(&burst, static_cast<std::uint32_t>(size), kTypeData, last ? kFlagEndStream : 0, *it);
+    for (std::size_t i = 0; i < size; ++i) {
+      burst.push_back(static_cast<char>('a' + (stream.body_remaining + i) % 26));
+    }
+    if (last) {
+      it = sending_.erase(it);
+    }
+  }
+  SendBytes(burst);
+  return !burst.empty();
+}
+
+/// Seed the mock from the scenario, then drive the perform loop until curl is
+/// done or the idle-iteration cap is hit. Each iteration answers whatever
+/// frames curl has sent and, once curl has what was written before, sends
+/// the next burst of generated DATA.
+/// @param multi    caller-owned multi; 'easy' is already added.
+/// @param easy     the curl easy handle attached to this mock.
+/// @param scenario source of the Http2Script.
+void Http2MockServer::RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Scenario& scenario) {
+  SetScript(scenario.connection().http2());
+
+  int still_running = 1;
+  int idle_iterations = 0;
+  CURLMcode rc = CURLM_OK;
+
+  while (still_running && idle_iterations < kMaxIdleIterations) {
+    rc = curl_multi_perform(multi, &still_running);
+    fuzz_spin_note_perform(multi, still_running);
+    fuzz_digest_iteration();
+    if (rc != CURLM_OK) {
+      break;
+    }
+    if (!still_running) {
+      break;
+    }
+    if (connection_ && connection_->FlushFragment()) {
+      idle_iterations = 0;
+    }
+
+    int ready = WaitOnMultiFdset(multi, easy, &rc);
+    if (rc != CURLM_OK) {
+      break;
+    }
+
+    bool progressed = ServiceInput();
+    if (!connection_ || !connection_->fragments_pending()) {
+      progressed = StreamBurst() || progressed;
+    }
+    if (progressed || ready != 0) {
+      idle_iterations = 0;
+    } else {
+      ++idle_iterations;
+    }
+  }
+}
+
+}  // namespace proto_fuzzer
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief Http2MockServer — an in-process HTTP/2 server that exchanges
+///        prefaces and SETTINGS with curl, then answers each request stream
+///        from an Http2Script within curl's flow-control windows.
+
+#ifndef PROTO_FUZZER_HTTP2_MOCK_SERVER_H_
+#define PROTO_FUZZER_HTTP2_MOCK_SERVER_H_
+
+#include <curl/curl.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+
+#include "curl_fuzzer.pb.h"
+#include "proto_fuzzer/mock_server_base.h"
+
+namespace proto_fuzzer {
+
+/// @class proto_fuzzer::Http2MockServer
+/// @brief In-process HTTP/2 peer, spoken with prior knowledge. Sends its
+///        preface as soon as curl connects, splits what curl sends into
+///        frames and answers each the way a server would: SETTINGS and PING
+///        are ACKed, DATA gets its window handed back, and a request stream
+///        curl has finished gets the scenario's next Http2Response. Generated
+///        bodies go out in bursts that never exceed the windows curl has
+///        granted.
+class Http2MockServer : public MockServerBase {
+ public:
+  Http2MockServer();
+  ~Http2MockServer() override;
+
+  /// Install the common socket callbacks via the base, then tell curl to
+  /// speak HTTP/2 without an Upgrade. A scenario's own CURLOPT_HTTP_VERSION
+  /// is applied afterwards and wins.
+  /// @param easy The curl easy handle to configure.
+  void Install(CURL* easy) override;
+
+  void SetScript(const curl::fuzzer::proto::Http2Script& script);
+
+ protected:
+  curl_socket_t HandleOpenSocket(const struct curl_sockaddr* address) override;
+  void RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Scenario& scenario) override;
+
+ private:
+  /// What the mock knows about one stream curl opened.
+  struct Stream {
+    /// Bytes the mock may still send on the stream.
+    std::int64_t send_window = 0;
+    /// Set once curl's header block is complete, and once it has ended the
+    /// stream.
+    bool headers_done = false;
+    bool end_stream = false;
+    /// Set once the stream has been answered.
+    bool answered = false;
+    /// Set once curl has reset the stream.
+    bool reset = false;
+    /// Generated body bytes still to send, and the largest DATA payload.
+    std::uint64_t body_remaining = 0;
+    std::uint32_t data_frame_size = 0;
+  };
+
+  bool ServiceInput();
+  void HandleFrame(std::uint8_t type, std::uint8_t flags, std::uint32_t stream_id, const std::string& payload);
+  void HandleSettings(const std::string& payload);
+  void MaybeAnswer(std::uint32_t stream_id);
+  void SendFrame(std::uint8_t type, std::uint8_t flags, std::uint32_t stream_id, const std::string& payload);
+  void SendBytes(const std::string& bytes);
+  bool StreamBurst();
+  void Close(std::uint32_t error_code);
+
+  /// The scenario's script; owned by the Scenario, which outlives the run.
+  const curl::fuzzer::proto::Http2Script* script_;
+  /// Bytes read from curl that don't yet form a whole frame.
+  std::string input_;
+  /// Set once curl's client preface has been read and checked.
+  bool preface_seen_;
+  /// Set once the mock has closed its side of the connection.
+  bool closed_;
+  /// Streams curl has opened, by identifier, and the highest identifier.
+  std::map<std::uint32_t, Stream> streams_;
+  std::uint32_t last_stream_id_;
+  /// Streams with generated body bytes still to send, in answer order.
+  std::deque<std::uint32_t> sending_;
+  /// Responses sent so far; also the index of the next scripted one.
+  std::size_t responses_sent_;
+  /// Generated body bytes promised so far, against the cap.
+  std::uint64_t body_budget_used_;
+  /// The connection-level window curl has granted, the window new streams
+  /// start with, and the largest frame payload curl accepts.
+  std::int64_t connection_window_;
+  std::int64_t initial_window_;
+  std::uint32_t max_frame_size_;
+};
+
+}  // namespace proto_fuzzer
+
+#endif  // PROTO_FUZZER_HTTP2_MOCK_SERVER_H_
@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief Implementation of SerializeHttpResponse.
+
+#include "proto_fuzzer/http_response.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "proto_fuzzer/body_encoding.h"
+
+namespace proto_fuzzer {
+
+namespace {
+
+constexpr std::uint32_t kDefaultStatus = 200;
+constexpr std::uint32_t kDefaultInterimStatus = 100;
+
+// Codes curl accepts without break_framing: any final code from 100 to
+// 599, and interim codes from 100 to 199.
+constexpr std::uint32_t kMinStatus = 100;
+constexpr std::uint32_t kMaxStatus = 599;
+constexpr std::uint32_t kMaxInterimStatus = 199;
+
+// As many codings as EncodeBody applies.
+constexpr int kMaxEncodingTokens = 8;
+
+/// @return the standard reason phrase for 'code', or "Unknown".
+const char* ReasonPhrase(std::uint32_t code) {
+  switch (code) {
+    case 100:
+      return "Continue";
+    case 101:
+      return "Switching Protocols";
+    case 103:
+      return "Early Hints";
+    case 200:
+      return "OK";
+    case 201:
+      return "Created";
+    case 204:
+      return "No Content";
+    case 206:
+      return "Partial Content";
+    case 301:
+      return "Moved Permanently";
+    case 302:
+      return "Found";
+    case 304:
+      return "Not Modified";
+    case 307:
+      return "Temporary Redirect";
+    case 308:
+      return "Permanent Redirect";
+    case 401:
+      return "Unauthorized";
+    case 404:
+      return "Not Found";
+    case 407:
+      return "Proxy Authentication Required";
+    case 416:
+      return "Range Not Satisfiable";
+    case 500:
+      return "Internal Server Error";
+    default:
+      return "Unknown";
+  }
+}
+
+/// @return 'code' folded into [kMinStatus, max] unless 'raw' is set, so a
+///         mutated code still gives a status line curl accepts.
+std::uint32_t FoldStatus(std::uint32_t code, std::uint32_t max, bool raw) {
+  if (raw || (code >= kMinStatus && code <= max)) {
+    return code;
+  }
+  return kMinStatus + code % (max - kMinStatus + 1);
+}
+
+/// Append 'field' to 'out', dropping CR and LF unless 'raw' is set, so a
+/// mutated field can't end its line early.
+void AppendHeadField(std::string* out, const std::string& field, bool raw) {
+  if (raw) {
+    out->append(field);
+    return;
+  }
+  for (char c : field) {
+    if (c != '\r' && c != '\n') {
+      out->push_back(c);
+    }
+  }
+}
+
+/// @return true if 'name' is 'framing_name' ignoring ASCII case and
+///         surrounding blanks.
+bool IsHeaderNamed(const std::string& name, const char* framing_name) {
+  std::size_t begin = 0;
+  std::size_t end = name.size();
+  while (begin < end && (name[begin] == ' ' || name[begin] == '\t')) {
+    ++begin;
+  }
+  while (end > begin && (name[end - 1] == ' ' || name[end - 1] == '\t')) {
+    --end;
+  }
+  std::size_t i = 0;
+  for (; begin + i < end && framing_name[i] != '\0'; ++i) {
+    if (std::tolower(static_cast<unsigned char>(name[begin + i])) != framing_name[i]) {
+      return false;
+    }
+  }
+  return begin + i == end && framing_name[i] == '\0';
+}
+
+/// Append "Name: value\r\n" lines for 'headers'. Without 'raw', headers
+/// that carry framing are left out, the serializer writing its own, and so
+/// is Content-Encoding when 'encoded' says the serializer writes that too.
+void AppendHeaders(std::string* out, const google::protobuf::RepeatedPtrField<curl::fuzzer::proto::HttpHeader>& headers,
+                   bool raw, bool encoded = false) {
+  for (const auto& header : headers) {
+    if (!raw && (IsHeaderNamed(header.name(), "content-length") || IsHeaderNamed(header.name(), "transfer-encoding") ||
+                 (encoded && IsHeaderNamed(header.name(), "content-encoding")))) {
+      continue;
+    }
+    AppendHeadField(out, header.name(), raw);
+    out->append(": ");
+    AppendHeadField(out, header.value(), raw);
+    out->append("\r\n");
+  }
+}
+
+/// Append a status line: version, three-or-more digit code and reason.
+void AppendStatusLine(std::string* out, const char* version, std::uint32_t code, const std::string& reason, bool raw) {
+  char line[48];
+  std::snprintf(line, sizeof(line), "%s %03u ", version, code);
+  out->append(line);
+  if (reason.empty()) {
+    out->append(ReasonPhrase(code));
+  } else {
+    AppendHeadField(out, reason, raw);
+  }
+  out->append("\r\n");
+}
+
+/// Append 'body' as chunks cut to 'response.chunk_sizes()', then the last
+/// chunk and trailers.
+void AppendChunkedBody(std::string* out, const curl::fuzzer::proto::HttpResponse& response, const std::string& body) {
+  const bool raw = response.break_framing();
+  const std::int64_t adjust = raw ? response.length_adjust() : 0;
+  int next_size = 0;
+  int next_extension = 0;
+  std::uint32_t size = 0;
+  auto append_size_line = [&](std::size_t real_size) {
+    const std::int64_t declared = std::max<std::int64_t>(0, static_cast<std::int64_t>(real_size) + adjust);
+    char line[24];
+    std::snprintf(line, sizeof(line), "%llx", static_cast<unsigned long long>(declared));
+    out->append(line);
+    if (next_extension < response.chunk_extensions_size()) {
+      const std::string& extension = response.chunk_extensions(next_extension++);
+      if (raw) {
+        out->append(extension);
+      } else {
+        // Write the separator here, so an extension can't run into the
+        // size as more hex digits.
+        out->push_back(';');
+        AppendHeadField(out, extension.substr(!extension.empty() && extension[0] == ';' ? 1 : 0), false);
+      }
+    }
+    out->append("\r\n");
+  };
+
+  for (std::size_t offset = 0; offset < body.size();) {
+    while (next_size < response.chunk_sizes_size()) {
+      const std::uint32_t candidate = response.chunk_sizes(next_size++);
+      if (candidate != 0) {
+        size = candidate;
+        break;
+      }
+    }
+    const std::size_t take = size == 0 ? body.size() - offset : std::min<std::size_t>(size, body.size() - offset);
+    append_size_line(take);
+    out->append(body, offset, take);
+    out->append("\r\n");
+    offset += take;
+  }
+  append_size_line(0);
+  AppendHeaders(out, response.trailers(), raw);
+  out->append("\r\n");
+}
+
+}  // namespace
+
+/// Serialise a proto HttpResponse into HTTP/1.x wire bytes: each interim
+/// response, then the final status line, headers, framing header and body,
+/// the body content-coded and corrupted first if the response says so.
+/// @param response The HttpResponse proto message to render.
+/// @return The serialised byte string, ready to push onto the mock socket.
+std::string SerializeHttpResponse(const curl::fuzzer::proto::HttpResponse& response) {
+  const bool raw = response.break_framing();
+  const char* version = response.version() == curl::fuzzer::proto::HttpResponse::HTTP_1_0 ? "HTTP/1.0" : "HTTP/1.1";
+  std::string body = response.encodings().empty() ? response.body() : EncodeBody(response.body(), response.encodings());
+  if (response.has_corruption()) {
+    CorruptBody(response.corruption(), &body);
+  }
+  std::string out;
+  out.reserve(256 + body.size());
+
+  for (const auto& interim : response.interim()) {
+    const std::uint32_t code =
+        FoldStatus(interim.status_code() != 0 ? interim.status_code() : kDefaultInterimStatus, kMaxInterimStatus, raw);
+    AppendStatusLine(&out, version, code, std::string(), raw);
+    AppendHeaders(&out, interim.headers(), raw);
+    out.append("\r\n");
+  }
+
+  const std::uint32_t code =
+      FoldStatus(response.status_code() != 0 ? response.status_code() : kDefaultStatus, kMaxStatus, raw);
+  AppendStatusLine(&out, version, code, response.reason(), raw);
+  AppendHeaders(&out, response.headers(), raw, !response.encodings().empty());
+  if (!response.encodings().empty()) {
+    out.append("Content-Encoding: ");
+    const int count = std::min(kMaxEncodingTokens, response.encodings_size());
+    for (int i = 0; i < count; ++i) {
+      out.append(i == 0 ? "" : ", ");
+      out.append(BodyEncodingToken(response.encodings(i)));
+    }
+    out.append("\r\n");
+  }
+
+  switch (response.framing()) {
+    case curl::fuzzer::proto::HttpResponse::FRAMING_CHUNKED:
+      out.append("Transfer-Encoding: chunked\r\n\r\n");
+      AppendChunkedBody(&out, response, body);
+      break;
+    case curl::fuzzer::proto::HttpResponse::FRAMING_CLOSE:
+      out.append("\r\n");
+      out.append(body);
+      break;
+    case curl::fuzzer::proto::HttpResponse::FRAMING_NONE:
+      out.append("\r\n");
+      break;
+    case curl::fuzzer::proto::HttpResponse::FRAMING_CONTENT_LENGTH:
+    default: {
+      const std::int64_t declared = static_cast<std::int64_t>(body.size()) + (raw ? response.length_adjust() : 0);
+      out.append("Content-Length: ");
+      out.append(std::to_string(declared));
+      out.append("\r\n\r\n");
+      out.append(body);
+      break;
+    }
+  }
+  return out;
+}
+
+}  // namespace proto_fuzzer
@@ -0,0 +1,27 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief Serialize a proto HttpResponse message into HTTP/1.x wire bytes.
+
+#ifndef PROTO_FUZZER_HTTP_RESPONSE_H_
+#define PROTO_FUZZER_HTTP_RESPONSE_H_
+
+#include <string>
+
+#include "curl_fuzzer.pb.h"
+
+namespace proto_fuzzer {
+
+// Render 'response', interim responses first, into raw HTTP/1.x bytes. The
+// framing matches the body unless the response sets break_framing, in which
+// case contradicting headers, CR/LF in head fields and adjusted lengths
+// round-trip into the byte stream unchanged so the parser sees them.
+std::string SerializeHttpResponse(const curl::fuzzer::proto::HttpResponse& response);
+
+}  // namespace proto_fuzzer
+
+#endif  // PROTO_FUZZER_HTTP_RESPONSE_H_
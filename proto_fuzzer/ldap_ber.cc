@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief Implementation of SerializeLdapMessage and ParseLdapRequest.
+
+#include "proto_fuzzer/ldap_ber.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace proto_fuzzer {
+
+namespace {
+
+// Universal tags (X.690 §8) and the LDAP application tags (RFC 4511 §4.2)
+// the typed ops stand for.
+constexpr std::uint8_t kTagInteger = 0x02;
+constexpr std::uint8_t kTagOctetString = 0x04;
+constexpr std::uint8_t kTagEnumerated = 0x0A;
+constexpr std::uint8_t kTagSequence = 0x30;
+constexpr std::uint8_t kTagSet = 0x31;
+constexpr std::uint8_t kTagBindResponse = 0x61;
+constexpr std::uint8_t kTagSearchResultEntry = 0x64;
+constexpr std::uint8_t kTagSearchResultDone = 0x65;
+
+// Eight length octets are as many as a 64-bit liblber accepts; the ninth is
+// there to be rejected.
+constexpr std::uint32_t kMaxLengthOctets = 9;
+
+// Longest length form the request parser follows; curl never sends
+// messages anywhere near 4 GiB.
+constexpr std::size_t kMaxRequestLengthOctets = 4;
+
+/// Append the BER length 'value' to 'out'. Form 0 is the minimal definite
+/// encoding; form N is the long form with N octets, holding the low N bytes
+/// of 'value' big-endian.
+void AppendLength(std::string* out, std::uint64_t value, std::uint32_t form) {
+  if (form == 0) {
+    if (value < 0x80) {
+      out->push_back(static_cast<char>(value));
+      return;
+    }
+    for (std::uint64_t rest = value; rest != 0; rest >>= 8) {
+      ++form;
+    }
+  }
+  if (form > kMaxLengthOctets) {
+    form = kMaxLengthOctets;
+  }
+  out->push_back(static_cast<char>(0x80 | form));
+  for (std::uint32_t i = form; i > 0; --i) {
+    const std::uint32_t shift = 8 * (i - 1);
+    out->push_back(shift < 64 ? static_cast<char>((value >> shift) & 0xFF) : '\0');
+  }
+}
+
+/// Append one TLV to 'out'.
+void AppendTlv(std::string* out, std::uint8_t tag, const std::string& content, std::uint32_t form) {
+  out->push_back(static_cast<char>(tag));
+  AppendLength(out, content.size(), form);
+  out->append(content);
+}
+
+/// Append 'value' as a minimal two's-complement INTEGER (or ENUMERATED).
+void AppendInteger(std::string* out, std::uint8_t tag, std::int64_t value, std::uint32_t form) {
+  std::string content;
+  for (int shift = 56; shift >= 0; shift -= 8) {
+    content.push_back(static_cast<char>((static_cast<std::uint64_t>(value) >> shift) & 0xFF));
+  }
+  // Drop leading octets that only repeat the sign bit of the next one.
+  std::size_t skip = 0;
+  while (skip + 1 < content.size()) {
+    const auto lead = static_cast<unsigned char>(content[skip]);
+    const auto next = static_cast<unsigned char>(content[skip + 1]);
+    if ((lead == 0x00 && (next & 0x80) == 0) || (lead == 0xFF && (next & 0x80) != 0)) {
+      ++skip;
+    } else {
+      break;
+    }
+  }
+  AppendTlv(out, tag, content.substr(skip), form);
+}
+
+/// Render an LDAPResult (RFC 4511 §4.1.9) under 'tag'.
+void AppendResult(std::string* out, std::uint8_t tag, const curl::fuzzer::proto::LdapResult& result,
+                  std::uint32_t form) {
+  std::string content;
+  AppendInteger(&content, kTagEnumerated, result.result_code(), form);
+  AppendTlv(&content, kTagOctetString, result.matched_dn(), form);
+  AppendTlv(&content, kTagOctetString, result.diagnostic_message(), form);
+  AppendTlv(out, tag, content, form);
+}
+
+/// Render a SearchResultEntry (RFC 4511 §4.5.2).
+void AppendEntry(std::string* out, const curl::fuzzer::proto::LdapEntry& entry, std::uint32_t form) {
+  std::string attributes;
+  for (const auto& attribute : entry.attributes()) {
+    std::string values;
+    for (const std::string& value : attribute.values()) {
+      AppendTlv(&values, kTagOctetString, value, form);
+    }
+    std::string partial;
+    AppendTlv(&partial, kTagOctetString, attribute.type(), form);
+    AppendTlv(&partial, kTagSet, values, form);
+    AppendTlv(&attributes, kTagSequence, partial, form);
+  }
+  std::string content;
+  AppendTlv(&content, kTagOctetString, entry.dn(), form);
+  AppendTlv(&content, kTagSequence, attributes, form);
+  AppendTlv(out, kTagSearchResultEntry, content, form);
+}
+
+/// Read a definite BER length from 'in' at '*pos', advancing past it.
+LdapParse ReadLength(const std::string& in, std::size_t* pos, std::uint64_t* length) {
+  if (*pos >= in.size()) {
+    return LdapParse::kNeedMore;
+  }
+  const auto first = static_cast<unsigned char>(in[(*pos)++]);
+  if ((first & 0x80) == 0) {
+    *length = first;
+    return LdapParse::kOk;
+  }
+  const std::size_t octets = first & 0x7F;
+  if (octets == 0 || octets > kMaxRequestLengthOctets) {
+    return LdapParse::kMalformed;
+  }
+  if (*pos + octets > in.size()) {
+    return LdapParse::kNeedMore;
+  }
+  *length = 0;
+  for (std::size_t i = 0; i < octets; ++i) {
+    *length = (*length << 8) | static_cast<unsigned char>(in[(*pos)++]);
+  }
+  return LdapParse::kOk;
+}
+
+}  // namespace
+
+std::string SerializeLdapMessage(const curl::fuzzer::proto::LdapMessage& message, std::int64_t message_id) {
+  const std::uint32_t form = message.length_octets();
+  std::string content;
+  AppendInteger(&content, kTagInteger, message_id + message.message_id_adjust(), form);
+  switch (message.op_case()) {
+    case curl::fuzzer::proto::LdapMessage::kBindResponse:
+      AppendResult(&content, kTagBindResponse, message.bind_response(), form);
+      break;
+    case curl::fuzzer::proto::LdapMessage::kSearchEntry:
+      AppendEntry(&content, message.search_entry(), form);
+      break;
+    case curl::fuzzer::proto::LdapMessage::kSearchDone:
+      AppendResult(&content, kTagSearchResultDone, message.search_done(), form);
+      break;
+    case curl::fuzzer::proto::LdapMessage::kRaw:
+      content += message.raw();
+      break;
+    case curl::fuzzer::proto::LdapMessage::OP_NOT_SET:
+      break;
+  }
+  std::string out;
+  AppendTlv(&out, kTagSequence, content, form);
+  return out;
+}
+
+LdapParse ParseLdapRequest(const std::string& in, LdapRequest* request) {
+  if (in.empty()) {
+    return LdapParse::kNeedMore;
+  }
+  if (static_cast<unsigned char>(in[0]) != kTagSequence) {
+    return LdapParse::kMalformed;
+  }
+  std::size_t pos = 1;
+  std::uint64_t length = 0;
+  LdapParse result = ReadLength(in, &pos, &length);
+  if (result != LdapParse::kOk) {
+    return result;
+  }
+  if (length > in.size() - pos) {
+    return LdapParse::kNeedMore;
+  }
+  const std::size_t end = pos + static_cast<std::size_t>(length);
+
+  // messageID INTEGER, then the protocolOp's tag.
+  if (pos >= end || static_cast<unsigned char>(in[pos++]) != kTagInteger) {
+    return LdapParse::kMalformed;
+  }
+  std::uint64_t id_length = 0;
+  if (ReadLength(in, &pos, &id_length) != LdapParse::kOk || pos > end || id_length == 0 || id_length > 8 ||
+      id_length >= end - pos) {
+    return LdapParse::kMalformed;
+  }
+  std::int64_t id = static_cast<signed char>(in[pos++]);
+  for (std::uint64_t i = 1; i < id_length; ++i) {
+    id = static_cast<std::int64_t>((static_cast<std::uint64_t>(id) << 8) | static_cast<unsigned char>(in[pos++]));
+  }
+  request->size = end;
+  request->message_id = id;
+  request->op = static_cast<std::uint8_t>(in[pos]);
+  return LdapParse::kOk;
+}
+
+}  // namespace proto_fuzzer
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief Serialize a proto LdapMessage into a BER-encoded LDAPMessage, and
+///        pick the message ID and operation out of one curl sent.
+
+#ifndef PROTO_FUZZER_LDAP_BER_H_
+#define PROTO_FUZZER_LDAP_BER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "curl_fuzzer.pb.h"
+
+namespace proto_fuzzer {
+
+// Render 'message' as an LDAPMessage answering request 'message_id'. No
+// validation: result codes, DNs and non-canonical or truncated lengths
+// round-trip into the byte stream unchanged so liblber sees them.
+std::string SerializeLdapMessage(const curl::fuzzer::proto::LdapMessage& message, std::int64_t message_id);
+
+// What the mock needs to know about one LDAPMessage from curl.
+struct LdapRequest {
+  // Bytes the whole message takes in the input, tag and length included.
+  std::size_t size = 0;
+  std::int64_t message_id = 0;
+  // Tag octet of the protocolOp, e.g. 0x60 for a BindRequest.
+  std::uint8_t op = 0;
+};
+
+enum class LdapParse {
+  kOk,
+  kNeedMore,
+  kMalformed,
+};
+
+// Parse the LDAPMessage at the start of 'in' far enough to fill 'request'.
+// Only the outer SEQUENCE's definite length is trusted to frame the message.
+LdapParse ParseLdapRequest(const std::string& in, LdapRequest* request);
+
+}  // namespace proto_fuzzer
+
+#endif  // PROTO_FUZZER_LDAP_BER_H_
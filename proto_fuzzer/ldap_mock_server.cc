@@ -0,0 +1,355 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief Implementation of LdapMockServer.
+
+#include "proto_fuzzer/ldap_mock_server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include "curl_fuzzer_digest.h"
+#include "curl_fuzzer_spin.h"
+#include "proto_fuzzer/ldap_ber.h"
+#include "proto_fuzzer/mock_server.h"
+
+namespace proto_fuzzer {
+
+namespace {
+
+// Caps on generated result sets, so one input can't keep curl formatting
+// output for long.
+constexpr std::size_t kMaxGeneratedEntries = 4096;
+constexpr std::uint32_t kMaxGeneratedAttributes = 32;
+constexpr std::uint32_t kMaxGeneratedValues = 32;
+constexpr std::uint32_t kMaxGeneratedValueSize = 4096;
+constexpr std::uint32_t kDefaultGeneratedValueSize = 16;
+constexpr std::uint64_t kMaxGeneratedBytes = 1024 * 1024;
+
+// Queued replies go out in bursts of about this much.
+constexpr std::size_t kBurstBytes = 16 * 1024;
+
+// Longest message the mock buffers before giving up on curl.
+constexpr std::size_t kMaxRequestSize = 64 * 1024;
+
+// protocolOp tags of the requests curl's OpenLDAP backend sends (RFC 4511
+// §4.2): bind and search get their scripted answers, unbind closes, abandon
+// gets nothing.
+constexpr std::uint8_t kOpBindRequest = 0x60;
+constexpr std::uint8_t kOpUnbindRequest = 0x42;
+constexpr std::uint8_t kOpSearchRequest = 0x63;
+constexpr std::uint8_t kOpAbandonRequest = 0x50;
+
+// ExtendedResponse refusing the request (StartTLS or anything else):
+// resultCode protocolError, empty matchedDN and diagnosticMessage.
+constexpr char kExtendedRefusal[] = "\x78\x07\x0a\x01\x02\x04\x00\x04\x00";
+
+constexpr char kResultsEnvVar[] = "FUZZ_LDAP_RESULTS";
+
+/// @return 'value' if non-zero, else 'fallback', capped at 'cap'.
+std::uint32_t OrDefault(std::uint32_t value, std::uint32_t fallback, std::uint32_t cap) {
+  return std::min(value != 0 ? value : fallback, cap);
+}
+
+/// Fill 'message' with generated entry 'index'. Printable values are
+/// letters; binary ones start with a NUL so curl base64-encodes them.
+/// @param generator  The script's generator.
+/// @param index      Position of the entry in the generated result set.
+/// @param attributes Attributes in the entry.
+/// @param values     Values per attribute.
+/// @param value_size Bytes per value.
+/// @param message    Scratch message to fill; its previous entry is replaced.
+void FillGeneratedEntry(const curl::fuzzer::proto::LdapEntryGenerator& generator, std::size_t index,
+                        std::uint32_t attributes, std::uint32_t values, std::uint32_t value_size,
+                        curl::fuzzer::proto::LdapMessage* message) {
+  message->set_length_octets(generator.length_octets());
+  auto* entry = message->mutable_search_entry();
+  entry->set_dn("cn=entry" + std::to_string(index) + ",dc=example,dc=com");
+  entry->mutable_attributes()->Clear();
+  for (std::uint32_t a = 0; a < attributes; ++a) {
+    auto* attribute = entry->add_attributes();
+    attribute->set_type("attr" + std::to_string(a));
+    for (std::uint32_t v = 0; v < values; ++v) {
+      std::string* value = attribute->add_values();
+      value->resize(value_size);
+      for (std::uint32_t i = 0; i < value_size; ++i) {
+        const std::size_t seed = index + a + v + i;
+        (*value)[i] = generator.binary() ? static_cast<char>((seed * 7) & 0xFF) : static_cast<char>('a' + seed % 26);
+      }
+      if (generator.binary() && value_size != 0) {
+        (*value)[0] = '\0';
+      }
+    }
+  }
+}
+
+}  // namespace
+
+/// Construct an idle LdapMockServer. RunLoop() seeds it from the scenario
+/// before curl opens the connection.
+LdapMockServer::LdapMockServer()
+    : script_(nullptr),
+      closed_(false),
+      searching_(false),
+      search_needs_done_(false),
+      search_id_(0),
+      generated_entries_(0),
+      next_generated_(0),
+      generated_bytes_(0),
+      entries_sent_(0),
+      bytes_sent_(0),
+      wrote_(false) {}
+
+/// Default destructor; the MockConnection closes its socket.
+LdapMockServer::~LdapMockServer() = default;
+
+/// Use 'script' for the rest of the scenario.
+/// @param script The scenario's LdapScript; must outlive the run.
+void LdapMockServer::SetScript(const curl::fuzzer::proto::LdapScript& script) {
+  script_ = &script;
+  generated_entries_ = std::min<std::size_t>(script.generated().count(), kMaxGeneratedEntries);
+}
+
+/// Called by the OPENSOCKETFUNCTION trampoline in the base class. LDAP uses a
+/// single connection, and the client speaks first.
+curl_socket_t LdapMockServer::HandleOpenSocket(const struct curl_sockaddr* /*address*/) {
+  if (connection_) {
+    return CURL_SOCKET_BAD;
+  }
+  connection_ = std::make_unique<MockConnection>();
+  if (!connection_->ok()) {
+    connection_.reset();
+    return CURL_SOCKET_BAD;
+  }
+  ApplyPendingBackpressure();
+  return connection_->take_client_fd();
+}
+
+/// Queue the scripted part of the answer to search 'message_id' and arm the
+/// generator for the rest.
+/// @param message_id The SearchRequest's message ID.
+void LdapMockServer::StartSearch(std::int64_t message_id) {
+  search_id_ = message_id;
+  search_needs_done_ = true;
+  for (const auto& message : script_->search()) {
+    output_ += SerializeLdapMessage(message, message_id);
+    if (message.has_search_entry()) {
+      ++entries_sent_;
+    } else if (message.has_search_done()) {
+      search_needs_done_ = false;
+    }
+  }
+  next_generated_ = 0;
+  generated_bytes_ = 0;
+  searching_ = true;
+}
+
+/// Queue generated entry 'index' of the current search. Its values are cut
+/// short if need be, so the entry fits in a burst and in what is left of the
+/// cap on generated bytes.
+/// @param index Position of the entry in the generated result set.
+/// @return false if not even an entry of empty values fits, which ends the
+///         generated results.
+bool LdapMockServer::AppendGeneratedEntry(std::size_t index) {
+  const auto& generator = script_->generated();
+  const std::uint32_t attributes = OrDefault(generator.attributes(), 1, kMaxGeneratedAttributes);
+  const std::uint32_t values = OrDefault(generator.values(), 1, kMaxGeneratedValues);
+  std::uint32_t value_size = OrDefault(generator.value_size(), kDefaultGeneratedValueSize, kMaxGeneratedValueSize);
+  const std::uint64_t budget = std::min<std::uint64_t>(kBurstBytes, kMaxGeneratedBytes - generated_bytes_);
+  const std::uint64_t count = static_cast<std::uint64_t>(attributes) * values;
+
+  // The values alone must fit; the BER around them is settled below.
+  value_size = static_cast<std::uint32_t>(std::min<std::uint64_t>(value_size, budget / count));
+  FillGeneratedEntry(generator, index, attributes, values, value_size, &generated_);
+  std::string message = SerializeLdapMessage(generated_, search_id_);
+  if (message.size() > budget) {
+    // Shorter contents never lengthen a BER length, so cutting every value
+    // by the overrun's share brings the entry within budget.
+    const std::uint64_t cut = (message.size() - budget + count - 1) / count;
+    value_size = cut < value_size ? static_cast<std::uint32_t>(value_size - cut) : 0;
+    FillGeneratedEntry(generator, index, attributes, values, value_size, &generated_);
+    message = SerializeLdapMessage(generated_, search_id_);
+    if (message.size() > budget) {
+      return false;
+    }
+  }
+  output_ += message;
+  generated_bytes_ += message.size();
+  ++entries_sent_;
+  return true;
+}
+
+/// Top the queue up to a burst from the current search's generator, then
+/// write as much of it as the socket takes.
+/// @return true if anything was written.
+bool LdapMockServer::SendBurst() {
+  if (!connection_ || closed_) {
+    return false;
+  }
+  while (searching_ && output_.size() < kBurstBytes) {
+    if (next_generated_ < generated_entries_ && generated_bytes_ < kMaxGeneratedBytes &&
+        AppendGeneratedEntry(next_generated_)) {
+      ++next_generated_;
+      continue;
+    }
+    if (search_needs_done_) {
+      curl::fuzzer::proto::LdapMessage done;
+      done.mutable_search_done();
+      output_ += SerializeLdapMessage(done, search_id_);
+    }
+    searching_ = false;
+  }
+  if (output_.empty()) {
+    return false;
+  }
+  if (!wrote_) {
+    wrote_ = true;
+    first_write_ = std::chrono::steady_clock::now();
+  }
+  // Whatever the socket doesn't take now stays queued for the next turn.
+  const std::size_t written =
+      connection_->WriteAvailable(reinterpret_cast<const unsigned char*>(output_.data()), output_.size());
+  bytes_sent_ += written;
+  output_.erase(0, written);
+  return written != 0;
+}
+
+/// Answer one request by its operation.
+/// @param message_id The request's message ID.
+/// @param op         Tag octet of its protocolOp.
+void LdapMockServer::HandleRequest(std::int64_t message_id, std::uint8_t op) {
+  switch (op) {
+    case kOpBindRequest:
+      if (script_->has_bind()) {
+        output_ += SerializeLdapMessage(script_->bind(), message_id);
+      } else {
+        curl::fuzzer::proto::LdapMessage bind;
+        bind.mutable_bind_response();
+        output_ += SerializeLdapMessage(bind, message_id);
+      }
+      break;
+    case kOpSearchRequest:
+      StartSearch(message_id);
+      break;
+    case kOpUnbindRequest:
+      // Whatever is still queued goes first; curl is done with it either way.
+      SendBurst();
+      closed_ = true;
+      connection_->ShutdownWrite();
+      break;
+    case kOpAbandonRequest:
+      searching_ = false;
+      break;
+    default: {
+      curl::fuzzer::proto::LdapMessage refusal;
+      refusal.set_raw(std::string(kExtendedRefusal, sizeof(kExtendedRefusal) - 1));
+      output_ += SerializeLdapMessage(refusal, message_id);
+      break;
+    }
+  }
+}
+
+/// Frame what curl has sent into LDAPMessages and answer each. Input that
+/// can't be an LDAPMessage closes the connection, as a server would.
+/// @return true if at least one message was answered.
+bool LdapMockServer::ServiceInput() {
+  if (!connection_ || closed_) {
+    return false;
+  }
+  connection_->ReadAvailable(&input_);
+
+  bool handled = false;
+  while (!closed_) {
+    LdapRequest request;
+    const LdapParse result = ParseLdapRequest(input_, &request);
+    if (result == LdapParse::kNeedMore && input_.size() <= kMaxRequestSize) {
+      break;
+    }
+    if (result != LdapParse::kOk) {
+      closed_ = true;
+      connection_->ShutdownWrite();
+      break;
+    }
+    input_.erase(0, request.size);
+    HandleRequest(request.message_id, request.op);
+    handled = true;
+  }
+  return handled;
+}
+
+/// With FUZZ_LDAP_RESULTS set, print how many entries the mock sent and how
+/// fast curl turned them into output, from the mock's first write to the
+/// end of the transfer.
+/// @param easy The handle the transfer ran on.
+void LdapMockServer::ReportResults(CURL* easy) const {
+  if (std::getenv(kResultsEnvVar) == nullptr || !wrote_) {
+    return;
+  }
+  curl_off_t written = 0;
+  curl_easy_getinfo(easy, CURLINFO_SIZE_DOWNLOAD_T, &written);
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - first_write_).count();
+  const double mb_per_second = seconds > 0.0 ? static_cast<double>(written) / seconds / 1e6 : 0.0;
+  std::fprintf(stderr,
+               "FUZZ: ldap results: %zu entries in %llu BER bytes, %lld bytes of output in %.3f ms (%.1f MB/s); "
+               "%zu of %zu generated\n",
+               entries_sent_, static_cast<unsigned long long>(bytes_sent_), static_cast<long long>(written),
+               seconds * 1e3, mb_per_second, next_generated_, generated_entries_);
+}
+
+/// Seed the mock from the scenario, then drive the perform loop until curl is
+/// done or the idle-iteration cap is hit. Each iteration answers whatever
+/// requests curl has sent and, once curl has what was written before, sends
+/// the next burst of replies.
+/// @param multi    caller-owned multi; 'easy' is already added.
+/// @param easy     the curl easy handle attached to this mock.
+/// @param scenario source of the LdapScript.
+void LdapMockServer::RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Scenario& scenario) {
+  SetScript(scenario.connection().ldap());
+
+  int still_running = 1;
+  int idle_iterations = 0;
+  CURLMcode rc = CURLM_OK;
+
+  while (still_running && idle_iterations < kMaxIdleIterations) {
+    rc = curl_multi_perform(multi, &still_running);
+    fuzz_spin_note_perform(multi, still_running);
+    fuzz_digest_iteration();
+    if (rc != CURLM_OK) {
+      break;
+    }
+    if (!still_running) {
+      break;
+    }
+    if (connection_ && connection_->FlushFragment()) {
+      idle_iterations = 0;
+    }
+
+    int ready = WaitOnMultiFdset(multi, easy, &rc);
+    if (rc != CURLM_OK) {
+      break;
+    }
+
+    bool progressed = ServiceInput();
+    if (!connection_ || !connection_->fragments_pending()) {
+      progressed = SendBurst() || progressed;
+    }
+    if (progressed || ready != 0) {
+      idle_iterations = 0;
+    } else {
+      ++idle_iterations;
+    }
+  }
+  ReportResults(easy);
+}
+
+}  // namespace proto_fuzzer
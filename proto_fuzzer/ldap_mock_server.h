@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief LdapMockServer — an in-process LDAPv3 server that answers curl's
+///        bind and search with BER-encoded messages from an LdapScript,
+///        matching each reply's message ID to the request it answers.
+
+#ifndef PROTO_FUZZER_LDAP_MOCK_SERVER_H_
+#define PROTO_FUZZER_LDAP_MOCK_SERVER_H_
+
+#include <curl/curl.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "curl_fuzzer.pb.h"
+#include "proto_fuzzer/mock_server_base.h"
+
+namespace proto_fuzzer {
+
+/// @class proto_fuzzer::LdapMockServer
+/// @brief In-process LDAP peer. Frames what curl sends into LDAPMessages and
+///        answers each by operation: the script's bind reply, then for a
+///        search its listed messages, its generated entries and a closing
+///        SearchResultDone. Replies queue up and go out in bursts once curl
+///        has taken what was written before, so large result sets don't
+///        overrun the socket. Setting FUZZ_LDAP_RESULTS reports on stderr how
+///        fast curl turned the result set into output.
+class LdapMockServer : public MockServerBase {
+ public:
+  LdapMockServer();
+  ~LdapMockServer() override;
+
+  void SetScript(const curl::fuzzer::proto::LdapScript& script);
+
+ protected:
+  curl_socket_t HandleOpenSocket(const struct curl_sockaddr* address) override;
+  void RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Scenario& scenario) override;
+
+ private:
+  bool ServiceInput();
+  void HandleRequest(std::int64_t message_id, std::uint8_t op);
+  void StartSearch(std::int64_t message_id);
+  bool AppendGeneratedEntry(std::size_t index);
+  bool SendBurst();
+  void ReportResults(CURL* easy) const;
+
+  /// The scenario's script; owned by the Scenario, which outlives the run.
+  const curl::fuzzer::proto::LdapScript* script_;
+  /// Bytes read from curl that don't yet form a whole message.
+  std::string input_;
+  /// Replies queued for the next burst.
+  std::string output_;
+  /// Set once the mock has closed its side of the connection.
+  bool closed_;
+  /// Set while a search still has generated entries or its done to queue.
+  bool searching_;
+  /// Whether the current search still owes a default SearchResultDone.
+  bool search_needs_done_;
+  /// Message ID of the search being answered.
+  std::int64_t search_id_;
+  /// Entries to generate per search, after the caps, and the next to queue.
+  std::size_t generated_entries_;
+  std::size_t next_generated_;
+  /// Generated bytes queued so far, checked against the cap.
+  std::uint64_t generated_bytes_;
+  /// Scratch message reused for every generated entry.
+  curl::fuzzer::proto::LdapMessage generated_;
+
+  /// Search result entries and BER bytes written, for FUZZ_LDAP_RESULTS.
+  std::size_t entries_sent_;
+  std::uint64_t bytes_sent_;
+  /// Set once the mock has written anything, and when it first did.
+  bool wrote_;
+  std::chrono::steady_clock::time_point first_write_;
+};
+
+}  // namespace proto_fuzzer
+
+#endif  // PROTO_FUZZER_LDAP_MOCK_SERVER_H_
@@ -0,0 +1,555 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief Implementation of MailMockServer.
+
+#include "proto_fuzzer/mail_mock_server.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include "curl_fuzzer_digest.h"
+#include "curl_fuzzer_spin.h"
+#include "proto_fuzzer/mock_server.h"
+
+namespace proto_fuzzer {
+
+namespace {
+
+// Cap on scripted replies considered, so a mutator that piles up entries
+// can't make every command a long scan.
+constexpr std::size_t kMaxScriptedReplies = 64;
+
+// Longest command line the mock buffers before treating it as complete.
+constexpr std::size_t kMaxCommandLine = 4096;
+
+// Placeholder in IMAP replies for the tag of the command being answered.
+constexpr char kTagPlaceholder[] = "%TAG%";
+
+constexpr char kSmtpGreeting[] = "220 curl-fuzzer ESMTP mock ready\r\n";
+constexpr char kImapGreeting[] = "* OK curl-fuzzer IMAP mock ready\r\n";
+constexpr char kPop3Greeting[] = "+OK curl-fuzzer POP3 mock ready\r\n";
+constexpr char kImapLiteralContinuation[] = "+ Ready for literal data\r\n";
+
+// A single message is all the defaults ever offer, so it is always number 1.
+constexpr char kMessageUid[] = "curl-fuzzer-1";
+
+/// @return 'text' upper-cased.
+std::string ToUpper(std::string text) {
+  std::transform(text.begin(), text.end(), text.begin(),
+                 [](unsigned char c) { return static_cast<char>(std::toupper(c)); });
+  return text;
+}
+
+/// Split 'line' at its first space.
+/// @param line  Text to split.
+/// @param head  Receives everything before the space, or all of 'line'.
+/// @param tail  Receives everything after the space, or nothing.
+void SplitWord(const std::string& line, std::string* head, std::string* tail) {
+  const std::size_t space = line.find(' ');
+  *head = line.substr(0, space);
+  *tail = space == std::string::npos ? std::string() : line.substr(space + 1);
+}
+
+/// @return 'message' dot-stuffed and terminated for a POP3 multi-line reply.
+std::string Pop3MultiLine(const std::string& message) {
+  std::string out;
+  out.reserve(message.size() + 8);
+  bool line_start = true;
+  for (char c : message) {
+    if (line_start && c == '.') {
+      out += '.';
+    }
+    out += c;
+    line_start = c == '\n';
+  }
+  if (!out.empty() && !line_start) {
+    out += "\r\n";
+  }
+  out += ".\r\n";
+  return out;
+}
+
+/// @return the tag curl will use for its next IMAP command after 'tag'. curl
+///         numbers commands "A001", "A002", ... wrapping at 1000.
+std::string NextImapTag(const std::string& tag) {
+  if (tag.size() != 4 || !std::isupper(static_cast<unsigned char>(tag[0])) ||
+      !std::all_of(tag.begin() + 1, tag.end(), [](unsigned char c) { return std::isdigit(c); })) {
+    return tag;
+  }
+  char next[8];
+  snprintf(next, sizeof(next), "%c%03d", tag[0], (atoi(tag.c_str() + 1) + 1) % 1000);
+  return next;
+}
+
+}  // namespace
+
+/// Construct an idle MailMockServer. RunLoop() seeds it from the scenario
+/// before curl opens the connection.
+/// @param dialect The protocol to speak, from the scenario's scheme.
+MailMockServer::MailMockServer(MailDialect dialect)
+    : dialect_(dialect),
+      script_(nullptr),
+      state_(InputState::kCommand),
+      literal_remaining_(0),
+      literal_tail_(false),
+      // curl numbers its first IMAP command A001.
+      tag_("A000"),
+      quit_seen_(false) {}
+
+/// Default destructor; the MockConnection closes its socket.
+MailMockServer::~MailMockServer() = default;
+
+/// Use 'script' for the rest of the scenario and mark every scripted reply
+/// unused.
+/// @param script The scenario's MailScript; must outlive the run.
+void MailMockServer::SetScript(const curl::fuzzer::proto::MailScript& script) {
+  script_ = &script;
+  reply_used_.assign(std::min<std::size_t>(kMaxScriptedReplies, script.replies_size()), false);
+}
+
+/// Called by the OPENSOCKETFUNCTION trampoline in the base class. The mail
+/// protocols use a single connection, which gets the greeting; any further
+/// socket is refused.
+curl_socket_t MailMockServer::HandleOpenSocket(const struct curl_sockaddr* /*address*/) {
+  if (connection_) {
+    return CURL_SOCKET_BAD;
+  }
+  connection_ = std::make_unique<MockConnection>();
+  if (!connection_->ok()) {
+    connection_.reset();
+    return CURL_SOCKET_BAD;
+  }
+  ApplyPendingBackpressure();
+
+  std::string greeting = script_ != nullptr ? script_->greeting() : std::string();
+  if (greeting.empty()) {
+    greeting = dialect_ == MailDialect::kSmtp ? kSmtpGreeting
+               : dialect_ == MailDialect::kImap ? kImapGreeting
+                                                : kPop3Greeting;
+  }
+  SendReply(greeting);
+  return connection_->take_client_fd();
+}
+
+/// Take the next unused scripted reply for 'verb', if there is one.
+/// @param verb  Upper-case command verb or pseudo verb.
+/// @param reply Receives the reply.
+/// @return true if a scripted reply was found.
+bool MailMockServer::TakeScriptedReply(const std::string& verb, std::string* reply) {
+  for (std::size_t i = 0; i < reply_used_.size(); ++i) {
+    if (reply_used_[i]) {
+      continue;
+    }
+    const auto& entry = script_->replies(static_cast<int>(i));
+    if (ToUpper(entry.verb()) != verb) {
+      continue;
+    }
+    reply_used_[i] = true;
+    *reply = entry.reply();
+    return true;
+  }
+  return false;
+}
+
+/// @return true if 'reply' asks curl for another SASL response.
+bool MailMockServer::IsContinuation(const std::string& reply) const {
+  if (dialect_ == MailDialect::kSmtp) {
+    return reply.compare(0, 3, "334") == 0;
+  }
+  // "+OK" is POP3's positive reply; a continuation is a bare "+".
+  return !reply.empty() && reply[0] == '+' && (reply.size() == 1 || reply[1] == ' ' || reply[1] == '\r');
+}
+
+/// Built-in SMTP reply for a command the script doesn't cover.
+/// @param verb     Upper-case command verb or pseudo verb.
+/// @param argument Everything after the verb.
+/// @return the complete reply.
+std::string MailMockServer::SmtpDefault(const std::string& verb, const std::string& argument) const {
+  if (verb == "EHLO") {
+    return "250-curl-fuzzer\r\n250-AUTH PLAIN LOGIN\r\n250-SIZE 1048576\r\n250 8BITMIME\r\n";
+  }
+  if (verb == "HELO") {
+    return "250 curl-fuzzer\r\n";
+  }
+  if (verb == "MAIL" || verb == "RCPT" || verb == "RSET" || verb == "NOOP") {
+    return "250 OK\r\n";
+  }
+  if (verb == "DATA") {
+    return "354 End data with <CR><LF>.<CR><LF>\r\n";
+  }
+  if (verb == ".") {
+    return "250 OK: queued\r\n";
+  }
+  if (verb == "VRFY") {
+    return "252 Cannot VRFY user, but will accept message\r\n";
+  }
+  if (verb == "EXPN") {
+    return "250 <postmaster@example.com>\r\n";
+  }
+  if (verb == "HELP") {
+    return "214 curl-fuzzer SMTP mock\r\n";
+  }
+  if (verb == "AUTH") {
+    // A mechanism followed by an initial response needs no challenge.
+    return argument.find(' ') != std::string::npos ? "235 Authentication successful\r\n" : "334 \r\n";
+  }
+  if (verb == "SASL") {
+    return "235 Authentication successful\r\n";
+  }
+  if (verb == "QUIT") {
+    return "221 Bye\r\n";
+  }
+  if (verb == "STARTTLS") {
+    return "454 TLS not available\r\n";
+  }
+  return "502 Command not implemented\r\n";
+}
+
+/// Built-in IMAP reply for a command the script doesn't cover. Any command
+/// without a special case gets a tagged OK.
+/// @param verb     Upper-case command verb or pseudo verb.
+/// @param argument Everything after the verb.
+/// @return the complete reply, with kTagPlaceholder for the tag.
+std::string MailMockServer::ImapDefault(const std::string& verb, const std::string& argument) const {
+  if (verb == "UID") {
+    std::string sub_verb;
+    std::string sub_argument;
+    SplitWord(argument, &sub_verb, &sub_argument);
+    return ImapDefault(ToUpper(sub_verb), sub_argument);
+  }
+  if (verb == "CAPABILITY") {
+    return "* CAPABILITY IMAP4rev1 AUTH=PLAIN AUTH=LOGIN\r\n%TAG% OK CAPABILITY completed\r\n";
+  }
+  if (verb == "SELECT" || verb == "EXAMINE") {
+    return "* FLAGS (\\Seen \\Deleted)\r\n* 1 EXISTS\r\n* OK [UIDVALIDITY 1] UIDs valid\r\n"
+           "%TAG% OK [READ-WRITE] " +
+           verb + " completed\r\n";
+  }
+  if (verb == "FETCH") {
+    const std::string& message = script_->message();
+    return "* 1 FETCH (BODY[] {" + std::to_string(message.size()) + "}\r\n" + message +
+           ")\r\n%TAG% OK FETCH completed\r\n";
+  }
+  if (verb == "SEARCH") {
+    return "* SEARCH 1\r\n%TAG% OK SEARCH completed\r\n";
+  }
+  if (verb == "LIST" || verb == "LSUB") {
+    return "* " + verb + " () \"/\" INBOX\r\n%TAG% OK " + verb + " completed\r\n";
+  }
+  if (verb == "AUTHENTICATE") {
+    return argument.find(' ') != std::string::npos ? "%TAG% OK AUTHENTICATE completed\r\n" : "+ \r\n";
+  }
+  if (verb == "SASL") {
+    return "%TAG% OK AUTHENTICATE completed\r\n";
+  }
+  if (verb == "LOGOUT") {
+    return "* BYE curl-fuzzer IMAP mock logging out\r\n%TAG% OK LOGOUT completed\r\n";
+  }
+  if (verb == "STARTTLS") {
+    return "%TAG% NO TLS not available\r\n";
+  }
+  return "%TAG% OK " + verb + " completed\r\n";
+}
+
+/// Built-in POP3 reply for a command the script doesn't cover.
+/// @param verb     Upper-case command verb or pseudo verb.
+/// @param argument Everything after the verb.
+/// @return the complete reply.
+std::string MailMockServer::Pop3Default(const std::string& verb, const std::string& argument) const {
+  const std::string size = std::to_string(script_->message().size());
+  if (verb == "CAPA") {
+    return "+OK Capability list follows\r\nUSER\r\nSASL PLAIN LOGIN\r\nTOP\r\nUIDL\r\n.\r\n";
+  }
+  if (verb == "USER" || verb == "PASS" || verb == "APOP" || verb == "DELE" || verb == "NOOP" || verb == "RSET") {
+    return "+OK\r\n";
+  }
+  if (verb == "STAT") {
+    return "+OK 1 " + size + "\r\n";
+  }
+  // LIST and UIDL with a message number are single-line.
+  if (verb == "LIST") {
+    return argument.empty() ? "+OK 1 messages\r\n1 " + size + "\r\n.\r\n" : "+OK 1 " + size + "\r\n";
+  }
+  if (verb == "UIDL") {
+    return argument.empty() ? std::string("+OK\r\n1 ") + kMessageUid + "\r\n.\r\n"
+                            : std::string("+OK 1 ") + kMessageUid + "\r\n";
+  }
+  if (verb == "RETR" || verb == "TOP") {
+    return "+OK " + size + " octets\r\n" + Pop3MultiLine(script_->message());
+  }
+  if (verb == "AUTH") {
+    return argument.find(' ') != std::string::npos ? "+OK Authenticated\r\n" : "+ \r\n";
+  }
+  if (verb == "SASL") {
+    return "+OK Authenticated\r\n";
+  }
+  if (verb == "QUIT") {
+    return "+OK Bye\r\n";
+  }
+  if (verb == "STLS") {
+    return "-ERR TLS not available\r\n";
+  }
+  return "-ERR Unknown command\r\n";
+}
+
+/// @return the dialect's built-in reply to 'verb'.
+std::string MailMockServer::DefaultReply(const std::string& verb, const std::string& argument) const {
+  switch (dialect_) {
+    case MailDialect::kSmtp:
+      return SmtpDefault(verb, argument);
+    case MailDialect::kImap:
+      return ImapDefault(verb, argument);
+    case MailDialect::kPop3:
+      return Pop3Default(verb, argument);
+  }
+  return std::string();
+}
+
+/// Write a reply, filling in the IMAP tag.
+/// @param reply   Complete reply, CRLF included.
+/// @param unsplit true for replies curl reads in a blocking call, which
+///                FUZZ_FRAGMENT must not split.
+void MailMockServer::SendReply(std::string reply, bool unsplit) {
+  if (!connection_ || reply.empty()) {
+    return;
+  }
+  if (dialect_ == MailDialect::kImap) {
+    const std::size_t placeholder_len = sizeof(kTagPlaceholder) - 1;
+    for (std::size_t pos = reply.find(kTagPlaceholder); pos != std::string::npos;
+         pos = reply.find(kTagPlaceholder, pos + tag_.size())) {
+      reply.replace(pos, placeholder_len, tag_);
+    }
+  }
+  const auto* data = reinterpret_cast<const unsigned char*>(reply.data());
+  if (unsplit) {
+    connection_->WriteUnsplit(data, reply.size());
+  } else {
+    connection_->WriteAll(data, reply.size());
+  }
+}
+
+/// Answer one command, then follow the exchange into a SASL, DATA or
+/// logged-out state as the reply dictates.
+///
+/// curl reads some replies in a blocking call from its done handler, after
+/// the drive loop has handed it the last of a transfer: the reply that ends
+/// an SMTP DATA body, the tagged reply to an IMAP APPEND, and the tail of an
+/// IMAP FETCH. Those are sent unsplit, and the first two are sent before
+/// curl has finished the upload they answer, as it won't read them earlier.
+/// @param verb     Upper-case command verb or pseudo verb.
+/// @param argument Everything after the verb.
+/// @param unsplit  true to send the reply unsplit whatever the verb.
+void MailMockServer::HandleCommand(const std::string& verb, const std::string& argument, bool unsplit) {
+  std::string reply;
+  if (!TakeScriptedReply(verb, &reply)) {
+    reply = DefaultReply(verb, argument);
+  }
+  if (dialect_ == MailDialect::kImap) {
+    unsplit = unsplit || verb == "FETCH" || (verb == "UID" && ToUpper(argument.substr(0, 5)) == "FETCH");
+  }
+
+  const bool sasl = verb == "AUTH" || verb == "AUTHENTICATE" || verb == "SASL";
+  if (sasl && IsContinuation(reply)) {
+    state_ = InputState::kSasl;
+  } else if (dialect_ == MailDialect::kSmtp && verb == "DATA" && reply.compare(0, 3, "354") == 0) {
+    state_ = InputState::kData;
+    SendReply(reply, true);
+    std::string done;
+    if (!TakeScriptedReply(".", &done)) {
+      done = DefaultReply(".", std::string());
+    }
+    SendReply(done, true);
+    return;
+  } else {
+    state_ = InputState::kCommand;
+  }
+  SendReply(reply, unsplit);
+
+  if ((verb == "QUIT" || verb == "LOGOUT") && connection_) {
+    quit_seen_ = true;
+    connection_->ShutdownWrite();
+  }
+}
+
+/// Split a command line into tag, verb and argument, and answer it. During a
+/// SASL exchange the whole line is the client's response.
+/// @param line    One command line, CRLF removed.
+/// @param unsplit Passed on to HandleCommand.
+void MailMockServer::Dispatch(const std::string& line, bool unsplit) {
+  if (state_ == InputState::kSasl) {
+    HandleCommand("SASL", line, unsplit);
+    return;
+  }
+  std::string rest = line;
+  if (dialect_ == MailDialect::kImap) {
+    SplitWord(line, &tag_, &rest);
+  }
+  std::string verb;
+  std::string argument;
+  SplitWord(rest, &verb, &argument);
+  HandleCommand(ToUpper(verb), argument, unsplit);
+}
+
+/// If 'line' ends in an IMAP literal announcement, "{N}" or the
+/// non-synchronising "{N+}", ask curl for a synchronising literal and get
+/// ready to read it. The command is answered here, ahead of its literal,
+/// unless this is a further literal in a command already answered.
+/// @param line One line, CRLF removed.
+/// @return true if a literal follows.
+bool MailMockServer::StartLiteral(const std::string& line) {
+  if (line.empty() || line.back() != '}') {
+    return false;
+  }
+  const std::size_t open = line.rfind('{');
+  if (open == std::string::npos) {
+    return false;
+  }
+  std::string count = line.substr(open + 1, line.size() - open - 2);
+  const bool synchronising = count.empty() || count.back() != '+';
+  if (!synchronising) {
+    count.pop_back();
+  }
+  if (count.empty() || !std::all_of(count.begin(), count.end(), [](unsigned char c) { return std::isdigit(c); })) {
+    return false;
+  }
+
+  if (synchronising) {
+    SendReply(kImapLiteralContinuation, true);
+  }
+  if (!literal_tail_) {
+    Dispatch(line, true);
+  }
+  literal_remaining_ = static_cast<std::size_t>(strtoull(count.c_str(), nullptr, 10));
+  state_ = InputState::kLiteral;
+  return true;
+}
+
+/// Read what curl has sent and consume all of it that is complete: command
+/// lines, SASL responses, DATA body lines and literal bytes.
+/// @return true if anything was consumed.
+bool MailMockServer::ServiceInput() {
+  if (!connection_) {
+    return false;
+  }
+  connection_->ReadAvailable(&input_);
+
+  bool consumed = false;
+  while (!input_.empty()) {
+    if (state_ == InputState::kLiteral) {
+      // The literal's bytes don't change the reply, so they aren't kept.
+      const std::size_t n = std::min(literal_remaining_, input_.size());
+      input_.erase(0, n);
+      literal_remaining_ -= n;
+      consumed = true;
+      if (literal_remaining_ > 0) {
+        break;
+      }
+      state_ = InputState::kCommand;
+      literal_tail_ = true;
+      continue;
+    }
+
+    std::size_t end = input_.find('\n');
+    if (end == std::string::npos) {
+      if (input_.size() < kMaxCommandLine) {
+        break;
+      }
+      end = input_.size() - 1;
+    }
+    std::string line = input_.substr(0, end);
+    input_.erase(0, end + 1);
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    consumed = true;
+
+    if (state_ == InputState::kData) {
+      // The reply was sent along with the 354.
+      if (line == ".") {
+        state_ = InputState::kCommand;
+      }
+      continue;
+    }
+    if (dialect_ == MailDialect::kImap && state_ == InputState::kCommand && StartLiteral(line)) {
+      continue;
+    }
+    // The rest of a command whose literal has been read was answered with it.
+    if (literal_tail_) {
+      literal_tail_ = false;
+      continue;
+    }
+    Dispatch(line, false);
+  }
+  return consumed;
+}
+
+/// Answer the QUIT (or IMAP LOGOUT) curl sends when the connection is torn
+/// down, ahead of time. curl waits for the reply inside curl_multi_cleanup,
+/// after the drive loop has stopped reading.
+void MailMockServer::PreAnswerQuit() {
+  if (!connection_ || quit_seen_) {
+    return;
+  }
+  const std::string verb = dialect_ == MailDialect::kImap ? "LOGOUT" : "QUIT";
+  if (dialect_ == MailDialect::kImap) {
+    tag_ = NextImapTag(tag_);
+  }
+  std::string reply;
+  if (!TakeScriptedReply(verb, &reply)) {
+    reply = DefaultReply(verb, std::string());
+  }
+  SendReply(reply, true);
+}
+
+/// Seed the mock from the scenario, then drive the perform loop until curl is
+/// done or the idle-iteration cap is hit. Each iteration answers whatever
+/// curl has sent.
+/// @param multi    caller-owned multi; 'easy' is already added.
+/// @param easy     the curl easy handle attached to this mock.
+/// @param scenario source of the MailScript.
+void MailMockServer::RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Scenario& scenario) {
+  SetScript(scenario.connection().mail());
+
+  int still_running = 1;
+  int idle_iterations = 0;
+  CURLMcode rc = CURLM_OK;
+
+  while (still_running && idle_iterations < kMaxIdleIterations) {
+    rc = curl_multi_perform(multi, &still_running);
+    fuzz_spin_note_perform(multi, still_running);
+    fuzz_digest_iteration();
+    if (rc != CURLM_OK) {
+      break;
+    }
+    if (!still_running) {
+      break;
+    }
+    if (connection_ && connection_->FlushFragment()) {
+      idle_iterations = 0;
+    }
+
+    int ready = WaitOnMultiFdset(multi, easy, &rc);
+    if (rc != CURLM_OK) {
+      break;
+    }
+
+    if (ServiceInput() || ready != 0) {
+      idle_iterations = 0;
+    } else {
+      ++idle_iterations;
+    }
+  }
+  PreAnswerQuit();
+}
+
+}  // namespace proto_fuzzer
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief MailMockServer — an in-process SMTP, IMAP or POP3 server that
+///        answers each command line curl sends from a MailScript.
+
+#ifndef PROTO_FUZZER_MAIL_MOCK_SERVER_H_
+#define PROTO_FUZZER_MAIL_MOCK_SERVER_H_
+
+#include <curl/curl.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "curl_fuzzer.pb.h"
+#include "proto_fuzzer/mock_server_base.h"
+
+namespace proto_fuzzer {
+
+/// Which line protocol a MailMockServer speaks.
+enum class MailDialect {
+  kSmtp,  ///< RFC 5321, with DATA bodies and 334 SASL continuations.
+  kImap,  ///< RFC 3501, with tags, literals and "+" continuations.
+  kPop3,  ///< RFC 1939, with "+ " SASL continuations.
+};
+
+/// @class proto_fuzzer::MailMockServer
+/// @brief In-process mail peer. Greets curl when it opens the connection,
+///        then reads one command line at a time — an IMAP tag, a verb and its
+///        arguments — and answers from the scenario's MailScript or the
+///        dialect's built-in defaults. Tracks the few exchanges that aren't
+///        command lines: SASL client responses, SMTP DATA bodies and IMAP
+///        literals.
+class MailMockServer : public MockServerBase {
+ public:
+  explicit MailMockServer(MailDialect dialect);
+  ~MailMockServer() override;
+
+  void SetScript(const curl::fuzzer::proto::MailScript& script);
+
+ protected:
+  curl_socket_t HandleOpenSocket(const struct curl_sockaddr* address) override;
+  void RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Scenario& scenario) override;
+
+ private:
+  /// How the next bytes from curl are interpreted.
+  enum class InputState {
+    kCommand,  ///< Command lines.
+    kSasl,     ///< SASL client responses, answered under "SASL".
+    kData,     ///< An SMTP DATA body, up to the "." line.
+    kLiteral,  ///< The bytes of an IMAP literal.
+  };
+
+  bool ServiceInput();
+  bool StartLiteral(const std::string& line);
+  void Dispatch(const std::string& line, bool unsplit);
+  void HandleCommand(const std::string& verb, const std::string& argument, bool unsplit);
+  bool TakeScriptedReply(const std::string& verb, std::string* reply);
+  std::string DefaultReply(const std::string& verb, const std::string& argument) const;
+  std::string SmtpDefault(const std::string& verb, const std::string& argument) const;
+  std::string ImapDefault(const std::string& verb, const std::string& argument) const;
+  std::string Pop3Default(const std::string& verb, const std::string& argument) const;
+  bool IsContinuation(const std::string& reply) const;
+  void SendReply(std::string reply, bool unsplit = false);
+  void PreAnswerQuit();
+
+  const MailDialect dialect_;
+  /// The scenario's script; owned by the Scenario, which outlives the run.
+  const curl::fuzzer::proto::MailScript* script_;
+  /// Which scripted replies have been used, parallel to script_->replies().
+  std::vector<bool> reply_used_;
+
+  InputState state_;
+  /// Bytes read from curl that haven't been consumed yet.
+  std::string input_;
+  /// Bytes of the current IMAP literal still to come.
+  std::size_t literal_remaining_;
+  /// Set once a literal has been read: the next line finishes a command
+  /// that has already been answered.
+  bool literal_tail_;
+  /// Tag of the IMAP command being answered; kept across a SASL exchange,
+  /// whose responses carry no tag.
+  std::string tag_;
+  /// Set once curl's QUIT or LOGOUT has been answered.
+  bool quit_seen_;
+};
+
+}  // namespace proto_fuzzer
+
+#endif  // PROTO_FUZZER_MAIL_MOCK_SERVER_H_
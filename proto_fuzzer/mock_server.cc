@@ -14,6 +14,7 @@
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include <algorithm>
@@ -22,6 +23,11 @@
 #include <utility>
 #include <vector>
 
+#include "curl_fuzzer_digest.h"
+#include "curl_fuzzer_pcap.h"
+#include "curl_fuzzer_spin.h"
+#include "curl_fuzzer_timing.h"
+#include "proto_fuzzer/http_response.h"
 #include "proto_fuzzer/ws_frame.h"
 
 namespace proto_fuzzer {
@@ -36,11 +42,23 @@ bool FdFitsInFdSet(int fd) { return fd >= 0 && fd < FD_SETSIZE; }
 // tiny on_readable entries can't dominate runtime.
 constexpr std::size_t kMaxResponseChunks = 16;
 
+// Most generated bytes WriteGenerated sends per call, as the streaming mocks
+// burst.
+constexpr std::size_t kGeneratedBurstBytes = 16 * 1024;
+
+// Most buffers WriteVector takes in one call.
+constexpr int kMaxWritePieces = 8;
+
 /// Combine the scenario's raw on_readable strings with any serialised
-/// WebSocket frames into a single ordered chunk list, capped at
-/// kMaxResponseChunks. Historical behaviour: HTTP scenarios can carry
-/// server_frames too; the fuzzer just feeds those bytes to curl.
-std::vector<std::string> BuildChunkList(const curl::fuzzer::proto::Connection& conn) {
+/// WebSocket frames and HTTP responses into a single ordered chunk list,
+/// capped at kMaxResponseChunks, then an empty chunk for generated_body.
+/// Historical behaviour: HTTP scenarios can carry server_frames too; the
+/// fuzzer just feeds those bytes to curl.
+/// @param conn      The scenario's connection.
+/// @param generated Out: the bytes generated after each chunk, by index.
+/// @return the chunks, in the order they are sent.
+std::vector<std::string> BuildChunkList(const curl::fuzzer::proto::Connection& conn,
+                                        std::vector<PayloadStream>* generated) {
   std::vector<std::string> chunks;
   chunks.reserve(kMaxResponseChunks);
   const std::size_t raw_budget = std::min<std::size_t>(kMaxResponseChunks, conn.on_readable_size());
@@ -50,7 +68,22 @@ std::vector<std::string> BuildChunkList(const curl::fuzzer::proto::Connection& c
   const std::size_t frame_budget = kMaxResponseChunks - chunks.size();
   const std::size_t frame_count = std::min<std::size_t>(frame_budget, conn.server_frames_size());
   for (std::size_t i = 0; i < frame_count; ++i) {
-    chunks.emplace_back(SerializeWebSocketFrame(conn.server_frames(static_cast<int>(i))));
+    const auto& frame = conn.server_frames(static_cast<int>(i));
+    chunks.emplace_back(SerializeWebSocketFrame(frame));
+    if (frame.has_generated_payload()) {
+      generated->resize(chunks.size());
+      generated->back() = GeneratedFramePayload(frame);
+    }
+  }
+  const std::size_t response_budget = kMaxResponseChunks - chunks.size();
+  const std::size_t response_count = std::min<std::size_t>(response_budget, conn.responses_size());
+  for (std::size_t i = 0; i < response_count; ++i) {
+    chunks.emplace_back(SerializeHttpResponse(conn.responses(static_cast<int>(i))));
+  }
+  if (conn.has_generated_body()) {
+    chunks.emplace_back();
+    generated->resize(chunks.size());
+    generated->back() = PayloadStream(conn.generated_body());
   }
   return chunks;
 }
@@ -62,8 +95,15 @@ std::vector<std::string> BuildChunkList(const curl::fuzzer::proto::Connection& c
 /// fd; the client-side fd is handed to libcurl via CURLOPT_OPENSOCKETFUNCTION and becomes curl's to close.
 
 /// Construct a non-blocking AF_UNIX/SOCK_STREAM socketpair. Both fds are validated to fit inside FD_SETSIZE; on any
-/// failure ok() returns false and the instance is unusable.
-MockConnection::MockConnection() : server_fd_(-1), client_fd_(-1), drain_limit_(0) {
+/// failure ok() returns false and the instance is unusable. When FUZZ_PCAP is set, a capture stream is opened for the
+/// connection.
+MockConnection::MockConnection()
+    : server_fd_(-1),
+      client_fd_(-1),
+      drain_limit_(0),
+      pcap_stream_(FUZZ_PCAP_NO_STREAM),
+      peer_closed_(false),
+      frag_() {
   int fds[2];
 
   if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
@@ -88,16 +128,49 @@ MockConnection::MockConnection() : server_fd_(-1), client_fd_(-1), drain_limit_(
   // Success: store the file descriptors.
   server_fd_ = fds[0];
   client_fd_ = fds[1];
+  pcap_stream_ = fuzz_pcap_open_stream();
+}
+
+/// Adopt a socket that is already connected to curl as the server side, e.g. an FTP active-mode data connection the
+/// mock made to a port curl listens on. There is no client-side fd to hand off. Takes ownership of 'server_fd' even on
+/// failure, in which case ok() returns false.
+/// @param server_fd Connected socket; made non-blocking here.
+MockConnection::MockConnection(int server_fd)
+    : server_fd_(-1),
+      client_fd_(-1),
+      drain_limit_(0),
+      pcap_stream_(FUZZ_PCAP_NO_STREAM),
+      peer_closed_(false),
+      frag_() {
+  if (!FdFitsInFdSet(server_fd)) {
+    if (server_fd >= 0) {
+      close(server_fd);
+    }
+    return;
+  }
+  int flags = fcntl(server_fd, F_GETFL, 0);
+  if (flags < 0 || fcntl(server_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    close(server_fd);
+    return;
+  }
+  server_fd_ = server_fd;
+  pcap_stream_ = fuzz_pcap_open_stream();
 }
 
-/// Close the server-side fd (and the client-side fd if it was never handed off via take_client_fd()).
+/// Close the server-side fd (and the client-side fd if it was never handed off via take_client_fd()). Bytes curl sent
+/// that the mock never read are drained into the capture first.
 MockConnection::~MockConnection() {
   if (server_fd_ >= 0) {
+    if (pcap_stream_ != FUZZ_PCAP_NO_STREAM) {
+      drain_limit_ = 0;
+      DrainIncoming();
+    }
     close(server_fd_);
   }
   if (client_fd_ >= 0) {
     close(client_fd_);
   }
+  fuzz_frag_free(&frag_);
 }
 
 /// @return true if the underlying socketpair was set up successfully.
@@ -116,7 +189,7 @@ curl_socket_t MockConnection::take_client_fd() {
 }
 
 /// Write 'size' bytes from 'data' to the server fd, looping until the whole buffer is sent or a short/failed write
-/// occurs.
+/// occurs. Under a FUZZ_FRAGMENT plan the bytes are queued instead and FlushFragment() hands them to curl.
 /// @param data Buffer to send.
 /// @param size Number of bytes in 'data'.
 /// @return false on short or failed write (treat the connection as lost).
@@ -124,25 +197,159 @@ bool MockConnection::WriteAll(const unsigned char* data, std::size_t size) {
   if (server_fd_ < 0) {
     return false;
   }
+  const FUZZ_TIMING_PHASE prev_phase = fuzz_timing_switch(FUZZ_TIMING_MOCK_IO);
+  if (fuzz_frag_plan() != FUZZ_FRAG_WHOLE) {
+    const bool queued = fuzz_frag_write(&frag_, server_fd_, data, size) == 0;
+    if (queued) {
+      fuzz_pcap_record(pcap_stream_, FUZZ_PCAP_TO_CLIENT, data, size);
+      fuzz_spin_note_bytes(size);
+      fuzz_digest_event(FUZZ_DIGEST_RESPOND);
+    }
+    fuzz_timing_switch(prev_phase);
+    return queued;
+  }
+  const bool written = WriteDirect(data, size) == size;
+  fuzz_timing_switch(prev_phase);
+  return written;
+}
+
+/// Write 'size' bytes from 'data' in one piece even under a FUZZ_FRAGMENT plan. For bytes curl reads in a blocking
+/// call, where a fragment held back for the next drive-loop iteration would never arrive. If earlier bytes are still
+/// queued the new ones go behind them, so ordering is kept.
+/// @param data Buffer to send.
+/// @param size Number of bytes in 'data'.
+/// @return false on short or failed write (treat the connection as lost).
+bool MockConnection::WriteUnsplit(const unsigned char* data, std::size_t size) {
+  if (server_fd_ < 0) {
+    return false;
+  }
+  if (fragments_pending()) {
+    return WriteAll(data, size);
+  }
+  const FUZZ_TIMING_PHASE prev_phase = fuzz_timing_switch(FUZZ_TIMING_MOCK_IO);
+  const bool written = WriteDirect(data, size) == size;
+  fuzz_timing_switch(prev_phase);
+  return written;
+}
+
+/// @return true if FUZZ_FRAGMENT still holds bytes for this connection that curl hasn't been given.
+bool MockConnection::fragments_pending() const { return frag_.sent < frag_.len; }
+
+/// Send the next burst of a generated payload, as much of it as the socket takes now. The rest stays in 'stream' for
+/// the next call, so a payload larger than the socket buffer goes out as curl reads it and is never held whole. Under
+/// a FUZZ_FRAGMENT plan a burst is queued once the one before has been handed over.
+/// @param stream The payload; advanced past what was sent.
+/// @return true if any bytes were sent or queued.
+bool MockConnection::WriteGenerated(PayloadStream* stream) {
+  if (server_fd_ < 0 || stream->done() || fragments_pending()) {
+    return false;
+  }
+  unsigned char burst[kGeneratedBurstBytes];
+  const std::size_t size = stream->Fill(burst, sizeof(burst));
+  const std::size_t written = WriteAvailable(burst, size);
+  stream->Advance(written);
+  return written != 0;
+}
+
+/// Write as much of 'data' as the socket takes now, for a caller that keeps the rest and tries again once curl has
+/// read some. Under a FUZZ_FRAGMENT plan the whole buffer is queued instead, as WriteAll would.
+/// @param data Buffer to send.
+/// @param size Number of bytes in 'data'.
+/// @return the number of bytes written or queued; 0 if the connection is gone.
+std::size_t MockConnection::WriteAvailable(const unsigned char* data, std::size_t size) {
+  if (server_fd_ < 0) {
+    return 0;
+  }
+  if (fuzz_frag_plan() != FUZZ_FRAG_WHOLE) {
+    return WriteAll(data, size) ? size : 0;
+  }
+  const FUZZ_TIMING_PHASE prev_phase = fuzz_timing_switch(FUZZ_TIMING_MOCK_IO);
+  const std::size_t written = WriteDirect(data, size);
+  fuzz_timing_switch(prev_phase);
+  return written;
+}
+
+/// Write several buffers as one message with writev(), so a caller can send a head it built next to a body that stays
+/// where it is rather than copying both into one buffer. Under a FUZZ_FRAGMENT plan each piece is queued in turn, as
+/// WriteAll would.
+/// @param pieces The buffers, in order.
+/// @param count  Number of entries in 'pieces'; at most kMaxWritePieces.
+/// @return false on short or failed write (treat the connection as lost).
+bool MockConnection::WriteVector(const struct iovec* pieces, int count) {
+  if (server_fd_ < 0 || count < 0 || count > kMaxWritePieces) {
+    return false;
+  }
+  if (fuzz_frag_plan() != FUZZ_FRAG_WHOLE) {
+    for (int i = 0; i < count; ++i) {
+      const auto* data = static_cast<const unsigned char*>(pieces[i].iov_base);
+      if (pieces[i].iov_len != 0 && !WriteAll(data, pieces[i].iov_len)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  const FUZZ_TIMING_PHASE prev_phase = fuzz_timing_switch(FUZZ_TIMING_MOCK_IO);
+  struct iovec left[kMaxWritePieces];
+  std::copy(pieces, pieces + count, left);
+  int first = 0;
+  std::size_t sent = 0;
+  while (true) {
+    // Record what went, piece by piece, and step past it and any empty pieces.
+    while (first < count && sent >= left[first].iov_len) {
+      fuzz_pcap_record(pcap_stream_, FUZZ_PCAP_TO_CLIENT, left[first].iov_base, left[first].iov_len);
+      sent -= left[first].iov_len;
+      ++first;
+    }
+    if (sent != 0) {
+      fuzz_pcap_record(pcap_stream_, FUZZ_PCAP_TO_CLIENT, left[first].iov_base, sent);
+      left[first].iov_base = static_cast<char*>(left[first].iov_base) + sent;
+      left[first].iov_len -= sent;
+      sent = 0;
+    }
+    if (first == count) {
+      break;
+    }
+    ssize_t n = ::writev(server_fd_, left + first, count - first);
+    if (n <= 0) {
+      break;
+    }
+    fuzz_spin_note_bytes(static_cast<std::size_t>(n));
+    fuzz_digest_event(FUZZ_DIGEST_RESPOND);
+    sent = static_cast<std::size_t>(n);
+  }
+  fuzz_timing_switch(prev_phase);
+  return first == count;
+}
+
+/// Write loop shared by WriteAll, WriteUnsplit and WriteAvailable, bypassing the fragment queue.
+/// @param data Buffer to send.
+/// @param size Number of bytes in 'data'.
+/// @return the number of bytes written before the socket stopped taking them.
+std::size_t MockConnection::WriteDirect(const unsigned char* data, std::size_t size) {
   std::size_t written = 0;
   while (written < size) {
     ssize_t n = ::write(server_fd_, data + written, size - written);
     if (n <= 0) {
-      return false;
+      break;
     }
+    fuzz_pcap_record(pcap_stream_, FUZZ_PCAP_TO_CLIENT, data + written, static_cast<std::size_t>(n));
+    fuzz_spin_note_bytes(static_cast<std::size_t>(n));
+    fuzz_digest_event(FUZZ_DIGEST_RESPOND);
     written += static_cast<std::size_t>(n);
   }
-  return true;
+  return written;
 }
 
 /// Drain bytes curl has written. When a backpressure drain limit has been
 /// applied (see ApplyBackpressure), stops after drain_limit_ bytes so the
 /// kernel recv buffer stays near-full and curl keeps seeing short writes.
 /// Otherwise drains until read() returns 0/EAGAIN, matching legacy behaviour.
-void MockConnection::DrainIncoming() {
+/// @param sink If non-null, the drained bytes are appended to it.
+void MockConnection::DrainIncoming(std::string* sink) {
   if (server_fd_ < 0) {
     return;
   }
+  const FUZZ_TIMING_PHASE prev_phase = fuzz_timing_switch(FUZZ_TIMING_MOCK_IO);
   unsigned char scratch[4096];
   std::size_t drained = 0;
   while (drain_limit_ == 0 || drained < drain_limit_) {
@@ -155,10 +362,19 @@ void MockConnection::DrainIncoming() {
     }
     ssize_t n = ::read(server_fd_, scratch, want);
     if (n <= 0) {
+      peer_closed_ = peer_closed_ || n == 0;
       break;
     }
+    fuzz_pcap_record(pcap_stream_, FUZZ_PCAP_TO_SERVER, scratch, static_cast<std::size_t>(n));
+    fuzz_spin_note_bytes(static_cast<std::size_t>(n));
+    fuzz_digest_bytes(FUZZ_DIGEST_SENT, scratch, static_cast<std::size_t>(n));
+    fuzz_digest_event(FUZZ_DIGEST_SEND);
+    if (sink != nullptr) {
+      sink->append(reinterpret_cast<const char*>(scratch), static_cast<std::size_t>(n));
+    }
     drained += static_cast<std::size_t>(n);
   }
+  fuzz_timing_switch(prev_phase);
 }
 
 /// Tighten both halves of the socketpair buffer and/or cap DrainIncoming's
@@ -188,24 +404,45 @@ void MockConnection::ReadAvailable(std::string* out) {
   if (server_fd_ < 0 || out == nullptr) {
     return;
   }
+  const FUZZ_TIMING_PHASE prev_phase = fuzz_timing_switch(FUZZ_TIMING_MOCK_IO);
   unsigned char scratch[4096];
   while (true) {
     ssize_t n = ::read(server_fd_, scratch, sizeof(scratch));
     if (n <= 0) {
+      peer_closed_ = peer_closed_ || n == 0;
       break;
     }
+    fuzz_pcap_record(pcap_stream_, FUZZ_PCAP_TO_SERVER, scratch, static_cast<std::size_t>(n));
+    fuzz_spin_note_bytes(static_cast<std::size_t>(n));
+    fuzz_digest_bytes(FUZZ_DIGEST_SENT, scratch, static_cast<std::size_t>(n));
+    fuzz_digest_event(FUZZ_DIGEST_SEND);
     out->append(reinterpret_cast<const char*>(scratch), static_cast<std::size_t>(n));
   }
+  fuzz_timing_switch(prev_phase);
 }
 
-/// Signal end-of-response to libcurl by half-closing the write side.
+/// Signal end-of-response to libcurl by half-closing the write side, once anything queued under FUZZ_FRAGMENT is out.
 void MockConnection::ShutdownWrite() {
   if (server_fd_ < 0) {
     return;
   }
-  ::shutdown(server_fd_, SHUT_WR);
+  fuzz_frag_shutdown(&frag_, server_fd_);
+  fuzz_pcap_close_stream(pcap_stream_, FUZZ_PCAP_TO_CLIENT);
 }
 
+/// Under FUZZ_FRAGMENT, write the next piece of what WriteAll() queued once curl has read the last one. Drive loops
+/// call this every iteration; it is a no-op when nothing is queued.
+/// @return true if a fragment was written.
+bool MockConnection::FlushFragment() {
+  if (server_fd_ < 0) {
+    return false;
+  }
+  return fuzz_frag_flush(&frag_, server_fd_) == 1;
+}
+
+/// @return true once a read has seen curl close its end of the connection.
+bool MockConnection::peer_closed() const { return peer_closed_; }
+
 /// @class proto_fuzzer::MockServer
 /// @brief Orchestrates a single mock HTTP exchange: installs the socket callbacks on an easy handle, then feeds queued
 /// responses as libcurl reads them.
@@ -219,25 +456,38 @@ MockServer::~MockServer() = default;
 
 /// Queue bytes to emit. initial_response is written synchronously in the
 /// OPENSOCKETFUNCTION callback (HandleOpenSocket); on_readable entries are
-/// written one-at-a-time when libcurl makes the fd readable.
+/// written one-at-a-time when libcurl makes the fd readable, each followed
+/// by its generated bytes a burst per iteration.
 /// @param initial_response Bytes written immediately on connection open.
 /// @param on_readable      Additional chunks delivered one per iteration.
-void MockServer::SetScript(std::string initial_response, std::vector<std::string> on_readable) {
+/// @param generated        Bytes generated after each chunk, by index.
+void MockServer::SetScript(std::string initial_response, std::vector<std::string> on_readable,
+                           std::vector<PayloadStream> generated) {
   initial_response_ = std::move(initial_response);
   on_readable_ = std::move(on_readable);
+  generated_ = std::move(generated);
+  streaming_ = PayloadStream();
   next_chunk_ = 0;
   initial_sent_ = false;
 }
 
-/// @return true if at least one on_readable chunk has not yet been sent.
-bool MockServer::has_more_chunks() const { return next_chunk_ < on_readable_.size(); }
+/// Answer curl from 'rules' instead of pushing on_readable chunks. An empty
+/// list keeps the tick-driven delivery.
+/// @param rules The scenario's ResponseRules; must outlive the run.
+void MockServer::SetRules(const google::protobuf::RepeatedPtrField<curl::fuzzer::proto::ResponseRule>& rules) {
+  matcher_.SetRules(rules);
+}
+
+/// @return true if at least one on_readable chunk, or generated bytes after
+///         the last one sent, have not yet been sent.
+bool MockServer::has_more_chunks() const { return next_chunk_ < on_readable_.size() || !streaming_.done(); }
 
 /// Called by the OPENSOCKETFUNCTION trampoline in the base class. Creates the
 /// MockConnection, writes initial_response into it, and returns the
 /// client-side fd to hand to libcurl.
 /// @return the client-side fd to hand to libcurl, or CURL_SOCKET_BAD on
 ///         failure.
-curl_socket_t MockServer::HandleOpenSocket() {
+curl_socket_t MockServer::HandleOpenSocket(const struct curl_sockaddr* /*address*/) {
   if (connection_) {
     // This mock supports exactly one connection per scenario.
     return CURL_SOCKET_BAD;
@@ -256,38 +506,74 @@ curl_socket_t MockServer::HandleOpenSocket() {
     }
   }
   initial_sent_ = true;
-  if (on_readable_.empty()) {
+  if (on_readable_.empty() && !matcher_.active()) {
     connection_->ShutdownWrite();
   }
   return connection_->take_client_fd();
 }
 
-/// Push the next queued chunk. Called by the drive loop when curl is ready
-/// for more data. No-op if the queue is empty or no connection is open.
+/// Push the next burst of generated bytes, or else the next queued chunk.
+/// Called by the drive loop when curl is ready for more data. No-op if the
+/// queue is empty or no connection is open.
 void MockServer::DeliverNextChunk() {
-  if (!connection_ || next_chunk_ >= on_readable_.size()) {
+  if (!connection_ || !has_more_chunks()) {
     return;
   }
   connection_->DrainIncoming();
-  const std::string& chunk = on_readable_[next_chunk_++];
-  if (!chunk.empty()) {
-    connection_->WriteAll(reinterpret_cast<const unsigned char*>(chunk.data()), chunk.size());
+  if (!streaming_.done()) {
+    connection_->WriteGenerated(&streaming_);
+  } else {
+    streaming_ = next_chunk_ < generated_.size() ? generated_[next_chunk_] : PayloadStream();
+    const std::string& chunk = on_readable_[next_chunk_++];
+    if (!chunk.empty()) {
+      connection_->WriteAll(reinterpret_cast<const unsigned char*>(chunk.data()), chunk.size());
+    }
   }
-  if (next_chunk_ >= on_readable_.size()) {
+  if (!has_more_chunks()) {
     connection_->ShutdownWrite();
   }
 }
 
+/// Drain what curl has sent into the rule matcher and send the response of
+/// every rule that fires, half-closing after one that says so.
+/// @return true if any rule fired.
+bool MockServer::AnswerRequests() {
+  std::string incoming;
+  connection_->DrainIncoming(&incoming);
+  matcher_.Append(incoming);
+  bool answered = false;
+  while (const curl::fuzzer::proto::ResponseRule* rule = matcher_.Next()) {
+    answered = true;
+    const std::string response =
+        rule->has_http_response() ? SerializeHttpResponse(rule->http_response()) : rule->response();
+    if (!response.empty()) {
+      connection_->WriteAll(reinterpret_cast<const unsigned char*>(response.data()), response.size());
+    }
+    if (rule->close()) {
+      connection_->ShutdownWrite();
+      matcher_.Clear();
+      break;
+    }
+  }
+  return answered;
+}
+
 /// Seed the mock from the scenario, then drive the perform loop until curl is
 /// done or the idle-iteration cap is hit. Bounded by select() timeouts so a
-/// misbehaving scenario cannot spin forever.
+/// misbehaving scenario cannot spin forever. With response rules, each
+/// iteration answers what curl has sent instead of pushing the next chunk.
 /// @param multi    caller-owned multi; 'easy' is already added.
 /// @param easy     the curl easy handle attached to this mock.
 /// @param scenario source of the initial_response and on_readable chunks.
 void MockServer::RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Scenario& scenario) {
-  (void)easy;
   const auto& conn = scenario.connection();
-  SetScript(conn.initial_response(), BuildChunkList(conn));
+  SetRules(conn.rules());
+  std::vector<PayloadStream> generated;
+  std::vector<std::string> chunks;
+  if (!matcher_.active()) {
+    chunks = BuildChunkList(conn, &generated);
+  }
+  SetScript(conn.initial_response(), std::move(chunks), std::move(generated));
 
   int still_running = 1;
   int idle_iterations = 0;
@@ -295,14 +581,19 @@ void MockServer::RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Sc
 
   while (still_running && idle_iterations < kMaxIdleIterations) {
     rc = curl_multi_perform(multi, &still_running);
+    fuzz_spin_note_perform(multi, still_running);
+    fuzz_digest_iteration();
     if (rc != CURLM_OK) {
       break;
     }
     if (!still_running) {
       break;
     }
+    if (connection_ && connection_->FlushFragment()) {
+      idle_iterations = 0;
+    }
 
-    int ready = WaitOnMultiFdset(multi, &rc);
+    int ready = WaitOnMultiFdset(multi, easy, &rc);
     if (rc != CURLM_OK) {
       break;
     }
@@ -311,13 +602,18 @@ void MockServer::RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Sc
     // recv buffer would otherwise stay full — curl short-writes, the mock
     // never consumes, and the transfer wedges until kMaxIdleIterations. With
     // drain_limit set this still honours the per-tick byte budget.
+    bool answered = false;
     if (connection_) {
-      connection_->DrainIncoming();
+      if (matcher_.active()) {
+        answered = AnswerRequests();
+      } else {
+        connection_->DrainIncoming();
+      }
     }
     if (has_more_chunks()) {
       DeliverNextChunk();
       idle_iterations = 0;
-    } else if (ready == 0) {
+    } else if (ready == 0 && !answered) {
       ++idle_iterations;
     } else {
       idle_iterations = 0;
@@ -12,19 +12,24 @@
 #define PROTO_FUZZER_MOCK_SERVER_H_
 
 #include <curl/curl.h>
+#include <sys/uio.h>
 
 #include <cstddef>
 #include <string>
 #include <vector>
 
 #include "curl_fuzzer.pb.h"
+#include "curl_fuzzer_frag.h"
 #include "proto_fuzzer/mock_server_base.h"
+#include "proto_fuzzer/payload_generator.h"
+#include "proto_fuzzer/request_matcher.h"
 
 namespace proto_fuzzer {
 
 class MockConnection {
  public:
   MockConnection();
+  explicit MockConnection(int server_fd);
   ~MockConnection();
 
   MockConnection(const MockConnection&) = delete;
@@ -35,9 +40,16 @@ class MockConnection {
   int server_fd() const;
 
   bool WriteAll(const unsigned char* data, std::size_t size);
-  void DrainIncoming();
+  bool WriteUnsplit(const unsigned char* data, std::size_t size);
+  bool WriteGenerated(PayloadStream* stream);
+  std::size_t WriteAvailable(const unsigned char* data, std::size_t size);
+  bool WriteVector(const struct iovec* pieces, int count);
+  void DrainIncoming(std::string* sink = nullptr);
   void ReadAvailable(std::string* out);
   void ShutdownWrite();
+  bool FlushFragment();
+  bool peer_closed() const;
+  bool fragments_pending() const;
 
   /// Apply deterministic backpressure knobs. Set SO_RCVBUF on the server
   /// side (if recv_buf_bytes > 0) to cap how much curl can write before it
@@ -49,9 +61,14 @@ class MockConnection {
   void ApplyBackpressure(int recv_buf_bytes, std::size_t drain_limit);
 
  private:
+  std::size_t WriteDirect(const unsigned char* data, std::size_t size);
+
   int server_fd_;
   int client_fd_;
   std::size_t drain_limit_;
+  int pcap_stream_;
+  bool peer_closed_;
+  FUZZ_FRAG_QUEUE frag_;
 };
 
 /// @class proto_fuzzer::MockServer
@@ -64,20 +81,30 @@ class MockServer : public MockServerBase {
   MockServer();
   ~MockServer() override;
 
-  void SetScript(std::string initial_response, std::vector<std::string> on_readable);
+  void SetScript(std::string initial_response, std::vector<std::string> on_readable,
+                 std::vector<PayloadStream> generated = {});
+  void SetRules(const google::protobuf::RepeatedPtrField<curl::fuzzer::proto::ResponseRule>& rules);
 
   void DeliverNextChunk();
   bool has_more_chunks() const;
 
  protected:
-  curl_socket_t HandleOpenSocket() override;
+  curl_socket_t HandleOpenSocket(const struct curl_sockaddr* address) override;
   void RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Scenario& scenario) override;
 
  private:
+  bool AnswerRequests();
+
   std::string initial_response_;
   std::vector<std::string> on_readable_;
+  /// Bytes generated after each on_readable chunk, by index; may be shorter.
+  std::vector<PayloadStream> generated_;
+  /// What is left of the generated bytes after the chunk last sent.
+  PayloadStream streaming_;
   std::size_t next_chunk_;
   bool initial_sent_;
+  /// Matches what curl sends against the scenario's rules, if it has any.
+  RequestMatcher matcher_;
 };
 
 }  // namespace proto_fuzzer
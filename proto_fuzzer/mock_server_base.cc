@@ -13,6 +13,9 @@
 
 #include <sys/select.h>
 
+#include "curl_fuzzer_digest.h"
+#include "curl_fuzzer_timing.h"
+#include "curl_fuzzer_waits.h"
 #include "proto_fuzzer/mock_server.h"
 
 namespace proto_fuzzer {
@@ -22,9 +25,14 @@ namespace {
 constexpr long kSelectTimeoutUs = 10 * 1000;  // 10 ms
 
 /// @brief Noop function to satisfy CURLOPT_SOCKOPTFUNCTION.
+/// @param purpose CURLSOCKTYPE_IPCXN for sockets the mock handed out, or
+///                CURLSOCKTYPE_ACCEPT for one curl accepted from a socket it
+///                listens on (FTP active mode).
 /// @return CURL_SOCKOPT_ALREADY_CONNECTED: the socketpair is already connected.
-int SockOptTrampoline(void* /*clientp*/, curl_socket_t /*curlfd*/, curlsocktype /*purpose*/) {
-  return CURL_SOCKOPT_ALREADY_CONNECTED;
+///         Accepted sockets get CURL_SOCKOPT_OK, as curl treats anything else
+///         there as an error.
+int SockOptTrampoline(void* /*clientp*/, curl_socket_t /*curlfd*/, curlsocktype purpose) {
+  return purpose == CURLSOCKTYPE_ACCEPT ? CURL_SOCKOPT_OK : CURL_SOCKOPT_ALREADY_CONNECTED;
 }
 
 }  // namespace
@@ -34,12 +42,17 @@ int SockOptTrampoline(void* /*clientp*/, curl_socket_t /*curlfd*/, curlsocktype
 /// @param clientp Pointer to the MockServerBase instance.
 /// @return The client-side socket fd as a curl_socket_t.
 curl_socket_t MockServerBaseOpenSocketTrampoline(void* clientp, curlsocktype /*purpose*/,
-                                                 struct curl_sockaddr* /*address*/) {
-  return static_cast<MockServerBase*>(clientp)->HandleOpenSocket();
+                                                 struct curl_sockaddr* address) {
+  const FUZZ_TIMING_PHASE prev_phase = fuzz_timing_switch(FUZZ_TIMING_SOCKET_OPEN);
+  fuzz_digest_event(FUZZ_DIGEST_SOCKET_OPEN);
+  curl_socket_t fd = static_cast<MockServerBase*>(clientp)->HandleOpenSocket(address);
+  fuzz_timing_switch(prev_phase);
+  return fd;
 }
 
 /// Default-construct an empty base instance with no connection.
-MockServerBase::MockServerBase() : connection_(nullptr), pending_recv_buf_bytes_(0), pending_drain_limit_(0) {}
+MockServerBase::MockServerBase()
+    : connection_(nullptr), pending_recv_buf_bytes_(0), pending_drain_limit_(0), front_(nullptr) {}
 
 /// Out-of-line destructor so MockConnection can stay forward-declared in the
 /// base header (its complete type is only needed where unique_ptr is
@@ -68,12 +81,23 @@ void MockServerBase::DriveScenario(CURL* easy, const curl::fuzzer::proto::Scenar
   pending_recv_buf_bytes_ = static_cast<int>(bp.recv_buf_bytes());
   pending_drain_limit_ = static_cast<std::size_t>(bp.drain_limit());
 
+  // Time in RunLoop is curl's unless the mock switches it out for select()
+  // or its own socket I/O.
+  fuzz_timing_switch(FUZZ_TIMING_PERFORM_CURL);
   CURLM* multi = curl_multi_init();
   if (multi == nullptr) {
     return;
   }
   if (curl_multi_add_handle(multi, easy) == CURLM_OK) {
     RunLoop(multi, easy, scenario);
+    // Record how the transfer ended, if it did, for the determinism check and the wait report.
+    int msgs_left = 0;
+    while (CURLMsg* msg = curl_multi_info_read(multi, &msgs_left)) {
+      if (msg->msg == CURLMSG_DONE) {
+        fuzz_digest_result(msg->data.result);
+        fuzz_waits_result(msg->data.result);
+      }
+    }
     curl_multi_remove_handle(multi, easy);
   }
   curl_multi_cleanup(multi);
@@ -88,9 +112,16 @@ void MockServerBase::ApplyPendingBackpressure() {
   }
 }
 
-/// Wait on curl's fdset with a short timeout. Returns select()'s result; on
-/// error sets *rc to the corresponding CURLMcode.
-int MockServerBase::WaitOnMultiFdset(CURLM* multi, CURLMcode* rc) {
+/// No hop in front of a plain mock.
+void MockServerBase::ServiceHop() {}
+
+/// Wait on curl's fdset with a short timeout, or just sleep for it if curl has
+/// no fds to wait on. Returns select()'s result; on error sets *rc to the
+/// corresponding CURLMcode.
+int MockServerBase::WaitOnMultiFdset(CURLM* multi, CURL* easy, CURLMcode* rc) {
+  if (front_ != nullptr) {
+    front_->ServiceHop();
+  }
   fd_set readfds;
   fd_set writefds;
   fd_set excfds;
@@ -102,13 +133,18 @@ int MockServerBase::WaitOnMultiFdset(CURLM* multi, CURLMcode* rc) {
   if (*rc != CURLM_OK) {
     return -1;
   }
-  if (maxfd < 0) {
-    return 0;
-  }
+  // With no fds curl is waiting on a timer alone (it often is with a partial
+  // frame or response buffered), so select() still sleeps for the timeout
+  // rather than returning straight away and burning idle iterations.
   struct timeval timeout;
   timeout.tv_sec = 0;
   timeout.tv_usec = kSelectTimeoutUs;
-  return ::select(maxfd + 1, &readfds, &writefds, &excfds, &timeout);
+  fuzz_waits_begin(multi, easy, kSelectTimeoutUs / 1000);
+  const FUZZ_TIMING_PHASE prev_phase = fuzz_timing_switch(FUZZ_TIMING_PERFORM_WAIT);
+  const int ready = ::select(maxfd + 1, &readfds, &writefds, &excfds, &timeout);
+  fuzz_timing_switch(prev_phase);
+  fuzz_waits_end(ready);
+  return ready;
 }
 
 }  // namespace proto_fuzzer
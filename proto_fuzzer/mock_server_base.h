@@ -63,8 +63,12 @@ class MockServerBase {
   /// Subclass hook invoked by the OPENSOCKET trampoline. The subclass owns the
   /// decision to construct `connection_`, push any initial bytes, and hand the
   /// client fd back to libcurl.
+  /// @param address The address curl wants the socket for. Most mocks ignore
+  ///                it; a protocol that has curl listen for the server (FTP
+  ///                active mode) needs its family to create a socket curl can
+  ///                bind.
   /// @return the client-side fd to hand to libcurl, or CURL_SOCKET_BAD.
-  virtual curl_socket_t HandleOpenSocket() = 0;
+  virtual curl_socket_t HandleOpenSocket(const struct curl_sockaddr* address) = 0;
 
   /// Subclass hook invoked from DriveScenario. Runs the protocol-specific
   /// perform loop against a caller-owned multi that already has 'easy' added.
@@ -74,11 +78,19 @@ class MockServerBase {
   virtual void RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Scenario& scenario) = 0;
 
   /// Wait on curl's fdset with a short timeout so a scenario cannot spin
-  /// forever. Shared by every subclass's drive loop.
+  /// forever. Shared by every subclass's drive loop. A mock in front of this
+  /// one (front_) gets its ServiceHop() turn first.
   /// @param multi The multi handle whose fdset to poll.
+  /// @param easy  The transfer being driven, used to attribute the wait to
+  ///              a transfer phase when FUZZ_WAITS is set.
   /// @param rc    Out parameter: set to the CURLMcode on error.
   /// @return select()'s result, or -1 on curl_multi_fdset failure.
-  static int WaitOnMultiFdset(CURLM* multi, CURLMcode* rc);
+  int WaitOnMultiFdset(CURLM* multi, CURL* easy, CURLMcode* rc);
+
+  /// Hook for a mock sitting in front of another on curl's connections (a
+  /// proxy hop). Called once per drive-loop iteration of the mock it fronts,
+  /// whose RunLoop drives the scenario. The default does nothing.
+  virtual void ServiceHop();
 
   /// Cap on consecutive idle perform iterations before a drive loop bails.
   /// Shared so subclass loops cap identically.
@@ -102,8 +114,13 @@ class MockServerBase {
   /// pending_recv_buf_bytes_; 0 means unlimited (legacy drain behaviour).
   std::size_t pending_drain_limit_;
 
+  /// The mock in front of this one, or nullptr when curl talks to it
+  /// directly. Set by ProxyMockServer for its origin.
+  MockServerBase* front_;
+
  private:
   friend curl_socket_t MockServerBaseOpenSocketTrampoline(void*, curlsocktype, struct curl_sockaddr*);
+  friend class ProxyMockServer;
 };
 
 }  // namespace proto_fuzzer
@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief Implementation of MqttMockServer.
+
+#include "proto_fuzzer/mqtt_mock_server.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "curl_fuzzer_digest.h"
+#include "curl_fuzzer_spin.h"
+#include "proto_fuzzer/mock_server.h"
+#include "proto_fuzzer/mqtt_packet.h"
+
+namespace proto_fuzzer {
+
+namespace {
+
+// Cap on PUBLISH packets streamed, so a mutator that piles up entries can't
+// dominate runtime.
+constexpr std::size_t kMaxPublishes = 16;
+
+// Largest packet from curl the mock buffers. curl's packets are small; a
+// remaining length beyond this means the stream is out of step.
+constexpr std::uint32_t kMaxClientPacket = 64 * 1024;
+
+// MQTT 3.1.1 §2.2.1 control packet types curl sends.
+constexpr std::uint8_t kTypeConnect = 1;
+constexpr std::uint8_t kTypeSubscribe = 8;
+constexpr std::uint8_t kTypePingreq = 12;
+constexpr std::uint8_t kTypeDisconnect = 14;
+
+constexpr char kPingresp[] = "\xD0\x00";
+
+}  // namespace
+
+/// Construct an idle MqttMockServer. RunLoop() seeds it from the scenario
+/// before curl opens the connection.
+MqttMockServer::MqttMockServer() : script_(nullptr), streaming_(false), next_publish_(0), closed_(false) {}
+
+/// Default destructor; the MockConnection closes its socket.
+MqttMockServer::~MqttMockServer() = default;
+
+/// Use 'script' for the rest of the scenario.
+/// @param script The scenario's MqttScript; must outlive the run.
+void MqttMockServer::SetScript(const curl::fuzzer::proto::MqttScript& script) { script_ = &script; }
+
+/// Called by the OPENSOCKETFUNCTION trampoline in the base class. MQTT uses
+/// a single connection, and the client speaks first.
+curl_socket_t MqttMockServer::HandleOpenSocket(const struct curl_sockaddr* /*address*/) {
+  if (connection_) {
+    return CURL_SOCKET_BAD;
+  }
+  connection_ = std::make_unique<MockConnection>();
+  if (!connection_->ok()) {
+    connection_.reset();
+    return CURL_SOCKET_BAD;
+  }
+  ApplyPendingBackpressure();
+  // curl's CONNECT carries a randomly generated client identifier, so what
+  // it sends can't be compared between runs.
+  fuzz_digest_ignore(FUZZ_DIGEST_SENT);
+  return connection_->take_client_fd();
+}
+
+/// Write already-serialised packet bytes to curl.
+/// @param bytes One or more whole packets.
+void MqttMockServer::SendPacket(const std::string& bytes) {
+  if (connection_ && !closed_ && !bytes.empty()) {
+    connection_->WriteAll(reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size());
+  }
+}
+
+/// Stop streaming and half-close the connection, as a broker does after
+/// DISCONNECT or a malformed packet.
+void MqttMockServer::Close() {
+  if (connection_ && !closed_) {
+    closed_ = true;
+    streaming_ = false;
+    connection_->ShutdownWrite();
+  }
+}
+
+/// Answer one packet from curl.
+/// @param type Packet type from the high nibble of byte 0.
+/// @param body Variable header and payload.
+void MqttMockServer::HandlePacket(std::uint8_t type, const std::string& body) {
+  switch (type) {
+    case kTypeConnect:
+      if (script_->has_connack()) {
+        SendPacket(SerializeMqttPacket(script_->connack()));
+      } else {
+        curl::fuzzer::proto::MqttPacket connack;
+        connack.mutable_connack();
+        SendPacket(SerializeMqttPacket(connack));
+      }
+      break;
+    case kTypeSubscribe: {
+      // A SUBACK names the SUBSCRIBE it answers by packet identifier.
+      std::uint32_t packet_id = 0;
+      if (body.size() >= 2) {
+        packet_id = (static_cast<std::uint32_t>(static_cast<unsigned char>(body[0])) << 8) |
+                    static_cast<unsigned char>(body[1]);
+      }
+      curl::fuzzer::proto::MqttPacket suback;
+      if (script_->has_suback()) {
+        suback = script_->suback();
+      } else {
+        suback.mutable_suback()->add_return_codes(0);
+      }
+      if (suback.has_suback() && suback.suback().packet_id() == 0) {
+        suback.mutable_suback()->set_packet_id(packet_id);
+      }
+      SendPacket(SerializeMqttPacket(suback));
+      streaming_ = true;
+      break;
+    }
+    case kTypePingreq:
+      SendPacket(std::string(kPingresp, sizeof(kPingresp) - 1));
+      break;
+    case kTypeDisconnect:
+      Close();
+      break;
+    default:
+      // PUBLISH at QoS 0 (all curl sends) and anything unexpected need no
+      // answer.
+      break;
+  }
+}
+
+/// Split what curl has sent into packets and answer each whole one.
+/// @return true if at least one packet was handled.
+bool MqttMockServer::ServiceInput() {
+  if (!connection_) {
+    return false;
+  }
+  connection_->ReadAvailable(&input_);
+
+  bool handled = false;
+  while (input_.size() >= 2) {
+    // Remaining length: up to four varint bytes after byte 0.
+    std::uint32_t length = 0;
+    std::size_t header = 0;
+    for (std::size_t i = 1; i < input_.size() && i <= 4; ++i) {
+      const auto digit = static_cast<unsigned char>(input_[i]);
+      length |= static_cast<std::uint32_t>(digit & 0x7F) << (7 * (i - 1));
+      if ((digit & 0x80) == 0) {
+        header = i + 1;
+        break;
+      }
+    }
+    if (header == 0) {
+      if (input_.size() > 4) {
+        // Five or more length bytes: curl is out of step, so stop listening.
+        input_.clear();
+        Close();
+      }
+      break;
+    }
+    if (length > kMaxClientPacket) {
+      input_.clear();
+      Close();
+      break;
+    }
+    if (input_.size() < header + length) {
+      break;
+    }
+
+    const auto type = static_cast<std::uint8_t>(static_cast<unsigned char>(input_[0]) >> 4);
+    const std::string body = input_.substr(header, length);
+    input_.erase(0, header + length);
+    HandlePacket(type, body);
+    handled = true;
+  }
+  return handled;
+}
+
+/// Send the next scripted PUBLISH, or close the connection once they have
+/// all gone.
+/// @return true if anything was sent or closed.
+bool MqttMockServer::StreamNextPublish() {
+  if (!streaming_ || closed_) {
+    return false;
+  }
+  const std::size_t count = std::min<std::size_t>(kMaxPublishes, script_->publishes_size());
+  if (next_publish_ < count) {
+    SendPacket(SerializeMqttPacket(script_->publishes(static_cast<int>(next_publish_))));
+    ++next_publish_;
+    return true;
+  }
+  Close();
+  return true;
+}
+
+/// Seed the mock from the scenario, then drive the perform loop until curl is
+/// done or the idle-iteration cap is hit. Each iteration answers whatever
+/// packets curl has sent and streams the next PUBLISH.
+/// @param multi    caller-owned multi; 'easy' is already added.
+/// @param easy     the curl easy handle attached to this mock.
+/// @param scenario source of the MqttScript.
+void MqttMockServer::RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Scenario& scenario) {
+  SetScript(scenario.connection().mqtt());
+
+  int still_running = 1;
+  int idle_iterations = 0;
+  CURLMcode rc = CURLM_OK;
+
+  while (still_running && idle_iterations < kMaxIdleIterations) {
+    rc = curl_multi_perform(multi, &still_running);
+    fuzz_spin_note_perform(multi, still_running);
+    fuzz_digest_iteration();
+    if (rc != CURLM_OK) {
+      break;
+    }
+    if (!still_running) {
+      break;
+    }
+    if (connection_ && connection_->FlushFragment()) {
+      idle_iterations = 0;
+    }
+
+    int ready = WaitOnMultiFdset(multi, easy, &rc);
+    if (rc != CURLM_OK) {
+      break;
+    }
+
+    bool progressed = ServiceInput();
+    // Hold the next PUBLISH back until curl has the previous one.
+    if (!connection_ || !connection_->fragments_pending()) {
+      progressed = StreamNextPublish() || progressed;
+    }
+    if (progressed || ready != 0) {
+      idle_iterations = 0;
+    } else {
+      ++idle_iterations;
+    }
+  }
+}
+
+}  // namespace proto_fuzzer
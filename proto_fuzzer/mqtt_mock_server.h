@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief MqttMockServer — an in-process MQTT broker that answers curl's
+///        CONNECT and SUBSCRIBE from an MqttScript and then streams PUBLISH
+///        packets.
+
+#ifndef PROTO_FUZZER_MQTT_MOCK_SERVER_H_
+#define PROTO_FUZZER_MQTT_MOCK_SERVER_H_
+
+#include <curl/curl.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "curl_fuzzer.pb.h"
+#include "proto_fuzzer/mock_server_base.h"
+
+namespace proto_fuzzer {
+
+/// @class proto_fuzzer::MqttMockServer
+/// @brief In-process MQTT peer. Parses the control packets curl sends and
+///        answers each one the way a broker would: CONNACK for CONNECT,
+///        SUBACK for SUBSCRIBE, PINGRESP for PINGREQ. Once a SUBSCRIBE has
+///        been answered it streams the scenario's PUBLISH packets, one per
+///        drive-loop iteration, then closes the connection.
+class MqttMockServer : public MockServerBase {
+ public:
+  MqttMockServer();
+  ~MqttMockServer() override;
+
+  void SetScript(const curl::fuzzer::proto::MqttScript& script);
+
+ protected:
+  curl_socket_t HandleOpenSocket(const struct curl_sockaddr* address) override;
+  void RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Scenario& scenario) override;
+
+ private:
+  bool ServiceInput();
+  void HandlePacket(std::uint8_t type, const std::string& body);
+  bool StreamNextPublish();
+  void SendPacket(const std::string& bytes);
+  void Close();
+
+  /// The scenario's script; owned by the Scenario, which outlives the run.
+  const curl::fuzzer::proto::MqttScript* script_;
+  /// Bytes read from curl that don't yet form a whole packet.
+  std::string input_;
+  /// Set once a SUBSCRIBE has been answered: PUBLISH packets follow.
+  bool streaming_;
+  /// Index of the next scripted PUBLISH to send.
+  std::size_t next_publish_;
+  /// Set once the mock has closed its side of the connection.
+  bool closed_;
+};
+
+}  // namespace proto_fuzzer
+
+#endif  // PROTO_FUZZER_MQTT_MOCK_SERVER_H_
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief Implementation of SerializeMqttPacket.
+
+#include "proto_fuzzer/mqtt_packet.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace proto_fuzzer {
+
+namespace {
+
+// MQTT 3.1.1 §2.2.1 control packet types the typed bodies stand for.
+constexpr std::uint32_t kTypeConnack = 2;
+constexpr std::uint32_t kTypePublish = 3;
+constexpr std::uint32_t kTypeSuback = 9;
+
+// A remaining length never takes more than four varint bytes (§2.2.3); the
+// fifth is there to be rejected.
+constexpr std::uint32_t kMaxLengthForm = 5;
+
+/// Append 'value' as a big-endian 16-bit integer to 'out'.
+void AppendUint16(std::string* out, std::uint32_t value) {
+  out->push_back(static_cast<char>((value >> 8) & 0xFF));
+  out->push_back(static_cast<char>(value & 0xFF));
+}
+
+/// Render the variable header and payload for the packet's typed body.
+/// @param packet The packet whose body to render.
+/// @param type   Receives the body's own packet type, or 0 for raw/none.
+/// @return the body bytes.
+std::string SerializeBody(const curl::fuzzer::proto::MqttPacket& packet, std::uint32_t* type) {
+  std::string body;
+  *type = 0;
+  switch (packet.body_case()) {
+    case curl::fuzzer::proto::MqttPacket::kConnack:
+      *type = kTypeConnack;
+      body.push_back(packet.connack().session_present() ? 0x01 : 0x00);
+      body.push_back(static_cast<char>(packet.connack().return_code() & 0xFF));
+      break;
+    case curl::fuzzer::proto::MqttPacket::kSuback:
+      *type = kTypeSuback;
+      AppendUint16(&body, packet.suback().packet_id());
+      for (std::uint32_t code : packet.suback().return_codes()) {
+        body.push_back(static_cast<char>(code & 0xFF));
+      }
+      break;
+    case curl::fuzzer::proto::MqttPacket::kPublish: {
+      *type = kTypePublish;
+      const std::string& topic = packet.publish().topic();
+      AppendUint16(&body, static_cast<std::uint32_t>(topic.size()));
+      body.append(topic);
+      // QoS 1 and 2 PUBLISH packets carry a packet identifier (§3.3.2.2).
+      if ((packet.flags() & 0x06) != 0) {
+        AppendUint16(&body, packet.publish().packet_id());
+      }
+      body.append(packet.publish().payload());
+      break;
+    }
+    case curl::fuzzer::proto::MqttPacket::kRaw:
+      body = packet.raw();
+      break;
+    case curl::fuzzer::proto::MqttPacket::BODY_NOT_SET:
+      break;
+  }
+  return body;
+}
+
+/// Append the remaining-length varint for 'value' to 'out' in 'form' bytes.
+/// A form shorter than the minimal encoding keeps only the low 7 bits per
+/// byte, and a longer one pads with zero-valued continuation bytes — both
+/// are what a malformed peer would send.
+void AppendRemainingLength(std::string* out, std::uint64_t value, std::uint32_t form) {
+  if (form == 0) {
+    do {
+      std::uint8_t digit = value & 0x7F;
+      value >>= 7;
+      if (value > 0) {
+        digit |= 0x80;
+      }
+      out->push_back(static_cast<char>(digit));
+    } while (value > 0);
+    return;
+  }
+  for (std::uint32_t i = 0; i < form; ++i) {
+    std::uint8_t digit = value & 0x7F;
+    value >>= 7;
+    if (i + 1 < form) {
+      digit |= 0x80;
+    }
+    out->push_back(static_cast<char>(digit));
+  }
+}
+
+}  // namespace
+
+/// Serialise a proto MqttPacket into MQTT 3.1.1 wire bytes: byte 0 from type
+/// and flags, the remaining-length varint, then the body.
+/// @param packet The MqttPacket proto message to render.
+/// @return The serialised byte string, ready to push onto the mock socket.
+std::string SerializeMqttPacket(const curl::fuzzer::proto::MqttPacket& packet) {
+  std::uint32_t body_type = 0;
+  const std::string body = SerializeBody(packet, &body_type);
+  const std::uint32_t type = packet.type() != 0 ? packet.type() : body_type;
+
+  std::string out;
+  out.reserve(body.size() + 1 + kMaxLengthForm);
+  out.push_back(static_cast<char>(((type & 0x0F) << 4) | (packet.flags() & 0x0F)));
+
+  const std::int64_t declared = static_cast<std::int64_t>(body.size()) + packet.length_adjust();
+  const std::uint32_t form = packet.length_form() > kMaxLengthForm ? kMaxLengthForm : packet.length_form();
+  AppendRemainingLength(&out, declared < 0 ? 0 : static_cast<std::uint64_t>(declared), form);
+
+  out.append(body);
+  return out;
+}
+
+}  // namespace proto_fuzzer
@@ -0,0 +1,26 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief Serialize a proto MqttPacket message into MQTT 3.1.1 wire bytes.
+
+#ifndef PROTO_FUZZER_MQTT_PACKET_H_
+#define PROTO_FUZZER_MQTT_PACKET_H_
+
+#include <string>
+
+#include "curl_fuzzer.pb.h"
+
+namespace proto_fuzzer {
+
+// Render 'packet' into raw MQTT wire bytes. No validation: reserved flags,
+// overlong or truncated remaining lengths and lengths that disagree with the
+// body round-trip into the byte stream unchanged so the decoder sees them.
+std::string SerializeMqttPacket(const curl::fuzzer::proto::MqttPacket& packet);
+
+}  // namespace proto_fuzzer
+
+#endif  // PROTO_FUZZER_MQTT_PACKET_H_
@@ -16,13 +16,16 @@
 #include <cstdlib>
 #include <string>
 
+#include "curl_fuzzer_digest.h"
+
 namespace proto_fuzzer {
 
 /// How a SetOption oneof should be decoded before calling curl_easy_setopt.
 enum class OptionValueKind {
   kString,  ///< string_value → const char* option.
   kUint,    ///< uint_value → long or curl_off_t option.
-  kBool     ///< bool_value → 0/1 long option.
+  kBool,    ///< bool_value → 0/1 long option.
+  kSlist    ///< slist_value → struct curl_slist* option.
 };
 
 /// One row in the build-time-generated option manifest: binds a proto enum
@@ -43,20 +46,27 @@ struct OptionDescriptor {
 
 namespace {
 
-constexpr char kProtocolsAllowed[] = "http,ws,wss";
+constexpr char kProtocolsAllowed[] = "http,ws,wss,ftp,smtp,imap,pop3,mqtt,rtsp,smb,ldap";
 constexpr char kConnectToOverride[] = "::127.0.1.127:";
 constexpr char kDevNull[] = "/dev/null";
 constexpr char kVerboseEnvVar[] = "FUZZ_VERBOSE";
 constexpr long kConnectTimeoutMs = 200;
 constexpr long kTimeoutMs = 2000;
 constexpr long kMaxRecvSpeed = 16 * 1024;
+// Cap on entries in one slist option, so a mutator that piles up items
+// can't make curl walk a huge recipient list.
+constexpr int kMaxSlistItems = 16;
 
 /// Baseline write callback for both CURLOPT_WRITEFUNCTION and
 /// CURLOPT_HEADERFUNCTION. Consumes every byte so transfers don't stall on
 /// backpressure and emits nothing. Protocol-specific mocks may install their
 /// own WRITEFUNCTION afterwards if they need to poke protocol APIs while
 /// inside a curl callback.
-size_t SilentWriteCallback(void* /*contents*/, size_t size, size_t nmemb, void* /*userdata*/) { return size * nmemb; }
+size_t SilentWriteCallback(void* contents, size_t size, size_t nmemb, void* /*userdata*/) {
+  fuzz_digest_event(FUZZ_DIGEST_WRITE_CB);
+  fuzz_digest_bytes(FUZZ_DIGEST_DELIVERED, contents, size * nmemb);
+  return size * nmemb;
+}
 
 /// Bounded stream of bytes fed to curl_easy when CURLOPT_UPLOAD is enabled.
 /// The fuzzer can't use stdin as the default UPLOAD source — it'd hang — so we
@@ -72,6 +82,7 @@ struct ReadState {
 };
 
 size_t BoundedReadCallback(char* buffer, size_t size, size_t nitems, void* userdata) {
+  fuzz_digest_event(FUZZ_DIGEST_READ_CB);
   if (userdata == nullptr) {
     return 0;
   }
@@ -124,8 +135,8 @@ struct curl_slist* ApplyBaselineOptions(CURL* easy) {
   curl_easy_setopt(easy, CURLOPT_READFUNCTION, &BoundedReadCallback);
   curl_easy_setopt(easy, CURLOPT_READDATA, &g_read_state);
 
-  // Confine the easy handle to plain HTTP; refuse redirects to any other
-  // scheme. CURLOPT_PROTOCOLS_STR arrived in 7.85.0.
+  // Confine the easy handle to the plain-text schemes the mocks speak;
+  // refuse redirects to any other scheme. CURLOPT_PROTOCOLS_STR arrived in 7.85.0.
   curl_easy_setopt(easy, CURLOPT_PROTOCOLS_STR, kProtocolsAllowed);
   curl_easy_setopt(easy, CURLOPT_REDIR_PROTOCOLS_STR, kProtocolsAllowed);
 
@@ -161,10 +172,13 @@ struct curl_slist* ApplyBaselineOptions(CURL* easy) {
 ///                       value to set.
 /// @param string_storage Backing store that the option's string value is
 ///                       copied into; must outlive curl_easy_perform.
+/// @param slist_storage  Receives any curl_slist built for the option. curl
+///                       doesn't copy lists, so the caller frees them with
+///                       curl_slist_free_all after curl_easy_cleanup.
 /// @return CURLE_OK on success, an error code if the option is unsupported or
 ///         the setopt call itself failed.
 CURLcode ApplySetOption(CURL* easy, const curl::fuzzer::proto::SetOption& option,
-                        std::vector<std::string>* string_storage) {
+                        std::vector<std::string>* string_storage, std::vector<struct curl_slist*>* slist_storage) {
   const OptionDescriptor* desc = Lookup(option.option_id());
   if (desc == nullptr) {
     return CURLE_UNKNOWN_OPTION;
@@ -201,6 +215,25 @@ CURLcode ApplySetOption(CURL* easy, const curl::fuzzer::proto::SetOption& option
       long flag = option.bool_value() ? 1L : 0L;
       return curl_easy_setopt(easy, desc->curlopt, flag);
     }
+
+    // Build a curl_slist from the items, capped at kMaxSlistItems. An empty
+    // list passes nullptr, which resets the option.
+    case OptionValueKind::kSlist: {
+      const auto& items = option.slist_value().items();
+      struct curl_slist* list = nullptr;
+      const int count = std::min(kMaxSlistItems, items.size());
+      for (int i = 0; i < count; ++i) {
+        struct curl_slist* appended = curl_slist_append(list, std::string(items.Get(i)).c_str());
+        if (appended == nullptr) {
+          break;
+        }
+        list = appended;
+      }
+      if (list != nullptr) {
+        slist_storage->push_back(list);
+      }
+      return curl_easy_setopt(easy, desc->curlopt, list);
+    }
   }
   return CURLE_UNKNOWN_OPTION;
 }
@@ -23,7 +23,7 @@ namespace proto_fuzzer {
 struct curl_slist* ApplyBaselineOptions(CURL* easy);
 
 CURLcode ApplySetOption(CURL* easy, const curl::fuzzer::proto::SetOption& option,
-                        std::vector<std::string>* string_storage);
+                        std::vector<std::string>* string_storage, std::vector<struct curl_slist*>* slist_storage);
 
 }  // namespace proto_fuzzer
 
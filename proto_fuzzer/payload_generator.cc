@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief Implementation of PayloadStream.
+
+#include "proto_fuzzer/payload_generator.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "proto_fuzzer/ws_frame.h"
+
+namespace proto_fuzzer {
+
+namespace {
+
+// Cap on a generated payload. At curl's capped receive rate the scenario
+// times out long before this, so it only bounds what a mutated length can
+// ask of the mock.
+constexpr std::uint64_t kMaxGeneratedBytes = 16 * 1024 * 1024;
+
+constexpr std::uint64_t kSplitMixGamma = 0x9e3779b97f4a7c15ULL;
+
+/// splitmix64's output function: a well-mixed word from any counter.
+std::uint64_t SplitMix64(std::uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+}  // namespace
+
+/// Work out how long a generated payload is.
+/// @param spec The scenario's generator.
+/// @return 'spec.length()', capped at 16 MiB.
+std::uint64_t GeneratedLength(const curl::fuzzer::proto::PayloadGenerator& spec) {
+  return std::min(spec.length(), kMaxGeneratedBytes);
+}
+
+/// Construct an empty stream: done() from the start.
+PayloadStream::PayloadStream()
+    : spec_(nullptr), length_(0), offset_(0), masked_(false), mask_key_(0), mask_phase_(0) {}
+
+/// Construct a stream positioned at the start of what 'spec' generates.
+/// @param spec The scenario's generator; must outlive the stream.
+PayloadStream::PayloadStream(const curl::fuzzer::proto::PayloadGenerator& spec)
+    : spec_(&spec), length_(GeneratedLength(spec)), offset_(0), masked_(false), mask_key_(0), mask_phase_(0) {}
+
+/// XOR the generated bytes with a WebSocket masking key, as if they carried
+/// on from 'phase' bytes of payload already masked with it.
+/// @param key   The 32-bit key, most significant byte first on the wire.
+/// @param phase Payload bytes before the generated ones.
+void PayloadStream::SetMask(std::uint32_t key, std::size_t phase) {
+  masked_ = true;
+  mask_key_ = key;
+  mask_phase_ = phase;
+}
+
+/// Write the next bytes of the payload to 'out' without moving past them.
+/// @param out Buffer of at least 'max' bytes.
+/// @param max Most bytes to write.
+/// @return the number written: 'max', or fewer at the end of the payload.
+std::size_t PayloadStream::Fill(unsigned char* out, std::size_t max) const {
+  const auto count = static_cast<std::size_t>(std::min<std::uint64_t>(max, remaining()));
+  for (std::size_t i = 0; i < count; ++i) {
+    out[i] = ByteAt(offset_ + i);
+  }
+  if (masked_) {
+    MaskWebSocketPayload(out, count, mask_key_, mask_phase_ + static_cast<std::size_t>(offset_), out);
+  }
+  return count;
+}
+
+/// Move past bytes Fill() produced once they have been sent.
+/// @param count Bytes sent; clamped to what is left.
+void PayloadStream::Advance(std::size_t count) { offset_ += std::min<std::uint64_t>(count, remaining()); }
+
+/// @return the number of bytes not yet advanced past.
+std::uint64_t PayloadStream::remaining() const { return length_ - offset_; }
+
+/// @return true once every generated byte has been advanced past.
+bool PayloadStream::done() const { return offset_ >= length_; }
+
+/// @return the unmasked byte at 'offset' in the payload.
+unsigned char PayloadStream::ByteAt(std::uint64_t offset) const {
+  const std::uint64_t position = spec_->period() != 0 ? offset % spec_->period() : offset;
+  if (spec_->kind() == curl::fuzzer::proto::PayloadGenerator::PRNG) {
+    // Counter-based, so any offset is as cheap to reach as the next one.
+    const std::uint64_t word = SplitMix64(spec_->seed() + (position / 8 + 1) * kSplitMixGamma);
+    return static_cast<unsigned char>(word >> ((position % 8) * 8));
+  }
+  const std::string& pattern = spec_->pattern();
+  if (pattern.empty()) {
+    return static_cast<unsigned char>('a' + position % 26);
+  }
+  return static_cast<unsigned char>(pattern[position % pattern.size()]);
+}
+
+}  // namespace proto_fuzzer
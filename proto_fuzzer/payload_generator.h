@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief PayloadStream — produces the bytes a PayloadGenerator describes a
+///        window at a time, so mocks can send large payloads without holding
+///        them.
+
+#ifndef PROTO_FUZZER_PAYLOAD_GENERATOR_H_
+#define PROTO_FUZZER_PAYLOAD_GENERATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "curl_fuzzer.pb.h"
+
+namespace proto_fuzzer {
+
+// @return the number of bytes 'spec' generates, after the cap.
+std::uint64_t GeneratedLength(const curl::fuzzer::proto::PayloadGenerator& spec);
+
+/// @class proto_fuzzer::PayloadStream
+/// @brief Read position in a generated payload. Every byte is a function of
+///        its offset alone, so a sender can fill a buffer, learn how much
+///        the socket took and advance by just that much. A default-
+///        constructed stream is empty.
+class PayloadStream {
+ public:
+  PayloadStream();
+  explicit PayloadStream(const curl::fuzzer::proto::PayloadGenerator& spec);
+
+  void SetMask(std::uint32_t key, std::size_t phase);
+
+  std::size_t Fill(unsigned char* out, std::size_t max) const;
+  void Advance(std::size_t count);
+
+  std::uint64_t remaining() const;
+  bool done() const;
+
+ private:
+  unsigned char ByteAt(std::uint64_t offset) const;
+
+  /// The scenario's generator; it outlives the run. nullptr when empty.
+  const curl::fuzzer::proto::PayloadGenerator* spec_;
+  std::uint64_t length_;
+  std::uint64_t offset_;
+  bool masked_;
+  std::uint32_t mask_key_;
+  std::size_t mask_phase_;
+};
+
+}  // namespace proto_fuzzer
+
+#endif  // PROTO_FUZZER_PAYLOAD_GENERATOR_H_
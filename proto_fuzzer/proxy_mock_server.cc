@@ -0,0 +1,454 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief Implementation of ProxyMockServer.
+
+#include "proto_fuzzer/proxy_mock_server.h"
+
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "proto_fuzzer/mock_server.h"
+
+namespace proto_fuzzer {
+
+namespace {
+
+// SOCKS versions and the RFC 1928 / RFC 1929 values the mock deals in.
+constexpr unsigned char kSocks4Version = 4;
+constexpr unsigned char kSocks5Version = 5;
+constexpr unsigned char kSocks5AuthVersion = 1;
+constexpr unsigned char kSocks5NoAuth = 0x00;
+constexpr unsigned char kSocks5UserPass = 0x02;
+constexpr unsigned char kSocks5NoMethod = 0xFF;
+constexpr unsigned char kSocks5Ipv4 = 1;
+constexpr unsigned char kSocks5Domain = 3;
+constexpr unsigned char kSocks5Ipv6 = 4;
+constexpr unsigned char kSocks4Granted = 90;
+
+constexpr std::uint32_t kConnectOk = 200;
+
+// Longest CONNECT request head the mock buffers before giving up on curl.
+constexpr std::size_t kMaxConnectHead = 16 * 1024;
+
+constexpr char kProxyHost[] = "127.0.0.1:1080";
+constexpr char kProxyEnvVar[] = "FUZZ_PROXY";
+
+/// @return the proxy URL scheme for 'type'. Values the schema doesn't name
+///         get an HTTP proxy, as the handshake does.
+const char* ProxyScheme(curl::fuzzer::proto::ProxyScript::Type type) {
+  switch (type) {
+    case curl::fuzzer::proto::ProxyScript::PROXY_SOCKS4:
+      return "socks4";
+    case curl::fuzzer::proto::ProxyScript::PROXY_SOCKS4A:
+      return "socks4a";
+    case curl::fuzzer::proto::ProxyScript::PROXY_SOCKS5:
+      return "socks5";
+    case curl::fuzzer::proto::ProxyScript::PROXY_SOCKS5_HOSTNAME:
+      return "socks5h";
+    case curl::fuzzer::proto::ProxyScript::PROXY_HTTP:
+    default:
+      return "http";
+  }
+}
+
+/// @return the byte of 'in' at 'pos' as an unsigned value.
+unsigned char At(const std::string& in, std::size_t pos) { return static_cast<unsigned char>(in[pos]); }
+
+/// @return 'in' with ASCII letters lowered.
+std::string Lower(std::string in) {
+  std::transform(in.begin(), in.end(), in.begin(), [](unsigned char c) { return std::tolower(c); });
+  return in;
+}
+
+}  // namespace
+
+/// Construct a proxy in front of 'origin'. It waits for curl's first socket
+/// and hands each connection to 'origin' once its handshake succeeds.
+/// @param script The scenario's ProxyScript; must outlive the run.
+/// @param origin The mock for the scenario's scheme.
+ProxyMockServer::ProxyMockServer(const curl::fuzzer::proto::ProxyScript& script, std::unique_ptr<MockServerBase> origin)
+    : script_(&script),
+      origin_(std::move(origin)),
+      step_(Step::kIdle),
+      curl_fd_(CURL_SOCKET_BAD),
+      address_(),
+      has_address_(false),
+      next_reply_(0),
+      opened_(0),
+      handed_over_(0),
+      total_seconds_(0.0),
+      max_seconds_(0.0) {}
+
+/// Default destructor; the origin and any connection mid-handshake close
+/// their sockets.
+ProxyMockServer::~ProxyMockServer() = default;
+
+void ProxyMockServer::Install(CURL* easy) {
+  origin_->Install(easy);
+  MockServerBase::Install(easy);
+  const std::string proxy = std::string(ProxyScheme(script_->type())) + "://" + kProxyHost;
+  curl_easy_setopt(easy, CURLOPT_PROXY, proxy.c_str());
+  // An inherited no_proxy must not route around the mock.
+  curl_easy_setopt(easy, CURLOPT_NOPROXY, "");
+  if (script_->type() == curl::fuzzer::proto::ProxyScript::PROXY_HTTP) {
+    curl_easy_setopt(easy, CURLOPT_HTTPPROXYTUNNEL, 1L);
+  }
+}
+
+/// Called by the OPENSOCKETFUNCTION trampoline in the base class. Every
+/// socket curl opens goes to the proxy first; one still mid-handshake is
+/// abandoned.
+curl_socket_t ProxyMockServer::HandleOpenSocket(const struct curl_sockaddr* address) {
+  connection_ = std::make_unique<MockConnection>();
+  if (!connection_->ok()) {
+    connection_.reset();
+    return CURL_SOCKET_BAD;
+  }
+  ApplyPendingBackpressure();
+
+  input_.clear();
+  has_address_ = address != nullptr;
+  if (has_address_) {
+    address_ = *address;
+  }
+  switch (script_->type()) {
+    case curl::fuzzer::proto::ProxyScript::PROXY_SOCKS4:
+    case curl::fuzzer::proto::ProxyScript::PROXY_SOCKS4A:
+      step_ = Step::kSocks4Request;
+      break;
+    case curl::fuzzer::proto::ProxyScript::PROXY_SOCKS5:
+    case curl::fuzzer::proto::ProxyScript::PROXY_SOCKS5_HOSTNAME:
+      step_ = Step::kSocks5Greeting;
+      break;
+    default:
+      step_ = Step::kConnectRequest;
+      break;
+  }
+  ++opened_;
+  opened_at_ = std::chrono::steady_clock::now();
+  curl_fd_ = connection_->take_client_fd();
+  return curl_fd_;
+}
+
+/// Write the reply to one handshake step: the script's next replacement if it
+/// has one, else 'reply'.
+/// @param reply      The default reply.
+/// @param final_step Whether this reply ends the handshake.
+/// @param success    Whether the default final reply grants the connection.
+void ProxyMockServer::SendReply(const std::string& reply, bool final_step, bool success) {
+  const std::string* bytes = &reply;
+  if (next_reply_ < script_->replies_size()) {
+    const std::string& replacement = script_->replies(next_reply_++);
+    if (!replacement.empty()) {
+      bytes = &replacement;
+      success = true;
+    }
+  }
+  connection_->WriteAll(reinterpret_cast<const unsigned char*>(bytes->data()), bytes->size());
+  if (final_step) {
+    step_ = success ? Step::kReplied : Step::kFailed;
+  }
+}
+
+/// SOCKS4 request: version, command, port, IPv4 address and a NUL-terminated
+/// user ID, then for SOCKS4a (address 0.0.0.x) a NUL-terminated host name.
+/// The reply echoes the port and address.
+/// @return true if the request was complete and answered.
+bool ProxyMockServer::AdvanceSocks4() {
+  if (input_.size() < 8) {
+    return false;
+  }
+  std::size_t end = input_.find('\0', 8);
+  if (end == std::string::npos) {
+    return false;
+  }
+  if (At(input_, 4) == 0 && At(input_, 5) == 0 && At(input_, 6) == 0 && At(input_, 7) != 0) {
+    end = input_.find('\0', end + 1);
+    if (end == std::string::npos) {
+      return false;
+    }
+  }
+  if (At(input_, 0) != kSocks4Version) {
+    step_ = Step::kFailed;
+    connection_->ShutdownWrite();
+    return false;
+  }
+  const auto code = static_cast<unsigned char>(script_->reply_code() != 0 ? script_->reply_code() : kSocks4Granted);
+  std::string reply(1, '\0');
+  reply.push_back(static_cast<char>(code));
+  reply.append(input_, 2, 6);
+  input_.erase(0, end + 1);
+  SendReply(reply, true, code == kSocks4Granted);
+  return true;
+}
+
+/// SOCKS5 greeting: version and the methods curl offers. The mock picks
+/// username/password if the script requires it and curl offers it, else no
+/// authentication if offered.
+/// @return true if the greeting was complete and answered.
+bool ProxyMockServer::AdvanceSocks5Greeting() {
+  if (input_.size() < 2) {
+    return false;
+  }
+  const std::size_t nmethods = At(input_, 1);
+  if (input_.size() < 2 + nmethods) {
+    return false;
+  }
+  if (At(input_, 0) != kSocks5Version) {
+    step_ = Step::kFailed;
+    connection_->ShutdownWrite();
+    return false;
+  }
+  const std::string methods = input_.substr(2, nmethods);
+  input_.erase(0, 2 + methods.size());
+  const bool no_auth = methods.find(static_cast<char>(kSocks5NoAuth)) != std::string::npos;
+  const bool user_pass = methods.find(static_cast<char>(kSocks5UserPass)) != std::string::npos;
+  unsigned char method = kSocks5NoMethod;
+  if (user_pass && (script_->require_auth() || !no_auth)) {
+    method = kSocks5UserPass;
+  } else if (no_auth && !script_->require_auth()) {
+    method = kSocks5NoAuth;
+  }
+  step_ = method == kSocks5UserPass ? Step::kSocks5Auth : Step::kSocks5Request;
+  std::string reply(1, static_cast<char>(kSocks5Version));
+  reply.push_back(static_cast<char>(method));
+  SendReply(reply, method == kSocks5NoMethod, false);
+  return true;
+}
+
+/// SOCKS5 username/password sub-negotiation (RFC 1929).
+/// @return true if the request was complete and answered.
+bool ProxyMockServer::AdvanceSocks5Auth() {
+  if (input_.size() < 2) {
+    return false;
+  }
+  const std::size_t ulen = At(input_, 1);
+  const std::size_t password_at = 2 + ulen;
+  if (input_.size() < password_at + 1) {
+    return false;
+  }
+  const std::size_t plen = At(input_, password_at);
+  if (input_.size() < password_at + 1 + plen) {
+    return false;
+  }
+  if (At(input_, 0) != kSocks5AuthVersion) {
+    step_ = Step::kFailed;
+    connection_->ShutdownWrite();
+    return false;
+  }
+  input_.erase(0, password_at + 1 + plen);
+  const auto status = static_cast<unsigned char>(script_->auth_status());
+  step_ = Step::kSocks5Request;
+  std::string reply(1, static_cast<char>(kSocks5AuthVersion));
+  reply.push_back(static_cast<char>(status));
+  SendReply(reply, status != 0, false);
+  return true;
+}
+
+/// SOCKS5 connect request: version, command, reserved, address type, address
+/// and port. The reply binds 0.0.0.0 and echoes the port.
+/// @return true if the request was complete and answered.
+bool ProxyMockServer::AdvanceSocks5Request() {
+  if (input_.size() < 5) {
+    return false;
+  }
+  std::size_t address_size = 0;
+  switch (At(input_, 3)) {
+    case kSocks5Ipv4:
+      address_size = 4;
+      break;
+    case kSocks5Domain:
+      address_size = 1 + At(input_, 4);
+      break;
+    case kSocks5Ipv6:
+      address_size = 16;
+      break;
+    default:
+      step_ = Step::kFailed;
+      connection_->ShutdownWrite();
+      return false;
+  }
+  const std::size_t size = 4 + address_size + 2;
+  if (input_.size() < size) {
+    return false;
+  }
+  if (At(input_, 0) != kSocks5Version) {
+    step_ = Step::kFailed;
+    connection_->ShutdownWrite();
+    return false;
+  }
+  const auto code = static_cast<unsigned char>(script_->reply_code());
+  std::string reply{static_cast<char>(kSocks5Version), static_cast<char>(code), '\0', static_cast<char>(kSocks5Ipv4)};
+  reply.append(4, '\0');
+  reply.append(input_, size - 2, 2);
+  input_.erase(0, size);
+  SendReply(reply, true, code == 0);
+  return true;
+}
+
+/// HTTP CONNECT request: answered with 407 while the script requires
+/// authentication and curl sent none, then with the script's status. curl
+/// always tunnels here: the harness's CURLOPT_CONNECT_TO makes it.
+/// @return true if the request was complete and answered.
+bool ProxyMockServer::AdvanceConnect() {
+  const std::size_t end = input_.find("\r\n\r\n");
+  if (end == std::string::npos) {
+    if (input_.size() > kMaxConnectHead) {
+      step_ = Step::kFailed;
+      connection_->ShutdownWrite();
+    }
+    return false;
+  }
+  if (input_.compare(0, 8, "CONNECT ") != 0) {
+    step_ = Step::kFailed;
+    connection_->ShutdownWrite();
+    return false;
+  }
+  const std::string head = Lower(input_.substr(0, end + 2));
+  input_.erase(0, end + 4);
+  const std::string& headers = script_->connect_headers();
+  if (script_->require_auth() && head.find("\r\nproxy-authorization:") == std::string::npos) {
+    SendReply(
+        "HTTP/1.1 407 Proxy Authentication Required\r\nProxy-Authenticate: Basic realm=\"curl-fuzzer\"\r\n" + headers +
+            "Content-Length: 0\r\n\r\n",
+        false, false);
+    return true;
+  }
+  const std::uint32_t code = script_->reply_code() != 0 ? script_->reply_code() : kConnectOk;
+  const bool success = code / 100 == 2;
+  std::string reply = "HTTP/1.1 " + std::to_string(code);
+  reply += success ? " Connection established\r\n" : " Proxy Error\r\n";
+  reply += headers;
+  reply += success ? "\r\n" : "Content-Length: 0\r\n\r\n";
+  SendReply(reply, true, success);
+  return true;
+}
+
+/// Run the current step on what curl has sent.
+/// @return true if a step was answered and the next may be ready.
+bool ProxyMockServer::Advance() {
+  switch (step_) {
+    case Step::kSocks4Request:
+      return AdvanceSocks4();
+    case Step::kSocks5Greeting:
+      return AdvanceSocks5Greeting();
+    case Step::kSocks5Auth:
+      return AdvanceSocks5Auth();
+    case Step::kSocks5Request:
+      return AdvanceSocks5Request();
+    case Step::kConnectRequest:
+      return AdvanceConnect();
+    case Step::kIdle:
+    case Step::kReplied:
+    case Step::kFailed:
+    default:
+      return false;
+  }
+}
+
+/// @return true once curl has read every byte of the final reply and still
+///         holds the connection open.
+bool ProxyMockServer::ReplyConsumed() const {
+  if (connection_->fragments_pending() || connection_->peer_closed()) {
+    return false;
+  }
+  int unread = 0;
+  return ioctl(curl_fd_, FIONREAD, &unread) == 0 && unread == 0;
+}
+
+/// Give the connection to the origin: have it open its own, pass on what
+/// curl already sent through the tunnel, and swap curl's fd onto it. The
+/// proxy's end of the old socketpair closes with connection_.
+void ProxyMockServer::HandOver() {
+  const curl_socket_t fd = origin_->HandleOpenSocket(has_address_ ? &address_ : nullptr);
+  if (fd == CURL_SOCKET_BAD) {
+    step_ = Step::kFailed;
+    connection_->ShutdownWrite();
+    return;
+  }
+  std::size_t written = 0;
+  while (written < input_.size()) {
+    const ssize_t n = ::write(fd, input_.data() + written, input_.size() - written);
+    if (n <= 0) {
+      break;
+    }
+    written += static_cast<std::size_t>(n);
+  }
+  // curl made its socket non-blocking; the one it gets in its place must be
+  // too.
+  fcntl(fd, F_SETFL, fcntl(curl_fd_, F_GETFL, 0));
+  dup2(fd, curl_fd_);
+  close(fd);
+  connection_.reset();
+  input_.clear();
+  step_ = Step::kIdle;
+
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - opened_at_).count();
+  ++handed_over_;
+  total_seconds_ += seconds;
+  max_seconds_ = std::max(max_seconds_, seconds);
+}
+
+/// Answer whatever handshake bytes curl has sent, and hand the connection
+/// over once curl has taken a successful final reply.
+void ProxyMockServer::ServiceHop() {
+  if (!connection_) {
+    return;
+  }
+  // A refusal still has to reach curl in full.
+  connection_->FlushFragment();
+  if (step_ == Step::kIdle || step_ == Step::kFailed) {
+    return;
+  }
+  connection_->ReadAvailable(&input_);
+  while (Advance()) {
+  }
+  if (step_ == Step::kReplied && connection_ && ReplyConsumed()) {
+    HandOver();
+  }
+}
+
+/// With FUZZ_PROXY set, print how many connections made it through the
+/// handshake and how long it took, from curl opening the socket to the
+/// hand-over.
+void ProxyMockServer::ReportHandshakes() const {
+  if (std::getenv(kProxyEnvVar) == nullptr || opened_ == 0) {
+    return;
+  }
+  const double mean = handed_over_ != 0 ? total_seconds_ / static_cast<double>(handed_over_) : 0.0;
+  std::fprintf(stderr,
+               "FUZZ: proxy: %s handshake completed on %zu of %zu connections, %.3f ms mean, %.3f ms max\n",
+               ProxyScheme(script_->type()), handed_over_, opened_, mean * 1e3, max_seconds_ * 1e3);
+}
+
+/// Let the origin drive the scenario, with this mock as the hop in front of
+/// it.
+/// @param multi    caller-owned multi; 'easy' is already added.
+/// @param easy     the curl easy handle attached to this mock.
+/// @param scenario the Scenario proto, handed to the origin.
+void ProxyMockServer::RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Scenario& scenario) {
+  origin_->front_ = this;
+  origin_->pending_recv_buf_bytes_ = pending_recv_buf_bytes_;
+  origin_->pending_drain_limit_ = pending_drain_limit_;
+  origin_->RunLoop(multi, easy, scenario);
+  ReportHandshakes();
+}
+
+}  // namespace proto_fuzzer
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief ProxyMockServer — an in-process HTTP CONNECT / SOCKS4 / SOCKS5
+///        proxy hop that runs curl's handshake on each connection, then
+///        hands the connection to the scenario's origin mock.
+
+#ifndef PROTO_FUZZER_PROXY_MOCK_SERVER_H_
+#define PROTO_FUZZER_PROXY_MOCK_SERVER_H_
+
+#include <curl/curl.h>
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include "curl_fuzzer.pb.h"
+#include "proto_fuzzer/mock_server_base.h"
+
+namespace proto_fuzzer {
+
+/// @class proto_fuzzer::ProxyMockServer
+/// @brief Proxy hop in front of another mock. Install() points curl at a
+///        proxy of the script's type, and every socket curl opens is a
+///        socketpair to this mock, which answers the SOCKS greeting,
+///        authentication and connect request or the CONNECT request from the
+///        ProxyScript. Once curl has read a successful final reply, the
+///        origin mock opens its own connection and curl's fd is swapped onto
+///        it with dup2(), so the origin sees a fresh connection and curl a
+///        tunnel. The origin's RunLoop drives the scenario and gives this mock
+///        its turn each iteration. Setting FUZZ_PROXY reports the handshake
+///        latency on stderr after each scenario.
+class ProxyMockServer : public MockServerBase {
+ public:
+  /// @param script The scenario's ProxyScript; must outlive the run.
+  /// @param origin The mock for the scenario's scheme.
+  ProxyMockServer(const curl::fuzzer::proto::ProxyScript& script, std::unique_ptr<MockServerBase> origin);
+  ~ProxyMockServer() override;
+
+  /// Install the origin's callbacks, route the socket callbacks to this
+  /// instance instead, and point curl at the proxy.
+  /// @param easy The curl easy handle to configure.
+  void Install(CURL* easy) override;
+
+ protected:
+  curl_socket_t HandleOpenSocket(const struct curl_sockaddr* address) override;
+  void RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Scenario& scenario) override;
+  void ServiceHop() override;
+
+ private:
+  /// Where the handshake on the current connection stands.
+  enum class Step {
+    kIdle,
+    kSocks4Request,
+    kSocks5Greeting,
+    kSocks5Auth,
+    kSocks5Request,
+    kConnectRequest,
+    kReplied,
+    kFailed,
+  };
+
+  bool Advance();
+  bool AdvanceSocks4();
+  bool AdvanceSocks5Greeting();
+  bool AdvanceSocks5Auth();
+  bool AdvanceSocks5Request();
+  bool AdvanceConnect();
+  void SendReply(const std::string& reply, bool final_step, bool success);
+  bool ReplyConsumed() const;
+  void HandOver();
+  void ReportHandshakes() const;
+
+  /// The scenario's script; owned by the Scenario, which outlives the run.
+  const curl::fuzzer::proto::ProxyScript* script_;
+  /// The mock connections are handed to.
+  std::unique_ptr<MockServerBase> origin_;
+  /// Bytes read from curl on the current connection that no step has used.
+  std::string input_;
+  Step step_;
+  /// The fd curl holds for the current connection, and the address it opened
+  /// it for, passed on to the origin.
+  curl_socket_t curl_fd_;
+  struct curl_sockaddr address_;
+  bool has_address_;
+  /// Index of the next entry of script_.replies() to use.
+  int next_reply_;
+
+  /// Connections opened and handed over, for FUZZ_PROXY.
+  std::size_t opened_;
+  std::size_t handed_over_;
+  /// When the current connection was opened, and the handshake time summed
+  /// and at most over the handed-over ones.
+  std::chrono::steady_clock::time_point opened_at_;
+  double total_seconds_;
+  double max_seconds_;
+};
+
+}  // namespace proto_fuzzer
+
+#endif  // PROTO_FUZZER_PROXY_MOCK_SERVER_H_
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief Implementation of RequestMatcher.
+
+#include "proto_fuzzer/request_matcher.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+
+namespace proto_fuzzer {
+
+namespace {
+
+// Caps so one input can't make every tick scan a long rule list or a huge
+// pattern.
+constexpr int kMaxRules = 64;
+constexpr std::size_t kMaxPatternSize = 256;
+
+// Unmatched request bytes kept before the oldest are dropped; an upload body
+// nobody matches shouldn't grow the buffer without bound.
+constexpr std::size_t kMaxRequestBytes = 64 * 1024;
+
+/// @return how much of the rule's pattern is used, after the cap.
+std::size_t PatternSize(const curl::fuzzer::proto::ResponseRule& rule) {
+  return std::min(rule.pattern().size(), kMaxPatternSize);
+}
+
+}  // namespace
+
+RequestMatcher::RequestMatcher() : trimmed_(false) {}
+
+void RequestMatcher::SetRules(const google::protobuf::RepeatedPtrField<curl::fuzzer::proto::ResponseRule>& rules) {
+  const int count = std::min(kMaxRules, rules.size());
+  rules_.clear();
+  for (int i = 0; i < count; ++i) {
+    rules_.push_back(&rules.Get(i));
+  }
+  fired_.assign(rules_.size(), false);
+  scanned_.assign(rules_.size(), 0);
+  request_.clear();
+  trimmed_ = false;
+}
+
+void RequestMatcher::Clear() {
+  rules_.clear();
+  fired_.clear();
+  scanned_.clear();
+  request_.clear();
+  trimmed_ = false;
+}
+
+bool RequestMatcher::active() const { return !rules_.empty(); }
+
+void RequestMatcher::Append(const std::string& bytes) {
+  if (rules_.empty() || bytes.empty()) {
+    return;
+  }
+  request_ += bytes;
+  if (request_.size() > kMaxRequestBytes) {
+    // Keep enough of the tail that a pattern straddling the cut still
+    // matches.
+    const std::size_t drop = request_.size() - (kMaxPatternSize - 1);
+    request_.erase(0, drop);
+    for (std::size_t& scanned : scanned_) {
+      scanned = scanned > drop ? scanned - drop : 0;
+    }
+    trimmed_ = true;
+  }
+}
+
+bool RequestMatcher::Matches(std::size_t index) {
+  const std::string& pattern = rules_[index]->pattern();
+  const std::size_t size = PatternSize(*rules_[index]);
+  if (size == 0) {
+    return !request_.empty();
+  }
+  if (rules_[index]->match() == curl::fuzzer::proto::ResponseRule::MATCH_PREFIX) {
+    return !trimmed_ && request_.compare(0, size, pattern, 0, size) == 0;
+  }
+  if (request_.find(pattern.data(), scanned_[index], size) != std::string::npos) {
+    return true;
+  }
+  // The next search only has to start where a match could still end in bytes
+  // not yet appended.
+  scanned_[index] = request_.size() >= size ? request_.size() - size + 1 : 0;
+  return false;
+}
+
+const curl::fuzzer::proto::ResponseRule* RequestMatcher::Next() {
+  for (std::size_t i = 0; i < rules_.size(); ++i) {
+    if (!fired_[i] && Matches(i)) {
+      fired_[i] = true;
+      request_.clear();
+      scanned_.assign(rules_.size(), 0);
+      trimmed_ = false;
+      return rules_[i];
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace proto_fuzzer
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief RequestMatcher — incremental matching of what curl has sent against
+///        a scenario's ResponseRule list.
+
+#ifndef PROTO_FUZZER_REQUEST_MATCHER_H_
+#define PROTO_FUZZER_REQUEST_MATCHER_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "curl_fuzzer.pb.h"
+
+namespace proto_fuzzer {
+
+/// @class proto_fuzzer::RequestMatcher
+/// @brief Accumulates the bytes curl sends and reports which ResponseRule
+///        fires next. Each rule remembers how far into the buffer it has
+///        already searched, so appending bytes costs a scan of the new bytes
+///        (plus a pattern's length of overlap) rather than of the whole
+///        request.
+class RequestMatcher {
+ public:
+  RequestMatcher();
+
+  /// Match against 'rules' from now on, forgetting any earlier bytes.
+  /// @param rules The scenario's rules; must outlive the matcher's use.
+  void SetRules(const google::protobuf::RepeatedPtrField<curl::fuzzer::proto::ResponseRule>& rules);
+
+  /// Stop matching; active() is false afterwards.
+  void Clear();
+
+  /// @return true if there are rules to match.
+  bool active() const;
+
+  /// Add bytes curl has sent.
+  /// @param bytes The bytes, in the order curl sent them.
+  void Append(const std::string& bytes);
+
+  /// Find the next rule to fire: the first unfired one, in order, that
+  /// matches the bytes since the previous rule fired. Those bytes are then
+  /// consumed and the rule is marked fired.
+  /// @return the rule, or nullptr if none matches yet.
+  const curl::fuzzer::proto::ResponseRule* Next();
+
+ private:
+  /// @return true if rule 'index' matches request_.
+  bool Matches(std::size_t index);
+
+  /// Rules after the cap, in scenario order.
+  std::vector<const curl::fuzzer::proto::ResponseRule*> rules_;
+  std::vector<bool> fired_;
+  /// Per rule, the offset in request_ before which its pattern can't start.
+  std::vector<std::size_t> scanned_;
+  /// Bytes curl has sent since the previous rule fired, trimmed at the front
+  /// once they outgrow the cap.
+  std::string request_;
+  /// Set once request_ has been trimmed; prefix rules can't match until the
+  /// next rule fires.
+  bool trimmed_;
+};
+
+}  // namespace proto_fuzzer
+
+#endif  // PROTO_FUZZER_REQUEST_MATCHER_H_
@@ -0,0 +1,434 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief Implementation of RtspMockServer.
+
+#include "proto_fuzzer/rtsp_mock_server.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include "curl_fuzzer_digest.h"
+#include "curl_fuzzer_spin.h"
+#include "proto_fuzzer/mock_server.h"
+
+namespace proto_fuzzer {
+
+namespace {
+
+// Cap on scripted responses honoured, matching the other reactive mocks.
+constexpr std::size_t kMaxScriptedResponses = 64;
+
+// Caps on the RTP stream, so a mutator can't make one input stream for long.
+constexpr std::size_t kMaxRtpPackets = 4096;
+constexpr std::size_t kMaxStreamBytes = 1024 * 1024;
+
+// RTP bytes written per drive-loop iteration. Well inside a socketpair's
+// buffer, so a burst is never cut short by a full socket.
+constexpr std::size_t kStreamBurstBytes = 16 * 1024;
+
+// Longest request head the mock buffers before giving up on curl.
+constexpr std::size_t kMaxRequestHead = 16 * 1024;
+
+// RTP packet defaults: a 12-byte header (RFC 3550 §5.1) with dynamic payload
+// type 96, carrying a 20 ms G.711 frame.
+constexpr std::size_t kRtpHeaderSize = 12;
+constexpr std::uint32_t kDefaultPacketSize = kRtpHeaderSize + 160;
+constexpr std::uint32_t kMaxPacketSize = 0xFFFF;
+constexpr std::uint8_t kRtpVersion2 = 0x80;
+constexpr std::uint8_t kRtpPayloadType = 96;
+constexpr std::uint32_t kRtpTimestampStep = 160;
+
+// Placeholder in raw responses for the CSeq of the request being answered.
+constexpr char kCseqPlaceholder[] = "%CSEQ%";
+
+// Set (to anything) to have each RTSP scenario report its demux throughput.
+constexpr char kInterleaveEnvVar[] = "FUZZ_INTERLEAVE";
+
+constexpr char kDefaultPublic[] =
+    "OPTIONS, DESCRIBE, SETUP, PLAY, PAUSE, TEARDOWN, GET_PARAMETER, SET_PARAMETER, RECORD";
+constexpr char kDefaultTransport[] = "RTP/AVP/TCP;unicast;interleaved=0-1";
+constexpr char kDefaultSession[] = "curl-fuzzer";
+constexpr char kDefaultSdp[] =
+    "v=0\r\n"
+    "o=- 0 0 IN IP4 127.0.0.1\r\n"
+    "s=curl-fuzzer\r\n"
+    "t=0 0\r\n"
+    "m=audio 0 RTP/AVP 96\r\n"
+    "a=rtpmap:96 PCMU/8000\r\n";
+
+/// @return true if 'a' and 'b' are equal ignoring ASCII case.
+bool EqualsIgnoreCase(const std::string& a, const std::string& b) {
+  return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](unsigned char x, unsigned char y) {
+           return std::tolower(x) == std::tolower(y);
+         });
+}
+
+/// Find a header in a request head.
+/// @param head Request line and header lines, each ending in CRLF.
+/// @param name Header name, matched case-insensitively.
+/// @param value Receives the header's value, leading blanks stripped.
+/// @return true if the header is present.
+bool FindHeader(const std::string& head, const std::string& name, std::string* value) {
+  std::size_t start = head.find("\r\n");
+  while (start != std::string::npos && start + 2 < head.size()) {
+    start += 2;
+    const std::size_t end = head.find("\r\n", start);
+    const std::string line = head.substr(start, end - start);
+    const std::size_t colon = line.find(':');
+    if (colon != std::string::npos && EqualsIgnoreCase(line.substr(0, colon), name)) {
+      const std::size_t first = line.find_first_not_of(" \t", colon + 1);
+      *value = first == std::string::npos ? std::string() : line.substr(first);
+      return true;
+    }
+    start = end;
+  }
+  return false;
+}
+
+/// @return 'text' with every "%CSEQ%" replaced by 'cseq'.
+std::string SubstituteCseq(std::string text, const std::string& cseq) {
+  const std::size_t placeholder_len = sizeof(kCseqPlaceholder) - 1;
+  for (std::size_t pos = text.find(kCseqPlaceholder); pos != std::string::npos;
+       pos = text.find(kCseqPlaceholder, pos + cseq.size())) {
+    text.replace(pos, placeholder_len, cseq);
+  }
+  return text;
+}
+
+/// @brief CURLOPT_INTERLEAVEFUNCTION installed by RtspMockServer::Install.
+///        curl hands it one whole interleaved packet per call, "$" header
+///        included. INTERLEAVEDATA is the owning RtspMockServer.
+size_t RtspInterleaveCallback(void* ptr, size_t size, size_t nmemb, void* userdata) {
+  fuzz_digest_event(FUZZ_DIGEST_WRITE_CB);
+  fuzz_digest_bytes(FUZZ_DIGEST_DELIVERED, ptr, size * nmemb);
+  static_cast<RtspMockServer*>(userdata)->NoteInterleaved(ptr, size * nmemb);
+  return size * nmemb;
+}
+
+}  // namespace
+
+/// Construct an idle RtspMockServer. RunLoop() seeds it from the scenario
+/// before curl opens the connection.
+RtspMockServer::RtspMockServer()
+    : script_(nullptr),
+      body_remaining_(0),
+      responses_sent_(0),
+      rtp_packets_(0),
+      next_packet_(0),
+      closed_(false),
+      wrote_(false),
+      demuxed_packets_(0),
+      demuxed_bytes_(0) {}
+
+/// Default destructor; the MockConnection closes its socket.
+RtspMockServer::~RtspMockServer() = default;
+
+void RtspMockServer::Install(CURL* easy) {
+  MockServerBase::Install(easy);
+  curl_easy_setopt(easy, CURLOPT_INTERLEAVEFUNCTION, &RtspInterleaveCallback);
+  curl_easy_setopt(easy, CURLOPT_INTERLEAVEDATA, this);
+}
+
+/// Use 'script' for the rest of the scenario, and work out how many RTP
+/// packets fit under the stream caps.
+/// @param script The scenario's RtspScript; must outlive the run.
+void RtspMockServer::SetScript(const curl::fuzzer::proto::RtspScript& script) {
+  script_ = &script;
+  const auto& rtp = script.rtp();
+  const std::size_t wanted = std::min<std::size_t>(kMaxRtpPackets, rtp.packets());
+  std::size_t total = 0;
+  rtp_packets_ = 0;
+  while (rtp_packets_ < wanted) {
+    const std::uint32_t size =
+        rtp.sizes().empty() ? kDefaultPacketSize : rtp.sizes(static_cast<int>(rtp_packets_ % rtp.sizes_size()));
+    total += 4 + std::min(size, kMaxPacketSize);
+    if (total > kMaxStreamBytes) {
+      break;
+    }
+    ++rtp_packets_;
+  }
+}
+
+/// Count one demuxed packet towards the throughput report.
+void RtspMockServer::NoteInterleaved(const void* data, std::size_t size) {
+  ++demuxed_packets_;
+  demuxed_bytes_ += size;
+  if (size >= 2) {
+    demuxed_channels_.set(static_cast<const unsigned char*>(data)[1]);
+  }
+  last_demuxed_ = std::chrono::steady_clock::now();
+}
+
+/// Called by the OPENSOCKETFUNCTION trampoline in the base class. RTSP runs
+/// over a single connection, and the client speaks first.
+curl_socket_t RtspMockServer::HandleOpenSocket(const struct curl_sockaddr* /*address*/) {
+  if (connection_) {
+    return CURL_SOCKET_BAD;
+  }
+  connection_ = std::make_unique<MockConnection>();
+  if (!connection_->ok()) {
+    connection_.reset();
+    return CURL_SOCKET_BAD;
+  }
+  ApplyPendingBackpressure();
+  return connection_->take_client_fd();
+}
+
+/// Write bytes to curl unless the mock has closed its side.
+/// @param bytes Response or RTP bytes.
+void RtspMockServer::SendBytes(const std::string& bytes) {
+  if (connection_ && !closed_ && !bytes.empty()) {
+    if (!wrote_) {
+      wrote_ = true;
+      first_write_ = std::chrono::steady_clock::now();
+    }
+    connection_->WriteAll(reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size());
+  }
+}
+
+/// Half-close the connection: curl in CURL_RTSPREQ_RECEIVE mode reads until
+/// it sees the end of the stream.
+void RtspMockServer::Close() {
+  if (connection_ && !closed_) {
+    closed_ = true;
+    connection_->ShutdownWrite();
+  }
+}
+
+/// Build the response to one request: the next scripted one, or a default
+/// that keeps the session going — the methods for OPTIONS, an SDP body for
+/// DESCRIBE, and the request's Transport and a session for SETUP.
+/// @param method The request's method.
+/// @param head   Its request line and headers.
+/// @param cseq   Its CSeq header's value.
+/// @return the complete response.
+std::string RtspMockServer::BuildResponse(const std::string& method, const std::string& head,
+                                          const std::string& cseq) {
+  const std::size_t scripted = std::min<std::size_t>(kMaxScriptedResponses, script_->responses_size());
+  const curl::fuzzer::proto::RtspResponse* response =
+      responses_sent_ < scripted ? &script_->responses(static_cast<int>(responses_sent_)) : nullptr;
+  if (response != nullptr && !response->raw().empty()) {
+    return SubstituteCseq(response->raw(), cseq);
+  }
+
+  const std::uint32_t status = response != nullptr && response->status_code() != 0 ? response->status_code() : 200;
+  std::string out = "RTSP/1.0 " + std::to_string(status) + (status / 100 == 2 ? " OK\r\n" : " Mock Status\r\n");
+  if (response == nullptr || !response->omit_cseq()) {
+    const std::int64_t adjust = response != nullptr ? response->cseq_adjust() : 0;
+    out += "CSeq: " + std::to_string(std::strtoll(cseq.c_str(), nullptr, 10) + adjust) + "\r\n";
+  }
+
+  std::string body;
+  if (response != nullptr) {
+    for (const std::string& header : response->headers()) {
+      out += header + "\r\n";
+    }
+    body = response->body();
+  } else {
+    std::string value;
+    if (method == "OPTIONS") {
+      out += std::string("Public: ") + kDefaultPublic + "\r\n";
+    } else if (method == "DESCRIBE") {
+      out += "Content-Type: application/sdp\r\n";
+      body = kDefaultSdp;
+    } else if (method == "SETUP") {
+      out += "Transport: " + (FindHeader(head, "Transport", &value) ? value : kDefaultTransport) + "\r\n";
+    }
+    // curl insists the session it was given comes back unchanged.
+    if (FindHeader(head, "Session", &value)) {
+      out += "Session: " + value + "\r\n";
+    } else if (method == "SETUP") {
+      out += std::string("Session: ") + kDefaultSession + "\r\n";
+    }
+  }
+  out += "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+  out += body;
+  return out;
+}
+
+/// Answer one request.
+/// @param head Its request line and headers, each ending in CRLF.
+void RtspMockServer::Answer(const std::string& head) {
+  const std::string method = head.substr(0, head.find(' '));
+  std::string cseq;
+  FindHeader(head, "CSeq", &cseq);
+  SendBytes(BuildResponse(method, head, cseq));
+  ++responses_sent_;
+}
+
+/// Split what curl has sent into requests and answer each whole one. Request
+/// bodies (ANNOUNCE, SET_PARAMETER, ...) are skipped by Content-Length.
+/// @return true if at least one request was answered.
+bool RtspMockServer::ServiceInput() {
+  if (!connection_) {
+    return false;
+  }
+  connection_->ReadAvailable(&input_);
+
+  bool handled = false;
+  while (!input_.empty()) {
+    if (body_remaining_ > 0) {
+      const std::size_t skip = std::min(body_remaining_, input_.size());
+      input_.erase(0, skip);
+      body_remaining_ -= skip;
+      continue;
+    }
+    const std::size_t end = input_.find("\r\n\r\n");
+    if (end == std::string::npos) {
+      if (input_.size() > kMaxRequestHead) {
+        // No end of headers in sight: curl is out of step, so stop listening.
+        input_.clear();
+        Close();
+      }
+      break;
+    }
+    const std::string head = input_.substr(0, end + 2);
+    input_.erase(0, end + 4);
+    std::string length;
+    if (FindHeader(head, "Content-Length", &length)) {
+      body_remaining_ = std::strtoull(length.c_str(), nullptr, 10);
+    }
+    Answer(head);
+    handled = true;
+  }
+  return handled;
+}
+
+/// Append interleaved RTP packet 'index' to 'out': "$", the channel, the
+/// 16-bit length, then an RTP header whose sequence number and timestamp
+/// follow the index, padded out with the script's payload.
+void RtspMockServer::AppendRtpPacket(std::size_t index, std::string* out) const {
+  const auto& rtp = script_->rtp();
+  const std::uint8_t channel =
+      rtp.channels().empty()
+          ? 0
+          : static_cast<std::uint8_t>(rtp.channels(static_cast<int>(index % rtp.channels_size())));
+  const std::uint32_t size = std::min(
+      kMaxPacketSize,
+      rtp.sizes().empty() ? kDefaultPacketSize : rtp.sizes(static_cast<int>(index % rtp.sizes_size())));
+
+  out->push_back('$');
+  out->push_back(static_cast<char>(channel));
+  out->push_back(static_cast<char>(size >> 8));
+  out->push_back(static_cast<char>(size & 0xFF));
+
+  const auto sequence = static_cast<std::uint16_t>(index);
+  const auto timestamp = static_cast<std::uint32_t>(index * kRtpTimestampStep);
+  const unsigned char header[kRtpHeaderSize] = {
+      kRtpVersion2,
+      kRtpPayloadType,
+      static_cast<unsigned char>(sequence >> 8),
+      static_cast<unsigned char>(sequence & 0xFF),
+      static_cast<unsigned char>(timestamp >> 24),
+      static_cast<unsigned char>((timestamp >> 16) & 0xFF),
+      static_cast<unsigned char>((timestamp >> 8) & 0xFF),
+      static_cast<unsigned char>(timestamp & 0xFF),
+      0,
+      0,
+      0,
+      channel,  // SSRC: one source per channel.
+  };
+  const std::size_t header_len = std::min<std::size_t>(size, kRtpHeaderSize);
+  out->append(reinterpret_cast<const char*>(header), header_len);
+
+  const std::string& payload = rtp.payload();
+  for (std::size_t i = header_len; i < size; ++i) {
+    const std::size_t offset = i - kRtpHeaderSize;
+    out->push_back(payload.empty() ? static_cast<char>((index + offset) & 0xFF) : payload[offset % payload.size()]);
+  }
+}
+
+/// Send the next burst of RTP packets, and close the connection once the
+/// last has gone.
+/// @return true if anything was sent or closed.
+bool RtspMockServer::StreamBurst() {
+  if (!connection_ || closed_ || next_packet_ >= rtp_packets_ ||
+      responses_sent_ < script_->rtp().start_after()) {
+    return false;
+  }
+  std::string burst;
+  while (next_packet_ < rtp_packets_ && burst.size() < kStreamBurstBytes) {
+    AppendRtpPacket(next_packet_, &burst);
+    ++next_packet_;
+  }
+  SendBytes(burst);
+  if (next_packet_ >= rtp_packets_) {
+    Close();
+  }
+  return true;
+}
+
+/// Print one line with what curl's demuxer handed to the interleave callback
+/// and how fast, measured from the mock's first write to the last packet
+/// delivered, next to how many generated packets were streamed.
+void RtspMockServer::ReportThroughput() const {
+  if (std::getenv(kInterleaveEnvVar) == nullptr || (rtp_packets_ == 0 && demuxed_packets_ == 0)) {
+    return;
+  }
+  const double seconds =
+      demuxed_packets_ == 0 ? 0.0 : std::chrono::duration<double>(last_demuxed_ - first_write_).count();
+  const double mb_per_second = seconds > 0.0 ? static_cast<double>(demuxed_bytes_) / seconds / 1e6 : 0.0;
+  std::fprintf(stderr,
+               "FUZZ: interleave: %zu packets, %llu bytes on %zu channels demuxed in %.3f ms (%.1f MB/s); "
+               "%zu of %zu streamed\n",
+               demuxed_packets_, static_cast<unsigned long long>(demuxed_bytes_), demuxed_channels_.count(),
+               seconds * 1e3, mb_per_second, next_packet_, rtp_packets_);
+}
+
+/// Seed the mock from the scenario, then drive the perform loop until curl is
+/// done or the idle-iteration cap is hit. Each iteration answers whatever
+/// requests curl has sent and, once the stream is due and curl has what was
+/// written before, sends the next burst of RTP.
+/// @param multi    caller-owned multi; 'easy' is already added.
+/// @param easy     the curl easy handle attached to this mock.
+/// @param scenario source of the RtspScript.
+void RtspMockServer::RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Scenario& scenario) {
+  SetScript(scenario.connection().rtsp());
+
+  int still_running = 1;
+  int idle_iterations = 0;
+  CURLMcode rc = CURLM_OK;
+
+  while (still_running && idle_iterations < kMaxIdleIterations) {
+    rc = curl_multi_perform(multi, &still_running);
+    fuzz_spin_note_perform(multi, still_running);
+    fuzz_digest_iteration();
+    if (rc != CURLM_OK) {
+      break;
+    }
+    if (!still_running) {
+      break;
+    }
+    if (connection_ && connection_->FlushFragment()) {
+      idle_iterations = 0;
+    }
+
+    int ready = WaitOnMultiFdset(multi, easy, &rc);
+    if (rc != CURLM_OK) {
+      break;
+    }
+
+    bool progressed = ServiceInput();
+    if (!connection_ || !connection_->fragments_pending()) {
+      progressed = StreamBurst() || progressed;
+    }
+    if (progressed || ready != 0) {
+      idle_iterations = 0;
+    } else {
+      ++idle_iterations;
+    }
+  }
+  ReportThroughput();
+}
+
+}  // namespace proto_fuzzer
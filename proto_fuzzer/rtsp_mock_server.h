@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief RtspMockServer — an in-process RTSP server that answers curl's
+///        requests from an RtspScript, echoing each CSeq, and streams
+///        interleaved RTP packets for curl to demux.
+
+#ifndef PROTO_FUZZER_RTSP_MOCK_SERVER_H_
+#define PROTO_FUZZER_RTSP_MOCK_SERVER_H_
+
+#include <curl/curl.h>
+
+#include <bitset>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "curl_fuzzer.pb.h"
+#include "proto_fuzzer/mock_server_base.h"
+
+namespace proto_fuzzer {
+
+/// @class proto_fuzzer::RtspMockServer
+/// @brief In-process RTSP peer. Reads each request curl sends — request line,
+///        headers and any Content-Length body — and answers it from the
+///        scenario's RtspScript or a default 200, echoing the request's CSeq.
+///        Once the script's RtpStream is due it writes generated "$"-framed
+///        RTP packets in bursts, and counts what curl's demuxer hands to
+///        CURLOPT_INTERLEAVEFUNCTION. Setting FUZZ_INTERLEAVE reports that
+///        demux throughput on stderr after each scenario.
+class RtspMockServer : public MockServerBase {
+ public:
+  RtspMockServer();
+  ~RtspMockServer() override;
+
+  /// Install the common socket callbacks via the base, then route
+  /// CURLOPT_INTERLEAVEFUNCTION to this instance.
+  /// @param easy The curl easy handle to configure.
+  void Install(CURL* easy) override;
+
+  void SetScript(const curl::fuzzer::proto::RtspScript& script);
+
+  /// Account for one interleaved packet curl has demuxed.
+  /// @param data The packet, "$" header included.
+  /// @param size Its length in bytes.
+  void NoteInterleaved(const void* data, std::size_t size);
+
+ protected:
+  curl_socket_t HandleOpenSocket(const struct curl_sockaddr* address) override;
+  void RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Scenario& scenario) override;
+
+ private:
+  bool ServiceInput();
+  void Answer(const std::string& head);
+  std::string BuildResponse(const std::string& method, const std::string& head, const std::string& cseq);
+  void AppendRtpPacket(std::size_t index, std::string* out) const;
+  bool StreamBurst();
+  void SendBytes(const std::string& bytes);
+  void Close();
+  void ReportThroughput() const;
+
+  /// The scenario's script; owned by the Scenario, which outlives the run.
+  const curl::fuzzer::proto::RtspScript* script_;
+  /// Bytes read from curl that don't yet form a whole request.
+  std::string input_;
+  /// Body bytes of the current request still to be skipped.
+  std::size_t body_remaining_;
+  /// Responses sent so far; also the index of the next scripted one.
+  std::size_t responses_sent_;
+  /// Packets to stream, after the caps.
+  std::size_t rtp_packets_;
+  /// Index of the next RTP packet to send.
+  std::size_t next_packet_;
+  /// Set once the mock has closed its side of the connection.
+  bool closed_;
+  /// Set once the mock has written anything.
+  bool wrote_;
+
+  /// Interleaved packets and bytes curl has delivered.
+  std::size_t demuxed_packets_;
+  std::uint64_t demuxed_bytes_;
+  /// Channels curl has delivered a packet on.
+  std::bitset<256> demuxed_channels_;
+  /// When the mock first wrote, and when curl last demuxed a packet.
+  std::chrono::steady_clock::time_point first_write_;
+  std::chrono::steady_clock::time_point last_demuxed_;
+};
+
+}  // namespace proto_fuzzer
+
+#endif  // PROTO_FUZZER_RTSP_MOCK_SERVER_H_
@@ -11,13 +11,31 @@
 
 #include <curl/curl.h>
 
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
+#include "curl_fuzzer_alloc.h"
+#include "curl_fuzzer_complexity.h"
+#include "curl_fuzzer_digest.h"
+#include "curl_fuzzer_drift.h"
+#include "curl_fuzzer_pcap.h"
+#include "curl_fuzzer_spin.h"
+#include "curl_fuzzer_stats.h"
+#include "curl_fuzzer_timing.h"
+#include "proto_fuzzer/ftp_mock_server.h"
+#include "proto_fuzzer/http2_mock_server.h"
+#include "proto_fuzzer/ldap_mock_server.h"
+#include "proto_fuzzer/mail_mock_server.h"
 #include "proto_fuzzer/mock_server.h"
 #include "proto_fuzzer/mock_server_base.h"
+#include "proto_fuzzer/mqtt_mock_server.h"
 #include "proto_fuzzer/option_apply.h"
+#include "proto_fuzzer/proxy_mock_server.h"
+#include "proto_fuzzer/rtsp_mock_server.h"
+#include "proto_fuzzer/smb_mock_server.h"
 #include "proto_fuzzer/websocket_mock_server.h"
 
 namespace proto_fuzzer {
@@ -32,6 +50,50 @@ struct CurlEasyDeleter {
 };
 using CurlEasyPtr = std::unique_ptr<CURL, CurlEasyDeleter>;
 
+/// @brief Brackets one input for the shared telemetry modules: starts the
+///        exec-stats, phase, busy-loop and allocation counters on entry, and on
+///        scope exit flushes the packet capture and accounts for the input.
+///        Declared before the mock so it runs after every MockConnection has
+///        been torn down. A complexity probe's grown copy is not an input of
+///        its own, so its packets are discarded and nothing is accounted.
+class InputTelemetryGuard {
+ public:
+  /// @param scenario The input. Its serialised size is the baseline for
+  ///                 memory amplification checks, and the drift monitor keeps
+  ///                 a serialised copy.
+  explicit InputTelemetryGuard(const curl::fuzzer::proto::Scenario& scenario)
+      : scenario_(scenario), probing_(fuzz_complexity_probing() != 0) {
+    if (probing_) {
+      return;
+    }
+    fuzz_alloc_begin_input();
+    fuzz_stats_begin_input();
+    fuzz_timing_begin_input();
+    fuzz_spin_begin_input();
+    fuzz_digest_begin_input();
+  }
+  ~InputTelemetryGuard() {
+    if (probing_) {
+      fuzz_pcap_discard_input();
+      return;
+    }
+    fuzz_pcap_end_input();
+    fuzz_stats_end_input();
+    fuzz_timing_end_input();
+    fuzz_spin_end_input();
+    fuzz_alloc_end_input(fuzz_alloc_enabled() ? scenario_.ByteSizeLong() : 0);
+    if (fuzz_drift_enabled()) {
+      const std::string serialised = scenario_.SerializeAsString();
+      fuzz_drift_end_input(reinterpret_cast<const uint8_t*>(serialised.data()), serialised.size());
+    }
+  }
+
+ private:
+  const curl::fuzzer::proto::Scenario& scenario_;
+  /// A complexity probe's grown copy: its packets are discarded.
+  const bool probing_;
+};
+
 /// Map a Scheme enum to the URL scheme literal.
 const char* SchemePrefix(curl::fuzzer::proto::Scheme scheme) {
   switch (scheme) {
@@ -43,30 +105,111 @@ const char* SchemePrefix(curl::fuzzer::proto::Scheme scheme) {
       return "ws";
     case curl::fuzzer::proto::SCHEME_WSS:
       return "wss";
+    case curl::fuzzer::proto::SCHEME_FTP:
+      return "ftp";
+    case curl::fuzzer::proto::SCHEME_SMTP:
+      return "smtp";
+    case curl::fuzzer::proto::SCHEME_IMAP:
+      return "imap";
+    case curl::fuzzer::proto::SCHEME_POP3:
+      return "pop3";
+    case curl::fuzzer::proto::SCHEME_MQTT:
+      return "mqtt";
+    case curl::fuzzer::proto::SCHEME_RTSP:
+      return "rtsp";
+    case curl::fuzzer::proto::SCHEME_SMB:
+      return "smb";
+    case curl::fuzzer::proto::SCHEME_LDAP:
+      return "ldap";
     case curl::fuzzer::proto::SCHEME_UNSPECIFIED:
     default:
       return nullptr;
   }
 }
 
-/// Pick the MockServerBase subclass to use for 'scenario'. The scheme is the
-/// sole classifier today: WS / WSS → WebSocketMockServer, HTTP / HTTPS →
-/// MockServer. Returns nullptr for unsupported / unspecified schemes so the
-/// runner can skip the scenario cleanly.
-std::unique_ptr<MockServerBase> MakeMockServerForScenario(const curl::fuzzer::proto::Scenario& scenario) {
+/// Map a Scheme enum to its well-known port, which packet captures label the
+/// mock's end with so Wireshark picks the right dissector.
+std::uint16_t SchemePort(curl::fuzzer::proto::Scheme scheme) {
+  switch (scheme) {
+    case curl::fuzzer::proto::SCHEME_HTTPS:
+    case curl::fuzzer::proto::SCHEME_WSS:
+      return 443;
+    case curl::fuzzer::proto::SCHEME_FTP:
+      return 21;
+    case curl::fuzzer::proto::SCHEME_SMTP:
+      return 25;
+    case curl::fuzzer::proto::SCHEME_IMAP:
+      return 143;
+    case curl::fuzzer::proto::SCHEME_POP3:
+      return 110;
+    case curl::fuzzer::proto::SCHEME_MQTT:
+      return 1883;
+    case curl::fuzzer::proto::SCHEME_RTSP:
+      return 554;
+    case curl::fuzzer::proto::SCHEME_SMB:
+      return 445;
+    case curl::fuzzer::proto::SCHEME_LDAP:
+      return 389;
+    case curl::fuzzer::proto::SCHEME_HTTP:
+    case curl::fuzzer::proto::SCHEME_WS:
+    default:
+      return 80;
+  }
+}
+
+/// Pick the MockServerBase subclass that plays the origin for 'scenario'. The
+/// scheme is the sole classifier: WS / WSS → WebSocketMockServer, FTP →
+/// FtpMockServer, SMTP / IMAP / POP3 → MailMockServer in the matching
+/// dialect, MQTT → MqttMockServer, RTSP → RtspMockServer, SMB →
+/// SmbMockServer, LDAP → LdapMockServer, HTTP with an Http2Script →
+/// Http2MockServer, other HTTP / HTTPS → MockServer. Returns nullptr for
+/// unsupported / unspecified schemes so the runner can skip the scenario
+/// cleanly.
+std::unique_ptr<MockServerBase> MakeOriginMockServer(const curl::fuzzer::proto::Scenario& scenario) {
   switch (scenario.scheme()) {
     case curl::fuzzer::proto::SCHEME_HTTP:
+      if (scenario.connection().has_http2()) {
+        return std::make_unique<Http2MockServer>();
+      }
+      return std::make_unique<MockServer>();
     case curl::fuzzer::proto::SCHEME_HTTPS:
       return std::make_unique<MockServer>();
     case curl::fuzzer::proto::SCHEME_WS:
     case curl::fuzzer::proto::SCHEME_WSS:
       return std::make_unique<WebSocketMockServer>();
+    case curl::fuzzer::proto::SCHEME_FTP:
+      return std::make_unique<FtpMockServer>();
+    case curl::fuzzer::proto::SCHEME_SMTP:
+      return std::make_unique<MailMockServer>(MailDialect::kSmtp);
+    case curl::fuzzer::proto::SCHEME_IMAP:
+      return std::make_unique<MailMockServer>(MailDialect::kImap);
+    case curl::fuzzer::proto::SCHEME_POP3:
+      return std::make_unique<MailMockServer>(MailDialect::kPop3);
+    case curl::fuzzer::proto::SCHEME_MQTT:
+      return std::make_unique<MqttMockServer>();
+    case curl::fuzzer::proto::SCHEME_RTSP:
+      return std::make_unique<RtspMockServer>();
+    case curl::fuzzer::proto::SCHEME_SMB:
+      return std::make_unique<SmbMockServer>();
+    case curl::fuzzer::proto::SCHEME_LDAP:
+      return std::make_unique<LdapMockServer>();
     case curl::fuzzer::proto::SCHEME_UNSPECIFIED:
     default:
       return nullptr;
   }
 }
 
+/// Pick the mock to drive 'scenario': the origin for its scheme, behind a
+/// ProxyMockServer when the scenario asks for a proxy hop.
+std::unique_ptr<MockServerBase> MakeMockServerForScenario(const curl::fuzzer::proto::Scenario& scenario) {
+  std::unique_ptr<MockServerBase> origin = MakeOriginMockServer(scenario);
+  const auto& proxy = scenario.connection().proxy();
+  if (!origin || proxy.type() == curl::fuzzer::proto::ProxyScript::PROXY_NONE) {
+    return origin;
+  }
+  return std::make_unique<ProxyMockServer>(proxy, std::move(origin));
+}
+
 }  // namespace
 
 /// @class proto_fuzzer::ScenarioRunner
@@ -82,32 +225,43 @@ ScenarioRunner::ScenarioRunner() = default;
 /// down at instance scope.
 ScenarioRunner::~ScenarioRunner() = default;
 
-/// Run the scenario. Classifies the scheme to pick a MockServer subclass,
-/// applies baseline + per-option setopt calls, builds the URL from
-/// scenario.scheme + scenario.host_path, and drives the transfer via the
-/// mock's own DriveScenario.
+/// Run the scenario. Classifies the scheme to pick a MockServer subclass and
+/// the port packet captures show, applies baseline + per-option setopt
+/// calls, builds the URL from scenario.scheme + scenario.host_path, and
+/// drives the transfer via the mock's own DriveScenario.
 /// @param scenario The Scenario describing the curl operations to perform.
 /// @return 0 on normal completion (including curl errors that aren't harness
 ///         failures). The libFuzzer entrypoint doesn't care about the return
 ///         value; it's there for tests.
 int ScenarioRunner::Run(const curl::fuzzer::proto::Scenario& scenario) {
+  InputTelemetryGuard telemetry(scenario);
   const char* prefix = SchemePrefix(scenario.scheme());
-  if (prefix == nullptr || scenario.host_path().empty()) {
+  if (prefix == nullptr) {
+    fuzz_stats_reject(FUZZ_STATS_REJECT_NO_SCHEME, FUZZ_STATS_KEY_NONE, 0);
+    return 0;
+  }
+  if (scenario.host_path().empty()) {
+    fuzz_stats_reject(FUZZ_STATS_REJECT_NO_HOST_PATH, FUZZ_STATS_KEY_NONE, 0);
     return 0;
   }
 
   std::unique_ptr<MockServerBase> mock = MakeMockServerForScenario(scenario);
   if (!mock) {
+    fuzz_stats_reject(FUZZ_STATS_REJECT_NO_SCHEME, FUZZ_STATS_KEY_NONE, 0);
     return 0;
   }
+  fuzz_pcap_set_port(SchemePort(scenario.scheme()));
 
   CurlEasyPtr easy(curl_easy_init());
   if (!easy) {
+    fuzz_stats_reject(FUZZ_STATS_REJECT_SETUP, FUZZ_STATS_KEY_NONE, 0);
     return 0;
   }
 
+  fuzz_timing_switch(FUZZ_TIMING_SETOPT);
   std::vector<std::string> string_storage;
   string_storage.reserve(scenario.options_size());
+  std::vector<struct curl_slist*> slist_storage;
 
   struct curl_slist* connect_to = ApplyBaselineOptions(easy.get());
 
@@ -118,14 +272,23 @@ int ScenarioRunner::Run(const curl::fuzzer::proto::Scenario& scenario) {
 
   for (const auto& option : scenario.options()) {
     // Intentionally ignore per-option CURLcode: the fuzzer's job is to stress
-    // curl, not to validate that every option is applied cleanly.
-    (void)ApplySetOption(easy.get(), option, &string_storage);
+    // curl, not to validate that every option is applied cleanly. Failures
+    // are still counted so FUZZ_STATS can show which options never stick.
+    const unsigned int option_key = static_cast<unsigned int>(option.option_id());
+    fuzz_stats_note_key(FUZZ_STATS_KEY_CURLOPT, option_key);
+    if (ApplySetOption(easy.get(), option, &string_storage, &slist_storage) != CURLE_OK) {
+      fuzz_stats_setopt_failed(FUZZ_STATS_KEY_CURLOPT, option_key);
+    }
   }
 
   mock->DriveScenario(easy.get(), scenario);
 
+  fuzz_timing_switch(FUZZ_TIMING_TEARDOWN);
   easy.reset();
   curl_slist_free_all(connect_to);
+  for (struct curl_slist* list : slist_storage) {
+    curl_slist_free_all(list);
+  }
   return 0;
 }
 
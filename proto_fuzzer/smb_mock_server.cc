@@ -0,0 +1,387 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief Implementation of SmbMockServer.
+
+#include "proto_fuzzer/smb_mock_server.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "curl_fuzzer_digest.h"
+#include "curl_fuzzer_spin.h"
+#include "proto_fuzzer/mock_server.h"
+
+namespace proto_fuzzer {
+
+namespace {
+
+// The generated file is capped so one input can't keep curl reading for long.
+constexpr std::uint64_t kMaxFileSize = 1024 * 1024;
+
+// NetBIOS session message header: type, flags (whose low bit extends the
+// length to 17 bits) and a 16-bit big-endian length.
+constexpr std::size_t kNbtHeaderSize = 4;
+constexpr std::size_t kMaxNbtLength = 0xFFFF;
+
+// Offsets into a message, NetBIOS header included, as curl's struct
+// smb_header lays it out.
+constexpr std::size_t kCommandOffset = 8;
+constexpr std::size_t kStatusOffset = 9;
+constexpr std::size_t kFlagsOffset = 13;
+constexpr std::size_t kTidOffset = 28;
+constexpr std::size_t kUidOffset = 32;
+constexpr std::size_t kHeaderSize = 36;
+
+// SMB1 commands curl sends.
+constexpr std::uint8_t kComClose = 0x04;
+constexpr std::uint8_t kComReadAndX = 0x2E;
+constexpr std::uint8_t kComWriteAndX = 0x2F;
+constexpr std::uint8_t kComNegotiate = 0x72;
+constexpr std::uint8_t kComSessionSetupAndX = 0x73;
+constexpr std::uint8_t kComTreeConnectAndX = 0x75;
+constexpr std::uint8_t kComNtCreateAndX = 0xA2;
+
+// SMB_FLAGS_REPLY | SMB_FLAGS_CANONICAL_PATHNAMES | SMB_FLAGS_CASELESS_PATHNAMES.
+constexpr std::uint8_t kReplyFlags = 0x98;
+
+// An AndX block ending the chain: no further command, reserved, offset 0.
+constexpr char kAndxNone[] = "\xFF\x00\x00\x00";
+
+// IDs the mock hands out.
+constexpr std::uint16_t kUid = 100;
+constexpr std::uint16_t kTid = 1;
+constexpr std::uint16_t kFid = 0x4000;
+
+constexpr char kChallenge[] = "curlfuzz";
+constexpr std::uint32_t kSessionKey = 0x12345678;
+// Primary domain, sent NUL-terminated after the challenge.
+constexpr char kNegotiateDomain[] = "WORKGROUP";
+// Native OS, native LAN manager and primary domain, each NUL-terminated.
+constexpr char kSessionStrings[] = "Unix\0curl-fuzzer\0WORKGROUP";
+// Service type and native file system, each NUL-terminated.
+constexpr char kTreeStrings[] = "A:\0NTFS";
+
+// READ_ANDX request parameter offsets past the header: word count (1),
+// AndX (4), FID (2), then the low offset, the byte count wanted and, 21
+// bytes in, the high offset.
+constexpr std::size_t kReadOffsetLow = kHeaderSize + 7;
+constexpr std::size_t kReadMaxCount = kHeaderSize + 11;
+constexpr std::size_t kReadOffsetHigh = kHeaderSize + 21;
+// WRITE_ANDX request: the data length, 21 bytes past the header.
+constexpr std::size_t kWriteDataLength = kHeaderSize + 21;
+
+// Data offset in a READ_ANDX reply, counted from the SMB magic: 32 header
+// bytes, the word count, 12 words and the byte count.
+constexpr std::size_t kReadDataOffset = 32 + 1 + 24 + 2;
+
+/// Append 'value' to 'out' little-endian in 'width' bytes.
+void AppendLe(std::string* out, std::uint64_t value, std::size_t width) {
+  for (std::size_t i = 0; i < width; ++i) {
+    out->push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+  }
+}
+
+/// Overwrite 'width' bytes of 'out' at 'pos' with 'value' little-endian.
+void StoreLe(std::string* out, std::size_t pos, std::uint64_t value, std::size_t width) {
+  for (std::size_t i = 0; i < width && pos + i < out->size(); ++i) {
+    (*out)[pos + i] = static_cast<char>((value >> (8 * i)) & 0xFF);
+  }
+}
+
+/// @return the little-endian value of 'width' bytes of 'in' at 'pos', or 0
+///         if 'in' is too short.
+std::uint64_t LoadLe(const std::string& in, std::size_t pos, std::size_t width) {
+  if (pos + width > in.size()) {
+    return 0;
+  }
+  std::uint64_t value = 0;
+  for (std::size_t i = 0; i < width; ++i) {
+    value |= static_cast<std::uint64_t>(static_cast<unsigned char>(in[pos + i])) << (8 * i);
+  }
+  return value;
+}
+
+}  // namespace
+
+/// Construct an idle SmbMockServer. RunLoop() seeds it from the scenario
+/// before curl opens the connection.
+SmbMockServer::SmbMockServer() : script_(nullptr), file_size_(0) {}
+
+/// Default destructor; the MockConnection closes its socket.
+SmbMockServer::~SmbMockServer() = default;
+
+/// Use 'script' for the rest of the scenario.
+/// @param script The scenario's SmbScript; must outlive the run.
+void SmbMockServer::SetScript(const curl::fuzzer::proto::SmbScript& script) {
+  script_ = &script;
+  file_size_ = std::min(kMaxFileSize, script.file().size());
+}
+
+/// Called by the OPENSOCKETFUNCTION trampoline in the base class. SMB uses a
+/// single connection, and the client speaks first.
+curl_socket_t SmbMockServer::HandleOpenSocket(const struct curl_sockaddr* /*address*/) {
+  if (connection_) {
+    return CURL_SOCKET_BAD;
+  }
+  connection_ = std::make_unique<MockConnection>();
+  if (!connection_->ok()) {
+    connection_.reset();
+    return CURL_SOCKET_BAD;
+  }
+  ApplyPendingBackpressure();
+  return connection_->take_client_fd();
+}
+
+/// Send the reply to 'request': its header with the reply flag, status and
+/// the IDs the mock assigned, then the parameter words and data block, all
+/// NetBIOS-framed, with the step's overrides applied.
+/// @param request   The request being answered, NetBIOS header included.
+/// @param overrides The script's SmbReply for this step, or nullptr.
+/// @param words     Parameter words of the well-formed reply.
+/// @param bytes     Data block of the well-formed reply.
+void SmbMockServer::Reply(const std::string& request, const curl::fuzzer::proto::SmbReply* overrides,
+                          const std::string& words, const std::string& bytes) {
+  std::string message;
+  if (overrides != nullptr && !overrides->raw().empty()) {
+    message = overrides->raw();
+  } else {
+    // Keep the request's command, flags2, PIDs and MID.
+    message = request.substr(kNbtHeaderSize, kHeaderSize - kNbtHeaderSize);
+    const auto command = static_cast<std::uint8_t>(request[kCommandOffset]);
+    StoreLe(&message, kStatusOffset - kNbtHeaderSize, overrides != nullptr ? overrides->status() : 0, 4);
+    message[kFlagsOffset - kNbtHeaderSize] = static_cast<char>(kReplyFlags);
+    std::uint32_t tid = command == kComTreeConnectAndX ? kTid : LoadLe(request, kTidOffset, 2);
+    std::uint32_t uid = command == kComSessionSetupAndX ? kUid : LoadLe(request, kUidOffset, 2);
+    if (overrides != nullptr && overrides->tid() != 0) {
+      tid = overrides->tid();
+    }
+    if (overrides != nullptr && overrides->uid() != 0) {
+      uid = overrides->uid();
+    }
+    StoreLe(&message, kTidOffset - kNbtHeaderSize, tid, 2);
+    StoreLe(&message, kUidOffset - kNbtHeaderSize, uid, 2);
+
+    const std::string data = overrides != nullptr ? bytes + overrides->extra_bytes() : bytes;
+    const std::int64_t word_count =
+        static_cast<std::int64_t>(words.size() / 2) + (overrides != nullptr ? overrides->word_count_adjust() : 0);
+    const std::int64_t byte_count =
+        static_cast<std::int64_t>(data.size()) + (overrides != nullptr ? overrides->byte_count_adjust() : 0);
+    message.push_back(static_cast<char>(word_count & 0xFF));
+    message += words;
+    AppendLe(&message, static_cast<std::uint64_t>(byte_count), 2);
+    message += data;
+  }
+
+  const std::int64_t length =
+      static_cast<std::int64_t>(message.size()) + (overrides != nullptr ? overrides->nbt_length_adjust() : 0);
+  const auto nbt_length =
+      static_cast<std::uint32_t>(std::max<std::int64_t>(0, std::min<std::int64_t>(length, kMaxNbtLength)));
+  std::string out;
+  out.reserve(kNbtHeaderSize + message.size());
+  out.push_back('\0');
+  out.push_back('\0');
+  out.push_back(static_cast<char>(nbt_length >> 8));
+  out.push_back(static_cast<char>(nbt_length & 0xFF));
+  out += message;
+  connection_->WriteAll(reinterpret_cast<const unsigned char*>(out.data()), out.size());
+}
+
+/// @return the NEGOTIATE reply's 17 parameter words: dialect 0 (curl only
+///         offers "NT LM 0.12"), user-level security with challenge/response,
+///         the session key and an 8-byte challenge length.
+std::string SmbMockServer::NegotiateWords() const {
+  std::string words;
+  AppendLe(&words, 0, 2);        // dialect index
+  words.push_back('\x03');       // security mode
+  AppendLe(&words, 50, 2);       // max pending multiplexed requests
+  AppendLe(&words, 1, 2);        // max virtual circuits
+  AppendLe(&words, 0x10000, 4);  // max buffer size
+  AppendLe(&words, 0x10000, 4);  // max raw size
+  AppendLe(&words, kSessionKey, 4);
+  AppendLe(&words, 0, 4);  // capabilities
+  AppendLe(&words, 0, 8);  // system time
+  AppendLe(&words, 0, 2);  // time zone
+  words.push_back(static_cast<char>(sizeof(kChallenge) - 1));
+  return words;
+}
+
+/// @return the NT_CREATE_ANDX reply's 34 parameter words, opening the
+///         generated file with its (possibly adjusted) end-of-file.
+std::string SmbMockServer::CreateWords() const {
+  std::string words(kAndxNone, sizeof(kAndxNone) - 1);
+  words.push_back('\0');  // oplock level
+  AppendLe(&words, kFid, 2);
+  AppendLe(&words, 1, 4);           // create action: opened
+  AppendLe(&words, 0, 8 * 4);       // creation, access, write, change times
+  AppendLe(&words, 0x80, 4);        // attributes: normal
+  AppendLe(&words, file_size_, 8);  // allocation size
+  const std::int64_t end_of_file = static_cast<std::int64_t>(file_size_) + script_->file().end_of_file_adjust();
+  AppendLe(&words, static_cast<std::uint64_t>(end_of_file), 8);
+  AppendLe(&words, 0, 2);  // file type: disk
+  AppendLe(&words, 0, 2);  // IPC state
+  words.push_back('\0');   // not a directory
+  return words;
+}
+
+/// Generate the READ_ANDX reply for 'request': as much of the file from the
+/// offset asked for as curl wants, the script's max_read and the file allow.
+/// @param request The READ_ANDX request.
+/// @param bytes   Receives the data block: the file bytes.
+/// @return the reply's 12 parameter words.
+std::string SmbMockServer::ReadReply(const std::string& request, std::string* bytes) const {
+  const auto& file = script_->file();
+  const std::uint64_t offset = LoadLe(request, kReadOffsetLow, 4) | (LoadLe(request, kReadOffsetHigh, 4) << 32);
+  std::uint64_t count = LoadLe(request, kReadMaxCount, 2);
+  count = std::min(count, offset < file_size_ ? file_size_ - offset : 0);
+  if (file.max_read() != 0) {
+    count = std::min<std::uint64_t>(count, file.max_read());
+  }
+
+  const std::string& pattern = file.pattern();
+  bytes->clear();
+  bytes->reserve(count);
+  for (std::uint64_t i = 0; i < count; ++i) {
+    const std::uint64_t at = offset + i;
+    bytes->push_back(pattern.empty() ? static_cast<char>(at & 0xFF) : pattern[at % pattern.size()]);
+  }
+
+  std::string words(kAndxNone, sizeof(kAndxNone) - 1);
+  AppendLe(&words, 0xFFFF, 2);  // available
+  AppendLe(&words, 0, 2);       // data compaction mode
+  AppendLe(&words, 0, 2);       // reserved
+  AppendLe(&words, count, 2);   // data length
+  const std::int64_t data_offset = static_cast<std::int64_t>(kReadDataOffset) + file.data_offset_adjust();
+  AppendLe(&words, static_cast<std::uint64_t>(data_offset), 2);
+  AppendLe(&words, 0, 10);  // data length high, reserved
+  return words;
+}
+
+/// @return the WRITE_ANDX reply's 6 parameter words, acknowledging all the
+///         data 'request' carried.
+std::string SmbMockServer::WriteWords(const std::string& request) const {
+  std::string words(kAndxNone, sizeof(kAndxNone) - 1);
+  AppendLe(&words, LoadLe(request, kWriteDataLength, 2), 2);
+  AppendLe(&words, 0xFFFF, 2);  // available
+  AppendLe(&words, 0, 4);       // count high, reserved
+  return words;
+}
+
+/// Answer one request by its command.
+/// @param message The request, NetBIOS header included.
+void SmbMockServer::HandleMessage(const std::string& message) {
+  const auto& script = *script_;
+  std::string bytes;
+  switch (static_cast<std::uint8_t>(message[kCommandOffset])) {
+    case kComNegotiate:
+      bytes = std::string(kChallenge, sizeof(kChallenge) - 1) + std::string(kNegotiateDomain, sizeof(kNegotiateDomain));
+      Reply(message, script.has_negotiate() ? &script.negotiate() : nullptr, NegotiateWords(), bytes);
+      break;
+    case kComSessionSetupAndX:
+      Reply(message, script.has_session_setup() ? &script.session_setup() : nullptr,
+            std::string(kAndxNone, sizeof(kAndxNone) - 1) + std::string(2, '\0'),
+            std::string(kSessionStrings, sizeof(kSessionStrings)));
+      break;
+    case kComTreeConnectAndX: {
+      std::string words(kAndxNone, sizeof(kAndxNone) - 1);
+      AppendLe(&words, 1, 2);  // optional support: search bits
+      Reply(message, script.has_tree_connect() ? &script.tree_connect() : nullptr, words,
+            std::string(kTreeStrings, sizeof(kTreeStrings)));
+      break;
+    }
+    case kComNtCreateAndX:
+      Reply(message, script.has_create() ? &script.create() : nullptr, CreateWords(), std::string());
+      break;
+    case kComReadAndX: {
+      const std::string words = ReadReply(message, &bytes);
+      Reply(message, script.has_read() ? &script.read() : nullptr, words, bytes);
+      break;
+    }
+    case kComWriteAndX:
+      Reply(message, script.has_write() ? &script.write() : nullptr, WriteWords(message), std::string());
+      break;
+    case kComClose:
+    default:
+      // CLOSE, TREE_DISCONNECT and anything else: an empty success.
+      Reply(message, nullptr, std::string(), std::string());
+      break;
+  }
+}
+
+/// Split what curl has sent into NetBIOS messages and answer each SMB one.
+/// @return true if at least one message was answered.
+bool SmbMockServer::ServiceInput() {
+  if (!connection_) {
+    return false;
+  }
+  connection_->ReadAvailable(&input_);
+
+  bool handled = false;
+  while (input_.size() >= kNbtHeaderSize) {
+    const std::size_t length = (static_cast<std::size_t>(static_cast<unsigned char>(input_[1]) & 0x01) << 16) |
+                               (static_cast<std::size_t>(static_cast<unsigned char>(input_[2])) << 8) |
+                               static_cast<unsigned char>(input_[3]);
+    if (input_.size() < kNbtHeaderSize + length) {
+      break;
+    }
+    const std::string message = input_.substr(0, kNbtHeaderSize + length);
+    input_.erase(0, kNbtHeaderSize + length);
+    // Session keep-alives and anything too short to carry an SMB header get
+    // no answer.
+    if (message.size() >= kHeaderSize && message.compare(kNbtHeaderSize, 4, "\xFFSMB") == 0) {
+      HandleMessage(message);
+      handled = true;
+    }
+  }
+  return handled;
+}
+
+/// Seed the mock from the scenario, then drive the perform loop until curl is
+/// done or the idle-iteration cap is hit. Each iteration answers whatever
+/// requests curl has sent.
+/// @param multi    caller-owned multi; 'easy' is already added.
+/// @param easy     the curl easy handle attached to this mock.
+/// @param scenario source of the SmbScript.
+void SmbMockServer::RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Scenario& scenario) {
+  SetScript(scenario.connection().smb());
+
+  int still_running = 1;
+  int idle_iterations = 0;
+  CURLMcode rc = CURLM_OK;
+
+  while (still_running && idle_iterations < kMaxIdleIterations) {
+    rc = curl_multi_perform(multi, &still_running);
+    fuzz_spin_note_perform(multi, still_running);
+    fuzz_digest_iteration();
+    if (rc != CURLM_OK) {
+      break;
+    }
+    if (!still_running) {
+      break;
+    }
+    if (connection_ && connection_->FlushFragment()) {
+      idle_iterations = 0;
+    }
+
+    int ready = WaitOnMultiFdset(multi, easy, &rc);
+    if (rc != CURLM_OK) {
+      break;
+    }
+
+    const bool progressed = ServiceInput();
+    if (progressed || ready != 0) {
+      idle_iterations = 0;
+    } else {
+      ++idle_iterations;
+    }
+  }
+}
+
+}  // namespace proto_fuzzer
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) Max Dymond, <cmeister2@gmail.com>, et al.
+ *
+ * SPDX-License-Identifier: curl
+ */
+
+/// @file
+/// @brief SmbMockServer — an in-process SMB1 server that takes curl through
+///        negotiate, session setup, tree connect and open, then serves a
+///        generated file over READ_ANDX.
+
+#ifndef PROTO_FUZZER_SMB_MOCK_SERVER_H_
+#define PROTO_FUZZER_SMB_MOCK_SERVER_H_
+
+#include <curl/curl.h>
+
+#include <cstdint>
+#include <string>
+
+#include "curl_fuzzer.pb.h"
+#include "proto_fuzzer/mock_server_base.h"
+
+namespace proto_fuzzer {
+
+/// @class proto_fuzzer::SmbMockServer
+/// @brief In-process SMB1 peer. Splits what curl sends into NetBIOS-framed
+///        messages and answers each by command with a well-formed reply that
+///        echoes the request's PID and MID, altered by the scenario's
+///        SmbScript where it says so. READ_ANDX replies are generated from
+///        the script's SmbFile at the offset curl asks for.
+class SmbMockServer : public MockServerBase {
+ public:
+  SmbMockServer();
+  ~SmbMockServer() override;
+
+  void SetScript(const curl::fuzzer::proto::SmbScript& script);
+
+ protected:
+  curl_socket_t HandleOpenSocket(const struct curl_sockaddr* address) override;
+  void RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Scenario& scenario) override;
+
+ private:
+  bool ServiceInput();
+  void HandleMessage(const std::string& message);
+  void Reply(const std::string& request, const curl::fuzzer::proto::SmbReply* overrides, const std::string& words,
+             const std::string& bytes);
+  std::string NegotiateWords() const;
+  std::string CreateWords() const;
+  std::string ReadReply(const std::string& request, std::string* bytes) const;
+  std::string WriteWords(const std::string& request) const;
+
+  /// The scenario's script; owned by the Scenario, which outlives the run.
+  const curl::fuzzer::proto::SmbScript* script_;
+  /// Bytes read from curl that don't yet form a whole message.
+  std::string input_;
+  /// Size of the generated file, after the cap.
+  std::uint64_t file_size_;
+};
+
+}  // namespace proto_fuzzer
+
+#endif  // PROTO_FUZZER_SMB_MOCK_SERVER_H_
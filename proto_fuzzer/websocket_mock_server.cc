@@ -10,12 +10,16 @@
 #include "proto_fuzzer/websocket_mock_server.h"
 
 #include <curl/websockets.h>
+#include <sys/uio.h>
 
 #include <algorithm>
 #include <cstddef>
+#include <cstring>
 #include <string>
 #include <utility>
 
+#include "curl_fuzzer_digest.h"
+#include "curl_fuzzer_spin.h"
 #include "proto_fuzzer/ws_accept_key.h"
 #include "proto_fuzzer/ws_frame.h"
 
@@ -96,18 +100,29 @@ std::string ComputeWebSocketAccept(const std::string& key) { return proto_fuzzer
 /// Build the ordered list of chunks to deliver once the 101 handshake has
 /// completed. Mixes raw `on_readable` bytes (fuzzer-controlled) with serialised
 /// `server_frames` (structured RFC 6455 frames from the proto) under a shared
-/// kMaxResponseChunks budget.
-std::vector<std::string> BuildFrameChunks(const curl::fuzzer::proto::Connection& conn) {
-  std::vector<std::string> chunks;
-  chunks.reserve(kMaxResponseChunks);
+/// kMaxResponseChunks budget, then an empty chunk for generated_body. The
+/// chunks refer to the scenario's bytes rather than copying them.
+/// @param conn The scenario's connection.
+/// @return the chunks, in the order they are sent.
+std::vector<WebSocketMockServer::Chunk> BuildFrameChunks(const curl::fuzzer::proto::Connection& conn) {
+  std::vector<WebSocketMockServer::Chunk> chunks;
+  chunks.reserve(kMaxResponseChunks + 1);
   const std::size_t raw_budget = std::min<std::size_t>(kMaxResponseChunks, conn.on_readable_size());
   for (std::size_t i = 0; i < raw_budget; ++i) {
-    chunks.emplace_back(conn.on_readable(i));
+    chunks.emplace_back();
+    chunks.back().raw = &conn.on_readable(static_cast<int>(i));
   }
   const std::size_t frame_budget = kMaxResponseChunks - chunks.size();
   const std::size_t frame_count = std::min<std::size_t>(frame_budget, conn.server_frames_size());
   for (std::size_t i = 0; i < frame_count; ++i) {
-    chunks.emplace_back(SerializeWebSocketFrame(conn.server_frames(static_cast<int>(i))));
+    const auto& frame = conn.server_frames(static_cast<int>(i));
+    chunks.emplace_back();
+    chunks.back().frame = &frame;
+    chunks.back().generated = GeneratedFramePayload(frame);
+  }
+  if (conn.has_generated_body()) {
+    chunks.emplace_back();
+    chunks.back().generated = PayloadStream(conn.generated_body());
   }
   return chunks;
 }
@@ -126,6 +141,16 @@ bool ScenarioRequestsManualWsDrive(const curl::fuzzer::proto::Scenario& scenario
   return false;
 }
 
+/// curl picks a random Sec-WebSocket-Key, so the Accept header the mock echoes
+/// back differs on every run and is kept out of the behaviour digest.
+/// @param contents Header or body bytes handed to the write callback.
+/// @param len      Number of bytes in 'contents'.
+/// @return true if 'contents' is the Sec-WebSocket-Accept header line.
+bool IsAcceptHeader(const void* contents, std::size_t len) {
+  static constexpr char kAccept[] = "Sec-WebSocket-Accept:";
+  return len >= sizeof(kAccept) - 1 && std::memcmp(contents, kAccept, sizeof(kAccept) - 1) == 0;
+}
+
 /// WRITEFUNCTION / HEADERFUNCTION installed on the easy handle by
 /// WebSocketMockServer::Install. Pokes curl_ws_meta on every invocation (so
 /// the Curl_is_in_callback-guarded branch stays covered), and fires a
@@ -136,7 +161,11 @@ bool ScenarioRequestsManualWsDrive(const curl::fuzzer::proto::Scenario& scenario
 /// tightened SO_RCVBUF. The one-shot gate keeps the per-scenario cost
 /// bounded when SOCKET_WRITABLE times out. WRITEDATA is the owning
 /// WebSocketMockServer so callback state lives on the server, not globals.
-size_t WebSocketWriteCallback(void* /*contents*/, size_t size, size_t nmemb, void* userdata) {
+size_t WebSocketWriteCallback(void* contents, size_t size, size_t nmemb, void* userdata) {
+  fuzz_digest_event(FUZZ_DIGEST_WRITE_CB);
+  if (!IsAcceptHeader(contents, size * nmemb)) {
+    fuzz_digest_bytes(FUZZ_DIGEST_DELIVERED, contents, size * nmemb);
+  }
   auto* server = static_cast<WebSocketMockServer*>(userdata);
   if (server != nullptr) {
     CURL* easy = server->easy_handle();
@@ -207,11 +236,12 @@ void WebSocketMockServer::MarkWsProbeFired() { ws_probe_fired_ = true; }
 /// @return the curl easy handle cached by Install() for the write callback.
 CURL* WebSocketMockServer::easy_handle() const { return easy_handle_; }
 
-/// Queue RFC 6455 wire-byte chunks to emit once the handshake has completed.
-/// Resets the next-chunk cursor.
-/// @param frames Ordered list of chunk byte strings.
-void WebSocketMockServer::SetFrames(std::vector<std::string> frames) {
-  frames_ = std::move(frames);
+/// Queue chunks to emit once the handshake has completed, each followed by
+/// the bytes generated after it. Resets the next-chunk cursor.
+/// @param chunks Ordered list of raw byte and frame chunks.
+void WebSocketMockServer::SetChunks(std::vector<Chunk> chunks) {
+  chunks_ = std::move(chunks);
+  streaming_ = PayloadStream();
   next_chunk_ = 0;
 }
 
@@ -226,24 +256,55 @@ bool WebSocketMockServer::manual_delivery() const { return manual_delivery_; }
 /// @return true once a 101 Switching Protocols response has been written.
 bool WebSocketMockServer::handshake_sent() const { return handshake_sent_; }
 
-/// @return true if at least one frame chunk has not yet been sent.
-bool WebSocketMockServer::has_more_chunks() const { return next_chunk_ < frames_.size(); }
+/// @return true if at least one frame chunk, or generated bytes after the
+///         last one sent, have not yet been sent.
+bool WebSocketMockServer::has_more_chunks() const { return next_chunk_ < chunks_.size() || !streaming_.done(); }
 
 /// @return the number of queued chunks not yet consumed.
 std::size_t WebSocketMockServer::remaining_chunks() const {
-  return next_chunk_ >= frames_.size() ? 0 : frames_.size() - next_chunk_;
+  return next_chunk_ >= chunks_.size() ? 0 : chunks_.size() - next_chunk_;
 }
 
-/// Access a pending chunk without consuming it.
-/// @param index Offset from the next-pending cursor.
-/// @return reference to the chunk byte string.
-const std::string& WebSocketMockServer::PeekChunk(std::size_t index) const { return frames_[next_chunk_ + index]; }
+/// Send the next queued chunk, after draining what curl has written, and
+/// make its generated bytes the ones to stream next. Used directly by the
+/// manual-drive path and, between bursts, by DeliverNextChunk.
+/// @return false if no chunk remains or the write failed.
+bool WebSocketMockServer::PushNextChunk() {
+  if (!connection_ || next_chunk_ >= chunks_.size()) {
+    return false;
+  }
+  connection_->DrainIncoming();
+  const Chunk& chunk = chunks_[next_chunk_++];
+  streaming_ = chunk.generated;
+  return WriteChunk(chunk);
+}
 
-/// Advance the pending-chunk cursor by one. No-op when no chunks remain.
-void WebSocketMockServer::ConsumeChunk() {
-  if (next_chunk_ < frames_.size()) {
-    ++next_chunk_;
+/// Write one chunk. A frame goes out as its head, built in head_, and its
+/// payload in a single writev; the payload is sent from the scenario where
+/// it lies unless it has to be masked, and then from mask_buffer_.
+/// @param chunk The chunk to send.
+/// @return false on short or failed write.
+bool WebSocketMockServer::WriteChunk(const Chunk& chunk) {
+  if (chunk.raw != nullptr) {
+    return chunk.raw->empty() ||
+           connection_->WriteAll(reinterpret_cast<const unsigned char*>(chunk.raw->data()), chunk.raw->size());
   }
+  if (chunk.frame == nullptr) {
+    return true;
+  }
+  const std::string& payload = chunk.frame->payload();
+  struct iovec pieces[2];
+  pieces[0].iov_base = head_;
+  pieces[0].iov_len = WriteWebSocketFrameHead(*chunk.frame, head_);
+  pieces[1].iov_base = const_cast<char*>(payload.data());
+  pieces[1].iov_len = payload.size();
+  if (chunk.frame->masked() && !payload.empty()) {
+    mask_buffer_.resize(payload.size());
+    MaskWebSocketPayload(reinterpret_cast<const unsigned char*>(payload.data()), payload.size(),
+                         chunk.frame->mask_key(), 0, mask_buffer_.data());
+    pieces[1].iov_base = mask_buffer_.data();
+  }
+  return connection_->WriteVector(pieces, 2);
 }
 
 /// Called by the OPENSOCKETFUNCTION trampoline in the base class. Creates the
@@ -251,7 +312,7 @@ void WebSocketMockServer::ConsumeChunk() {
 /// by TryAdvanceHandshake().
 /// @return the client-side fd to hand to libcurl, or CURL_SOCKET_BAD on
 ///         failure.
-curl_socket_t WebSocketMockServer::HandleOpenSocket() {
+curl_socket_t WebSocketMockServer::HandleOpenSocket(const struct curl_sockaddr* /*address*/) {
   if (connection_) {
     return CURL_SOCKET_BAD;
   }
@@ -261,37 +322,29 @@ curl_socket_t WebSocketMockServer::HandleOpenSocket() {
     return CURL_SOCKET_BAD;
   }
   ApplyPendingBackpressure();
+  // curl masks every frame it sends with a random key, so what it sends can't
+  // be compared between runs.
+  fuzz_digest_ignore(FUZZ_DIGEST_SENT);
   // Wait for curl's Upgrade request before we write anything — the drive
   // loop calls TryAdvanceHandshake() to drive that exchange.
   return connection_->take_client_fd();
 }
 
-/// Push raw bytes onto the server fd. Used by the manual-drive path to feed
-/// frame bytes directly into curl without any mock-side framing.
-/// @param data Buffer to send.
-/// @param size Number of bytes in 'data'.
-/// @return false on short or failed write.
-bool WebSocketMockServer::PushRawBytes(const unsigned char* data, std::size_t size) {
-  if (!connection_) {
-    return false;
-  }
-  connection_->DrainIncoming();
-  return connection_->WriteAll(data, size);
-}
-
-/// Push the next queued frame when curl is ready. Used in streaming mode;
-/// the drive loop calls this after the handshake has been sent. Shuts
-/// the write side once the last chunk is delivered.
+/// Push the next burst of generated bytes, or else the next queued frame,
+/// when curl is ready. Used in streaming mode; the drive loop calls this
+/// after the handshake has been sent. Shuts the write side once the last
+/// chunk is delivered.
 void WebSocketMockServer::DeliverNextChunk() {
-  if (!connection_ || next_chunk_ >= frames_.size()) {
+  if (!connection_ || !has_more_chunks()) {
     return;
   }
-  connection_->DrainIncoming();
-  const std::string& chunk = frames_[next_chunk_++];
-  if (!chunk.empty()) {
-    connection_->WriteAll(reinterpret_cast<const unsigned char*>(chunk.data()), chunk.size());
+  if (!streaming_.done()) {
+    connection_->DrainIncoming();
+    connection_->WriteGenerated(&streaming_);
+  } else {
+    PushNextChunk();
   }
-  if (next_chunk_ >= frames_.size()) {
+  if (!has_more_chunks()) {
     connection_->ShutdownWrite();
   }
 }
@@ -336,7 +389,7 @@ void WebSocketMockServer::RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::
   SetManualDelivery(ScenarioRequestsManualWsDrive(scenario));
   // initial_response is unused in WS mode; we synthesise the 101 dynamically
   // from curl's Upgrade request.
-  SetFrames(BuildFrameChunks(scenario.connection()));
+  SetChunks(BuildFrameChunks(scenario.connection()));
 
   int still_running = 1;
   int idle_iterations = 0;
@@ -344,6 +397,8 @@ void WebSocketMockServer::RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::
 
   while (still_running && idle_iterations < kMaxIdleIterations) {
     rc = curl_multi_perform(multi, &still_running);
+    fuzz_spin_note_perform(multi, still_running);
+    fuzz_digest_iteration();
     if (rc != CURLM_OK) {
       break;
     }
@@ -356,8 +411,11 @@ void WebSocketMockServer::RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::
     if (!still_running) {
       break;
     }
+    if (connection_ && connection_->FlushFragment()) {
+      idle_iterations = 0;
+    }
 
-    int ready = WaitOnMultiFdset(multi, &rc);
+    int ready = WaitOnMultiFdset(multi, easy, &rc);
     if (rc != CURLM_OK) {
       break;
     }
@@ -381,12 +439,20 @@ void WebSocketMockServer::RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::
   // Manual-drive tail: feed every remaining scripted chunk straight onto the
   // server fd as raw frame bytes, draining curl_ws_recv between each push.
   while (remaining_chunks() > 0) {
-    const std::string& chunk = PeekChunk(0);
-    if (!chunk.empty()) {
-      PushRawBytes(reinterpret_cast<const unsigned char*>(chunk.data()), chunk.size());
-    }
-    ConsumeChunk();
+    PushNextChunk();
     DrainWsRecv(easy);
+    // Under FUZZ_FRAGMENT the chunk was queued; feed it through piece by piece.
+    while (connection_ && connection_->FlushFragment()) {
+      DrainWsRecv(easy);
+    }
+    // Then its generated bytes, a burst at a time, curl_ws_recv emptying the
+    // socket in between. Stops early if curl no longer reads.
+    while (connection_ && connection_->WriteGenerated(&streaming_)) {
+      DrainWsRecv(easy);
+      while (connection_->FlushFragment()) {
+        DrainWsRecv(easy);
+      }
+    }
   }
   // Final drain in case frame parsing produced more work after the last push.
   DrainWsRecv(easy);
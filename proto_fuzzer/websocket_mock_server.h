@@ -20,6 +20,8 @@
 #include "curl_fuzzer.pb.h"
 #include "proto_fuzzer/mock_server.h"
 #include "proto_fuzzer/mock_server_base.h"
+#include "proto_fuzzer/payload_generator.h"
+#include "proto_fuzzer/ws_frame.h"
 
 namespace proto_fuzzer {
 
@@ -41,7 +43,17 @@ class WebSocketMockServer : public MockServerBase {
   /// @param easy The curl easy handle to configure.
   void Install(CURL* easy) override;
 
-  void SetFrames(std::vector<std::string> frames);
+  /// One queued chunk: on_readable bytes sent as they are, or a structured
+  /// frame whose head is built as it goes out. Either points into the
+  /// scenario, which outlives the run.
+  struct Chunk {
+    const std::string* raw = nullptr;
+    const curl::fuzzer::proto::WebSocketFrame* frame = nullptr;
+    /// Bytes generated after the chunk.
+    PayloadStream generated;
+  };
+
+  void SetChunks(std::vector<Chunk> chunks);
 
   void SetManualDelivery(bool manual);
   bool manual_delivery() const;
@@ -53,12 +65,10 @@ class WebSocketMockServer : public MockServerBase {
   bool has_more_chunks() const;
 
   std::size_t remaining_chunks() const;
-  const std::string& PeekChunk(std::size_t index) const;
-  void ConsumeChunk();
-  bool PushRawBytes(const unsigned char* data, std::size_t size);
+  bool PushNextChunk();
 
  protected:
-  curl_socket_t HandleOpenSocket() override;
+  curl_socket_t HandleOpenSocket(const struct curl_sockaddr* address) override;
   void RunLoop(CURLM* multi, CURL* easy, const curl::fuzzer::proto::Scenario& scenario) override;
 
  public:
@@ -71,8 +81,16 @@ class WebSocketMockServer : public MockServerBase {
   CURL* easy_handle() const;
 
  private:
-  std::vector<std::string> frames_;
+  bool WriteChunk(const Chunk& chunk);
+
+  std::vector<Chunk> chunks_;
+  /// What is left of the generated bytes after the chunk last sent.
+  PayloadStream streaming_;
   std::size_t next_chunk_;
+  /// Frame heads are built here, and masked payloads in mask_buffer_, both
+  /// reused from frame to frame.
+  unsigned char head_[kMaxWebSocketHeadBytes];
+  std::vector<unsigned char> mask_buffer_;
   bool manual_delivery_;
   bool handshake_sent_;
   bool ws_probe_fired_;
@@ -5,12 +5,17 @@
  */
 
 /// @file
-/// @brief Implementation of SerializeWebSocketFrame.
+/// @brief Implementation of the WebSocket frame writers and payload masking.
 
 #include "proto_fuzzer/ws_frame.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <string>
 
 namespace proto_fuzzer {
@@ -40,26 +45,29 @@ std::uint32_t ResolveLengthForm(std::uint32_t form, std::size_t payload_len) {
   return kLenForm64;
 }
 
-/// Append 'value' as big-endian bytes of width 'width' to 'out'.
-void AppendBigEndian(std::string* out, std::uint64_t value, std::size_t width) {
+/// Write 'value' as big-endian bytes of width 'width' to 'out'.
+/// @return the position just past what was written.
+unsigned char* PutBigEndian(unsigned char* out, std::uint64_t value, std::size_t width) {
   for (std::size_t i = 0; i < width; ++i) {
     std::size_t shift = (width - 1 - i) * 8;
-    out->push_back(static_cast<char>((value >> shift) & 0xFF));
+    *out++ = static_cast<unsigned char>((value >> shift) & 0xFF);
   }
+  return out;
 }
 
 }  // namespace
 
-/// Serialise a proto WebSocketFrame into RFC 6455 wire bytes. No validation
-/// is performed — invalid combinations (reserved bits set, oversized
-/// length_form for a tiny payload, opcode > 15) round-trip to the decoder
-/// unchanged, which is the point.
+/// Write a proto WebSocketFrame's head in RFC 6455 wire format: flags and
+/// opcode, mask bit and length, and the masking key if it has one. The
+/// length counts the payload and any generated_payload, so a sender can put
+/// the payload after the head without copying it.
 /// @param frame The WebSocketFrame proto message to render.
-/// @return The serialised byte string, ready to push onto the mock socket.
-std::string SerializeWebSocketFrame(const curl::fuzzer::proto::WebSocketFrame& frame) {
-  std::string out;
-  const std::string& payload = frame.payload();
-  const std::size_t payload_len = payload.size();
+/// @param head  Buffer of at least kMaxWebSocketHeadBytes.
+/// @return the number of bytes written to 'head'.
+std::size_t WriteWebSocketFrameHead(const curl::fuzzer::proto::WebSocketFrame& frame, unsigned char* head) {
+  unsigned char* out = head;
+  const std::size_t payload_len =
+      frame.payload().size() + (frame.has_generated_payload() ? GeneratedLength(frame.generated_payload()) : 0);
 
   // Byte 0: FIN | RSV1 | RSV2 | RSV3 | opcode(4 bits).
   std::uint8_t byte0 = 0;
@@ -68,7 +76,7 @@ std::string SerializeWebSocketFrame(const curl::fuzzer::proto::WebSocketFrame& f
   if (frame.rsv2()) byte0 |= 0x20;
   if (frame.rsv3()) byte0 |= 0x10;
   byte0 |= static_cast<std::uint8_t>(frame.opcode() & 0x0F);
-  out.push_back(static_cast<char>(byte0));
+  *out++ = byte0;
 
   // Byte 1: MASK bit | payload-length indicator (7 bits).
   const std::uint32_t length_form = ResolveLengthForm(frame.length_form(), payload_len);
@@ -80,45 +88,102 @@ std::string SerializeWebSocketFrame(const curl::fuzzer::proto::WebSocketFrame& f
       // are what the decoder sees — which is exactly the malformed-frame
       // path we want to reach.
       byte1 |= static_cast<std::uint8_t>(payload_len & 0x7F);
-      out.push_back(static_cast<char>(byte1));
+      *out++ = byte1;
       break;
     case kLenForm16:
       byte1 |= 126;
-      out.push_back(static_cast<char>(byte1));
-      AppendBigEndian(&out, static_cast<std::uint64_t>(payload_len & 0xFFFF), 2);
+      *out++ = byte1;
+      out = PutBigEndian(out, static_cast<std::uint64_t>(payload_len & 0xFFFF), 2);
       break;
     case kLenForm64:
     default:
       byte1 |= 127;
-      out.push_back(static_cast<char>(byte1));
-      AppendBigEndian(&out, static_cast<std::uint64_t>(payload_len), 8);
+      *out++ = byte1;
+      out = PutBigEndian(out, static_cast<std::uint64_t>(payload_len), 8);
       break;
   }
 
-  // Masking key (4 bytes) and XORed payload. Client-to-server frames must be
-  // masked per spec; server-to-client frames must NOT — but we emit whatever
-  // the scenario says, so the decoder's "masked server frame" error path is
-  // reachable.
+  // Masking key (4 bytes). Client-to-server frames must be masked per spec;
+  // server-to-client frames must NOT — but we emit whatever the scenario
+  // says, so the decoder's "masked server frame" error path is reachable.
   if (frame.masked()) {
-    const std::uint32_t key = frame.mask_key();
-    std::uint8_t key_bytes[4] = {
-        static_cast<std::uint8_t>((key >> 24) & 0xFF),
-        static_cast<std::uint8_t>((key >> 16) & 0xFF),
-        static_cast<std::uint8_t>((key >> 8) & 0xFF),
-        static_cast<std::uint8_t>(key & 0xFF),
-    };
-    for (unsigned char b : key_bytes) {
-      out.push_back(static_cast<char>(b));
-    }
-    out.reserve(out.size() + payload_len);
-    for (std::size_t i = 0; i < payload_len; ++i) {
-      out.push_back(static_cast<char>(static_cast<std::uint8_t>(payload[i]) ^ key_bytes[i & 0x3]));
-    }
-  } else {
-    out.append(payload);
+    out = PutBigEndian(out, frame.mask_key(), 4);
+  }
+  return static_cast<std::size_t>(out - head);
+}
+
+/// XOR a run of payload bytes with a masking key, a vector register at a
+/// time where SSE2 is available and a 64-bit word at a time elsewhere. The
+/// key is rotated once up front, so the wide loop needs no per-byte index.
+/// @param in    Bytes to mask.
+/// @param size  Number of bytes in 'in'.
+/// @param key   The 32-bit key, most significant byte first on the wire.
+/// @param phase Offset of in[0] within the payload.
+/// @param out   Receives the masked bytes; may be 'in'.
+void MaskWebSocketPayload(const unsigned char* in, std::size_t size, std::uint32_t key, std::size_t phase,
+                          unsigned char* out) {
+  unsigned char pattern[16];
+  for (std::size_t i = 0; i < sizeof(pattern); ++i) {
+    pattern[i] = static_cast<unsigned char>(key >> ((3 - ((phase + i) & 0x3)) * 8));
   }
+  std::size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i wide = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pattern));
+  for (; i + 16 <= size; i += 16) {
+    const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_xor_si128(data, wide));
+  }
+#else
+  std::uint64_t wide;
+  std::memcpy(&wide, pattern, sizeof(wide));
+  for (; i + 8 <= size; i += 8) {
+    std::uint64_t data;
+    std::memcpy(&data, in + i, sizeof(data));
+    data ^= wide;
+    std::memcpy(out + i, &data, sizeof(data));
+  }
+#endif
+  for (; i < size; ++i) {
+    out[i] = in[i] ^ pattern[i & 0x3];
+  }
+}
 
+/// Serialise a proto WebSocketFrame into RFC 6455 wire bytes. No validation
+/// is performed — invalid combinations (reserved bits set, oversized
+/// length_form for a tiny payload, opcode > 15) round-trip to the decoder
+/// unchanged, which is the point. A generated_payload is counted in the
+/// length but left out of the bytes; GeneratedFramePayload streams it.
+/// @param frame The WebSocketFrame proto message to render.
+/// @return The serialised byte string, ready to push onto the mock socket.
+std::string SerializeWebSocketFrame(const curl::fuzzer::proto::WebSocketFrame& frame) {
+  unsigned char head[kMaxWebSocketHeadBytes];
+  const std::size_t head_len = WriteWebSocketFrameHead(frame, head);
+  const std::string& payload = frame.payload();
+  std::string out;
+  out.reserve(head_len + payload.size());
+  out.append(reinterpret_cast<const char*>(head), head_len);
+  out.append(payload);
+  if (frame.masked()) {
+    auto* masked = reinterpret_cast<unsigned char*>(&out[head_len]);
+    MaskWebSocketPayload(masked, payload.size(), frame.mask_key(), 0, masked);
+  }
   return out;
 }
 
+/// Start the stream of bytes a frame generates after its payload. The
+/// masking key, if the frame has one, is applied at the offset the payload
+/// leaves it.
+/// @param frame The WebSocketFrame proto message; must outlive the stream.
+/// @return the stream, or an empty one if the frame generates nothing.
+PayloadStream GeneratedFramePayload(const curl::fuzzer::proto::WebSocketFrame& frame) {
+  if (!frame.has_generated_payload()) {
+    return PayloadStream();
+  }
+  PayloadStream stream(frame.generated_payload());
+  if (frame.masked()) {
+    stream.SetMask(frame.mask_key(), frame.payload().size());
+  }
+  return stream;
+}
+
 }  // namespace proto_fuzzer
@@ -10,18 +10,39 @@
 #ifndef PROTO_FUZZER_WS_FRAME_H_
 #define PROTO_FUZZER_WS_FRAME_H_
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
 #include "curl_fuzzer.pb.h"
+#include "proto_fuzzer/payload_generator.h"
 
 namespace proto_fuzzer {
 
+// Longest head WriteWebSocketFrameHead writes: two bytes, a 64-bit length
+// and a masking key.
+constexpr std::size_t kMaxWebSocketHeadBytes = 14;
+
+// Write the head of 'frame' (everything before the payload) to 'head', which
+// holds kMaxWebSocketHeadBytes, and return its size. The length counts the
+// payload and any generated_payload.
+std::size_t WriteWebSocketFrameHead(const curl::fuzzer::proto::WebSocketFrame& frame, unsigned char* head);
+
+// XOR 'size' bytes of 'in' into 'out' with masking key 'key', the first
+// being byte 'phase' of the payload. 'in' and 'out' may be the same buffer.
+void MaskWebSocketPayload(const unsigned char* in, std::size_t size, std::uint32_t key, std::size_t phase,
+                          unsigned char* out);
+
 // Render 'frame' into raw RFC 6455 wire bytes. No validation: invalid
 // combinations (reserved bits set, opcode > 15, oversized length_form for a
 // tiny payload) round-trip into the byte stream unchanged so the decoder sees
 // them.
 std::string SerializeWebSocketFrame(const curl::fuzzer::proto::WebSocketFrame& frame);
 
+// The bytes 'frame' generates after its serialised part, masked to carry on
+// from its payload. Empty if it has no generated_payload.
+PayloadStream GeneratedFramePayload(const curl::fuzzer::proto::WebSocketFrame& frame);
+
 }  // namespace proto_fuzzer
 
 #endif  // PROTO_FUZZER_WS_FRAME_H_
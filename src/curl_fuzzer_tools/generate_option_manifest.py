@@ -44,6 +44,7 @@ BASE_KIND: Dict[str, str] = {
     "CURLOPTTYPE_VALUES": "uint",
     "CURLOPTTYPE_STRINGPOINT": "string",
     "CURLOPTTYPE_OFF_T": "uint",
+    "CURLOPTTYPE_SLISTPOINT": "slist",
 }
 
 # Options whose kind cannot be inferred from the type token alone.
@@ -57,12 +58,22 @@ OPTION_KIND_OVERRIDES: Dict[str, str] = {
     "CURLOPT_FAILONERROR": "bool",
     "CURLOPT_AUTOREFERER": "bool",
     "CURLOPT_HTTP09_ALLOWED": "bool",
+    "CURLOPT_FTP_USE_EPSV": "bool",
+    "CURLOPT_FTP_USE_EPRT": "bool",
+    "CURLOPT_FTP_USE_PRET": "bool",
+    "CURLOPT_FTP_SKIP_PASV_IP": "bool",
+    "CURLOPT_DIRLISTONLY": "bool",
+    "CURLOPT_TRANSFERTEXT": "bool",
+    "CURLOPT_APPEND": "bool",
+    "CURLOPT_SASL_IR": "bool",
+    "CURLOPT_MAIL_RCPT_ALLOWFAILS": "bool",
 }
 
 VALUE_KIND_SYMBOLS: Dict[str, str] = {
     "string": "OptionValueKind::kString",
     "uint": "OptionValueKind::kUint",
     "bool": "OptionValueKind::kBool",
+    "slist": "OptionValueKind::kSlist",
 }
 
 
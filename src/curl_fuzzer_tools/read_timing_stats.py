@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+#
+"""Read the live phase-timing stats file written when FUZZ_TIMING is set."""
+
+import argparse
+import logging
+import struct
+import time
+from dataclasses import dataclass
+from pathlib import Path
+
+from curl_fuzzer_tools import common_logging
+
+log = logging.getLogger(__name__)
+
+# Layout of FUZZ_TIMING_FILE in curl_fuzzer_timing.h.
+FUZZ_TIMING_MAGIC = 0x474E494D49544643
+FUZZ_TIMING_VERSION = 1
+FUZZ_TIMING_NUM_BUCKETS = 48
+FUZZ_TIMING_NAME_LEN = 16
+
+HEADER = struct.Struct("=QIIIIQQ")
+HIST = struct.Struct(f"={FUZZ_TIMING_NAME_LEN}s3Q{FUZZ_TIMING_NUM_BUCKETS}Q")
+
+
+@dataclass
+class PhaseHistogram:
+    """Histogram for one phase."""
+
+    name: str
+    count: int
+    total_ns: int
+    max_ns: int
+    buckets: list[int]
+
+
+@dataclass
+class TimingStats:
+    """A consistent snapshot of the stats file."""
+
+    pid: int
+    inputs: int
+    phases: list[PhaseHistogram]
+
+
+def parse_timing_stats(data: bytes) -> TimingStats:
+    """Parse a snapshot of the stats file."""
+    magic, version, num_phases, num_buckets, pid, _seq, inputs = HEADER.unpack_from(
+        data, 0
+    )
+    if magic != FUZZ_TIMING_MAGIC:
+        raise ValueError("Not a FUZZ_TIMING stats file")
+    if version != FUZZ_TIMING_VERSION or num_buckets != FUZZ_TIMING_NUM_BUCKETS:
+        raise ValueError(f"Unsupported stats file version {version}")
+
+    phases = []
+    for ii in range(num_phases):
+        fields = HIST.unpack_from(data, HEADER.size + ii * HIST.size)
+        phases.append(
+            PhaseHistogram(
+                name=fields[0].split(b"\0", 1)[0].decode("ascii"),
+                count=fields[1],
+                total_ns=fields[2],
+                max_ns=fields[3],
+                buckets=list(fields[4:]),
+            )
+        )
+    return TimingStats(pid=pid, inputs=inputs, phases=phases)
+
+
+def read_timing_stats(stats_file: Path, retries: int = 100) -> TimingStats:
+    """Read the stats file, retrying until no update raced with the copy."""
+    seq_offset = HEADER.size - 16
+    for _ in range(retries):
+        before = stats_file.read_bytes()
+        after = stats_file.read_bytes()
+        seq_before = struct.unpack_from("=Q", before, seq_offset)[0]
+        seq_after = struct.unpack_from("=Q", after, seq_offset)[0]
+        if seq_before == seq_after and seq_before % 2 == 0 and before == after:
+            return parse_timing_stats(before)
+        time.sleep(0.001)
+    raise RuntimeError(f"Could not get a consistent snapshot of {stats_file}")
+
+
+def format_ns(ns: int) -> str:
+    """Format a duration with a sensible unit."""
+    for unit, scale in (("s", 10**9), ("ms", 10**6), ("us", 10**3)):
+        if ns >= scale:
+            return f"{ns // scale}{unit}"
+    return f"{ns}ns"
+
+
+def print_timing_stats(stats: TimingStats) -> None:
+    """Print the snapshot in the same layout as the harness's exit report."""
+    print(f"# curl-fuzzer phase timing, pid {stats.pid}, {stats.inputs} inputs")
+    print(f"# {'phase':<14} {'count':>10} {'avg_us':>10} {'max_us':>10}  histogram")
+    for phase in stats.phases:
+        avg_us = phase.total_ns / phase.count / 1000 if phase.count else 0
+        buckets = " ".join(
+            f">={format_ns(1 << (ii - 1) if ii else 0)}:{count}"
+            for ii, count in enumerate(phase.buckets)
+            if count
+        )
+        print(
+            f"{phase.name:<16} {phase.count:>10} {avg_us:>10.1f} "
+            f"{phase.max_ns / 1000:>10.1f}  {buckets}"
+        )
+
+
+def main() -> None:
+    """Begin main function."""
+    parser = argparse.ArgumentParser()
+    parser.add_argument("input", help="Stats file named by FUZZ_TIMING")
+    parser.add_argument(
+        "--watch",
+        type=float,
+        metavar="SECONDS",
+        help="Re-read and print the stats file every SECONDS",
+    )
+    args = parser.parse_args()
+
+    stats_file = Path(args.input)
+    if not stats_file.exists():
+        raise FileNotFoundError(f"Stats file {args.input} does not exist")
+
+    while True:
+        print_timing_stats(read_timing_stats(stats_file))
+        if args.watch is None:
+            break
+        time.sleep(args.watch)
+
+
+def run() -> None:
+    """Set up common logging and run the main function."""
+    common_logging(__name__, __file__)
+    main()
+
+
+if __name__ == "__main__":
+    run()
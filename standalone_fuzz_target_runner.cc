@@ -20,6 +20,7 @@
  *
  ***************************************************************************/
 
+#include <inttypes.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdint.h>
@@ -29,13 +30,19 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <chrono>
 #include <filesystem>
+#include <string>
 #include <system_error>
+#include <vector>
 
+#include "curl_fuzzer_digest.h"
+#include "curl_fuzzer_frag.h"
+#include "curl_fuzzer_perf.h"
 #include "testinput.h"
 
 /**
- * Per-input timeout (seconds). When LLVMFuzzerTestOneInput hangs (busy
+ * Per-run timeout (seconds). When LLVMFuzzerTestOneInput hangs (busy
  * loop, blocking I/O, etc.) we'd otherwise hang the whole corpus replay
  * and get SIGKILLed by the CI runner with no trace of which input is at
  * fault. An itimer + siglongjmp lets us abort the one call, log the
@@ -80,6 +87,235 @@ static void install_timeout_handler(void)
   sigaction(SIGALRM, &sa, NULL);
 }
 
+/**
+ * Run an input once. Determinism and fragmentation re-runs go through here
+ * too, so each run gets the whole timeout rather than sharing one with the
+ * others.
+ */
+static void run_input(const uint8_t *data, size_t len)
+{
+  if(g_timeout_armed)
+    alarm((unsigned int)g_timeout_secs);
+  LLVMFuzzerTestOneInput(data, len);
+}
+
+/**
+ * Slow-unit report. With FUZZ_PERF set, every input's cost (retired
+ * instructions, or CPU time where hardware counters aren't available) is
+ * recorded, and the most expensive inputs are listed once the replay is
+ * done, with their cycles and instructions per cycle when the hardware
+ * counters are in use. Unlike wall time these numbers hold still on a busy
+ * machine, so totals can be compared between runs.
+ */
+static const size_t SLOW_UNITS_REPORTED = 10;
+
+struct unit_cost
+{
+  std::string path;
+  uint64_t cost;
+  uint64_t cycles;
+  uint64_t cpu_ns;
+};
+
+static std::vector<unit_cost> g_unit_costs;
+
+/**
+ * Determinism checker. With FUZZ_DETERMINISM=<N> every input is run N times
+ * and each run's behaviour digest is compared with the first's.
+ */
+static size_t g_inputs_checked;
+static size_t g_inputs_unstable;
+
+static void check_determinism(const char *path, const uint8_t *data,
+                              size_t len)
+{
+  char where[512];
+  int runs = fuzz_digest_runs();
+
+  if(runs == 0)
+    return;
+
+  g_inputs_checked++;
+
+  for(int run = 1; run < runs; run++) {
+    run_input(data, len);
+    if(fuzz_digest_compare(where, sizeof(where))) {
+      g_inputs_unstable++;
+      fprintf(stderr, "\nFUZZ: determinism: %s: run %d differs: %s\n",
+              path, run + 1, where);
+      return;
+    }
+  }
+}
+
+static void report_determinism(void)
+{
+  if(g_inputs_checked == 0)
+    return;
+
+  fprintf(stderr, "FUZZ: determinism: %zu of %zu inputs unstable over %d "
+          "runs\n", g_inputs_unstable, g_inputs_checked, fuzz_digest_runs());
+}
+
+/**
+ * Fragmentation oracle. With FUZZ_FRAGMENT set every input is re-run under
+ * each fragmentation plan; what curl delivered must match the first, unsplit
+ * run, and the slowdown against an unsplit re-run is measured.
+ */
+struct fragment_slowdown
+{
+  std::string path;
+  double factor;
+};
+
+static size_t g_inputs_fragmented;
+static size_t g_inputs_diverged;
+static fragment_slowdown g_worst_slowdowns[FUZZ_FRAG_NUM_PLANS];
+
+/* Run an input and return its cost: FUZZ_PERF's if set, else wall time in
+   nanoseconds. */
+static uint64_t run_timed(const uint8_t *data, size_t len)
+{
+  FUZZ_PERF_SAMPLE start;
+  FUZZ_PERF_SAMPLE end;
+
+  if(fuzz_perf_source() != FUZZ_PERF_NONE) {
+    fuzz_perf_read(&start);
+    run_input(data, len);
+    fuzz_perf_read(&end);
+    return fuzz_perf_cost(&start, &end);
+  }
+
+  auto wall_start = std::chrono::steady_clock::now();
+  run_input(data, len);
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now() - wall_start).count();
+}
+
+static void check_fragmentation(const char *path, const uint8_t *data,
+                                size_t len)
+{
+  char where[512];
+  bool diverged = false;
+
+  if(!fuzz_frag_enabled())
+    return;
+
+  g_inputs_fragmented++;
+
+  /* Time an unsplit run with warm caches, as the first run's are cold. */
+  uint64_t baseline = run_timed(data, len);
+  if(baseline == 0)
+    baseline = 1;
+
+  for(int plan = FUZZ_FRAG_WHOLE + 1; plan < FUZZ_FRAG_NUM_PLANS; plan++) {
+    const char *name = fuzz_frag_plan_name((FUZZ_FRAG_PLAN)plan);
+
+    fuzz_frag_set_plan((FUZZ_FRAG_PLAN)plan);
+    double factor = (double)run_timed(data, len) / baseline;
+    fuzz_frag_set_plan(FUZZ_FRAG_WHOLE);
+
+    if(fuzz_digest_compare_output(where, sizeof(where))) {
+      diverged = true;
+      fprintf(stderr, "\nFUZZ: fragmentation: %s: %s differs: %s\n",
+              path, name, where);
+    }
+
+    if(factor > fuzz_frag_slowdown_limit()) {
+      fprintf(stderr, "\nFUZZ: fragmentation: %s: %s is %.1fx slower\n",
+              path, name, factor);
+    }
+
+    if(factor > g_worst_slowdowns[plan].factor)
+      g_worst_slowdowns[plan] = {path, factor};
+  }
+
+  if(diverged)
+    g_inputs_diverged++;
+}
+
+static void report_fragmentation(void)
+{
+  if(g_inputs_fragmented == 0)
+    return;
+
+  fprintf(stderr, "FUZZ: fragmentation: %zu of %zu inputs diverged\n",
+          g_inputs_diverged, g_inputs_fragmented);
+  for(int plan = FUZZ_FRAG_WHOLE + 1; plan < FUZZ_FRAG_NUM_PLANS; plan++) {
+    fprintf(stderr, "FUZZ: fragmentation: worst %s slowdown %.1fx  %s\n",
+            fuzz_frag_plan_name((FUZZ_FRAG_PLAN)plan),
+            g_worst_slowdowns[plan].factor,
+            g_worst_slowdowns[plan].path.c_str());
+  }
+}
+
+/**
+ * Run one input, recording its cost if FUZZ_PERF is set, then re-running it
+ * if FUZZ_DETERMINISM or FUZZ_FRAGMENT is.
+ */
+static void run_measured(const char *path, const uint8_t *data, size_t len)
+{
+  FUZZ_PERF_SAMPLE start;
+  FUZZ_PERF_SAMPLE end;
+
+  fuzz_perf_read(&start);
+  run_input(data, len);
+  if(fuzz_perf_source() != FUZZ_PERF_NONE) {
+    fuzz_perf_read(&end);
+    g_unit_costs.push_back({path,
+                            fuzz_perf_cost(&start, &end),
+                            end.cycles - start.cycles,
+                            end.cpu_ns - start.cpu_ns});
+  }
+
+  fuzz_digest_keep_reference();
+  check_determinism(path, data, len);
+  check_fragmentation(path, data, len);
+}
+
+static void report_slow_units(void)
+{
+  uint64_t total = 0;
+
+  if(g_unit_costs.empty())
+    return;
+
+  for(const unit_cost &unit : g_unit_costs)
+    total += unit.cost;
+
+  size_t shown = std::min(SLOW_UNITS_REPORTED, g_unit_costs.size());
+  std::partial_sort(g_unit_costs.begin(),
+                    g_unit_costs.begin() + shown,
+                    g_unit_costs.end(),
+                    [](const unit_cost &a, const unit_cost &b) {
+                      return a.cost > b.cost;
+                    });
+
+  fprintf(stderr, "FUZZ: perf: %zu inputs, %" PRIu64 " %s total\n",
+          g_unit_costs.size(), total, fuzz_perf_cost_unit());
+  for(size_t ii = 0; ii < shown; ii++) {
+    const unit_cost &unit = g_unit_costs[ii];
+
+    if(fuzz_perf_source() == FUZZ_PERF_COUNTERS) {
+      fprintf(stderr, "FUZZ: perf: %14" PRIu64 " %s %14" PRIu64 " cycles "
+              "%5.2f IPC %10.1f cpu_us  %s\n",
+              unit.cost,
+              fuzz_perf_cost_unit(),
+              unit.cycles,
+              unit.cycles ? (double)unit.cost / unit.cycles : 0,
+              (double)unit.cpu_ns / 1000,
+              unit.path.c_str());
+    }
+    else {
+      fprintf(stderr, "FUZZ: perf: %14" PRIu64 " %s %10.1f cpu_us  %s\n",
+              unit.cost,
+              fuzz_perf_cost_unit(),
+              (double)unit.cpu_ns / 1000,
+              unit.path.c_str());
+    }
+  }
+}
+
 /**
  * Read one file and feed its contents through LLVMFuzzerTestOneInput.
  * If verbose is true, print the familiar per-file trace; otherwise stay
@@ -113,8 +349,7 @@ static void run_one_file(const char *path, bool verbose)
     if(g_timeout_secs > 0) {
       if(sigsetjmp(g_timeout_env, 1) == 0) {
         g_timeout_armed = 1;
-        alarm((unsigned int)g_timeout_secs);
-        LLVMFuzzerTestOneInput(buffer, buffer_len);
+        run_measured(path, buffer, buffer_len);
         alarm(0);
         g_timeout_armed = 0;
         if(verbose)
@@ -129,7 +364,7 @@ static void run_one_file(const char *path, bool verbose)
       }
     }
     else {
-      LLVMFuzzerTestOneInput(buffer, buffer_len);
+      run_measured(path, buffer, buffer_len);
       if(verbose)
         printf("complete !!");
     }
@@ -248,5 +483,9 @@ int main(int argc, char **argv)
     }
   }
 
+  report_slow_units();
+  report_determinism();
+  report_fragmentation();
+
   return 0;
 }
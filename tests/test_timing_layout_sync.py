@@ -0,0 +1,61 @@
+"""Consistency checks between the C and Python FUZZ_TIMING file layouts."""
+
+from __future__ import annotations
+
+import re
+from pathlib import Path
+
+from curl_fuzzer_tools import read_timing_stats
+
+_DEFINE_PATTERN = re.compile(
+    r"#define\s+(FUZZ_TIMING_[A-Z_]+)\s+(0x[0-9A-Fa-f]+|[0-9]+)"
+)
+
+
+def _repo_root() -> Path:
+    return Path(__file__).resolve().parents[1]
+
+
+def _parse_header_constants(header_path: Path) -> dict[str, int]:
+    constants: dict[str, int] = {}
+    for line in header_path.read_text(encoding="utf-8").splitlines():
+        match = _DEFINE_PATTERN.search(line)
+        if match:
+            constants[match.group(1)] = int(match.group(2), 0)
+    return constants
+
+
+def test_timing_layout_constants_are_in_sync() -> None:
+    """Ensure the stats file constants match between C header and reader."""
+    header_constants = _parse_header_constants(_repo_root() / "curl_fuzzer_timing.h")
+
+    assert header_constants, "No FUZZ_TIMING constants found in curl_fuzzer_timing.h"
+    for name, value in header_constants.items():
+        assert getattr(read_timing_stats, name) == value, (
+            f"{name} is {value} in curl_fuzzer_timing.h but "
+            f"{getattr(read_timing_stats, name)} in read_timing_stats.py"
+        )
+
+
+def test_timing_stats_round_trip() -> None:
+    """Parse a synthetic stats file laid out as FUZZ_TIMING_FILE."""
+    buckets = [0] * read_timing_stats.FUZZ_TIMING_NUM_BUCKETS
+    buckets[11] = 3
+    header = read_timing_stats.HEADER.pack(
+        read_timing_stats.FUZZ_TIMING_MAGIC,
+        read_timing_stats.FUZZ_TIMING_VERSION,
+        1,
+        read_timing_stats.FUZZ_TIMING_NUM_BUCKETS,
+        1234,
+        2,
+        3,
+    )
+    hist = read_timing_stats.HIST.pack(b"parse", 3, 3000, 1500, *buckets)
+
+    stats = read_timing_stats.parse_timing_stats(header + hist)
+
+    assert stats.pid == 1234
+    assert stats.inputs == 3
+    assert len(stats.phases) == 1
+    assert stats.phases[0].name == "parse"
+    assert stats.phases[0].buckets[11] == 3